@@ -0,0 +1,140 @@
+/*
+ * checksum_benchmark.cpp
+ *
+ *  Created on: May 12, 2016
+ *      Author: rafal
+ *
+ * Microbenchmark of CRC implementations: bitwise reference, slicing-by-8
+ * and hardware accelerated ones (when supported by CPU). Results are
+ * written to stdout as JSON array, one object per measurement.
+ *
+ * Usage: checksum_benchmark [--quick]
+ */
+
+#include "checksum.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+using namespace mrobot;
+using benchmark_clock = std::chrono::steady_clock;
+
+const char* type_name(checksum_type type)
+{
+	switch (type)
+	{
+	case checksum_type::crc16_modbus:
+		return "crc16_modbus";
+	case checksum_type::crc16_ccitt:
+		return "crc16_ccitt";
+	case checksum_type::crc32:
+		return "crc32";
+	default:
+		return "crc32c";
+	}
+}
+
+const char* implementation_name(checksum_implementation implementation)
+{
+	switch (implementation)
+	{
+	case checksum_implementation::bitwise:
+		return "bitwise";
+	case checksum_implementation::slicing_by_8:
+		return "slicing_by_8";
+	case checksum_implementation::sse42:
+		return "sse42";
+	default:
+		return "pclmul";
+	}
+}
+
+/**
+ * @brief Computes checksums of frames of given size and returns JSON object
+ *
+ * Checksums are combined into result, so computation isn't optimized out.
+ */
+std::string measure(checksum_type type, checksum_implementation implementation, const std::vector<char>& data,
+		std::size_t frame_size, std::size_t total_bytes)
+{
+	std::size_t frames_count = data.size() / frame_size;
+	std::size_t iterations = std::max<std::size_t>(1, total_bytes / frame_size);
+	std::uint32_t result = 0;
+
+	auto start = benchmark_clock::now();
+	for (std::size_t i = 0; i < iterations; i++)
+	{
+		buffer_view frame{data.data() + (i % frames_count) * frame_size, frame_size};
+		result += update_checksum(type, get_initial_checksum(type), frame, implementation);
+	}
+	double elapsed = std::chrono::duration<double>(benchmark_clock::now() - start).count();
+
+	char text[256];
+	std::snprintf(text, sizeof(text),
+			"{\"benchmark\":\"checksum\",\"type\":\"%s\",\"implementation\":\"%s\",\"frame_size\":%zu,"
+			"\"mb_per_s\":%.1f,\"ns_per_frame\":%.1f,\"checksum\":%u}",
+			type_name(type), implementation_name(implementation), frame_size,
+			iterations * frame_size / elapsed / 1e6, elapsed * 1e9 / iterations, result);
+	return text;
+}
+
+/**
+ * @brief Checks that implementation gives the same checksums as bitwise reference
+ */
+bool is_matching_reference(checksum_type type, checksum_implementation implementation, const std::vector<char>& data)
+{
+	for (std::size_t size = 0; size < 300; size++)
+	{
+		buffer_view part{data.data() + size % 13, size};
+		if (update_checksum(type, get_initial_checksum(type), part, implementation)
+				!= update_checksum(type, get_initial_checksum(type), part, checksum_implementation::bitwise))
+			return false;
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	bool is_quick = argc > 1 && std::string{argv[1]} == "--quick";
+	const std::size_t total_bytes = is_quick ? (4 << 20) : (64 << 20);
+
+	std::vector<char> data(1 << 20);
+	std::mt19937 random{2016};
+	for (char& byte : data)
+		byte = static_cast<char>(random());
+
+	std::vector<std::string> results;
+	for (checksum_type type : { checksum_type::crc16_modbus, checksum_type::crc16_ccitt, checksum_type::crc32,
+			checksum_type::crc32c })
+	{
+		for (checksum_implementation implementation : { checksum_implementation::bitwise,
+				checksum_implementation::slicing_by_8, checksum_implementation::sse42, checksum_implementation::pclmul })
+		{
+			if (!is_checksum_implementation_supported(type, implementation))
+				continue;
+			if (!is_matching_reference(type, implementation, data))
+			{
+				std::fprintf(stderr, "%s implementation of %s doesn't match reference.\n",
+						implementation_name(implementation), type_name(type));
+				return 1;
+			}
+
+			// bitwise reference is slow, so it gets less data
+			std::size_t bytes = implementation == checksum_implementation::bitwise ? total_bytes / 16 : total_bytes;
+			for (std::size_t frame_size : { 8, 64, 256, 4096, 65536 })
+				results.push_back(measure(type, implementation, data, frame_size, bytes));
+		}
+	}
+
+	std::printf("[\n");
+	for (std::size_t i = 0; i < results.size(); i++)
+		std::printf("  %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+	std::printf("]\n");
+	return 0;
+}
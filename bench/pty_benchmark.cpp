@@ -0,0 +1,599 @@
+/*
+ * pty_benchmark.cpp
+ *
+ *  Created on: Apr 9, 2016
+ *      Author: rafal
+ *
+ * Benchmarks of serial_port and poll_controler on pseudo-terminal pairs
+ * (no hardware needed). Results are written to stdout as JSON array,
+ * one object per measurement, so they can be compared between builds.
+ *
+ * Usage: pty_benchmark [--quick] [filter]
+ *   --quick  smaller transfers (for smoke tests)
+ *   filter   run only benchmarks which name contains given text
+ */
+
+#include "serial_port.h"
+#include "inline_serial_port.h"
+#include "poll_controler.h"
+#include "histogram.h"
+#include <pty.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+using namespace mrobot;
+using benchmark_clock = std::chrono::steady_clock;
+
+/**
+ * @brief Pseudo-terminal with raw master side and serial_port opened on slave side
+ */
+class pty_pair
+{
+public:
+	using port_factory = std::function<serial_port*(const char* device)>;
+
+	pty_pair() :
+			pty_pair([](const char* device)
+			{	return new serial_port{device, baudrate_option::b115200};})
+	{
+	}
+
+	explicit pty_pair(const port_factory& create_port)
+	{
+		char name[64];
+		if (openpty(&_master, &_slave, name, nullptr, nullptr) < 0)
+			throw serial_port_exception("Cannot open pseudo-terminal.", strerror(errno));
+
+		termios config;
+		tcgetattr(_master, &config);
+		cfmakeraw(&config);
+		tcsetattr(_master, TCSANOW, &config);
+
+		port.reset(create_port(name));
+	}
+
+	~pty_pair()
+	{
+		port.reset();
+		close(_slave);
+		close(_master);
+	}
+
+	int master() { return _master; }
+
+	std::unique_ptr<serial_port> port;
+
+private:
+	int _master = -1;
+	int _slave = -1;
+};
+
+/**
+ * @brief Measurement settings and results written as single JSON object
+ */
+class result
+{
+public:
+	explicit result(const std::string& benchmark)
+	{
+		add("benchmark", benchmark);
+	}
+
+	result& add(const std::string& key, const std::string& value)
+	{
+		_fields.push_back("\"" + key + "\":\"" + value + "\"");
+		return *this;
+	}
+
+	template<typename number>
+	typename std::enable_if<std::is_arithmetic<number>::value, result&>::type add(const std::string& key, number value)
+	{
+		std::ostringstream text;
+		text << value;
+		_fields.push_back("\"" + key + "\":" + text.str());
+		return *this;
+	}
+
+	std::string json() const
+	{
+		std::string text = "{";
+		for (std::size_t i = 0; i < _fields.size(); i++)
+			text += (i > 0 ? "," : "") + _fields[i];
+		return text + "}";
+	}
+
+private:
+	std::vector<std::string> _fields;
+};
+
+/**
+ * @brief Serial port dispatched by virtual calls (path used before dispatch table)
+ */
+class virtual_dispatch_port: public serial_port
+{
+public:
+	using serial_port::serial_port;
+
+	virtual dispatch_functions get_dispatch_functions() override
+	{
+		return ifile_descriptor_owner::get_dispatch_functions();
+	}
+};
+
+/**
+ * @brief Handler of dispatch benchmark (type known at compile time)
+ */
+struct counting_handler
+{
+	std::atomic<std::size_t>* received_bytes;
+
+	void operator()(serial_port&, buffer_view data)
+	{
+		received_bytes->fetch_add(data.size, std::memory_order_relaxed);
+	}
+};
+
+/**
+ * @brief CPU time (user and system) used by process
+ */
+double cpu_seconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+			+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+double seconds_since(benchmark_clock::time_point start)
+{
+	return std::chrono::duration<double>(benchmark_clock::now() - start).count();
+}
+
+const char* backend_name(io_backend backend)
+{
+	return backend == io_backend::io_uring ? "io_uring" : "epoll";
+}
+
+const char* mode_name(trigger_mode mode)
+{
+	return mode == trigger_mode::edge ? "edge" : "level";
+}
+
+/**
+ * @brief Spins for given time (simulates processing done by data handler)
+ */
+void spin_for(std::chrono::nanoseconds duration)
+{
+	if (duration.count() == 0)
+		return;
+	auto end = benchmark_clock::now() + duration;
+	while (benchmark_clock::now() < end)
+	{
+	}
+}
+
+/**
+ * @brief Writes whole buffer to descriptor, waiting when it is full
+ */
+void write_fully(int file_descriptor, const char* data, std::size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t written = write(file_descriptor, data, size);
+		if (written < 0)
+		{
+			if (errno != EAGAIN && errno != EINTR)
+				return;
+			pollfd descriptor{file_descriptor, POLLOUT, 0};
+			poll(&descriptor, 1, 10);
+			continue;
+		}
+		data += written;
+		size -= written;
+	}
+}
+
+struct benchmark_settings
+{
+	bool is_quick = false;
+	std::string filter;
+	std::vector<result> results;
+
+	bool is_selected(const std::string& name) const
+	{
+		return filter.empty() || name.find(filter) != std::string::npos;
+	}
+};
+
+/**
+ * @brief Receive path: data written to master is delivered to view handler by poll controler
+ */
+void receive_throughput(benchmark_settings& settings, io_backend backend, trigger_mode mode,
+		std::size_t receive_buffer_size, std::chrono::nanoseconds handler_cost)
+{
+	const std::size_t total_bytes = settings.is_quick ? (1 << 20) : (16 << 20);
+	const std::size_t chunk_size = 4096;
+
+	pty_pair pty;
+	pty.port->set_receive_buffer_size(receive_buffer_size);
+
+	std::atomic<std::size_t> received_bytes{0};
+	pty.port->subscribe_data_view_event([&](serial_port&, buffer_view data)
+	{
+		spin_for(handler_cost);
+		received_bytes.fetch_add(data.size, std::memory_order_relaxed);
+	});
+
+	poll_controler controler{-1, mode};
+	controler.set_io_backend(backend);
+	controler.add(pty.port.get());
+	controler.start_polling();
+
+	std::vector<char> chunk(chunk_size, 'x');
+	double cpu_start = cpu_seconds();
+	auto start = benchmark_clock::now();
+
+	for (std::size_t sent = 0; sent < total_bytes; sent += chunk_size)
+		write_fully(pty.master(), chunk.data(), chunk_size);
+	while (received_bytes < total_bytes)
+		std::this_thread::yield();
+
+	double elapsed = seconds_since(start);
+	double cpu = cpu_seconds() - cpu_start;
+	port_metrics_snapshot port_metrics = pty.port->get_metrics();
+	reactor_metrics_snapshot reactor_metrics = controler.get_metrics(0);
+	controler.stop_polling();
+
+	settings.results.push_back(result{"receive_throughput"}
+		.add("backend", backend_name(backend))
+		.add("trigger_mode", mode_name(mode))
+		.add("receive_buffer_size", receive_buffer_size)
+		.add("handler_cost_ns", handler_cost.count())
+		.add("bytes", total_bytes)
+		.add("mb_per_s", total_bytes / elapsed / 1e6)
+		.add("cpu_ns_per_byte", cpu * 1e9 / total_bytes)
+		.add("read_calls", port_metrics.read_calls)
+		.add("mean_read_size", port_metrics.read_size.mean)
+		.add("wakeups", reactor_metrics.wakeups));
+}
+
+/**
+ * @brief Transmit path: blocking send(), send() with write coalescing or send_async() drained by reader of master side
+ */
+void transmit_throughput(benchmark_settings& settings, const std::string& api, std::size_t message_size)
+{
+	const std::size_t total_bytes = settings.is_quick ? (1 << 20) : (16 << 20);
+
+	pty_pair pty;
+	poll_controler controler;
+	controler.add(pty.port.get());
+	controler.start_polling();
+
+	std::atomic<bool> is_reading{true};
+	std::size_t read_bytes = 0;
+	std::thread reader{[&]
+	{
+		std::vector<char> buffer(65536);
+		while (read_bytes < total_bytes && is_reading)
+		{
+			pollfd descriptor{pty.master(), POLLIN, 0};
+			if (poll(&descriptor, 1, 100) <= 0)
+				continue;
+			ssize_t count = read(pty.master(), buffer.data(), buffer.size());
+			if (count > 0)
+				read_bytes += count;
+		}
+	}};
+
+	std::vector<char> message(message_size, 'y');
+	std::size_t messages_count = total_bytes / message_size;
+	pty.port->set_transmit_queue_capacity(256 * 1024);
+	pty.port->set_backpressure(backpressure_option::block);
+	if (api == "send_coalesced")
+		pty.port->set_write_coalescing(4096, std::chrono::microseconds{200});
+
+	double cpu_start = cpu_seconds();
+	auto start = benchmark_clock::now();
+
+	for (std::size_t i = 0; i < messages_count; i++)
+	{
+		if (api == "send_async")
+			pty.port->send_async(buffer_view{message});
+		else
+			pty.port->send(buffer_view{message});
+	}
+	pty.port->flush();
+	reader.join();
+
+	double elapsed = seconds_since(start);
+	double cpu = cpu_seconds() - cpu_start;
+	port_metrics_snapshot metrics = pty.port->get_metrics();
+	is_reading = false;
+	controler.stop_polling();
+
+	settings.results.push_back(result{"transmit_throughput"}
+		.add("api", api)
+		.add("message_size", message_size)
+		.add("bytes", messages_count * message_size)
+		.add("mb_per_s", messages_count * message_size / elapsed / 1e6)
+		.add("cpu_ns_per_byte", cpu * 1e9 / (messages_count * message_size))
+		.add("write_calls", metrics.write_calls)
+		.add("syscalls_per_message", double(metrics.write_calls) / messages_count));
+}
+
+/**
+ * @brief Round trip: request sent by port, echoed by master side, reply delivered by poll controler
+ */
+void round_trip_latency(benchmark_settings& settings, io_backend backend, int poll_timeout, bool is_busy_polling)
+{
+	const int requests_count = settings.is_quick ? 200 : 5000;
+
+	pty_pair pty;
+
+	std::mutex reply_mutex;
+	std::condition_variable reply_condition;
+	std::size_t replies = 0;
+	pty.port->subscribe_data_view_event([&](serial_port&, buffer_view)
+	{
+		std::unique_lock<std::mutex> lock{reply_mutex};
+		replies++;
+		reply_condition.notify_one();
+	});
+
+	poll_controler controler{poll_timeout};
+	controler.set_io_backend(backend);
+	std::size_t shard = 0;
+	if (is_busy_polling)
+	{
+		low_latency_options options;
+		options.busy_polling = true;
+		shard = controler.add_low_latency_shard(options);
+	}
+	controler.add(pty.port.get(), shard);
+	controler.start_polling();
+
+	std::atomic<bool> is_echoing{true};
+	std::thread echo{[&]
+	{
+		char buffer[256];
+		while (is_echoing)
+		{
+			pollfd descriptor{pty.master(), POLLIN, 0};
+			if (poll(&descriptor, 1, 100) <= 0)
+				continue;
+			ssize_t count = read(pty.master(), buffer, sizeof(buffer));
+			if (count > 0)
+				write_fully(pty.master(), buffer, count);
+		}
+	}};
+
+	latency_histogram latencies;
+	const char request[] = "ping";
+	double cpu_start = cpu_seconds();
+
+	for (int i = 0; i < requests_count; i++)
+	{
+		auto start = benchmark_clock::now();
+		std::unique_lock<std::mutex> lock{reply_mutex};
+		std::size_t expected_replies = replies + 1;
+		lock.unlock();
+
+		pty.port->send(buffer_view{request, sizeof(request) - 1});
+
+		lock.lock();
+		reply_condition.wait(lock, [&]
+		{	return replies >= expected_replies;});
+		latencies.record(benchmark_clock::now() - start);
+	}
+
+	double cpu = cpu_seconds() - cpu_start;
+	is_echoing = false;
+	echo.join();
+	controler.stop_polling();
+
+	settings.results.push_back(result{"round_trip_latency"}
+		.add("backend", backend_name(backend))
+		.add("poll_timeout_ms", poll_timeout)
+		.add("busy_polling", is_busy_polling ? 1 : 0)
+		.add("requests", requests_count)
+		.add("p50_us", latencies.percentile(0.5).count() / 1e3)
+		.add("p90_us", latencies.percentile(0.9).count() / 1e3)
+		.add("p99_us", latencies.percentile(0.99).count() / 1e3)
+		.add("max_us", latencies.max().count() / 1e3)
+		.add("cpu_us_per_request", cpu * 1e6 / requests_count));
+}
+
+/**
+ * @brief Many ports: small messages written round robin to all masters
+ */
+void port_scaling(benchmark_settings& settings, std::size_t ports_count, std::size_t shards_count)
+{
+	const std::size_t messages_per_port = settings.is_quick ? 50 : 1000;
+	const std::size_t message_size = 32;
+
+	std::vector<std::unique_ptr<pty_pair>> ptys;
+	std::atomic<std::size_t> received_bytes{0};
+	for (std::size_t i = 0; i < ports_count; i++)
+	{
+		ptys.emplace_back(new pty_pair);
+		ptys.back()->port->subscribe_data_view_event([&](serial_port&, buffer_view data)
+		{	received_bytes.fetch_add(data.size, std::memory_order_relaxed);});
+	}
+
+	poll_controler controler{-1, trigger_mode::level, shards_count};
+	for (auto& pty : ptys)
+		controler.add(pty->port.get());
+	controler.start_polling();
+
+	std::vector<char> message(message_size, 'z');
+	std::size_t total_bytes = ports_count * messages_per_port * message_size;
+	double cpu_start = cpu_seconds();
+	auto start = benchmark_clock::now();
+
+	for (std::size_t i = 0; i < messages_per_port; i++)
+	{
+		for (auto& pty : ptys)
+			write_fully(pty->master(), message.data(), message.size());
+	}
+	while (received_bytes < total_bytes)
+		std::this_thread::yield();
+
+	double elapsed = seconds_since(start);
+	double cpu = cpu_seconds() - cpu_start;
+	unsigned long long wakeups = 0;
+	for (std::size_t shard = 0; shard < controler.get_shards_count(); shard++)
+		wakeups += controler.get_metrics(shard).wakeups;
+	controler.stop_polling();
+
+	settings.results.push_back(result{"port_scaling"}
+		.add("ports", ports_count)
+		.add("shards", shards_count)
+		.add("bytes", total_bytes)
+		.add("mb_per_s", total_bytes / elapsed / 1e6)
+		.add("messages_per_s", ports_count * messages_per_port / elapsed)
+		.add("cpu_ns_per_byte", cpu * 1e9 / total_bytes)
+		.add("wakeups_per_message", double(wakeups) / (ports_count * messages_per_port)));
+}
+
+/**
+ * @brief Dispatch path: many ports with small messages, so cost of single dispatch dominates
+ *
+ * Variants: "virtual" (virtual process_data() and std::function handler),
+ * "table" (dispatch table and std::function handler) and "inline"
+ * (dispatch table and handler type known at compile time).
+ */
+void dispatch_overhead(benchmark_settings& settings, const std::string& variant, std::size_t ports_count)
+{
+	const std::size_t messages_per_port = settings.is_quick ? 200 : 5000;
+	const std::size_t message_size = 8;
+
+	std::atomic<std::size_t> received_bytes{0};
+	counting_handler handler{&received_bytes};
+	pty_pair::port_factory create_port = [&](const char* device) -> serial_port*
+	{
+		if (variant == "inline")
+			return new inline_serial_port<counting_handler>{device, handler, baudrate_option::b115200};
+
+		serial_port* port = variant == "virtual" ? new virtual_dispatch_port{device, baudrate_option::b115200}
+				: new serial_port{device, baudrate_option::b115200};
+		port->subscribe_data_view_event(handler);
+		return port;
+	};
+
+	std::vector<std::unique_ptr<pty_pair>> ptys;
+	for (std::size_t i = 0; i < ports_count; i++)
+		ptys.emplace_back(new pty_pair{create_port});
+
+	poll_controler controler{-1, trigger_mode::level};
+	for (auto& pty : ptys)
+		controler.add(pty->port.get());
+	controler.start_polling();
+
+	std::vector<char> message(message_size, 'd');
+	std::size_t total_messages = ports_count * messages_per_port;
+	double cpu_start = cpu_seconds();
+	auto start = benchmark_clock::now();
+
+	for (std::size_t i = 0; i < messages_per_port; i++)
+	{
+		for (auto& pty : ptys)
+			write_fully(pty->master(), message.data(), message.size());
+	}
+	while (received_bytes < total_messages * message_size)
+		std::this_thread::yield();
+
+	double elapsed = seconds_since(start);
+	double cpu = cpu_seconds() - cpu_start;
+	reactor_metrics_snapshot reactor_metrics = controler.get_metrics(0);
+	controler.stop_polling();
+
+	settings.results.push_back(result{"dispatch_overhead"}
+		.add("variant", variant)
+		.add("ports", ports_count)
+		.add("messages", total_messages)
+		.add("messages_per_s", total_messages / elapsed)
+		.add("cpu_ns_per_message", cpu * 1e9 / total_messages)
+		.add("events_per_wakeup", double(reactor_metrics.dispatched_events) / std::max(1ULL, reactor_metrics.wakeups)));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace mrobot;
+
+	benchmark_settings settings;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		if (argument == "--quick")
+			settings.is_quick = true;
+		else
+			settings.filter = argument;
+	}
+
+	try
+	{
+		if (settings.is_selected("receive_throughput"))
+		{
+			for (io_backend backend : { io_backend::epoll, io_backend::io_uring })
+				for (trigger_mode mode : { trigger_mode::level, trigger_mode::edge })
+					for (std::size_t size : { 256, 4096, 65536 })
+						receive_throughput(settings, backend, mode, size, std::chrono::nanoseconds{0});
+			for (long cost : { 1000, 10000 })
+				receive_throughput(settings, io_backend::epoll, trigger_mode::level, 4096, std::chrono::nanoseconds{cost});
+		}
+
+		if (settings.is_selected("transmit_throughput"))
+		{
+			for (const char* api : { "send", "send_coalesced", "send_async" })
+				for (std::size_t size : { 16, 256, 4096 })
+					transmit_throughput(settings, api, size);
+		}
+
+		if (settings.is_selected("round_trip_latency"))
+		{
+			for (io_backend backend : { io_backend::epoll, io_backend::io_uring })
+				for (int timeout : { -1, 1 })
+					round_trip_latency(settings, backend, timeout, false);
+			round_trip_latency(settings, io_backend::epoll, -1, true);
+		}
+
+		if (settings.is_selected("port_scaling"))
+		{
+			for (std::size_t ports : { 1, 4, 16, 64, 256 })
+				for (std::size_t shards : { 1, 4 })
+					port_scaling(settings, ports, shards);
+		}
+
+		if (settings.is_selected("dispatch_overhead"))
+		{
+			for (std::size_t ports : { 1, 64 })
+				for (const char* variant : { "virtual", "table", "inline" })
+					dispatch_overhead(settings, variant, ports);
+		}
+	} catch (std::exception& ex)
+	{
+		std::fprintf(stderr, "%s", ex.what());
+		return 1;
+	}
+
+	std::printf("[\n");
+	for (std::size_t i = 0; i < settings.results.size(); i++)
+		std::printf("  %s%s\n", settings.results[i].json().c_str(), i + 1 < settings.results.size() ? "," : "");
+	std::printf("]\n");
+	return 0;
+}
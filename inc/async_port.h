@@ -0,0 +1,340 @@
+/*
+ * async_port.h
+ *
+ *  Created on: Apr 21, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_ASYNC_PORT_H_
+#define INC_ASYNC_PORT_H_
+
+/*
+ * Coroutine interface of serial port (requires C++20, e.g. -std=c++20).
+ * Coroutines are resumed by polling thread of reactor which observes the
+ * port, so thousands of conversations run without additional threads.
+ */
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include "serial_port.h"
+#include "reactor.h"
+#include "log.h"
+
+namespace mrobot
+{
+
+template <typename T = void>
+class task;
+
+class async_port;
+
+namespace detail
+{
+
+/**
+ * @brief State shared by promises of all task types
+ */
+struct task_promise_base
+{
+	/**
+	 * @brief Resumes awaiting coroutine (or destroys frame of spawned task)
+	 */
+	struct final_awaiter
+	{
+		bool await_ready() noexcept { return false; }
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			task_promise_base& promise = handle.promise();
+			if (promise.continuation)
+				return promise.continuation;
+
+			if (promise.is_detached)
+			{
+				if (promise.exception)
+				{
+					try
+					{
+						std::rethrow_exception(promise.exception);
+					} catch (std::exception& ex)
+					{
+						MROBOT_LOG_ERROR(ex.what());
+					}
+				}
+				handle.destroy();
+			}
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+	std::coroutine_handle<> continuation; /// coroutine which awaits the task
+	std::exception_ptr exception; /// exception thrown by task body
+	bool is_detached = false; /// task was spawned (frame is destroyed when it finishes)
+};
+
+template <typename T>
+struct task_promise: task_promise_base
+{
+	task<T> get_return_object() noexcept;
+	void return_value(T result) { value.emplace(std::move(result)); }
+
+	T result()
+	{
+		if (exception)
+			std::rethrow_exception(exception);
+		return std::move(*value);
+	}
+
+	std::optional<T> value;
+};
+
+template <>
+struct task_promise<void>: task_promise_base
+{
+	task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+
+	void result()
+	{
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+};
+
+}
+
+/**
+ * @brief Lazily started coroutine which can be awaited by other coroutine
+ *
+ * Top level task is started with spawn(), awaiting task runs it and
+ * returns its result (or rethrows its exception).
+ */
+template <typename T>
+class task
+{
+public:
+	using promise_type = detail::task_promise<T>;
+
+	task(task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+	task(const task&) = delete;
+	task& operator=(task other) noexcept
+	{
+		std::swap(_handle, other._handle);
+		return *this;
+	}
+	~task()
+	{
+		if (_handle)
+			_handle.destroy();
+	}
+
+	bool await_ready() noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		_handle.promise().continuation = awaiting;
+		return _handle;
+	}
+
+	T await_resume() { return _handle.promise().result(); }
+
+private:
+	friend promise_type;
+	friend void spawn(reactor& owner_reactor, task<void> coroutine);
+	friend void spawn(async_port& port, task<void> coroutine);
+
+	explicit task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+	std::coroutine_handle<promise_type> _handle;
+};
+
+template <typename T>
+task<T> detail::task_promise<T>::get_return_object() noexcept
+{
+	return task<T>{std::coroutine_handle<task_promise<T>>::from_promise(*this)};
+}
+
+inline task<void> detail::task_promise<void>::get_return_object() noexcept
+{
+	return task<void>{std::coroutine_handle<task_promise<void>>::from_promise(*this)};
+}
+
+void spawn(reactor& owner_reactor, task<void> coroutine);
+void spawn(async_port& port, task<void> coroutine);
+
+/**
+ * @brief Suspends coroutine for given time (awaited result of sleep_for())
+ */
+class sleep_awaiter
+{
+public:
+	sleep_awaiter(reactor& owner_reactor, timer_clock::duration delay) :
+			_reactor(owner_reactor), _delay(delay)
+	{
+	}
+
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() {}
+
+private:
+	reactor& _reactor;
+	timer_clock::duration _delay;
+};
+
+inline sleep_awaiter sleep_for(reactor& owner_reactor, timer_clock::duration delay)
+{
+	return sleep_awaiter{owner_reactor, delay};
+}
+
+/**
+ * @brief Awaitable reads and writes of serial port
+ *
+ * Wrapper subscribes data view event of the port and buffers data which
+ * isn't awaited. Port has to be added to poll controler and coroutines
+ * using wrapper have to be spawned with spawn(async_port&, ...), so
+ * wrapper is used only by polling thread of the port. Timers of wrapper
+ * (timeouts, sleeps, start of spawned coroutines) are owned by the port,
+ * so they move with it when poll controler rebalances shards. Only one
+ * read can be awaited at a time. Timeouts (zero means none) throw
+ * serial_port_exception. Coroutines suspended on wrapper are never
+ * resumed when port is removed from poll controler or wrapper is
+ * destroyed.
+ */
+class async_port
+{
+public:
+	/**
+	 * @brief Read awaited by coroutine
+	 */
+	struct pending_read
+	{
+		std::coroutine_handle<> handle;
+		std::span<char> buffer; /// destination of read_some()
+		std::optional<char> delimiter; /// delimiter of read_until()
+		std::size_t result_size = 0;
+		std::string result; /// data returned by read_until()
+		std::uint64_t timer_id = 0; /// timeout timer (zero if none)
+		bool is_timed_out = false;
+	};
+
+	/**
+	 * @brief Awaited result of read_some() and read_until()
+	 */
+	class read_awaiter
+	{
+	public:
+		read_awaiter(async_port& port, pending_read read, timer_clock::duration timeout) :
+				_port(port), _read(std::move(read)), _timeout(timeout)
+		{
+		}
+
+		bool await_ready() { return _port.complete_read(_read); }
+		void await_suspend(std::coroutine_handle<> handle);
+		std::size_t await_resume();
+
+	protected:
+		async_port& _port;
+		pending_read _read;
+		timer_clock::duration _timeout;
+	};
+
+	/**
+	 * @brief Awaited result of read_until()
+	 */
+	class read_until_awaiter: public read_awaiter
+	{
+	public:
+		using read_awaiter::read_awaiter;
+		std::string await_resume()
+		{
+			read_awaiter::await_resume();
+			return std::move(_read.result);
+		}
+	};
+
+	/**
+	 * @brief Awaited result of sleep_for() (resumed by polling thread of the port)
+	 */
+	class delay_awaiter
+	{
+	public:
+		delay_awaiter(async_port& port, timer_clock::duration delay) : _port(port), _delay(delay) {}
+
+		bool await_ready() { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { _port.schedule_resume(handle, _delay); }
+		void await_resume() {}
+
+	private:
+		async_port& _port;
+		timer_clock::duration _delay;
+	};
+
+	/**
+	 * @brief Awaited result of write_all()
+	 */
+	class write_awaiter
+	{
+	public:
+		write_awaiter(async_port& port, buffer_view data) : _port(port), _data(data) {}
+
+		bool await_ready() { return false; }
+		bool await_suspend(std::coroutine_handle<> handle);
+		void await_resume();
+
+	private:
+		async_port& _port;
+		buffer_view _data;
+		std::coroutine_handle<> _handle;
+		std::atomic<bool> _is_completed{false}; /// completion handler was called (before or after suspension)
+		send_status _status = send_status::sent;
+	};
+
+	explicit async_port(serial_port& port);
+	~async_port();
+	async_port(const async_port&) = delete;
+	async_port& operator=(const async_port&) = delete;
+
+	read_awaiter read_some(std::span<char> buffer, timer_clock::duration timeout = timer_clock::duration::zero());
+	read_until_awaiter read_until(char delimiter, timer_clock::duration timeout = timer_clock::duration::zero());
+	write_awaiter write_all(buffer_view data) { return write_awaiter{*this, data}; }
+	delay_awaiter sleep_for(timer_clock::duration delay) { return delay_awaiter{*this, delay}; }
+
+	serial_port& get_port() { return _port; }
+	reactor& get_reactor();
+
+private:
+	friend void spawn(async_port& port, task<void> coroutine);
+
+	void receive(buffer_view data);
+	bool complete_read(pending_read& read);
+	void time_out();
+	void schedule_resume(std::coroutine_handle<> handle, timer_clock::duration delay);
+
+	serial_port& _port;
+	std::string _received; /// data which wasn't returned by reads
+	pending_read* _pending_read = nullptr; /// read awaited by suspended coroutine (owned by its awaiter)
+	std::mutex _resume_mutex; /// guards resume timers (coroutines can be spawned by other thread)
+	std::map<std::uint64_t, std::uint64_t> _resume_timers; /// pending resumes of sleeping and spawned coroutines (timer by sequence number)
+	std::uint64_t _resume_sequence = 0; /// sequence number of last scheduled resume
+};
+
+}
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* INC_ASYNC_PORT_H_ */
@@ -0,0 +1,28 @@
+/*
+ * baudrate.h
+ *
+ *  Created on: Apr 12, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_BAUDRATE_H_
+#define INC_BAUDRATE_H_
+
+/*
+ * Functions which use termios2 interface of the kernel. They are defined
+ * in separate translation unit, because kernel termios structures
+ * (asm/termbits.h) conflict with definitions from glibc termios.h.
+ */
+
+namespace mrobot
+{
+
+bool to_speed_constant(unsigned int baudrate, unsigned int& speed);
+unsigned int from_speed_constant(unsigned int speed);
+
+void set_custom_baudrate(int file_descriptor, unsigned int baudrate);
+unsigned int get_actual_baudrate(int file_descriptor);
+
+}
+
+#endif /* INC_BAUDRATE_H_ */
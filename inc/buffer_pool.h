@@ -0,0 +1,112 @@
+/*
+ * buffer_pool.h
+ *
+ *  Created on: Apr 15, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_BUFFER_POOL_H_
+#define INC_BUFFER_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "buffer_view.h"
+
+namespace mrobot
+{
+
+class buffer_pool;
+
+/**
+ * @brief Header stored before data of each pool block
+ */
+struct pool_block
+{
+	std::atomic<unsigned> references; /// number of handles which use block
+	std::shared_ptr<buffer_pool> pool; /// keeps pool alive while block is used (empty when block is free)
+	pool_block* next_free; /// next block in free list
+	std::size_t size; /// number of valid bytes
+};
+
+/**
+ * @brief Reference counted handle of pool block
+ *
+ * Copies of the handle share the same block, which returns to its pool
+ * when last handle is destroyed (or reset), so received data can be kept
+ * or passed to other threads without copying. Handle itself isn't thread
+ * safe, but different copies can be used and destroyed by different threads.
+ * Data shouldn't be modified when block is shared.
+ */
+class pooled_buffer
+{
+public:
+	pooled_buffer() = default;
+	pooled_buffer(const pooled_buffer& other);
+	pooled_buffer(pooled_buffer&& other) noexcept;
+	pooled_buffer& operator=(pooled_buffer other) noexcept;
+	~pooled_buffer() { reset(); }
+
+	void reset();
+
+	char* data() { return reinterpret_cast<char*>(_block + 1); }
+	const char* data() const { return reinterpret_cast<const char*>(_block + 1); }
+	std::size_t size() const { return _block ? _block->size : 0; }
+	void set_size(std::size_t size) { _block->size = size; }
+	std::size_t capacity() const;
+	buffer_view view() const { return _block ? buffer_view{data(), _block->size} : buffer_view{}; }
+	unsigned use_count() const { return _block ? _block->references.load(std::memory_order_relaxed) : 0; }
+	explicit operator bool() const { return _block != nullptr; }
+
+private:
+	friend class buffer_pool;
+	explicit pooled_buffer(pool_block* block) : _block(block) {}
+
+	pool_block* _block = nullptr;
+};
+
+/**
+ * @brief Pool of fixed size buffers allocated in slabs
+ *
+ * Blocks are allocated in slabs when pool is empty, and then reused, so
+ * in steady state acquiring and releasing buffer doesn't allocate memory.
+ * Pool is shared by all ports of poll controler and can be used from
+ * any thread. Pool is destroyed when last shared pointer and last
+ * acquired buffer are released.
+ */
+class buffer_pool: public std::enable_shared_from_this<buffer_pool>
+{
+public:
+	static std::shared_ptr<buffer_pool> create(std::size_t block_size = 4096,
+			std::size_t blocks_per_slab = 64, std::size_t max_blocks = 0);
+
+	pooled_buffer acquire();
+
+	std::size_t get_block_size() const { return _block_size; }
+	std::size_t get_blocks_count();
+	std::size_t get_free_blocks_count();
+
+private:
+	friend class pooled_buffer;
+
+	buffer_pool(std::size_t block_size, std::size_t blocks_per_slab, std::size_t max_blocks);
+	void allocate_slab();
+	void release(pool_block* block);
+
+	std::size_t _block_size; /// capacity of single buffer in bytes
+	std::size_t _block_stride; /// distance between blocks in slab (header with aligned data)
+	std::size_t _blocks_per_slab; /// number of blocks allocated at once
+	std::size_t _max_blocks; /// maximal number of blocks (zero means no limit)
+
+	std::mutex _mutex; /// guards free list and slabs
+	pool_block* _free_blocks = nullptr; /// blocks ready to acquire
+	std::size_t _free_blocks_count = 0;
+	std::size_t _blocks_count = 0; /// number of allocated blocks
+	std::vector<std::unique_ptr<char[]>> _slabs; /// memory of all blocks
+};
+
+}
+
+#endif /* INC_BUFFER_POOL_H_ */
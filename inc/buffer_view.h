@@ -0,0 +1,50 @@
+/*
+ * buffer_view.h
+ *
+ *  Created on: Mar 2, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_BUFFER_VIEW_H_
+#define INC_BUFFER_VIEW_H_
+
+#include <cstddef>
+#include <vector>
+#include <string>
+
+namespace mrobot
+{
+
+/**
+ * @brief Non owning view of contiguous block of bytes
+ *
+ * Viewed memory has to outlive the view. Views passed to event handlers
+ * are valid only until handler returns.
+ */
+struct buffer_view
+{
+	buffer_view() = default;
+	buffer_view(const char* data, std::size_t size) :
+			data(data), size(size)
+	{
+	}
+	buffer_view(const std::vector<char>& buffer) :
+			data(buffer.data()), size(buffer.size())
+	{
+	}
+	buffer_view(const std::string& buffer) :
+			data(buffer.data()), size(buffer.size())
+	{
+	}
+
+	const char* begin() const { return data; }
+	const char* end() const { return data + size; }
+	bool empty() const { return size == 0; }
+
+	const char* data = nullptr; /// first viewed byte
+	std::size_t size = 0; /// number of viewed bytes
+};
+
+}
+
+#endif /* INC_BUFFER_VIEW_H_ */
@@ -0,0 +1,104 @@
+/*
+ * capture.h
+ *
+ *  Created on: May 1, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_CAPTURE_H_
+#define INC_CAPTURE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <sys/uio.h>
+#include "buffer_view.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Direction of captured data
+ */
+enum class capture_direction : std::uint8_t
+{
+	received, // data read from device
+	sent, // data written to device
+};
+
+/**
+ * @brief Captured chunk of traffic
+ */
+struct capture_record
+{
+	std::uint64_t time; /// CLOCK_MONOTONIC time in nanoseconds
+	std::uint32_t port_id; /// identifier given to port when capture was set
+	capture_direction direction;
+	buffer_view data; /// payload (points to mapped file)
+};
+
+/**
+ * @brief Writes traffic to append-only capture file through memory mapping
+ *
+ * File starts with 16 byte header ("MRCAP" magic, version), each record
+ * has 16 byte header (time, port id, direction with size) followed by
+ * payload padded to 8 bytes. Records are copied to mapped memory, system
+ * calls are made only when file grows by next segment. File is truncated
+ * to written size when writer is closed. Can be used by many threads.
+ */
+class capture_writer
+{
+public:
+	capture_writer(const std::string& path, std::size_t segment_size = 64 * 1024 * 1024);
+	virtual ~capture_writer();
+
+	capture_writer(const capture_writer&) = delete;
+	capture_writer& operator=(const capture_writer&) = delete;
+
+	void record(capture_direction direction, std::uint32_t port_id, std::uint64_t time, buffer_view data);
+	void record(capture_direction direction, std::uint32_t port_id, std::uint64_t time, const iovec* buffers, int count);
+	void close();
+
+	std::size_t get_size();
+	unsigned long long get_records_count();
+
+private:
+	char* reserve(std::size_t size);
+	void grow(std::size_t minimal_size);
+
+	std::mutex _mutex; /// guards mapping and write offset
+	int _file_descriptor = -1;
+	char* _memory = nullptr; /// mapped file
+	std::size_t _mapped_size = 0;
+	std::size_t _segment_size; /// file is extended by multiple of this size
+	std::size_t _offset = 0; /// end of written data
+	unsigned long long _records_count = 0;
+};
+
+/**
+ * @brief Reads capture file through read-only memory mapping
+ */
+class capture_reader
+{
+public:
+	explicit capture_reader(const std::string& path);
+	virtual ~capture_reader();
+
+	capture_reader(const capture_reader&) = delete;
+	capture_reader& operator=(const capture_reader&) = delete;
+
+	bool next(capture_record& record);
+	void rewind() { _offset = _header_size; }
+
+private:
+	static constexpr std::size_t _header_size = 16;
+
+	const char* _memory = nullptr;
+	std::size_t _size = 0;
+	std::size_t _offset = _header_size; /// position of next record
+};
+
+}
+
+#endif /* INC_CAPTURE_H_ */
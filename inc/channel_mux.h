@@ -0,0 +1,171 @@
+/*
+ * channel_mux.h
+ *
+ *  Created on: May 14, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_CHANNEL_MUX_H_
+#define INC_CHANNEL_MUX_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "serial_port.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Counters of single virtual channel
+ */
+struct channel_stats
+{
+	std::size_t queued_bytes = 0; /// bytes of messages waiting for transmission
+	std::size_t peak_queued_bytes = 0; /// maximal observed number of queued bytes
+	unsigned long long sent_messages = 0; /// messages completely written to port
+	unsigned long long sent_bytes = 0; /// payload bytes written to port
+	unsigned long long rejected_messages = 0; /// messages not queued because channel queue was full
+	unsigned long long failed_messages = 0; /// messages which fragment couldn't be sent
+	unsigned long long received_messages = 0; /// reassembled messages passed to handler
+};
+
+/**
+ * @brief Multiplexes virtual channels over one serial port
+ *
+ * Messages are split into fragments of at most max_fragment_size bytes,
+ * each sent as frame: 2 byte length (big endian, counts rest of frame),
+ * 1 byte channel (bit 7 set when more fragments of message follow),
+ * 1 byte fragment index (0 for first fragment of message, then 1 - 255
+ * repeated) and payload. Only frames_in_flight fragments are queued in
+ * port at once, next fragment is chosen when one is written. Channels of
+ * the highest priority with queued data are served first, channels of
+ * equal priority share link in proportion to their weights (deficit round
+ * robin). So urgent message waits at most for fragments in flight, even
+ * when bulk channels saturate the link.
+ *
+ * Received frames are reassembled and passed to handler of the channel.
+ * When fragment is missing (e.g. its send failed), partial message is
+ * discarded and counted as error, so fragments of different messages are
+ * never joined. Mux sets frame decoder of the port and subscribes its
+ * frame event. Channels are added before port is added to poll controler,
+ * and mux has to be destroyed after port is removed from it.
+ */
+class channel_mux
+{
+public:
+	using message_handler = std::function<void(channel_mux&, std::uint8_t channel, buffer_view message)>;
+	using send_completion_handler = std::function<void(channel_mux&, send_status)>;
+
+	static constexpr std::uint8_t max_channel = 127;
+
+	channel_mux(serial_port& port, std::size_t max_fragment_size = 256, std::size_t frames_in_flight = 1);
+	virtual ~channel_mux();
+
+	channel_mux(const channel_mux&) = delete;
+	channel_mux& operator=(const channel_mux&) = delete;
+
+	void add_channel(std::uint8_t channel, int priority = 0, unsigned weight = 1,
+			std::size_t queue_capacity = 64 * 1024);
+	void subscribe_message_event(std::uint8_t channel, const message_handler& handler);
+
+	bool send(std::uint8_t channel, buffer_view message, const send_completion_handler& completion_handler = nullptr);
+
+	channel_stats get_stats(std::uint8_t channel);
+	unsigned long long get_errors_count() { return _errors_count; }
+
+	serial_port& get_port() { return _port; }
+
+private:
+
+	static constexpr std::size_t _header_size = 4;
+	static constexpr char _more_fragments_flag = static_cast<char>(0x80);
+
+	/**
+	 * @brief Gets index of fragment which follows given one (0 is used only by first fragment)
+	 */
+	static std::uint8_t next_fragment_index(std::uint8_t index) { return index == 255 ? 1 : index + 1; }
+
+	/**
+	 * @brief Message waiting for transmission
+	 */
+	struct queued_message
+	{
+		std::uint64_t id; /// sequence number in channel
+		std::vector<char> data;
+		std::size_t offset; /// bytes already passed to port
+		send_completion_handler completion_handler;
+		std::uint8_t fragment_index = 0; /// index of next fragment
+	};
+
+	/**
+	 * @brief Virtual channel (transmit queue and receive state)
+	 */
+	struct channel_entry
+	{
+		std::uint8_t id;
+		int priority;
+		std::size_t quantum; /// bytes added to deficit in each round (weight times fragment frame size)
+		std::size_t queue_capacity; /// maximal number of queued bytes
+		std::size_t deficit = 0; /// bytes which channel can send in current round
+		std::deque<queued_message> queue;
+		std::uint64_t queued_messages_count = 0; /// identifier of last queued message
+		std::uint64_t failed_message_id = 0; /// message which fragment failed while its last fragment was in flight
+		channel_stats stats;
+
+		std::shared_ptr<const message_handler> handler; /// called by polling thread with reassembled messages
+		std::vector<char> partial_message; /// fragments received so far (used only by polling thread)
+		bool is_receiving = false; /// fragments of message are being received (used only by polling thread)
+		std::uint8_t expected_fragment_index = 0; /// index of next fragment of received message (used only by polling thread)
+	};
+
+	/**
+	 * @brief Channels of the same priority served by deficit round robin
+	 */
+	struct priority_level
+	{
+		std::vector<channel_entry*> channels;
+		std::size_t current = 0; /// channel served in current round
+		bool is_quantum_added = false; /// current channel got its quantum in this round
+		std::size_t queued_messages = 0;
+	};
+
+	/**
+	 * @brief Fragment passed to port
+	 */
+	struct fragment
+	{
+		channel_entry* channel;
+		std::uint64_t message_id;
+		std::shared_ptr<std::vector<char>> frame;
+		std::size_t payload_size;
+		bool is_last; /// last fragment of message
+		send_completion_handler completion_handler; /// handler of message (set only for last fragment)
+	};
+
+	channel_entry& get_channel(std::uint8_t channel);
+	bool next_fragment(fragment& next);
+	std::size_t next_frame_size(const channel_entry& channel);
+	void transmit();
+	void complete_fragment(fragment& sent, send_status status);
+	void receive(buffer_view frame);
+
+	serial_port& _port;
+	const std::size_t _max_fragment_size;
+	const std::size_t _frames_in_flight;
+
+	std::mutex _mutex; /// guards transmit queues, scheduler state and statistics
+	std::map<std::uint8_t, std::unique_ptr<channel_entry>> _channels;
+	std::map<int, priority_level, std::greater<int>> _levels; /// levels from the highest priority
+	std::size_t _in_flight_count = 0; /// fragments queued in port
+	bool _is_transmitting = false; /// transmit() is running (completions called from it don't start it again)
+	std::atomic<unsigned long long> _errors_count{0}; /// malformed frames, frames of unknown channels and incomplete messages
+};
+
+}
+
+#endif /* INC_CHANNEL_MUX_H_ */
@@ -0,0 +1,53 @@
+/*
+ * checksum.h
+ *
+ *  Created on: May 12, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_CHECKSUM_H_
+#define INC_CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "buffer_view.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief CRC appended to frames by supported protocols
+ */
+enum class checksum_type
+{
+	crc16_modbus, // polynomial 0x8005 reflected, initial 0xFFFF, sent low byte first
+	crc16_ccitt, // polynomial 0x1021, initial 0xFFFF (CCITT-FALSE), sent high byte first
+	crc32, // polynomial 0x04C11DB7 reflected (Ethernet, zlib), sent low byte first
+	crc32c, // polynomial 0x1EDC6F41 reflected (Castagnoli, iSCSI), sent low byte first
+};
+
+/**
+ * @brief Implementation used to compute checksum
+ */
+enum class checksum_implementation
+{
+	bitwise, // reference, one bit per step
+	slicing_by_8, // eight lookup tables, eight bytes per step
+	sse42, // crc32 instruction (CRC-32C only)
+	pclmul, // carry-less multiplication folding (CRC-32 only)
+};
+
+std::size_t get_checksum_size(checksum_type type);
+std::uint32_t get_initial_checksum(checksum_type type);
+std::uint32_t update_checksum(checksum_type type, std::uint32_t checksum, buffer_view data);
+std::uint32_t update_checksum(checksum_type type, std::uint32_t checksum, buffer_view data,
+		checksum_implementation implementation);
+std::uint32_t compute_checksum(checksum_type type, buffer_view data);
+void write_checksum(checksum_type type, std::uint32_t checksum, char* destination);
+std::uint32_t read_checksum(checksum_type type, const char* source);
+checksum_implementation get_checksum_implementation(checksum_type type);
+bool is_checksum_implementation_supported(checksum_type type, checksum_implementation implementation);
+
+}
+
+#endif /* INC_CHECKSUM_H_ */
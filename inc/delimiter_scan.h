@@ -0,0 +1,28 @@
+/*
+ * delimiter_scan.h
+ *
+ *  Created on: May 3, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_DELIMITER_SCAN_H_
+#define INC_DELIMITER_SCAN_H_
+
+namespace mrobot
+{
+
+/**
+ * @brief Implementation used by delimiter scanning functions
+ */
+enum class scan_implementation
+{
+	scalar, sse2, avx2,
+};
+
+const char* find_byte(const char* begin, const char* end, char value);
+const char* find_any_of_two(const char* begin, const char* end, char first, char second);
+scan_implementation get_scan_implementation();
+
+}
+
+#endif /* INC_DELIMITER_SCAN_H_ */
@@ -0,0 +1,149 @@
+/*
+ * frame_decoder.h
+ *
+ *  Created on: May 3, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_FRAME_DECODER_H_
+#define INC_FRAME_DECODER_H_
+
+#include <cstddef>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include "buffer_view.h"
+#include "checksum.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Base of decoders which split received byte stream into frames
+ *
+ * Data is passed to decoder in chunks of any size. Decoder keeps partial
+ * frame between calls and calls handler only with complete frames. Frame
+ * views are valid only until handler returns.
+ */
+class frame_decoder
+{
+public:
+	using frame_handler = std::function<void(buffer_view)>;
+
+	virtual void decode(buffer_view data, const frame_handler& handler) = 0; /// feeds decoder with received data
+	virtual void reset() { _frame.clear(); }; /// drops partial frame
+	virtual ~frame_decoder() {};
+
+	unsigned long long get_errors_count() { return _errors_count.load(std::memory_order_relaxed); } /// number of malformed or too long frames
+
+protected:
+	frame_decoder(std::size_t max_frame_size);
+
+	bool append(const char* begin, const char* end);
+
+	std::vector<char> _frame; /// partial frame collected from previous chunks
+	std::size_t _max_frame_size; /// frames longer than this are dropped
+	bool _is_frame_dropped = false; /// rest of current frame is skipped
+	std::atomic<unsigned long long> _errors_count{0}; /// can be read by other thread than decoding one
+};
+
+/**
+ * @brief Splits stream on delimiter byte (e.g. lines terminated by '\n')
+ */
+class delimiter_decoder: public frame_decoder
+{
+public:
+	delimiter_decoder(char delimiter = '\n', bool include_delimiter = false,
+			std::size_t max_frame_size = 4096);
+
+	virtual void decode(buffer_view data, const frame_handler& handler) override;
+
+private:
+	const char _delimiter;
+	const bool _include_delimiter; /// delimiter is passed as last byte of frame
+};
+
+/**
+ * @brief Decodes frames preceded by their length (payload is passed to handler)
+ */
+class length_prefix_decoder: public frame_decoder
+{
+public:
+	length_prefix_decoder(std::size_t prefix_size = 2, bool is_big_endian = true,
+			std::size_t max_frame_size = 4096);
+
+	virtual void decode(buffer_view data, const frame_handler& handler) override;
+	virtual void reset() override;
+
+private:
+	std::size_t read_length(const char* prefix);
+
+	const std::size_t _prefix_size; /// 1, 2 or 4 bytes
+	const bool _is_big_endian;
+	char _prefix[4]; /// partial length prefix
+	std::size_t _prefix_length = 0; /// number of collected prefix bytes
+	std::size_t _payload_size = 0; /// payload size of current frame (valid when prefix is complete)
+};
+
+/**
+ * @brief Decodes SLIP (RFC 1055) frames
+ */
+class slip_decoder: public frame_decoder
+{
+public:
+	slip_decoder(std::size_t max_frame_size = 4096);
+
+	virtual void decode(buffer_view data, const frame_handler& handler) override;
+	virtual void reset() override;
+
+	static constexpr char end = static_cast<char>(0xC0);
+	static constexpr char escape = static_cast<char>(0xDB);
+	static constexpr char escaped_end = static_cast<char>(0xDC);
+	static constexpr char escaped_escape = static_cast<char>(0xDD);
+
+private:
+	bool _is_escaped = false; /// previous chunk ended with escape byte
+};
+
+/**
+ * @brief Decodes COBS (consistent overhead byte stuffing) frames delimited by zero byte
+ */
+class cobs_decoder: public frame_decoder
+{
+public:
+	cobs_decoder(std::size_t max_frame_size = 4096);
+
+	virtual void decode(buffer_view data, const frame_handler& handler) override;
+
+private:
+	bool decode_frame(buffer_view encoded);
+
+	std::vector<char> _decoded; /// decoded frame passed to handler
+};
+
+/**
+ * @brief Validates and strips checksum of frames decoded by other decoder
+ *
+ * Checksum is the last bytes of frame passed by inner decoder. Frames with
+ * invalid checksum (or shorter than checksum) are dropped and counted as
+ * errors. Errors of inner decoder are counted by inner decoder.
+ */
+class checksum_decoder: public frame_decoder
+{
+public:
+	checksum_decoder(std::unique_ptr<frame_decoder> decoder, checksum_type type);
+
+	virtual void decode(buffer_view data, const frame_handler& handler) override;
+	virtual void reset() override { _decoder->reset(); }
+
+	frame_decoder& get_decoder() { return *_decoder; }
+
+private:
+	std::unique_ptr<frame_decoder> _decoder; /// splits stream into frames with checksum
+	const checksum_type _type;
+};
+
+}
+
+#endif /* INC_FRAME_DECODER_H_ */
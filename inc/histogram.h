@@ -0,0 +1,68 @@
+/*
+ * histogram.h
+ *
+ *  Created on: Apr 4, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_HISTOGRAM_H_
+#define INC_HISTOGRAM_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace mrobot
+{
+
+/**
+ * @brief Histogram of non-negative values with logarithmic buckets
+ *
+ * Each power of two range is split into 8 linear buckets, so reported
+ * percentiles are accurate to 12.5%. Recording uses only relaxed atomic
+ * increments, so it can be done from polling thread while other threads
+ * read percentiles.
+ */
+class histogram
+{
+public:
+	void record(std::uint64_t value);
+	void reset();
+
+	std::uint64_t percentile(double fraction) const;
+	std::uint64_t mean() const;
+	std::uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+	unsigned long long count() const { return _count.load(std::memory_order_relaxed); }
+
+private:
+
+	static constexpr int _sub_bucket_bits = 3; /// log2 of number of buckets per power of two
+	static constexpr std::size_t _sub_buckets_count = 1 << _sub_bucket_bits;
+	static constexpr std::size_t _buckets_count = (64 - _sub_bucket_bits + 1) * _sub_buckets_count;
+
+	static std::size_t bucket_of(std::uint64_t value);
+	static std::uint64_t upper_bound_of(std::size_t bucket);
+
+	std::atomic<unsigned long long> _buckets[_buckets_count] {}; /// number of values in each bucket
+	std::atomic<unsigned long long> _count{0}; /// number of recorded values
+	std::atomic<unsigned long long> _sum{0}; /// sum of recorded values
+	std::atomic<std::uint64_t> _max{0}; /// the biggest recorded value
+};
+
+/**
+ * @brief Histogram of durations (stored in nanoseconds)
+ */
+class latency_histogram: public histogram
+{
+public:
+	void record(std::chrono::nanoseconds latency) { histogram::record(latency.count() > 0 ? latency.count() : 0); }
+
+	std::chrono::nanoseconds percentile(double fraction) const { return std::chrono::nanoseconds{histogram::percentile(fraction)}; }
+	std::chrono::nanoseconds mean() const { return std::chrono::nanoseconds{histogram::mean()}; }
+	std::chrono::nanoseconds max() const { return std::chrono::nanoseconds{histogram::max()}; }
+};
+
+}
+
+#endif /* INC_HISTOGRAM_H_ */
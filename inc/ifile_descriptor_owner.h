@@ -8,18 +8,70 @@
 #ifndef INC_IFILE_DESCRIPTOR_OWNER_H_
 #define INC_IFILE_DESCRIPTOR_OWNER_H_
 
+#include <sys/uio.h>
+
 namespace mrobot
 {
+	class reactor;
+	class ifile_descriptor_owner;
+
+	using dispatch_function = void (*)(ifile_descriptor_owner* owner); /// calls handler of owner without virtual call
+
+	/**
+	 * @brief Functions stored by reactor in dispatch table of observed descriptor
+	 */
+	struct dispatch_functions
+	{
+		dispatch_function process_data;
+		dispatch_function process_write;
+	};
+
 	/**
 	 * @brief Interface from which will derivative all class which can be updated and have fille descriptor
 	 */
 	class ifile_descriptor_owner
 	{
 	public:
-		virtual void process_data()=0; /// process data which arrived to file
+		virtual void process_data()=0; /// process data which arrived to file (in edge triggered mode all available data has to be read)
+		virtual void process_write() {}; /// writes pending data when file becomes writable (called only when write interest is set)
+		virtual void attach(reactor* /*owner_reactor*/) {}; /// called when owner is added to reactor (with nullptr when it is removed)
 		virtual int get_file_descriptor()=0; /// gets file descriptor
+		virtual dispatch_functions get_dispatch_functions(); /// gets functions called by reactor for readiness events (called once, when descriptor is registered)
+
+		// completion based I/O (used by io_uring backend of reactor)
+		virtual bool is_completion_io_supported() { return false; }; /// owner implements functions below (otherwise readiness is reported by process_data() and process_write())
+		virtual int prepare_read(iovec /*regions*/[2]) { return 0; }; /// describes memory for next read, returns number of regions (memory has to stay valid until complete_read())
+		virtual void complete_read(int /*result*/) {}; /// called with result of read into prepared memory (negative errno on error)
+		virtual int prepare_write(iovec* /*buffers*/, int /*max_count*/) { return 0; }; /// describes data for next write, returns number of buffers (data has to stay valid until complete_write())
+		virtual void complete_write(int /*result*/) {}; /// called with result of write of prepared data (negative errno on error)
 		virtual ~ifile_descriptor_owner() {};
 	};
+
+	/**
+	 * @brief Creates dispatch functions which call handlers of given type directly
+	 *
+	 * Handlers are called with qualified names, so calls aren't virtual and
+	 * can be inlined. Only final owner class should return them from its
+	 * override of get_dispatch_functions(), otherwise overrides of
+	 * process_data() and process_write() in derived classes are bypassed.
+	 */
+	template<typename owner_type>
+	dispatch_functions make_dispatch_functions()
+	{
+		return dispatch_functions{
+			[](ifile_descriptor_owner* owner) { static_cast<owner_type*>(owner)->owner_type::process_data(); },
+			[](ifile_descriptor_owner* owner) { static_cast<owner_type*>(owner)->owner_type::process_write(); }};
+	}
+
+	/**
+	 * @brief Default dispatch functions use virtual calls
+	 */
+	inline dispatch_functions ifile_descriptor_owner::get_dispatch_functions()
+	{
+		return dispatch_functions{
+			[](ifile_descriptor_owner* owner) { owner->process_data(); },
+			[](ifile_descriptor_owner* owner) { owner->process_write(); }};
+	}
 }
 
 
@@ -0,0 +1,52 @@
+/*
+ * inline_serial_port.h
+ *
+ *  Created on: May 10, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_INLINE_SERIAL_PORT_H_
+#define INC_INLINE_SERIAL_PORT_H_
+
+#include "serial_port.h"
+#include <utility>
+
+namespace mrobot
+{
+	/**
+	 * @brief Serial port which type of data handler is known at compile time
+	 *
+	 * Reactor with epoll backend calls process_data() of this class through
+	 * its dispatch table, and the handler is called directly, so whole path
+	 * from readiness event to handler has no virtual calls and no std::function.
+	 * Other paths (io_uring completions, packet gap timeouts, worker pool)
+	 * reach the handler through data view event, which is subscribed by the
+	 * port itself (it mustn't be unsubscribed or replaced). When frame
+	 * decoder or other receive event is set, data is delivered by generic
+	 * process_data() of serial_port.
+	 * @tparam handler_type callable with (serial_port&, buffer_view)
+	 */
+	template<typename handler_type>
+	class inline_serial_port final: public serial_port
+	{
+	public:
+		inline_serial_port(std::string device, handler_type handler, baudrate_option baudrate = baudrate_option::b9600,
+				data_bits_option data_bits = data_bits_option::eight, parity_option parity = parity_option::none,
+				stop_bits_option stop_bits = stop_bits_option::one) :
+				serial_port(std::move(device), baudrate, data_bits, parity, stop_bits), _handler(std::move(handler))
+		{
+			subscribe_data_view_event([this](serial_port& port, buffer_view data)
+			{	_handler(port, data);});
+		}
+
+		virtual void process_data() override { process_data_with(_handler); }
+		virtual dispatch_functions get_dispatch_functions() override { return make_dispatch_functions<inline_serial_port>(); }
+
+		handler_type& get_handler() { return _handler; }
+
+	private:
+		handler_type _handler; /// called with received data
+	};
+}
+
+#endif /* INC_INLINE_SERIAL_PORT_H_ */
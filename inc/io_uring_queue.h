@@ -0,0 +1,100 @@
+/*
+ * io_uring_queue.h
+ *
+ *  Created on: Apr 10, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_IO_URING_QUEUE_H_
+#define INC_IO_URING_QUEUE_H_
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <errno.h>
+#include "poll_exception.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Minimal io_uring submission/completion queue pair
+ *
+ * Uses raw system calls, so no additional library is required. Queue is
+ * used only by owning reactor thread and isn't thread safe.
+ */
+class io_uring_queue
+{
+public:
+	explicit io_uring_queue(unsigned entries);
+	~io_uring_queue();
+
+	io_uring_queue(const io_uring_queue&) = delete;
+	io_uring_queue& operator=(const io_uring_queue&) = delete;
+
+	io_uring_sqe* get_sqe();
+	int submit();
+	int submit_and_wait(int timeout);
+
+	template<typename handler_type>
+	unsigned process_completions(handler_type handler);
+
+	bool has_timeout_support() { return _params.features & IORING_FEAT_EXT_ARG; }
+
+private:
+
+	std::size_t _sq_ring_size = 0; /// size of mapped submission ring
+	std::size_t _cq_ring_size = 0; /// size of mapped completion ring (0 when mapped together with submission ring)
+	std::size_t _sqes_size = 0; /// size of mapped submission entries array
+
+	int _ring_fd = -1; /// io_uring instance
+	io_uring_params _params{}; /// parameters returned by io_uring_setup()
+
+	char* _sq_ring = nullptr; /// mapped submission ring
+	char* _cq_ring = nullptr; /// mapped completion ring
+	io_uring_sqe* _sqes = nullptr; /// mapped submission entries
+
+	unsigned* _sq_tail = nullptr;
+	unsigned* _sq_head = nullptr;
+	unsigned* _sq_array = nullptr;
+	unsigned _sq_mask = 0;
+	unsigned* _cq_head = nullptr;
+	unsigned* _cq_tail = nullptr;
+	unsigned _cq_mask = 0;
+	io_uring_cqe* _cqes = nullptr;
+
+	unsigned _pending_submissions = 0; /// entries filled since last io_uring_enter()
+};
+
+/**
+ * @brief Calls handler for each available completion
+ *
+ * Completion is consumed before handler is called, so exception thrown
+ * by handler doesn't cause completion to be processed again.
+ * @param handler function called with user data and result of completed operation
+ * @return number of processed completions
+ */
+template<typename handler_type>
+unsigned io_uring_queue::process_completions(handler_type handler)
+{
+	unsigned processed = 0;
+	unsigned head = *_cq_head;
+
+	while (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+	{
+		io_uring_cqe completion = _cqes[head & _cq_mask];
+		__atomic_store_n(_cq_head, ++head, __ATOMIC_RELEASE);
+		processed++;
+
+		handler(completion.user_data, completion.res);
+	}
+	return processed;
+}
+
+}
+
+#endif /* INC_IO_URING_QUEUE_H_ */
@@ -0,0 +1,38 @@
+/*
+ * log.h
+ *
+ *  Created on: Apr 6, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_LOG_H_
+#define INC_LOG_H_
+
+#include <iostream>
+
+/*
+ * Diagnostic messages are written to std::cerr. Messages above compile time
+ * level MROBOT_LOG_LEVEL are removed by compiler, so they don't cost anything
+ * in polling threads (e.g. compile with -DMROBOT_LOG_LEVEL=MROBOT_LOG_LEVEL_DEBUG).
+ */
+#define MROBOT_LOG_LEVEL_NONE 0
+#define MROBOT_LOG_LEVEL_ERROR 1
+#define MROBOT_LOG_LEVEL_WARNING 2
+#define MROBOT_LOG_LEVEL_DEBUG 3
+
+#ifndef MROBOT_LOG_LEVEL
+#define MROBOT_LOG_LEVEL MROBOT_LOG_LEVEL_WARNING
+#endif
+
+#define MROBOT_LOG(level, message) \
+	do \
+	{ \
+		if (MROBOT_LOG_LEVEL >= (level)) \
+			std::cerr << message; \
+	} while (0)
+
+#define MROBOT_LOG_ERROR(message) MROBOT_LOG(MROBOT_LOG_LEVEL_ERROR, message)
+#define MROBOT_LOG_WARNING(message) MROBOT_LOG(MROBOT_LOG_LEVEL_WARNING, message)
+#define MROBOT_LOG_DEBUG(message) MROBOT_LOG(MROBOT_LOG_LEVEL_DEBUG, message)
+
+#endif /* INC_LOG_H_ */
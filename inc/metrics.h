@@ -0,0 +1,130 @@
+/*
+ * metrics.h
+ *
+ *  Created on: Apr 6, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_METRICS_H_
+#define INC_METRICS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include "histogram.h"
+
+namespace mrobot
+{
+
+using metrics_counter = std::atomic<unsigned long long>;
+
+/**
+ * @brief Summary of histogram (percentiles are upper bounds of buckets)
+ */
+struct histogram_summary
+{
+	unsigned long long count = 0;
+	std::uint64_t mean = 0;
+	std::uint64_t p50 = 0;
+	std::uint64_t p90 = 0;
+	std::uint64_t p99 = 0;
+	std::uint64_t max = 0;
+
+	static histogram_summary of(const histogram& values);
+};
+
+/**
+ * @brief Copy of serial port counters
+ */
+struct port_metrics_snapshot
+{
+	unsigned long long bytes_in = 0; /// bytes read from device
+	unsigned long long bytes_out = 0; /// bytes written to device
+	unsigned long long frames_in = 0; /// frames passed to frame event handler
+	unsigned long long frames_out = 0; /// messages completely written to device
+	unsigned long long read_calls = 0; /// read system calls (and io_uring read completions)
+	unsigned long long write_calls = 0; /// write system calls (and io_uring write completions)
+	unsigned long long read_errors = 0; /// failed reads (without EAGAIN and EINTR)
+	unsigned long long write_errors = 0; /// failed writes (without EAGAIN and EINTR)
+	unsigned long long frame_errors = 0; /// invalid or oversized frames dropped by frame decoder
+	unsigned long long dropped_messages = 0; /// messages dropped because transmit queue was full
+	unsigned long long coalesced_messages = 0; /// blocking sends gathered in coalescing buffer
+	unsigned long long coalesced_writes = 0; /// writes of coalescing buffer (each carries one or more messages)
+	std::size_t transmit_queue_bytes = 0; /// bytes waiting in transmit queue
+	std::size_t transmit_queue_messages = 0; /// messages waiting in transmit queue
+	std::size_t peak_receive_buffer_bytes = 0; /// maximal number of bytes stored in receive buffer
+	unsigned long long dispatched_buffers = 0; /// buffers of received data queued for worker pool
+	unsigned long long dispatch_overflows = 0; /// buffers dropped because dispatch queue (or buffer pool) was full
+	std::size_t dispatch_queue_depth = 0; /// buffers waiting for worker
+	histogram_summary read_size; /// bytes returned by single read
+	histogram_summary handler_time; /// nanoseconds spent in data handlers per delivery
+
+	double get_write_calls_per_message() const { return frames_out > 0 ? double(write_calls) / frames_out : 0.0; }
+};
+
+/**
+ * @brief Serial port counters updated without locks
+ *
+ * Counters are relaxed atomics, so they can be read by any thread
+ * while polling thread updates them.
+ */
+struct port_metrics
+{
+	metrics_counter bytes_in{0};
+	metrics_counter bytes_out{0};
+	metrics_counter frames_in{0};
+	metrics_counter frames_out{0};
+	metrics_counter read_calls{0};
+	metrics_counter write_calls{0};
+	metrics_counter read_errors{0};
+	metrics_counter write_errors{0};
+	metrics_counter coalesced_messages{0};
+	metrics_counter coalesced_writes{0};
+	std::atomic<std::size_t> peak_receive_buffer_bytes{0};
+	metrics_counter dispatched_buffers{0};
+	metrics_counter dispatch_overflows{0};
+	histogram read_size;
+	histogram handler_time;
+
+	static void add(metrics_counter& counter, unsigned long long value = 1) { counter.fetch_add(value, std::memory_order_relaxed); }
+	void update_peak_receive_buffer(std::size_t bytes);
+	void fill(port_metrics_snapshot& snapshot) const;
+};
+
+/**
+ * @brief Copy of reactor (poll controler shard) counters
+ */
+struct reactor_metrics_snapshot
+{
+	unsigned long long wakeups = 0; /// returns from epoll_wait() (or io_uring_enter())
+	unsigned long long empty_wakeups = 0; /// wakeups without any descriptor event (timeouts and wake up events)
+	unsigned long long dispatched_events = 0; /// read and write events passed to owners
+	unsigned long long expired_timers = 0; /// called timer handlers
+	unsigned long long errors = 0; /// exceptions caught in polling thread
+	std::size_t observers = 0; /// observed descriptors
+	std::size_t pending_changes = 0; /// registration changes waiting for polling thread
+	std::size_t pending_timers = 0; /// scheduled timers
+};
+
+/**
+ * @brief Reactor counters updated without locks
+ */
+struct reactor_metrics
+{
+	metrics_counter wakeups{0};
+	metrics_counter empty_wakeups{0};
+	metrics_counter dispatched_events{0};
+	metrics_counter expired_timers{0};
+	metrics_counter errors{0};
+
+	static void add(metrics_counter& counter, unsigned long long value = 1) { counter.fetch_add(value, std::memory_order_relaxed); }
+	void fill(reactor_metrics_snapshot& snapshot) const;
+};
+
+void export_metrics(std::ostream& stream, const std::string& port_name, const port_metrics_snapshot& snapshot);
+void export_metrics(std::ostream& stream, std::size_t shard, const reactor_metrics_snapshot& snapshot);
+
+}
+
+#endif /* INC_METRICS_H_ */
@@ -9,74 +9,117 @@
 #define INC_POLL_CONTROLER_H_
 
 #include <vector>
-#include <chrono>
-#include <thread>
-#include <algorithm>
-#include <sys/poll.h>
-#include <cstring>
+#include <memory>
 #include <map>
-#include <exception>
-#include <errno.h>
-#include <ifile_descriptor_owner.h>
-#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <reactor.h>
+#include "buffer_pool.h"
 
 namespace mrobot
 {
-using milliseconds = std::chrono::milliseconds;
 
+/**
+ * @brief Describes how observed descriptors are assigned to shards
+ */
+enum class shard_assignment
+{
+	hash, // shard is chosen by hash of file descriptor
+	least_loaded, // shard which observes the smallest number of descriptors
+};
+
+/**
+ * @brief Settings of shard dedicated to latency sensitive descriptors
+ *
+ * Busy polling thread with real-time priority never gives up its CPU,
+ * so it should be pinned to CPU which isn't used by other threads.
+ */
+struct low_latency_options
+{
+	bool busy_polling = true; /// polling thread spins instead of sleeping in kernel
+	int realtime_priority = 0; /// SCHED_FIFO priority of polling thread (zero keeps normal scheduling)
+	std::vector<int> cpus; /// CPUs to which polling thread is pinned (empty means no pinning)
+	bool lock_memory = false; /// lock process memory with mlockall(), so page faults don't add jitter
+};
+
+/**
+ * @brief Observes file descriptors and dispatches their events
+ *
+ * Descriptors are distributed between one or more shards (reactors),
+ * each running its own polling thread. Events of descriptors assigned
+ * to one shard are dispatched serially, so slow owner delays only
+ * descriptors from its shard. Dedicated low latency shards serve only
+ * descriptors explicitly added to them.
+ */
 class poll_controler
 {
 public:
 	poll_controler();
-	poll_controler(int poll_timeout, milliseconds poll_interval);
+	poll_controler(int poll_timeout, trigger_mode mode = trigger_mode::level, std::size_t shards_count = 1);
 	virtual ~poll_controler();
 
 	void add(ifile_descriptor_owner* observer);
+	void add(ifile_descriptor_owner* observer, std::size_t shard);
 	void remove(ifile_descriptor_owner* observer);
 
 	void start_polling();
 	void stop_polling();
 
-private:
+	void set_shard_assignment(shard_assignment assignment) { _shard_assignment = assignment; }
+	void set_automatic_rebalancing(bool is_enabled);
+	void set_cpu_affinity(std::size_t shard, const std::vector<int>& cpus);
+	void set_io_backend(io_backend backend);
+	io_backend get_io_backend(std::size_t shard) { return _shards.at(shard)->get_io_backend(); }
+	void rebalance();
 
-	void poll_loop();
-	void poll_file_descriptors();
-	void construct_ufds_array();
+	std::size_t add_low_latency_shard(const low_latency_options& options);
+	bool is_memory_locked() { return _is_memory_locked; }
 
-	std::map<int, ifile_descriptor_owner*> _observers;
+	std::size_t get_shards_count() { return _shards.size(); }
+	std::size_t get_shard_load(std::size_t shard);
+	std::size_t get_shard_of(ifile_descriptor_owner* observer);
+	reactor& get_shard(std::size_t shard) { return *_shards.at(shard); }
+	reactor_metrics_snapshot get_metrics(std::size_t shard) { return _shards.at(shard)->get_metrics(); }
+	void export_metrics(std::ostream& stream);
+	const std::shared_ptr<buffer_pool>& get_buffer_pool() { return _buffer_pool; }
+	trace_ring& get_trace_ring() { return *_trace_ring; }
 
-	std::thread _poll_thread;
+	trigger_mode get_trigger_mode() { return _trigger_mode; }
+	bool is_poll_thread();
 
-	bool _is_poll_thread_running = false;
-
-	int _observed_fd_count = 0; /// amount of sockets which are polled by poll()
-
-	bool _are_poll_objects_initialized = false;
-
-	int _timeout = -1; /// time in milliseconds after which poll function() terminates (if negative function never terminates)
-
-	milliseconds _poll_interval
-	{ 500 }; /// time after which polling thread will poll file descriptors
-
-	pollfd* _ufds = nullptr; /// array of structures representing file descriptors used in file descriptors polling
-};
+private:
 
-class poll_exception: std::exception
-{
-public:
-	poll_exception(std::string message, std::string error = "None") :
-			_message(message), _error_description(error)
+	/**
+	 * @brief Shard assigned to observed descriptor
+	 */
+	struct assignment_entry
 	{
-	}
-	const char* what() const throw () override
-	{
-		std::string result = ("Message: " + _message + "\n"
-				+ "Error description: " + _error_description + "\n");
-		return result.c_str();
-	}
-private:
-	const std::string _message;
-	const std::string _error_description;
+		std::size_t shard;
+		bool is_pinned; /// explicitly assigned, never moved by rebalancing
+		bool is_moving; /// descriptor is being moved to other shard
+	};
+
+	void add(ifile_descriptor_owner* observer, std::size_t shard, bool is_pinned);
+	std::size_t choose_shard(ifile_descriptor_owner* observer);
+	bool move_observer();
+
+	std::vector<std::unique_ptr<reactor>> _shards; /// reactors which poll assigned descriptors
+	std::size_t _shared_shards_count = 1; /// shards used by automatic assignment (dedicated shards follow them)
+	std::shared_ptr<buffer_pool> _buffer_pool = buffer_pool::create(); /// buffers of received data shared by all shards
+	std::shared_ptr<trace_ring> _trace_ring = std::make_shared<trace_ring>(); /// trace records of all shards (disabled by default)
+
+	std::mutex _assignments_mutex; /// guards assignments and shard loads
+	std::condition_variable _move_finished_condition; /// notified when descriptor was moved between shards
+	std::map<ifile_descriptor_owner*, assignment_entry> _assignments; /// shard of each observed descriptor
+	std::vector<std::size_t> _shard_loads; /// number of descriptors assigned to each shard
+
+	trigger_mode _trigger_mode = trigger_mode::level; /// readiness notification mode used by all shards
+	int _poll_timeout = -1; /// epoll_wait() timeout of shards in milliseconds
+	io_backend _io_backend = io_backend::epoll; /// backend requested for all shards
+	shard_assignment _shard_assignment = shard_assignment::hash; /// assignment of descriptors added without explicit shard
+	bool _is_automatic_rebalancing_enabled = false; /// rebalance shards after each add and remove
+	bool _is_polling = false; /// polling threads are started
+	bool _is_memory_locked = false; /// process memory was locked for low latency shard
 };
 
 }
@@ -0,0 +1,37 @@
+/*
+ * poll_exception.h
+ *
+ *  Created on: Jan 12, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_POLL_EXCEPTION_H_
+#define INC_POLL_EXCEPTION_H_
+#include <string>
+#include <exception>
+
+namespace mrobot
+{
+
+/**
+ * @brief Represents errors of file descriptors polling
+ */
+class poll_exception: public std::exception
+{
+public:
+	poll_exception(std::string message, std::string error = "None") :
+			_message(message), _error_description(error),
+			_what("Message: " + _message + "\n" + "Error description: " + _error_description + "\n")
+	{
+	}
+	const char* what() const throw () override
+	{
+		return _what.c_str();
+	}
+private:
+	const std::string _message;
+	const std::string _error_description;
+	const std::string _what; /// message returned by what() (has to outlive the call)
+};
+}
+#endif /* INC_POLL_EXCEPTION_H_ */
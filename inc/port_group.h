@@ -0,0 +1,95 @@
+/*
+ * port_group.h
+ *
+ *  Created on: Apr 24, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_PORT_GROUP_H_
+#define INC_PORT_GROUP_H_
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "serial_port.h"
+#include "poll_controler.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Bank of serial ports served together
+ *
+ * Broadcast queues one shared payload on all members with non-blocking
+ * asynchronous sends, each member applies its own backpressure option
+ * (drop is recommended, so slow device doesn't stall the others).
+ * Data received by members is merged into one stream ordered by receive
+ * time. Chunk is delivered when it is older than merge delay, so chunks
+ * read by different polling threads can be put in order. Group uses
+ * buffer event of its members.
+ */
+class port_group
+{
+public:
+	using merged_data_event_handler = std::function<void(serial_port&, timer_clock::time_point, pooled_buffer)>;
+	using send_completion_handler = serial_port::send_completion_handler;
+
+	port_group(poll_controler& controler, timer_clock::duration merge_delay = std::chrono::milliseconds{1});
+	virtual ~port_group();
+
+	void add(serial_port* port);
+	void remove(serial_port* port);
+
+	std::size_t broadcast(buffer_view data, const send_completion_handler& completion_handler = nullptr);
+	std::size_t broadcast(const std::shared_ptr<const std::vector<char>>& payload, const send_completion_handler& completion_handler = nullptr);
+
+	void subscribe_merged_data_event(const merged_data_event_handler& event_handler);
+	void unsubscribe_merged_data_event();
+	void flush();
+
+	std::size_t get_members_count();
+	unsigned long long get_failed_broadcasts_count() { return _failed_broadcasts_count; }
+
+private:
+
+	/**
+	 * @brief Data received by member and waiting for its turn
+	 */
+	struct received_chunk
+	{
+		timer_clock::time_point time; /// time when data was received
+		std::uint64_t sequence; /// keeps order of chunks received at the same time
+		serial_port* port;
+		pooled_buffer buffer;
+
+		bool operator>(const received_chunk& other) const
+		{
+			return time != other.time ? time > other.time : sequence > other.sequence;
+		}
+	};
+
+	void receive(serial_port& port, pooled_buffer buffer);
+	void deliver_chunks(timer_clock::time_point deadline);
+	void schedule_delivery(serial_port& port);
+
+	poll_controler& _controler;
+	const timer_clock::duration _merge_delay; /// age of chunk after which it is delivered
+
+	std::mutex _members_mutex; /// guards members
+	std::vector<serial_port*> _members;
+	std::atomic<unsigned long long> _failed_broadcasts_count{0}; /// member sends which threw exception
+
+	std::mutex _merge_mutex; /// guards pending chunks and delivery (handler is called with it locked)
+	std::vector<received_chunk> _pending_chunks; /// heap ordered by receive time (the oldest on top)
+	std::uint64_t _next_sequence = 0;
+	bool _is_delivery_scheduled = false; /// reactor timer delivering pending chunks is scheduled
+	serial_port* _delivery_timer_owner = nullptr; /// member which reactor runs delivery timer
+	bool _is_merged_data_event_subscribed = false;
+	merged_data_event_handler _merged_data_event_handler;
+};
+
+}
+
+#endif /* INC_PORT_GROUP_H_ */
@@ -0,0 +1,272 @@
+/*
+ * reactor.h
+ *
+ *  Created on: Mar 20, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_REACTOR_H_
+#define INC_REACTOR_H_
+
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <climits>
+#include <map>
+#include <set>
+#include <exception>
+#include <errno.h>
+#include <ifile_descriptor_owner.h>
+#include <iostream>
+#include <pthread.h>
+#include "poll_exception.h"
+#include "io_uring_queue.h"
+#include "metrics.h"
+#include "log.h"
+#include "buffer_pool.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include <memory>
+#include <functional>
+
+namespace mrobot
+{
+using milliseconds = std::chrono::milliseconds;
+
+/**
+ * @brief Describes when epoll reports readiness of observed file descriptor
+ */
+enum class trigger_mode
+{
+	level, // readiness is reported as long as there is data to read
+	edge, // readiness is reported only when new data arrives (owner has to read until EAGAIN)
+};
+
+/**
+ * @brief Kernel interface used by reactor to wait for I/O
+ */
+enum class io_backend
+{
+	epoll, // readiness notifications, owner reads and writes itself
+	io_uring, // completion based I/O, reads and writes of all descriptors are submitted in batches
+};
+
+/**
+ * @brief Single polling thread with its own epoll (or io_uring) instance
+ *
+ * Reactor observes set of file descriptors and dispatches their events
+ * in its thread. Poll controler uses one or more reactors (shards).
+ */
+class reactor
+{
+public:
+	reactor(int poll_timeout, trigger_mode mode = trigger_mode::level);
+	virtual ~reactor();
+
+	void add(ifile_descriptor_owner* observer);
+	void remove(ifile_descriptor_owner* observer);
+	void move(ifile_descriptor_owner* observer, reactor& destination);
+
+	void start_polling();
+	void stop_polling();
+
+	void set_write_interest(ifile_descriptor_owner* observer, bool is_interested);
+
+	std::uint64_t schedule_timer(ifile_descriptor_owner* owner, timer_clock::duration delay, const timer_handler& handler);
+	void cancel_timer(std::uint64_t timer_id);
+
+	void set_cpu_affinity(const std::vector<int>& cpus);
+	void set_io_backend(io_backend backend) { _requested_io_backend = backend; }
+	void set_busy_polling(bool is_enabled) { _is_busy_polling_enabled = is_enabled; }
+	void set_realtime_priority(int priority) { _realtime_priority = priority; }
+	void set_buffer_pool(std::shared_ptr<buffer_pool> pool) { _buffer_pool = std::move(pool); }
+	const std::shared_ptr<buffer_pool>& get_buffer_pool() { return _buffer_pool; }
+	void set_trace_ring(std::shared_ptr<trace_ring> ring) { _trace_ring = std::move(ring); }
+	trace_ring* get_trace_ring() { return _trace_ring.get(); }
+	std::uint64_t get_wakeup_time() { return _wakeup_time; }
+
+	trigger_mode get_trigger_mode() { return _trigger_mode; }
+	io_backend get_io_backend() { return _io_uring ? io_backend::io_uring : io_backend::epoll; }
+	bool is_poll_thread();
+	bool is_realtime() { return _is_realtime; }
+	std::size_t get_observers_count();
+	reactor_metrics_snapshot get_metrics();
+
+private:
+
+	static constexpr int _max_write_buffers = 16; /// maximal number of buffers in single io_uring write
+
+	/**
+	 * @brief Registration change requested while polling thread is running
+	 */
+	struct registration_change
+	{
+		ifile_descriptor_owner* observer;
+		int file_descriptor;
+		bool is_add;
+		std::vector<timer_wheel::timer_entry>* moved_timers; /// receives timers of removed owner (nullptr means timers are cancelled)
+	};
+
+	/**
+	 * @brief Observed file descriptor
+	 */
+	struct observer_entry
+	{
+		ifile_descriptor_owner* observer;
+		int file_descriptor;
+		bool is_registered; /// descriptor is added to epoll instance (or served by io_uring)
+		std::uint64_t dispatch_key; /// slot and generation stored in epoll events of descriptor
+
+		// io_uring backend state (used only by polling thread)
+		bool is_read_submitted; /// read (or poll for input) is in flight
+		bool is_write_submitted; /// write (or poll for output) is in flight
+		bool is_read_completion_io; /// submitted read is done into owner memory (not poll)
+		bool is_write_completion_io; /// submitted write is done from owner memory (not poll)
+		bool is_removing; /// entry is removed when submitted operations complete
+		bool is_scheduled; /// entry is in submission schedule
+		iovec read_regions[2]; /// memory of submitted read
+		iovec write_buffers[_max_write_buffers]; /// data of submitted write
+	};
+
+	/**
+	 * @brief Entry of dispatch table used by epoll backend
+	 *
+	 * Epoll event holds index of slot and its generation, so polling thread
+	 * finds owner without lookups and skips events of removed owners.
+	 */
+	struct dispatch_slot
+	{
+		ifile_descriptor_owner* observer; /// nullptr when slot is free
+		dispatch_functions functions; /// handlers of readiness events
+		std::uint32_t generation; /// increased when slot is freed
+		std::uint32_t next_free; /// next free slot (valid only for free slots)
+	};
+
+	static constexpr std::uint64_t _wake_up_key = 0; /// epoll data of wake up event
+	static constexpr std::uint64_t _timer_key = UINT64_MAX; /// epoll data of timer descriptor
+
+	/**
+	 * @brief Kind of io_uring operation stored in low bits of user data
+	 */
+	enum operation_tag : std::uintptr_t
+	{
+		wake_up_operation = 0, read_operation = 1, write_operation = 2, cancel_operation = 3, tag_mask = 3,
+	};
+
+	void poll_loop();
+	void poll_file_descriptors();
+	void register_observers();
+	void unregister_observers();
+	void register_observer(observer_entry& entry);
+	void remove_observer(ifile_descriptor_owner* observer, std::vector<timer_wheel::timer_entry>* moved_timers);
+	void apply_change(const registration_change& change);
+	void apply_pending_changes();
+	void finish_removal(ifile_descriptor_owner* observer);
+	std::uint64_t acquire_dispatch_slot(ifile_descriptor_owner* observer);
+	void release_dispatch_slot(std::uint64_t dispatch_key);
+	uint32_t events_for(int file_descriptor);
+	int wait_timeout();
+	void run_expired_timers();
+	void cancel_timers_of(ifile_descriptor_owner* owner);
+	void adopt_timers(std::vector<timer_wheel::timer_entry>& timers);
+	bool arm_next_expiration();
+	void arm_timer(timer_clock::time_point expiration);
+	void wake_up();
+	void apply_cpu_affinity();
+	void apply_realtime_priority();
+
+	void start_io_uring();
+	void complete_io_uring_operations();
+	void schedule_submission(observer_entry& entry);
+	void submit_scheduled_operations();
+	void submit_read(observer_entry& entry);
+	void submit_write(observer_entry& entry);
+	void submit_wake_up_read();
+	void cancel_operations(observer_entry& entry);
+	void process_completion(std::uint64_t user_data, int result);
+
+	std::map<int, observer_entry> _observers;
+
+	std::mutex _observers_mutex; /// guards observers, write interests, epoll registrations and submission schedule
+	std::set<int> _write_interests; /// descriptors which are observed for EPOLLOUT
+
+	std::mutex _changes_mutex; /// guards pending changes and removals
+	std::condition_variable _removal_finished_condition; /// notified when observer removal was finished
+	std::vector<registration_change> _pending_changes; /// changes which will be applied by polling thread
+	std::multiset<ifile_descriptor_owner*> _pending_removals; /// observers which removal isn't finished
+
+	std::vector<ifile_descriptor_owner*> _removed_observers; /// observers removed during current dispatch of io_uring completions
+
+	std::vector<dispatch_slot> _dispatch_slots; /// owners of descriptors registered in epoll (modified by polling thread or when it's stopped)
+	std::uint32_t _free_dispatch_slot = UINT32_MAX; /// first free slot of dispatch table
+
+	std::mutex _timers_mutex; /// guards timer wheel and armed expiration
+	timer_wheel _timers; /// pending timers (owners are removed observers)
+	timer_clock::time_point _armed_expiration = timer_clock::time_point::max(); /// expiration of timer descriptor
+
+	std::thread _poll_thread;
+
+	std::atomic<std::thread::id> _poll_thread_id{}; /// identifier of running polling thread (set by thread itself)
+
+	reactor_metrics _metrics; /// counters updated by polling thread
+
+	std::shared_ptr<buffer_pool> _buffer_pool; /// pool used by owners for received data (shared by poll controler shards)
+
+	std::shared_ptr<trace_ring> _trace_ring; /// trace records of owners (shared by poll controler shards)
+
+	std::uint64_t _wakeup_time = 0; /// CLOCK_MONOTONIC time of last wakeup (taken only when tracing is enabled)
+
+	std::vector<int> _cpu_affinity; /// CPUs on which polling thread can run (empty means all)
+
+	int _realtime_priority = 0; /// SCHED_FIFO priority of polling thread (zero means normal scheduling)
+
+	std::atomic<bool> _is_realtime{false}; /// polling thread runs with SCHED_FIFO policy
+
+	bool _is_busy_polling_enabled = false; /// polling thread never sleeps in epoll_wait() (or io_uring_enter())
+
+	std::atomic<bool> _is_poll_thread_running{false};
+
+	int _timeout = -1; /// time in milliseconds after which epoll_wait() terminates (if negative function never terminates)
+
+	trigger_mode _trigger_mode = trigger_mode::level; /// readiness notification mode used for all observed descriptors
+
+	int _epoll_fd = -1; /// epoll instance which holds observed file descriptors
+
+	int _wake_up_fd = -1; /// eventfd used to interrupt epoll_wait() from other threads
+
+	int _timer_fd = -1; /// timerfd armed to the nearest expiration of timer wheel
+
+	static constexpr int _max_events = 64; /// maximal number of events returned by single epoll_wait() call
+
+	epoll_event _events[_max_events]; /// array filled by epoll_wait() with ready file descriptors
+
+	io_backend _requested_io_backend = io_backend::epoll; /// backend used when polling is started
+
+	static constexpr unsigned _io_uring_entries = 256; /// size of io_uring submission ring
+
+	std::unique_ptr<io_uring_queue> _io_uring; /// io_uring instance (only when io_uring backend is active)
+
+	std::vector<observer_entry*> _scheduled_entries; /// entries which need new submissions
+
+	std::vector<observer_entry*> _submitting_entries; /// entries processed by current submission (reused storage)
+
+	bool _is_wake_up_read_submitted = false; /// read of wake up event is in flight
+
+	eventfd_t _wake_up_value = 0; /// value read from wake up event by io_uring
+
+	unsigned _submitted_operations_count = 0; /// io_uring operations in flight (without wake up read)
+};
+
+}
+
+#endif /* INC_REACTOR_H_ */
@@ -0,0 +1,84 @@
+/*
+ * replay_engine.h
+ *
+ *  Created on: May 1, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_REPLAY_ENGINE_H_
+#define INC_REPLAY_ENGINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include "capture.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Pseudo-terminal which feeds replayed data to serial port
+ *
+ * Serial port is opened on get_device(), replay engine writes to master.
+ */
+class replay_pty
+{
+public:
+	replay_pty();
+	virtual ~replay_pty();
+
+	replay_pty(const replay_pty&) = delete;
+	replay_pty& operator=(const replay_pty&) = delete;
+
+	int get_master() { return _master; }
+	const std::string& get_device() { return _device; }
+
+private:
+	int _master = -1;
+	std::string _device; /// path of slave side
+};
+
+/**
+ * @brief Counters of finished replay
+ */
+struct replay_statistics
+{
+	unsigned long long records = 0; /// replayed records
+	unsigned long long bytes = 0; /// replayed bytes
+	std::chrono::nanoseconds duration{0}; /// time of replay
+};
+
+/**
+ * @brief Feeds received data from capture back to devices
+ *
+ * Data received by captured port is written to target descriptor (e.g.
+ * master of replay_pty), so serial port opened on the other side gets it
+ * again. Sent data and ports without target are skipped. Replay keeps
+ * original timing divided by speed, zero speed replays as fast as target
+ * accepts data.
+ */
+class replay_engine
+{
+public:
+	explicit replay_engine(capture_reader& reader);
+
+	void set_speed(double speed) { _speed = speed; }
+	void add_target(std::uint32_t port_id, int file_descriptor) { _targets[port_id] = file_descriptor; }
+
+	replay_statistics run();
+	void stop() { _is_stopped = true; }
+
+private:
+	void write_all(int file_descriptor, buffer_view data);
+
+	capture_reader& _reader;
+	double _speed = 1.0; /// replay speed relative to original (zero means as fast as possible)
+	std::map<std::uint32_t, int> _targets; /// descriptor for each captured port
+	std::atomic<bool> _is_stopped{false};
+};
+
+}
+
+#endif /* INC_REPLAY_ENGINE_H_ */
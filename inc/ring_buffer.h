@@ -0,0 +1,59 @@
+/*
+ * ring_buffer.h
+ *
+ *  Created on: Mar 2, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_RING_BUFFER_H_
+#define INC_RING_BUFFER_H_
+
+#include <cstddef>
+#include <memory>
+#include <sys/uio.h>
+#include "buffer_view.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Byte ring buffer with power of two capacity
+ *
+ * Free space is exposed as (at most two) iovec regions, so buffer can be
+ * filled by single readv() call. Stored data is exposed as contiguous views,
+ * so it can be processed without copying. Buffer isn't thread safe.
+ */
+class ring_buffer
+{
+public:
+	explicit ring_buffer(std::size_t capacity);
+
+	void resize(std::size_t capacity);
+
+	int writable_regions(iovec regions[2]);
+	void commit(std::size_t count);
+
+	buffer_view readable_front() const;
+	std::size_t read(char* destination, std::size_t count);
+	void consume(std::size_t count);
+	void clear() { _read_index = _write_index = 0; }
+
+	std::size_t capacity() const { return _mask + 1; }
+	std::size_t size() const { return _write_index - _read_index; }
+	std::size_t free_space() const { return capacity() - size(); }
+	bool empty() const { return _read_index == _write_index; }
+	bool full() const { return size() == capacity(); }
+
+private:
+
+	static std::size_t round_up_to_power_of_two(std::size_t value);
+
+	std::unique_ptr<char[]> _data; /// buffer memory
+	std::size_t _mask = 0; /// capacity - 1, used to wrap indexes
+	std::size_t _read_index = 0; /// not wrapped index of first stored byte
+	std::size_t _write_index = 0; /// not wrapped index one past last stored byte
+};
+
+}
+
+#endif /* INC_RING_BUFFER_H_ */
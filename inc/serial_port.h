@@ -19,65 +19,342 @@
 #include <iostream>
 #include <exception>
 #include <sys/ioctl.h>
+#include <sys/poll.h>
 #include <vector>
 #include "serial_port_exception.h"
 #include "serial_port_util.h"
 #include <errno.h>
 #include <functional>
 #include "ifile_descriptor_owner.h"
+#include "buffer_view.h"
+#include "ring_buffer.h"
+#include "frame_decoder.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "buffer_pool.h"
+#include "spsc_queue.h"
+#include "worker_pool.h"
+#include "trace.h"
+#include "capture.h"
+#include "checksum.h"
+#include <memory>
+#include <sys/uio.h>
+#include <climits>
+#include <algorithm>
+#include <initializer_list>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 namespace mrobot
 {
+	/**
+	 * @brief Transmit queue depth and counters
+	 */
+	struct transmit_queue_stats
+	{
+		std::size_t queued_bytes = 0; /// bytes waiting in transmit queue
+		std::size_t queued_messages = 0; /// messages waiting in transmit queue
+		std::size_t peak_queued_bytes = 0; /// maximal observed number of queued bytes
+		unsigned long long sent_messages = 0; /// messages completely written to device
+		unsigned long long sent_bytes = 0; /// bytes written by asynchronous sends
+		unsigned long long dropped_messages = 0; /// messages dropped because queue was full
+		unsigned long long failed_messages = 0; /// messages not sent because of write error
+	};
+
 	/**
 	 * @brief Class with allows easy serial port communication in linux.
 	 */
-	class serial_port: public ifile_descriptor_owner
+	class serial_port: public ifile_descriptor_owner, private idispatch_consumer
 	{
 	public:
 
 		using data_ready_event_handler = std::function<void(serial_port&, std::vector<char>&)>;
+		using data_view_event_handler = std::function<void(serial_port&, buffer_view)>;
+		using send_completion_handler = std::function<void(serial_port&, send_status)>;
+		using frame_event_handler = std::function<void(serial_port&, buffer_view)>;
+		using buffer_event_handler = std::function<void(serial_port&, pooled_buffer)>;
 
 		serial_port(std::string device, baudrate_option baudrate = baudrate_option::b9600, data_bits_option data_bits = data_bits_option::eight,
 				parity_option parity = parity_option::none, stop_bits_option stop_bits=stop_bits_option::one);
+		serial_port(std::string device, unsigned int baudrate, data_bits_option data_bits = data_bits_option::eight,
+				parity_option parity = parity_option::none, stop_bits_option stop_bits=stop_bits_option::one);
 		virtual ~serial_port();
 
 		void open_device(std::string device);
 		void configure(baudrate_option baudrate, data_bits_option data_bits,
 				parity_option parity, stop_bits_option stop_bits);
+		void configure(unsigned int baudrate, data_bits_option data_bits,
+				parity_option parity, stop_bits_option stop_bits);
+		unsigned int get_baudrate() { return _baudrate; }
 
 		void send_data(const std::vector<char>& buffer);
+		void send(buffer_view data);
+		void send(std::initializer_list<buffer_view> buffers);
+		void send(const iovec* buffers, int count);
+		bool send_async(buffer_view data, const send_completion_handler& completion_handler = nullptr);
+		bool send_async(const std::shared_ptr<const std::vector<char>>& payload, const send_completion_handler& completion_handler = nullptr);
+		void send_urgent(buffer_view data);
+		void flush();
 		int is_data_ready();
 		void receive_data(std::vector<char>& buffer);
-		void set_min_data_to_read(int min_data_to_read_count){_min_data_to_read_count = min_data_to_read_count;};
+		void set_min_data_to_read(int min_data_to_read_count);
+
+		void set_read_mode(read_mode mode);
+		read_mode get_read_mode() { return _read_mode; }
+		void set_inter_byte_timeout(std::chrono::microseconds timeout);
+		std::chrono::microseconds get_inter_byte_timeout();
+
+		bool set_low_latency(bool is_enabled);
+		bool is_driver_low_latency() { return _is_driver_low_latency; }
+		const latency_histogram& get_round_trip_latency() { return _round_trip_latency; }
+
+		void set_transmit_queue_capacity(std::size_t capacity);
+		void set_backpressure(backpressure_option backpressure);
+		transmit_queue_stats get_transmit_queue_stats();
+
+		port_metrics_snapshot get_metrics();
+
+		void set_receive_buffer_size(std::size_t size);
+		std::size_t get_receive_buffer_size() { return _receive_buffer.capacity(); }
 
 		void subscribe_data_ready_event(data_ready_event_handler& event_handler);
 		void unsubscribe_data_ready_event();
 
+		void subscribe_data_view_event(const data_view_event_handler& event_handler);
+		void unsubscribe_data_view_event();
+
+		void subscribe_buffer_event(const buffer_event_handler& event_handler);
+		void unsubscribe_buffer_event();
+		bool is_buffer_event_subscribed() { return _is_buffer_event_subscribed; }
+		void set_buffer_pool(std::shared_ptr<buffer_pool> pool);
+		const std::shared_ptr<buffer_pool>& get_buffer_pool() { return _buffer_pool; }
+
+		void set_worker_pool(std::shared_ptr<worker_pool> pool, std::size_t queue_capacity = 256);
+		bool is_dispatched_to_workers() { return _worker_pool != nullptr; }
+		reactor* get_reactor() { return _reactor; }
+
+		void set_capture(std::shared_ptr<capture_writer> writer, std::uint32_t port_id);
+
+		void set_send_checksum(checksum_type type);
+		void disable_send_checksum() { _is_send_checksum_enabled = false; }
+
+		void set_write_coalescing(std::size_t threshold, std::chrono::microseconds deadline);
+		void disable_write_coalescing();
+		bool is_write_coalescing_enabled() { return _is_write_coalescing_enabled; }
+
+		void set_frame_decoder(std::unique_ptr<frame_decoder> decoder);
+		frame_decoder* get_frame_decoder() { return _frame_decoder.get(); }
+		void subscribe_frame_event(const frame_event_handler& event_handler);
+		void unsubscribe_frame_event();
+
 		bool is_ready(){ return _is_opend&&_is_configured;}
 		bool is_open(){ return _is_opend; }
 		bool is_configured() { return _is_configured; }
 
 		virtual void process_data() override;
+		virtual void process_write() override;
+		virtual void attach(reactor* owner_reactor) override;
 		virtual int get_file_descriptor() override;
 
+		virtual bool is_completion_io_supported() override { return true; }
+		virtual int prepare_read(iovec regions[2]) override;
+		virtual void complete_read(int result) override;
+		virtual int prepare_write(iovec* buffers, int max_count) override;
+		virtual void complete_write(int result) override;
+
+	protected:
+
+		template<typename handler_type>
+		void process_data_with(handler_type& handler);
+
 	private:
 
-		void read_data();
-		const int _data_buffer_size = 60;
-		int _min_data_to_read_count = -1; ///
-		std::vector<char> _received_data_buffer{static_cast<char>(_data_buffer_size), 0}; /// data buffer which received data
+		/**
+		 * @brief Message waiting in transmit queue
+		 */
+		struct transmit_entry
+		{
+			std::shared_ptr<const void> storage; /// keeps data alive (copy of message or shared payload)
+			buffer_view data; /// unsent part of message
+			std::size_t offset; /// number of already written bytes of data
+			std::uint64_t trace_id; /// identifier of traced message (zero if message isn't traced)
+			send_completion_handler completion_handler; /// called when message is sent or fails
+		};
+
+		using transmit_completion = std::pair<send_completion_handler, send_status>;
+
+		bool send_async(buffer_view data, std::shared_ptr<const void> payload, const send_completion_handler& completion_handler);
+		bool read_data();
+		void deliver_data();
+		void deliver_buffers(buffer_view data);
+		void dispatch_data(buffer_view data);
+		void call_handlers(buffer_view data, const pooled_buffer* buffer);
+		virtual bool process_dispatched() override;
+		void flush_received_data();
+		bool is_delivery_due();
+		void apply_read_mode();
+		std::size_t get_batch_size();
+		void schedule_gap_timer(std::chrono::microseconds delay);
+		void restart_gap_timer();
+		void set_idle_wakeup(bool is_enabled);
+		void process_gap_timeout();
+		void mark_send_time();
+		void record_accepted_send(buffer_view data, std::uint64_t trace_id, std::uint64_t enqueue_time);
+		void trace_read(std::size_t size);
+		void capture_received(const iovec regions[2], int regions_count, std::size_t size);
+		void record_trace(trace_point point, std::uint64_t id, std::size_t size);
+		void wait_for(short events);
+		void write_all(iovec* buffers, int count, std::size_t messages_count = 1);
+		void write_message(iovec* buffers, int count, bool is_urgent);
+		void write_coalesced(iovec* buffers, int count, bool is_urgent);
+		void write_coalescing_buffer();
+		void write_coalesced_batch(iovec* buffers, int count, std::size_t messages_count);
+		void queue_coalesced_batch(std::shared_ptr<std::vector<char>> batch, std::size_t messages_count);
+		std::size_t end_coalescing_batch();
+		void schedule_coalescing_timer();
+		void process_coalescing_deadline(std::uint64_t batch);
+		int append_checksum(iovec* buffers, int count, char* checksum);
+		std::size_t write_some(buffer_view data);
+		bool has_transmit_space(std::size_t size);
+		int collect_transmit_buffers(iovec* buffers, int max_count);
+		void advance_transmit_queue(ssize_t result);
+		void complete_transmissions(std::vector<transmit_completion>& completions);
+		static constexpr std::size_t _max_write_batch = 64;
+		static constexpr std::size_t _max_local_buffers = 64; /// buffers of message described on stack by send() (longer lists are allocated)
+		static constexpr std::size_t _default_receive_buffer_size = 4096;
+		int _min_data_to_read_count = -1; /// batch size in batched read mode (not positive means one byte)
+		read_mode _read_mode = read_mode::low_latency; /// when received data is delivered to handlers
+		std::chrono::microseconds _inter_byte_timeout{0}; /// silence which ends batch or packet (zero means 3.5 characters)
+		std::chrono::microseconds _character_time{0}; /// transmission time of single character at configured baud rate
+		std::atomic<bool> _is_gap_timer_scheduled{false}; /// reactor timer which checks inter-byte gap is pending
+		std::chrono::steady_clock::time_point _last_receive_time; /// time of last read which returned data
+		bool _is_data_received = false; /// read returned data since start of process_data() (gap modes)
+		bool _is_idle_wakeup_set = false; /// device of idle port in batched mode is readable with first byte (VMIN is 1)
+		bool _is_driver_low_latency = false; /// ASYNC_LOW_LATENCY flag is set in tty driver
+		std::atomic<bool> _is_round_trip_measured{false}; /// time from send to next received data is recorded
+		std::atomic<std::int64_t> _request_send_time{0}; /// steady clock time of first send not followed by received data (zero if none)
+		latency_histogram _round_trip_latency; /// times from send to next received data
+		ring_buffer _receive_buffer{_default_receive_buffer_size}; /// buffer filled with data read from device
+		std::vector<char> _received_data_buffer; /// copy of received data passed to data ready event handler
 
 
 		bool _is_data_ready_event_subscribed = false; /// indicates that data ready event is subscribed
 		data_ready_event_handler _data_ready_event_handler; /// function called when data ready event occurs
 
+		bool _is_data_view_event_subscribed = false; /// indicates that data view event is subscribed
+		data_view_event_handler _data_view_event_handler; /// function called with views of received data
+
+		bool _is_buffer_event_subscribed = false; /// indicates that buffer event is subscribed
+		buffer_event_handler _buffer_event_handler; /// function called with pooled copies of received data
+		std::shared_ptr<buffer_pool> _buffer_pool; /// pool of buffers passed to buffer event handler
+		bool _is_buffer_pool_set = false; /// pool was set explicitly (isn't replaced by pool of reactor)
+
+		static constexpr std::size_t _max_dispatch_batch = 64; /// buffers handled by worker before it serves other ports
+		std::shared_ptr<worker_pool> _worker_pool; /// runs handlers when data is dispatched to workers
+		std::size_t _worker = 0; /// index of worker which handles data of port
+		std::unique_ptr<spsc_queue<pooled_buffer>> _dispatch_queue; /// received data passed from polling thread to worker
+		pooled_buffer _dispatched_buffer; /// buffer popped by worker (reused storage)
+
+		std::mutex _transmit_mutex; /// guards transmit queue, its settings and statistics
+		std::condition_variable _transmit_space_condition; /// notified when transmit queue is drained
+		std::deque<transmit_entry> _transmit_queue; /// messages waiting for device to become writable
+		std::size_t _transmit_queue_capacity = 64 * 1024; /// maximal number of queued bytes
+		backpressure_option _backpressure = backpressure_option::block; /// behavior when transmit queue is full
+		transmit_queue_stats _transmit_stats; /// transmit queue depth and counters
+		bool _is_write_interest_set = false; /// poll controler observes writability of device
+		std::vector<transmit_completion> _write_completions; /// completions collected by process_write()
+		std::atomic<reactor*> _reactor{nullptr}; /// reactor (poll controler shard) which observes device
+
+		port_metrics _metrics; /// counters updated without locks
+
+		std::atomic<trace_ring*> _trace_ring{nullptr}; /// trace ring of reactor (nullptr when port isn't observed)
+		unsigned _receive_trace_countdown = 0; /// sampling state of received chunks
+		std::uint64_t _traced_chunks_count = 0; /// identifier of last traced chunk
+		std::uint64_t _traced_chunk = 0; /// traced chunk waiting for handlers (zero if none)
+		unsigned _transmit_trace_countdown = 0; /// sampling state of sent messages (guarded by transmit mutex)
+		std::uint64_t _traced_messages_count = 0; /// identifier of last traced message (guarded by transmit mutex)
+
+		std::shared_ptr<capture_writer> _capture; /// records received and sent data (nullptr when capture is disabled)
+		std::uint32_t _capture_port_id = 0; /// identifier of port in capture file
+
+		bool _is_send_checksum_enabled = false; /// checksum is appended to every sent message
+		checksum_type _send_checksum_type = checksum_type::crc16_modbus; /// checksum appended to sent messages
+
+		std::mutex _coalescing_mutex; /// guards coalescing buffer and its settings
+		std::atomic<bool> _is_write_coalescing_enabled{false}; /// small blocking sends are gathered in coalescing buffer
+		std::size_t _coalescing_threshold = 0; /// buffered bytes which cause immediate write
+		std::chrono::microseconds _coalescing_deadline{0}; /// maximal time data waits in coalescing buffer
+		std::vector<char> _coalescing_buffer; /// messages (with checksums) waiting for single write
+		std::size_t _coalesced_messages_count = 0; /// messages stored in coalescing buffer
+		std::chrono::steady_clock::time_point _coalescing_start; /// time when first message was put in empty coalescing buffer
+		std::uint64_t _coalescing_batch = 0; /// number of written batches (identifies batch of deadline timer)
+		std::atomic<std::uint64_t> _coalescing_timer{0}; /// reactor timer which writes batch at deadline (zero if not scheduled)
+
+		std::unique_ptr<frame_decoder> _frame_decoder; /// splits received data into frames
+		bool _is_frame_event_subscribed = false; /// indicates that frame event is subscribed
+		frame_event_handler _frame_event_handler; /// function called with complete frames
+		frame_decoder::frame_handler _decoded_frame_handler; /// passes decoded frames to frame event handler
+
 		bool _is_opend = false;
 		bool _is_configured = false;
+		unsigned int _baudrate = 0; /// baud rate applied by driver (read back after configuration)
 
 		const std::string _device; /// path to device
 		//std::mutex _fd_mutex; /// blocks when thread has access to file
 		int _file_descriptor; /// device file descriptor
 	};
+
+	/**
+	 * @brief Reads available data and passes it directly to given handler
+	 *
+	 * Handler is called as in low latency or batched mode, but without
+	 * std::function, so the call can be inlined. Handler replaces data view
+	 * event, so ports with frame decoder, data ready, buffer or frame event
+	 * are served by process_data() (as are packet gap mode, worker pool,
+	 * round trip measurement and traced chunks).
+	 * @param handler called with serial port and view of received data
+	 */
+	template<typename handler_type>
+	void serial_port::process_data_with(handler_type& handler)
+	{
+		if(_read_mode == read_mode::packet_gap || _worker_pool || _is_round_trip_measured.load(std::memory_order_relaxed)
+				|| _frame_decoder || _is_data_ready_event_subscribed || _is_buffer_event_subscribed || _is_frame_event_subscribed)
+		{
+			serial_port::process_data();
+			return;
+		}
+
+		_is_data_received = false;
+		bool has_more_data = false;
+		do
+		{
+			has_more_data = read_data();
+			if(!has_more_data && !is_delivery_due())
+				continue;
+
+			if(_traced_chunk != 0)
+			{
+				deliver_data();
+				continue;
+			}
+
+			auto start_time = std::chrono::steady_clock::now();
+			while(!_receive_buffer.empty())
+			{
+				buffer_view data = _receive_buffer.readable_front();
+				handler(*this, data);
+				_receive_buffer.consume(data.size);
+			}
+			_metrics.handler_time.record((std::chrono::steady_clock::now() - start_time).count());
+		}
+		while(has_more_data);
+
+		if(_is_data_received && _read_mode == read_mode::batched)
+			restart_gap_timer();
+	}
 } /* namespace mrobot */
 
 #endif /* SERIALPORT_H_ */
@@ -22,18 +22,19 @@ class serial_port_exception: public std::exception
 	//TODO: Add more parameters to file exception (fd, flags,...)
 public:
 	serial_port_exception(std::string message, std::string error_description = "None") :
-			_message(message), _error_description(error_description)
+			_message(message), _error_description(error_description),
+			_what("Message: " + _message + "\nError: " + _error_description + "\n")
 	{
 	}
 
 	const char* what() const throw () override
 	{
-		std::string message= "Message: "+_message+"\nError: "+_error_description+"\n";
-		return message.c_str();
+		return _what.c_str();
 	}
 private:
 	const std::string _message;
 	const std::string _error_description;
+	const std::string _what; /// message returned by what() (has to outlive the call)
 };
 }
 #endif /* INC_SERIAL_PORT_EXCEPTION_H_ */
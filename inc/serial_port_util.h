@@ -46,7 +46,50 @@ enum class baudrate_option
 	b19200 = B19200,
 	b38400 = B38400,
 	b57600 = B57600,
-	b115200 = B1152000,
+	b115200 = B115200,
+	b230400 = B230400,
+	b460800 = B460800,
+	b500000 = B500000,
+	b576000 = B576000,
+	b921600 = B921600,
+	b1000000 = B1000000,
+	b1152000 = B1152000,
+	b1500000 = B1500000,
+	b2000000 = B2000000,
+	b2500000 = B2500000,
+	b3000000 = B3000000,
+	b3500000 = B3500000,
+	b4000000 = B4000000,
+};
+
+/**
+ * @brief Describes when received data is passed to event handlers
+ */
+enum class read_mode
+{
+	low_latency, // every read is delivered immediately (VMIN = 1)
+	batched, // data is delivered when batch size is reached or inter-byte timeout expires
+	packet_gap, // data is delivered as one packet after silence on the line (Modbus RTU framing)
+};
+
+/**
+ * @brief Behavior of asynchronous send when transmit queue is full
+ */
+enum class backpressure_option
+{
+	block, // wait until queue has enough free space
+	drop, // drop message and report it through completion handler
+	error, // throw serial_port_exception
+};
+
+/**
+ * @brief Result of asynchronous send passed to completion handler
+ */
+enum class send_status
+{
+	sent, // all bytes were written to device
+	dropped, // message was dropped because transmit queue was full
+	failed, // error occurred when writing to device
 };
 
 }
@@ -0,0 +1,103 @@
+/*
+ * spsc_queue.h
+ *
+ *  Created on: Apr 18, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_SPSC_QUEUE_H_
+#define INC_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace mrobot
+{
+
+/**
+ * @brief Bounded lock-free queue for one producer and one consumer thread
+ *
+ * Capacity is rounded up to power of two. Producer and consumer indexes
+ * are kept in separate cache lines, each side caches index of the other
+ * side, so shared cache line is read only when queue looks full (or empty).
+ */
+template <typename T>
+class spsc_queue
+{
+public:
+	explicit spsc_queue(std::size_t capacity) :
+			_capacity(round_capacity(capacity)), _mask(_capacity - 1), _slots(new T[_capacity])
+	{
+	}
+
+	spsc_queue(const spsc_queue&) = delete;
+	spsc_queue& operator=(const spsc_queue&) = delete;
+
+	/**
+	 * @brief Adds value to queue (called only by producer)
+	 * @return false when queue is full (value isn't moved)
+	 */
+	bool try_push(T&& value)
+	{
+		std::size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _cached_head == _capacity)
+		{
+			_cached_head = _head.load(std::memory_order_acquire);
+			if (tail - _cached_head == _capacity)
+				return false;
+		}
+
+		_slots[tail & _mask] = std::move(value);
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief Takes first value from queue (called only by consumer)
+	 * @return false when queue is empty
+	 */
+	bool try_pop(T& value)
+	{
+		std::size_t head = _head.load(std::memory_order_relaxed);
+		if (head == _cached_tail)
+		{
+			_cached_tail = _tail.load(std::memory_order_acquire);
+			if (head == _cached_tail)
+				return false;
+		}
+
+		value = std::move(_slots[head & _mask]);
+		_slots[head & _mask] = T{};
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// number of queued values (approximate when both sides are running)
+	std::size_t size() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire); }
+	bool empty() const { return size() == 0; }
+	std::size_t capacity() const { return _capacity; }
+
+private:
+	static std::size_t round_capacity(std::size_t capacity)
+	{
+		std::size_t rounded = 1;
+		while (rounded < capacity)
+			rounded <<= 1;
+		return rounded;
+	}
+
+	const std::size_t _capacity;
+	const std::size_t _mask;
+	std::unique_ptr<T[]> _slots;
+
+	alignas(64) std::atomic<std::size_t> _head{0}; /// index of next value to pop (written by consumer)
+	std::size_t _cached_tail = 0; /// tail seen by consumer
+
+	alignas(64) std::atomic<std::size_t> _tail{0}; /// index of next free slot (written by producer)
+	std::size_t _cached_head = 0; /// head seen by producer
+};
+
+}
+
+#endif /* INC_SPSC_QUEUE_H_ */
@@ -0,0 +1,139 @@
+/*
+ * timer_wheel.h
+ *
+ *  Created on: May 8, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_TIMER_WHEEL_H_
+#define INC_TIMER_WHEEL_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace mrobot
+{
+using timer_clock = std::chrono::steady_clock;
+using timer_handler = std::function<void()>;
+
+/**
+ * @brief Hierarchical timer wheel (four levels of 256 slots)
+ *
+ * Deadlines are rounded up to ticks. Level 0 slots hold timers expiring
+ * in the next 256 ticks, slots of higher levels cover 256 times longer
+ * periods and their timers are moved (cascaded) to lower levels when
+ * wheel reaches them. Timers are nodes of intrusive lists stored in one
+ * vector, so scheduling and cancelling are O(1) and don't allocate
+ * memory once vector has grown. Expired timers are moved to due list
+ * and taken from it one by one. Timers beyond range of levels (2^32
+ * ticks) wait in overflow list. Wheel isn't thread safe.
+ *
+ * Timers can be taken from one wheel and adopted by other (when their
+ * owner moves between reactors). Identifier of adopted timer doesn't
+ * change, so it can be cancelled in the new wheel. Identifiers contain
+ * tag of the wheel which created them, so they never match timers
+ * created by other wheels.
+ */
+class timer_wheel
+{
+public:
+	/**
+	 * @brief Timer taken from the wheel (see take_owner())
+	 */
+	struct timer_entry
+	{
+		std::uint64_t id; /// identifier given by wheel which created the timer
+		timer_clock::time_point deadline; /// time after which timer expires
+		const void* owner;
+		timer_handler handler;
+	};
+
+	explicit timer_wheel(timer_clock::duration tick = std::chrono::milliseconds{1},
+			timer_clock::time_point origin = timer_clock::now());
+
+	std::uint64_t schedule(timer_clock::time_point deadline, const void* owner, timer_handler handler);
+	bool cancel(std::uint64_t timer_id);
+	void cancel_owner(const void* owner);
+	std::vector<timer_entry> take_owner(const void* owner);
+	void adopt(timer_entry timer);
+
+	std::size_t advance(timer_clock::time_point now);
+	bool pop_expired(timer_handler& handler);
+	std::size_t get_expired_count() const { return _due_count; }
+
+	bool has_next_expiration() const { return _count != 0; }
+	timer_clock::time_point get_next_expiration() const;
+	std::size_t size() const { return _count; }
+	timer_clock::duration get_tick() const { return _tick; }
+
+private:
+	static constexpr unsigned _levels = 4;
+	static constexpr unsigned _slot_bits = 8;
+	static constexpr unsigned _slots = 1 << _slot_bits;
+	static constexpr std::uint32_t _none = UINT32_MAX;
+	static constexpr unsigned _index_bits = 24; /// bits of identifier holding index of node
+	static constexpr unsigned _generation_bits = 24; /// bits of identifier holding generation of node
+	static constexpr std::uint32_t _max_nodes = 1 << _index_bits;
+	static constexpr unsigned _due_list = _levels * _slots; /// index of list with expired timers
+	static constexpr unsigned _overflow_list = _due_list + 1; /// index of list with timers beyond range of levels
+
+	/**
+	 * @brief Scheduled timer (or free node)
+	 */
+	struct node
+	{
+		std::uint64_t expiration_tick = 0;
+		const void* owner = nullptr; /// timers can be cancelled by owner
+		timer_handler handler;
+		std::uint64_t id = 0; /// identifier returned by schedule() (or kept by adopted timer)
+		std::uint32_t previous = _none;
+		std::uint32_t next = _none;
+		std::uint32_t generation = 1; /// increased when node is freed, so old identifiers don't match
+		std::uint32_t list = _none; /// list holding node (none when node is free)
+	};
+
+	/**
+	 * @brief Head of doubly linked list of nodes
+	 */
+	struct list_head
+	{
+		std::uint32_t first = _none;
+		std::uint32_t last = _none;
+	};
+
+	std::uint64_t make_id(std::uint32_t index) const;
+	std::uint32_t allocate(timer_clock::time_point deadline, const void* owner, timer_handler handler);
+	std::uint64_t to_tick(timer_clock::time_point time) const;
+	void insert(std::uint32_t index);
+	void link(std::uint32_t list, std::uint32_t index);
+	void unlink(std::uint32_t index);
+	void release(std::uint32_t index);
+	void cascade(std::uint32_t list);
+	void expire_slot(unsigned slot);
+	unsigned find_slot(unsigned level, unsigned first_slot) const;
+	std::uint64_t next_event_tick() const;
+
+	static std::atomic<std::uint16_t> _tags_count; /// number of created wheels (source of tags)
+
+	std::uint16_t _tag; /// tag stored in identifiers of timers created by the wheel
+	timer_clock::duration _tick; /// resolution of wheel
+	timer_clock::time_point _origin; /// time of tick zero
+	std::uint64_t _current_tick = 0; /// last processed tick
+
+	std::vector<node> _nodes;
+	std::unordered_map<std::uint64_t, std::uint32_t> _adopted_timers; /// nodes of adopted timers by their identifiers
+	std::uint32_t _free_nodes = _none; /// list of unused nodes (linked by next)
+	std::array<list_head, _levels * _slots + 2> _lists; /// slots of all levels, due and overflow lists
+	std::array<std::uint64_t, _levels * _slots / 64> _occupied_slots{}; /// bitmap of non-empty slots
+	std::size_t _count = 0; /// scheduled and due timers
+	std::size_t _due_count = 0; /// timers in due list
+};
+
+}
+
+#endif /* INC_TIMER_WHEEL_H_ */
@@ -0,0 +1,106 @@
+/*
+ * trace.h
+ *
+ *  Created on: Apr 27, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_TRACE_H_
+#define INC_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <time.h>
+
+namespace mrobot
+{
+
+/**
+ * @brief Stage of data pipeline at which trace record is taken
+ */
+enum class trace_point : std::uint8_t
+{
+	wakeup, // polling thread returned from epoll_wait() (or io_uring_enter()) before chunk was read
+	read, // chunk was read from device
+	handler_enter, // handlers were called with chunk
+	handler_exit, // handlers returned
+	transmit_enqueue, // message was passed to asynchronous send
+	write_complete, // last byte of message was written to device
+};
+
+const char* to_string(trace_point point);
+
+/**
+ * @brief Single trace record
+ */
+struct trace_record
+{
+	std::uint64_t time; /// CLOCK_MONOTONIC time in nanoseconds
+	std::uint64_t id; /// number of traced chunk (or message) of source
+	std::uint32_t source; /// identifier of port (its file descriptor)
+	std::uint32_t size; /// bytes of chunk or message
+	trace_point point;
+};
+
+/**
+ * @brief Gets CLOCK_MONOTONIC time in nanoseconds
+ */
+inline std::uint64_t trace_time()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<std::uint64_t>(now.tv_sec) * 1000000000u + now.tv_nsec;
+}
+
+/**
+ * @brief Lock-free ring of the latest trace records
+ *
+ * Records are written by polling threads without locks, the oldest ones
+ * are overwritten. Only every n-th chunk (and message) of each source is
+ * traced, tracing is disabled by default, so the only cost on data path
+ * is a check of sampling period.
+ */
+class trace_ring
+{
+public:
+	explicit trace_ring(std::size_t capacity = 65536);
+
+	void set_sampling(unsigned period) { _sampling_period.store(period, std::memory_order_relaxed); }
+	unsigned get_sampling() const { return _sampling_period.load(std::memory_order_relaxed); }
+	bool is_enabled() const { return get_sampling() != 0; }
+	bool sample(unsigned& countdown) const;
+
+	void record(trace_point point, std::uint32_t source, std::uint64_t id, std::size_t size, std::uint64_t time);
+
+	std::vector<trace_record> get_records() const;
+	void dump(std::ostream& stream) const;
+	void dump(const std::string& path) const;
+	void clear();
+
+private:
+
+	/**
+	 * @brief Record guarded by sequence stamp (fields are atomics, so readers can't see torn values)
+	 */
+	struct slot
+	{
+		std::atomic<std::uint64_t> stamp{0}; /// index of stored record plus one (zero while written)
+		std::atomic<std::uint64_t> time{0};
+		std::atomic<std::uint64_t> id{0};
+		std::atomic<std::uint64_t> details{0}; /// source, size and trace point packed into one word
+	};
+
+	std::size_t _mask;
+	std::unique_ptr<slot[]> _slots;
+	std::atomic<unsigned> _sampling_period{0}; /// n-th chunk of source is traced (zero disables tracing)
+	alignas(64) std::atomic<std::uint64_t> _next_index{0}; /// index of next written record
+};
+
+}
+
+#endif /* INC_TRACE_H_ */
@@ -0,0 +1,131 @@
+/*
+ * transaction_engine.h
+ *
+ *  Created on: May 5, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_TRANSACTION_ENGINE_H_
+#define INC_TRANSACTION_ENGINE_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "serial_port.h"
+#include "reactor.h"
+
+namespace mrobot
+{
+
+/**
+ * @brief Final state of transaction
+ */
+enum class transaction_status
+{
+	completed, // response was received
+	timed_out, // no response after last retry
+	failed, // request couldn't be sent
+	cancelled, // engine was destroyed before transaction finished
+};
+
+/**
+ * @brief Result passed to completion handler (or future)
+ */
+struct transaction_result
+{
+	transaction_status status = transaction_status::cancelled;
+	std::vector<char> response; /// response frame (empty if transaction didn't complete)
+	unsigned attempts = 0; /// number of times request was sent
+};
+
+/**
+ * @brief Timeout and retry policy of single transaction
+ */
+struct transaction_options
+{
+	timer_clock::duration timeout = std::chrono::seconds{1}; /// time for response after each send
+	unsigned retries = 0; /// number of times request is sent again after timeout
+};
+
+/**
+ * @brief Keeps several request/response transactions in flight on serial port
+ *
+ * Up to window requests are sent without waiting for responses, further
+ * requests wait in queue. Responses are frames found by frame decoder of
+ * the port (engine subscribes frame event), correlator maps response to
+ * key given to request. Timeouts are reactor timers, responses and
+ * timeouts are handled by polling thread, so engine doesn't need its own
+ * threads. Completion handlers are called by polling thread (or by
+ * submitting thread when request can't be sent). Port has to be added
+ * to poll controler.
+ */
+class transaction_engine
+{
+public:
+	using correlator = std::function<std::optional<std::uint64_t>(buffer_view response)>;
+	using completion_handler = std::function<void(transaction_result&)>;
+	using unsolicited_frame_handler = std::function<void(buffer_view frame)>;
+
+	transaction_engine(serial_port& port, const correlator& response_correlator, std::size_t window = 4);
+	virtual ~transaction_engine();
+
+	transaction_engine(const transaction_engine&) = delete;
+	transaction_engine& operator=(const transaction_engine&) = delete;
+
+	void submit(std::uint64_t key, std::vector<char> request, const transaction_options& options,
+			const completion_handler& handler);
+	std::future<transaction_result> submit(std::uint64_t key, std::vector<char> request,
+			const transaction_options& options = transaction_options{});
+
+	void set_window(std::size_t window);
+	void set_unsolicited_frame_handler(const unsolicited_frame_handler& handler);
+
+	std::size_t get_in_flight_count();
+	std::size_t get_queued_count();
+	unsigned long long get_unmatched_responses_count() { return _unmatched_responses_count; }
+
+private:
+
+	/**
+	 * @brief Submitted request and its state
+	 */
+	struct transaction
+	{
+		std::uint64_t key;
+		std::vector<char> request;
+		transaction_options options;
+		completion_handler handler;
+		transaction_result result;
+		std::uint64_t timer_id = 0; /// timeout of current attempt (zero if none)
+		reactor* timer_reactor = nullptr; /// reactor which scheduled timeout (timer can be moved with port to other reactor)
+		bool is_finished = false;
+	};
+
+	using transaction_pointer = std::shared_ptr<transaction>;
+
+	void send(const transaction_pointer& current);
+	void receive(buffer_view frame);
+	void time_out(const transaction_pointer& current, unsigned attempt);
+	void finish(const transaction_pointer& current, transaction_status status);
+	void start_queued();
+
+	serial_port& _port;
+	correlator _correlator; /// gets key of transaction from response
+	unsolicited_frame_handler _unsolicited_frame_handler; /// called with frames which don't match any transaction
+
+	std::mutex _mutex; /// guards transactions and window
+	std::size_t _window; /// maximal number of transactions in flight
+	std::map<std::uint64_t, transaction_pointer> _in_flight; /// sent transactions by key
+	std::deque<transaction_pointer> _queued; /// transactions waiting for free slot in window
+	std::atomic<unsigned long long> _unmatched_responses_count{0};
+};
+
+}
+
+#endif /* INC_TRANSACTION_ENGINE_H_ */
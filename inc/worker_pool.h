@@ -0,0 +1,76 @@
+/*
+ * worker_pool.h
+ *
+ *  Created on: Apr 18, 2016
+ *      Author: rafal
+ */
+
+#ifndef INC_WORKER_POOL_H_
+#define INC_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mrobot
+{
+
+/**
+ * @brief Interface of objects which queue work for worker pool
+ */
+class idispatch_consumer
+{
+public:
+	virtual bool process_dispatched() = 0; /// handles queued work (called only by assigned worker), returns false when nothing was queued
+	virtual ~idispatch_consumer() {};
+};
+
+/**
+ * @brief Threads which run handlers of received data outside of polling threads
+ *
+ * Each consumer is assigned to single worker (the least loaded one), so
+ * its work is handled in order. Producers notify worker after queueing
+ * work, mutex is locked only when worker goes to sleep or has to be woken.
+ */
+class worker_pool
+{
+public:
+	explicit worker_pool(std::size_t workers_count = 1);
+	virtual ~worker_pool();
+
+	std::size_t attach(idispatch_consumer* consumer);
+	void detach(idispatch_consumer* consumer);
+	void notify(std::size_t worker);
+
+	std::size_t get_workers_count() { return _workers.size(); }
+	bool is_worker_thread();
+
+private:
+
+	/**
+	 * @brief Thread with consumers assigned to it
+	 */
+	struct worker
+	{
+		std::thread thread;
+		std::mutex consumers_mutex; /// guards consumers (locked by thread when it handles them)
+		std::vector<idispatch_consumer*> consumers;
+		std::atomic<std::size_t> consumers_count{0}; /// size of consumers (read without locking)
+		std::mutex wake_up_mutex; /// guards sleeping of thread
+		std::condition_variable wake_up_condition;
+		std::atomic<bool> is_notified{false}; /// work was queued since thread checked consumers
+	};
+
+	void work(worker& current);
+
+	std::vector<std::unique_ptr<worker>> _workers;
+	std::atomic<bool> _is_running{true};
+};
+
+}
+
+#endif /* INC_WORKER_POOL_H_ */
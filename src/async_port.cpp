@@ -0,0 +1,255 @@
+/*
+ * async_port.cpp
+ *
+ *  Created on: Apr 21, 2016
+ *      Author: rafal
+ */
+
+#include "async_port.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include "delimiter_scan.h"
+#include <algorithm>
+#include <cstring>
+
+namespace mrobot
+{
+
+/**
+ * @brief Starts task in polling thread of reactor
+ *
+ * Task frame is destroyed when task finishes, exception thrown by task
+ * is logged. Task which isn't started before reactor is destroyed is
+ * never run (use spawn(async_port&, ...) for tasks which use port).
+ * @param owner_reactor reactor which resumes task
+ * @param coroutine task to run
+ */
+void spawn(reactor& owner_reactor, task<void> coroutine)
+{
+	auto handle = std::exchange(coroutine._handle, nullptr);
+	handle.promise().is_detached = true;
+	owner_reactor.schedule_timer(nullptr, timer_clock::duration::zero(), [handle]() { handle.resume(); });
+}
+
+/**
+ * @brief Starts task in polling thread of port
+ *
+ * Start of task is cancelled when port is removed from poll controler or
+ * wrapper is destroyed before task runs.
+ * @param port wrapper used by task
+ * @param coroutine task to run
+ * @throws serial_port_exception when port isn't added to poll controler
+ */
+void spawn(async_port& port, task<void> coroutine)
+{
+	coroutine._handle.promise().is_detached = true;
+	port.schedule_resume(coroutine._handle, timer_clock::duration::zero());
+	coroutine._handle = nullptr;
+}
+
+void sleep_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	_reactor.schedule_timer(nullptr, _delay, [handle]() { handle.resume(); });
+}
+
+/**
+ * @brief Subscribes data view event of port
+ *
+ * Port can't have other data view event handler.
+ */
+async_port::async_port(serial_port& port) :
+		_port(port)
+{
+	_port.subscribe_data_view_event([this](serial_port&, buffer_view data) { receive(data); });
+}
+
+/**
+ * @brief Cancels timers of wrapper (suspended coroutines aren't resumed)
+ */
+async_port::~async_port()
+{
+	_port.unsubscribe_data_view_event();
+
+	// timers owned by port are cancelled when port is removed from poll controler
+	reactor* owner_reactor = _port.get_reactor();
+	if (owner_reactor == nullptr)
+		return;
+
+	if (_pending_read != nullptr && _pending_read->timer_id != 0)
+		owner_reactor->cancel_timer(_pending_read->timer_id);
+	std::unique_lock<std::mutex> lock{_resume_mutex};
+	for (auto& entry : _resume_timers)
+		owner_reactor->cancel_timer(entry.second);
+}
+
+/**
+ * @brief Reads available data (waits until at least one byte is received)
+ * @param buffer destination of data
+ * @param timeout maximal waiting time (zero means no timeout)
+ * @return number of read bytes
+ */
+async_port::read_awaiter async_port::read_some(std::span<char> buffer, timer_clock::duration timeout)
+{
+	pending_read read;
+	read.buffer = buffer;
+	return read_awaiter{*this, std::move(read), timeout};
+}
+
+/**
+ * @brief Reads data up to (and including) delimiter
+ * @param delimiter last byte of returned data
+ * @param timeout maximal waiting time (zero means no timeout)
+ * @return received data
+ */
+async_port::read_until_awaiter async_port::read_until(char delimiter, timer_clock::duration timeout)
+{
+	pending_read read;
+	read.delimiter = delimiter;
+	return read_until_awaiter{*this, std::move(read), timeout};
+}
+
+/**
+ * @throws serial_port_exception when port isn't added to poll controler
+ */
+reactor& async_port::get_reactor()
+{
+	reactor* owner_reactor = _port.get_reactor();
+	if (owner_reactor == nullptr)
+		throw serial_port_exception("Port isn't added to poll controler.");
+	return *owner_reactor;
+}
+
+/**
+ * @brief Buffers received data and resumes pending read when it can be completed
+ */
+void async_port::receive(buffer_view data)
+{
+	_received.append(data.begin(), data.end());
+	if (_pending_read == nullptr || !complete_read(*_pending_read))
+		return;
+
+	pending_read* read = std::exchange(_pending_read, nullptr);
+	reactor* owner_reactor = _port.get_reactor();
+	if (read->timer_id != 0 && owner_reactor != nullptr)
+		owner_reactor->cancel_timer(read->timer_id);
+	read->handle.resume();
+}
+
+/**
+ * @brief Moves buffered data to read result
+ * @return false when buffered data isn't enough to complete read
+ */
+bool async_port::complete_read(pending_read& read)
+{
+	if (read.delimiter)
+	{
+		const char* end = _received.data() + _received.size();
+		const char* delimiter = find_byte(_received.data(), end, *read.delimiter);
+		if (delimiter == end)
+			return false;
+
+		std::size_t size = delimiter - _received.data() + 1;
+		read.result.assign(_received, 0, size);
+		read.result_size = size;
+		_received.erase(0, size);
+		return true;
+	}
+
+	if (_received.empty())
+		return false;
+
+	read.result_size = std::min(read.buffer.size(), _received.size());
+	std::memcpy(read.buffer.data(), _received.data(), read.result_size);
+	_received.erase(0, read.result_size);
+	return true;
+}
+
+/**
+ * @brief Resumes pending read which timeout expired
+ */
+void async_port::time_out()
+{
+	if (_pending_read == nullptr)
+		return;
+
+	pending_read* read = std::exchange(_pending_read, nullptr);
+	read->timer_id = 0;
+	read->is_timed_out = true;
+	read->handle.resume();
+}
+
+/**
+ * @brief Schedules resume of coroutine by polling thread of the port
+ * @throws serial_port_exception when port isn't added to poll controler
+ */
+void async_port::schedule_resume(std::coroutine_handle<> handle, timer_clock::duration delay)
+{
+	std::unique_lock<std::mutex> lock{_resume_mutex};
+	std::uint64_t sequence = ++_resume_sequence;
+	std::uint64_t timer_id = get_reactor().schedule_timer(&_port, delay, [this, sequence, handle]()
+	{
+		{
+			std::unique_lock<std::mutex> lock{_resume_mutex};
+			_resume_timers.erase(sequence);
+		}
+		handle.resume();
+	});
+	_resume_timers.emplace(sequence, timer_id);
+}
+
+/**
+ * @throws serial_port_exception when other read is pending
+ */
+void async_port::read_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	if (_port._pending_read != nullptr)
+		throw serial_port_exception("Other read is already awaited on port.");
+
+	_read.handle = handle;
+	if (_timeout > timer_clock::duration::zero())
+		_read.timer_id = _port.get_reactor().schedule_timer(&_port.get_port(), _timeout, [port = &_port]() { port->time_out(); });
+	_port._pending_read = &_read;
+}
+
+/**
+ * @throws serial_port_exception when timeout expired
+ */
+std::size_t async_port::read_awaiter::await_resume()
+{
+	if (_read.is_timed_out)
+		throw serial_port_exception("Read timed out.");
+	return _read.result_size;
+}
+
+/**
+ * @brief Queues data with send_async() and suspends until it is sent
+ * @return false when data was sent immediately (coroutine isn't suspended)
+ */
+bool async_port::write_awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	_handle = handle;
+	_port.get_port().send_async(_data, [this](serial_port&, send_status status)
+	{
+		_status = status;
+		// second of completion and suspension continues coroutine
+		if (_is_completed.exchange(true))
+			_handle.resume();
+	});
+	return !_is_completed.exchange(true);
+}
+
+/**
+ * @throws serial_port_exception when data was dropped or write failed
+ */
+void async_port::write_awaiter::await_resume()
+{
+	if (_status == send_status::dropped)
+		throw serial_port_exception("Data was dropped (transmit queue is full).");
+	if (_status == send_status::failed)
+		throw serial_port_exception("Error when writing to serial port.");
+}
+
+}
+
+#endif /* __cpp_impl_coroutine */
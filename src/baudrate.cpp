@@ -0,0 +1,105 @@
+/*
+ * baudrate.cpp
+ *
+ *  Created on: Apr 12, 2016
+ *      Author: rafal
+ */
+
+#include "baudrate.h"
+#include "serial_port_exception.h"
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <cerrno>
+#include <cstring>
+
+namespace mrobot
+{
+
+/**
+ * @brief Baud rates which have standard speed constants
+ */
+static const struct
+{
+	unsigned int speed;
+	unsigned int baudrate;
+} standard_baudrates[] =
+{
+	{ B0, 0 }, { B50, 50 }, { B75, 75 }, { B110, 110 }, { B134, 134 }, { B150, 150 },
+	{ B200, 200 }, { B300, 300 }, { B600, 600 }, { B1200, 1200 }, { B1800, 1800 },
+	{ B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+	{ B38400, 38400 }, { B57600, 57600 }, { B115200, 115200 }, { B230400, 230400 },
+	{ B460800, 460800 }, { B500000, 500000 }, { B576000, 576000 }, { B921600, 921600 },
+	{ B1000000, 1000000 }, { B1152000, 1152000 }, { B1500000, 1500000 },
+	{ B2000000, 2000000 }, { B2500000, 2500000 }, { B3000000, 3000000 },
+	{ B3500000, 3500000 }, { B4000000, 4000000 },
+};
+
+/**
+ * @brief Finds standard speed constant (Bxxx) of baud rate
+ * @param baudrate baud rate in bits per second
+ * @param speed set to speed constant when it exists
+ * @return false if baud rate has no standard constant
+ */
+bool to_speed_constant(unsigned int baudrate, unsigned int& speed)
+{
+	for (auto& standard : standard_baudrates)
+	{
+		if (standard.baudrate == baudrate)
+		{
+			speed = standard.speed;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Converts speed constant (Bxxx) to bits per second
+ * @return baud rate (zero when constant is unknown)
+ */
+unsigned int from_speed_constant(unsigned int speed)
+{
+	for (auto& standard : standard_baudrates)
+	{
+		if (standard.speed == speed)
+			return standard.baudrate;
+	}
+	return 0;
+}
+
+/**
+ * @brief Sets input and output baud rate which has no speed constant
+ *
+ * Uses BOTHER flag of termios2 interface, so driver computes divisor
+ * for requested rate (it can be rounded, see get_actual_baudrate()).
+ * Other settings of the device are preserved.
+ * @throws serial_port_exception
+ */
+void set_custom_baudrate(int file_descriptor, unsigned int baudrate)
+{
+	termios2 config;
+	if (ioctl(file_descriptor, TCGETS2, &config) < 0)
+		throw serial_port_exception("Cannot get serial interface configuration", strerror(errno));
+
+	config.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	config.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	config.c_ispeed = baudrate;
+	config.c_ospeed = baudrate;
+
+	if (ioctl(file_descriptor, TCSETS2, &config) < 0)
+		throw serial_port_exception("Error when setting baud rate.", strerror(errno));
+}
+
+/**
+ * @brief Reads output baud rate applied by driver
+ * @throws serial_port_exception
+ */
+unsigned int get_actual_baudrate(int file_descriptor)
+{
+	termios2 config;
+	if (ioctl(file_descriptor, TCGETS2, &config) < 0)
+		throw serial_port_exception("Cannot get serial interface configuration", strerror(errno));
+	return config.c_ospeed;
+}
+
+}
@@ -0,0 +1,152 @@
+/*
+ * buffer_pool.cpp
+ *
+ *  Created on: Apr 15, 2016
+ *      Author: rafal
+ */
+
+#include "buffer_pool.h"
+#include <new>
+#include <algorithm>
+#include <cstdint>
+
+namespace mrobot
+{
+
+pooled_buffer::pooled_buffer(const pooled_buffer& other) :
+		_block(other._block)
+{
+	if (_block)
+		_block->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+pooled_buffer::pooled_buffer(pooled_buffer&& other) noexcept :
+		_block(other._block)
+{
+	other._block = nullptr;
+}
+
+pooled_buffer& pooled_buffer::operator=(pooled_buffer other) noexcept
+{
+	std::swap(_block, other._block);
+	return *this;
+}
+
+/**
+ * @brief Releases block (returns it to pool when it was the last handle)
+ */
+void pooled_buffer::reset()
+{
+	if (_block == nullptr)
+		return;
+
+	if (_block->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		// pool can be destroyed when this reference is dropped, so it is moved out of the block
+		std::shared_ptr<buffer_pool> pool = std::move(_block->pool);
+		pool->release(_block);
+	}
+	_block = nullptr;
+}
+
+std::size_t pooled_buffer::capacity() const
+{
+	return _block ? _block->pool->get_block_size() : 0;
+}
+
+/**
+ * @param block_size capacity of single buffer in bytes
+ * @param blocks_per_slab number of blocks allocated at once when pool is empty
+ * @param max_blocks maximal number of blocks (zero means no limit)
+ */
+std::shared_ptr<buffer_pool> buffer_pool::create(std::size_t block_size,
+		std::size_t blocks_per_slab, std::size_t max_blocks)
+{
+	return std::shared_ptr<buffer_pool>{new buffer_pool{block_size, blocks_per_slab, max_blocks}};
+}
+
+buffer_pool::buffer_pool(std::size_t block_size, std::size_t blocks_per_slab,
+		std::size_t max_blocks) :
+		_block_size(block_size), _blocks_per_slab(std::max<std::size_t>(blocks_per_slab, 1)),
+		_max_blocks(max_blocks)
+{
+	// data follows header, blocks are aligned to cache line
+	constexpr std::size_t alignment = 64;
+	_block_stride = (sizeof(pool_block) + _block_size + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Gets free buffer (with zero size)
+ *
+ * New slab is allocated when there is no free block.
+ * @return buffer or empty handle when pool reached maximal number of blocks
+ */
+pooled_buffer buffer_pool::acquire()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	if (_free_blocks == nullptr)
+	{
+		if (_max_blocks != 0 && _blocks_count >= _max_blocks)
+			return pooled_buffer{};
+		allocate_slab();
+	}
+
+	pool_block* block = _free_blocks;
+	_free_blocks = block->next_free;
+	_free_blocks_count--;
+	lock.unlock();
+
+	block->references.store(1, std::memory_order_relaxed);
+	block->pool = shared_from_this();
+	block->size = 0;
+	return pooled_buffer{block};
+}
+
+std::size_t buffer_pool::get_blocks_count()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return _blocks_count;
+}
+
+std::size_t buffer_pool::get_free_blocks_count()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return _free_blocks_count;
+}
+
+/**
+ * @brief Allocates memory for next blocks and adds them to free list (mutex has to be locked)
+ */
+void buffer_pool::allocate_slab()
+{
+	std::size_t count = _blocks_per_slab;
+	if (_max_blocks != 0)
+		count = std::min(count, _max_blocks - _blocks_count);
+
+	std::unique_ptr<char[]> slab{new char[count * _block_stride + 64]};
+	char* memory = slab.get() + (64 - reinterpret_cast<std::uintptr_t>(slab.get()) % 64) % 64;
+
+	for (std::size_t i = 0; i < count; i++)
+	{
+		pool_block* block = new (memory + i * _block_stride) pool_block{};
+		block->next_free = _free_blocks;
+		_free_blocks = block;
+	}
+
+	_slabs.push_back(std::move(slab));
+	_blocks_count += count;
+	_free_blocks_count += count;
+}
+
+/**
+ * @brief Returns block to free list (called when last handle is released)
+ */
+void buffer_pool::release(pool_block* block)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	block->next_free = _free_blocks;
+	_free_blocks = block;
+	_free_blocks_count++;
+}
+
+}
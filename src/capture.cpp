@@ -0,0 +1,251 @@
+/*
+ * capture.cpp
+ *
+ *  Created on: May 1, 2016
+ *      Author: rafal
+ */
+
+#include "capture.h"
+#include "serial_port_exception.h"
+#include "log.h"
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mrobot
+{
+
+namespace
+{
+
+constexpr char capture_magic[8] = {'M', 'R', 'C', 'A', 'P', 0, 0, 0};
+constexpr std::uint32_t capture_version = 1;
+constexpr std::size_t file_header_size = 16;
+constexpr std::size_t record_header_size = 16;
+constexpr std::uint32_t sent_flag = 0x80000000u; /// highest bit of size field marks sent data
+
+/**
+ * @brief Header of single record (followed by payload padded to 8 bytes)
+ */
+struct record_header
+{
+	std::uint64_t time;
+	std::uint32_t port_id;
+	std::uint32_t size; /// payload size with direction flag
+};
+
+static_assert(sizeof(record_header) == record_header_size, "Record header has to be packed");
+
+std::size_t padded(std::size_t size)
+{
+	return (size + 7) & ~std::size_t{7};
+}
+
+}
+
+/**
+ * @param path capture file (truncated when it exists)
+ * @param segment_size file is extended by this number of bytes when it is full
+ * @throws serial_port_exception
+ */
+capture_writer::capture_writer(const std::string& path, std::size_t segment_size) :
+		_segment_size(padded(std::max<std::size_t>(segment_size, 4096)))
+{
+	_file_descriptor = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (_file_descriptor < 0)
+		throw serial_port_exception("Cannot open capture file.", strerror(errno));
+
+	try
+	{
+		grow(file_header_size);
+	} catch (serial_port_exception&)
+	{
+		::close(_file_descriptor);
+		throw;
+	}
+
+	std::memcpy(_memory, capture_magic, sizeof(capture_magic));
+	std::memcpy(_memory + sizeof(capture_magic), &capture_version, sizeof(capture_version));
+	_offset = file_header_size;
+}
+
+capture_writer::~capture_writer()
+{
+	close();
+}
+
+/**
+ * @brief Appends chunk of traffic
+ * @throws serial_port_exception when file can't grow
+ */
+void capture_writer::record(capture_direction direction, std::uint32_t port_id, std::uint64_t time, buffer_view data)
+{
+	iovec buffer{const_cast<char*>(data.data), data.size};
+	record(direction, port_id, time, &buffer, 1);
+}
+
+/**
+ * @brief Appends chunk of traffic gathered from many buffers (as one record)
+ * @throws serial_port_exception when file can't grow
+ */
+void capture_writer::record(capture_direction direction, std::uint32_t port_id, std::uint64_t time, const iovec* buffers, int count)
+{
+	std::size_t size = 0;
+	for (int i = 0; i < count; i++)
+		size += buffers[i].iov_len;
+	size = std::min<std::size_t>(size, sent_flag - 1);
+
+	record_header header{time, port_id, static_cast<std::uint32_t>(size)};
+	if (direction == capture_direction::sent)
+		header.size |= sent_flag;
+
+	std::unique_lock<std::mutex> lock{_mutex};
+	char* position = reserve(record_header_size + padded(size));
+	if (position == nullptr)
+		return;
+
+	std::memcpy(position, &header, sizeof(header));
+	position += record_header_size;
+	for (int i = 0; i < count && size > 0; i++)
+	{
+		std::size_t chunk = std::min(size, buffers[i].iov_len);
+		std::memcpy(position, buffers[i].iov_base, chunk);
+		position += chunk;
+		size -= chunk;
+	}
+	_records_count++;
+}
+
+/**
+ * @brief Unmaps file and truncates it to written size
+ */
+void capture_writer::close()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	if (_file_descriptor < 0)
+		return;
+
+	munmap(_memory, _mapped_size);
+	_memory = nullptr;
+	if (ftruncate(_file_descriptor, _offset) < 0)
+		MROBOT_LOG_WARNING(serial_port_exception("Cannot truncate capture file.", strerror(errno)).what());
+	::close(_file_descriptor);
+	_file_descriptor = -1;
+}
+
+std::size_t capture_writer::get_size()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return _offset;
+}
+
+unsigned long long capture_writer::get_records_count()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return _records_count;
+}
+
+/**
+ * @brief Gets memory for next record (mutex has to be locked)
+ * @return nullptr when writer is closed
+ */
+char* capture_writer::reserve(std::size_t size)
+{
+	if (_file_descriptor < 0)
+		return nullptr;
+
+	if (_offset + size > _mapped_size)
+		grow(_offset + size);
+
+	char* position = _memory + _offset;
+	_offset += size;
+	return position;
+}
+
+/**
+ * @brief Extends file and its mapping by whole segments (mutex has to be locked)
+ * @throws serial_port_exception
+ */
+void capture_writer::grow(std::size_t minimal_size)
+{
+	std::size_t size = (minimal_size + _segment_size - 1) / _segment_size * _segment_size;
+	if (ftruncate(_file_descriptor, size) < 0)
+		throw serial_port_exception("Cannot extend capture file.", strerror(errno));
+
+	void* memory = _memory == nullptr
+			? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _file_descriptor, 0)
+			: mremap(_memory, _mapped_size, size, MREMAP_MAYMOVE);
+	if (memory == MAP_FAILED)
+		throw serial_port_exception("Cannot map capture file.", strerror(errno));
+
+	_memory = static_cast<char*>(memory);
+	_mapped_size = size;
+}
+
+/**
+ * @param path capture file written by capture_writer
+ * @throws serial_port_exception
+ */
+capture_reader::capture_reader(const std::string& path)
+{
+	int file_descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file_descriptor < 0)
+		throw serial_port_exception("Cannot open capture file.", strerror(errno));
+
+	struct stat status;
+	if (fstat(file_descriptor, &status) < 0 || static_cast<std::size_t>(status.st_size) < file_header_size)
+	{
+		::close(file_descriptor);
+		throw serial_port_exception("Invalid capture file.");
+	}
+
+	_size = status.st_size;
+	void* memory = mmap(nullptr, _size, PROT_READ, MAP_SHARED, file_descriptor, 0);
+	::close(file_descriptor);
+	if (memory == MAP_FAILED)
+		throw serial_port_exception("Cannot map capture file.", strerror(errno));
+	_memory = static_cast<const char*>(memory);
+
+	if (std::memcmp(_memory, capture_magic, sizeof(capture_magic)) != 0)
+	{
+		munmap(const_cast<char*>(_memory), _size);
+		throw serial_port_exception("Invalid capture file.", "Wrong magic number");
+	}
+}
+
+capture_reader::~capture_reader()
+{
+	munmap(const_cast<char*>(_memory), _size);
+}
+
+/**
+ * @brief Gets next record (its data points to mapped file)
+ * Zero filled tail of file which wasn't closed (e.g. after crash) ends records.
+ * @return false at end of file (or at truncated record)
+ */
+bool capture_reader::next(capture_record& record)
+{
+	if (_offset + record_header_size > _size)
+		return false;
+
+	record_header header;
+	std::memcpy(&header, _memory + _offset, sizeof(header));
+	if (header.time == 0)
+		return false;
+	std::size_t size = header.size & ~sent_flag;
+	if (_offset + record_header_size + size > _size)
+		return false;
+
+	record.time = header.time;
+	record.port_id = header.port_id;
+	record.direction = (header.size & sent_flag) ? capture_direction::sent : capture_direction::received;
+	record.data = buffer_view{_memory + _offset + record_header_size, size};
+	_offset += record_header_size + padded(size);
+	return true;
+}
+
+}
@@ -0,0 +1,391 @@
+/*
+ * channel_mux.cpp
+ *
+ *  Created on: May 14, 2016
+ *      Author: rafal
+ */
+
+#include "channel_mux.h"
+#include "log.h"
+#include <algorithm>
+
+namespace mrobot
+{
+
+/**
+ * @brief Sets frame decoder of port and subscribes its frame event
+ * @param port port shared by channels
+ * @param max_fragment_size maximal payload of single frame (1 - 65533 bytes)
+ * @param frames_in_flight fragments queued in port at once (at least one)
+ */
+channel_mux::channel_mux(serial_port& port, std::size_t max_fragment_size, std::size_t frames_in_flight) :
+		_port(port), _max_fragment_size(std::min<std::size_t>(std::max<std::size_t>(max_fragment_size, 1), 0xFFFD)),
+		_frames_in_flight(std::max<std::size_t>(frames_in_flight, 1))
+{
+	_port.set_frame_decoder(std::unique_ptr<frame_decoder>(new length_prefix_decoder(2, true, _max_fragment_size + _header_size - 2)));
+	_port.subscribe_frame_event([this](serial_port&, buffer_view frame) { receive(frame); });
+}
+
+/**
+ * @brief Unsubscribes frame event and drops queued messages
+ *
+ * Completion handlers of queued messages are called with dropped status.
+ */
+channel_mux::~channel_mux()
+{
+	_port.unsubscribe_frame_event();
+
+	std::vector<send_completion_handler> dropped;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		for (auto& channel : _channels)
+		{
+			for (queued_message& message : channel.second->queue)
+				if (message.completion_handler)
+					dropped.push_back(std::move(message.completion_handler));
+			channel.second->queue.clear();
+		}
+	}
+
+	for (auto& handler : dropped)
+		handler(*this, send_status::dropped);
+}
+
+/**
+ * @brief Adds virtual channel (has to be called before port is added to poll controler)
+ * @param channel identifier of channel (0 - max_channel)
+ * @param priority channels with higher priority are always served first
+ * @param weight share of link among channels of the same priority
+ * @param queue_capacity maximal number of queued bytes (also maximal message size)
+ * @throws serial_port_exception when identifier is invalid or already used
+ */
+void channel_mux::add_channel(std::uint8_t channel, int priority, unsigned weight, std::size_t queue_capacity)
+{
+	if (channel > max_channel)
+		throw serial_port_exception("Channel identifier is too big.");
+
+	std::unique_lock<std::mutex> lock{_mutex};
+	if (_channels.count(channel))
+		throw serial_port_exception("Channel is already added.");
+
+	std::unique_ptr<channel_entry> entry{new channel_entry};
+	entry->id = channel;
+	entry->priority = priority;
+	entry->quantum = std::max(weight, 1u) * (_max_fragment_size + _header_size);
+	entry->queue_capacity = queue_capacity;
+	_levels[priority].channels.push_back(entry.get());
+	_channels[channel] = std::move(entry);
+}
+
+/**
+ * @brief Sets handler called with messages received on channel
+ *
+ * Handler is called by polling thread, message view is valid until it returns.
+ * @throws serial_port_exception when channel isn't added
+ */
+void channel_mux::subscribe_message_event(std::uint8_t channel, const message_handler& handler)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	get_channel(channel).handler = std::make_shared<const message_handler>(handler);
+}
+
+/**
+ * @brief Queues message for transmission on channel
+ *
+ * Message is copied to channel queue and sent in fragments chosen by
+ * scheduler. Completion handler is called when last fragment is written,
+ * or immediately with dropped status when queue is full.
+ * @return false if message was dropped because channel queue was full
+ * @throws serial_port_exception when channel isn't added
+ */
+bool channel_mux::send(std::uint8_t channel, buffer_view message, const send_completion_handler& completion_handler)
+{
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		channel_entry& entry = get_channel(channel);
+		if (entry.stats.queued_bytes + message.size > entry.queue_capacity)
+		{
+			entry.stats.rejected_messages++;
+			lock.unlock();
+			if (completion_handler)
+				completion_handler(*this, send_status::dropped);
+			return false;
+		}
+
+		entry.queue.push_back(queued_message{++entry.queued_messages_count, std::vector<char>(message.begin(), message.end()), 0,
+				completion_handler});
+		entry.stats.queued_bytes += message.size;
+		entry.stats.peak_queued_bytes = std::max(entry.stats.peak_queued_bytes, entry.stats.queued_bytes);
+		_levels[entry.priority].queued_messages++;
+	}
+
+	transmit();
+	return true;
+}
+
+/**
+ * @brief Gets counters of channel
+ * @throws serial_port_exception when channel isn't added
+ */
+channel_stats channel_mux::get_stats(std::uint8_t channel)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return get_channel(channel).stats;
+}
+
+/**
+ * @brief Finds channel (mutex has to be locked)
+ * @throws serial_port_exception when channel isn't added
+ */
+channel_mux::channel_entry& channel_mux::get_channel(std::uint8_t channel)
+{
+	auto entry = _channels.find(channel);
+	if (entry == _channels.end())
+		throw serial_port_exception("Unknown channel.");
+	return *entry->second;
+}
+
+/**
+ * @brief Gets size of next frame of channel (mutex has to be locked)
+ */
+std::size_t channel_mux::next_frame_size(const channel_entry& channel)
+{
+	const queued_message& message = channel.queue.front();
+	return _header_size + std::min(message.data.size() - message.offset, _max_fragment_size);
+}
+
+/**
+ * @brief Chooses fragment which is sent next (mutex has to be locked)
+ *
+ * Levels are checked from the highest priority. Within level, current
+ * channel sends frames while they fit in its deficit, then next channel
+ * gets its quantum.
+ * @return false when all queues are empty
+ */
+bool channel_mux::next_fragment(fragment& next)
+{
+	for (auto& level_entry : _levels)
+	{
+		priority_level& level = level_entry.second;
+		if (level.queued_messages == 0)
+			continue;
+
+		while (true)
+		{
+			channel_entry& channel = *level.channels[level.current];
+			if (!channel.queue.empty())
+			{
+				if (!level.is_quantum_added)
+				{
+					channel.deficit += channel.quantum;
+					level.is_quantum_added = true;
+				}
+
+				std::size_t frame_size = next_frame_size(channel);
+				if (frame_size <= channel.deficit)
+				{
+					channel.deficit -= frame_size;
+					break;
+				}
+			}
+			else
+			{
+				channel.deficit = 0;
+			}
+
+			level.current = (level.current + 1) % level.channels.size();
+			level.is_quantum_added = false;
+		}
+
+		channel_entry& channel = *level.channels[level.current];
+		queued_message& message = channel.queue.front();
+		std::size_t payload_size = std::min(message.data.size() - message.offset, _max_fragment_size);
+		bool is_last = message.offset + payload_size == message.data.size();
+
+		std::size_t length = _header_size - 2 + payload_size;
+		auto frame = std::make_shared<std::vector<char>>(_header_size + payload_size);
+		(*frame)[0] = static_cast<char>(length >> 8);
+		(*frame)[1] = static_cast<char>(length);
+		(*frame)[2] = static_cast<char>(channel.id | (is_last ? 0 : _more_fragments_flag));
+		(*frame)[3] = static_cast<char>(message.fragment_index);
+		message.fragment_index = next_fragment_index(message.fragment_index);
+		std::copy_n(message.data.begin() + message.offset, payload_size, frame->begin() + _header_size);
+		message.offset += payload_size;
+		channel.stats.queued_bytes -= payload_size;
+
+		next = fragment{&channel, message.id, std::move(frame), payload_size, is_last, nullptr};
+		if (is_last)
+		{
+			next.completion_handler = std::move(message.completion_handler);
+			channel.queue.pop_front();
+			level.queued_messages--;
+		}
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Passes fragments to port until frames in flight limit is reached
+ *
+ * Port can call completion handler from this function (when fragment is
+ * written immediately), then fragments are taken by this loop.
+ */
+void channel_mux::transmit()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	if (_is_transmitting)
+		return;
+	_is_transmitting = true;
+
+	while (_in_flight_count < _frames_in_flight)
+	{
+		auto sent = std::make_shared<fragment>();
+		if (!next_fragment(*sent))
+			break;
+		_in_flight_count++;
+		lock.unlock();
+
+		try
+		{
+			std::shared_ptr<const std::vector<char>> frame = sent->frame;
+			_port.send_async(frame, [this, sent](serial_port&, send_status status)
+			{	complete_fragment(*sent, status);});
+		} catch (serial_port_exception& ex)
+		{
+			MROBOT_LOG_ERROR(ex.what());
+			complete_fragment(*sent, send_status::failed);
+		}
+		lock.lock();
+	}
+	_is_transmitting = false;
+}
+
+/**
+ * @brief Updates statistics and calls handler of message when its last fragment is done
+ *
+ * Other fragments of message which fragment failed are dropped. When
+ * last fragment is already in flight, message is reported as failed
+ * after it completes (receiver discards incomplete message).
+ */
+void channel_mux::complete_fragment(fragment& sent, send_status status)
+{
+	send_completion_handler handler;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		_in_flight_count--;
+		channel_stats& stats = sent.channel->stats;
+		if (status == send_status::sent)
+			stats.sent_bytes += sent.payload_size;
+		if (sent.is_last && sent.channel->failed_message_id == sent.message_id)
+		{
+			sent.channel->failed_message_id = 0;
+			if (status == send_status::sent)
+				status = send_status::failed;
+		}
+
+		if (status == send_status::sent)
+		{
+			if (sent.is_last)
+				stats.sent_messages++;
+		}
+		else if (sent.is_last)
+		{
+			stats.failed_messages++;
+		}
+		else if (!sent.channel->queue.empty() && sent.channel->queue.front().id == sent.message_id)
+		{
+			// rest of message isn't sent (unless its last fragment is already in flight)
+			queued_message& message = sent.channel->queue.front();
+			stats.queued_bytes -= message.data.size() - message.offset;
+			stats.failed_messages++;
+			handler = std::move(message.completion_handler);
+			sent.channel->queue.pop_front();
+			_levels[sent.channel->priority].queued_messages--;
+		}
+		else
+		{
+			sent.channel->failed_message_id = sent.message_id;
+		}
+		if (sent.is_last)
+			handler = std::move(sent.completion_handler);
+	}
+
+	if (handler)
+		handler(*this, status);
+	transmit();
+}
+
+/**
+ * @brief Reassembles fragments and passes messages to channel handlers (called by polling thread)
+ *
+ * Fragment which doesn't continue received message (its index is out of
+ * order) discards the message, first fragment discards incomplete one.
+ */
+void channel_mux::receive(buffer_view frame)
+{
+	if (frame.size < _header_size - 2)
+	{
+		_errors_count++;
+		return;
+	}
+
+	std::uint8_t id = static_cast<std::uint8_t>(frame.data[0] & ~_more_fragments_flag);
+	auto found = _channels.find(id);
+	if (found == _channels.end())
+	{
+		_errors_count++;
+		return;
+	}
+
+	channel_entry& channel = *found->second;
+	std::uint8_t index = static_cast<std::uint8_t>(frame.data[1]);
+	if (index == 0 ? channel.is_receiving : !channel.is_receiving || index != channel.expected_fragment_index)
+	{
+		// fragment of message was lost - nothing is delivered until next first fragment
+		channel.partial_message.clear();
+		channel.is_receiving = false;
+		_errors_count++;
+		if (index != 0)
+			return;
+	}
+
+	buffer_view payload{frame.data + _header_size - 2, frame.size - (_header_size - 2)};
+	if (frame.data[0] & _more_fragments_flag)
+	{
+		if (channel.partial_message.size() + payload.size > channel.queue_capacity)
+		{
+			channel.partial_message.clear();
+			channel.is_receiving = false;
+			_errors_count++;
+			return;
+		}
+		channel.partial_message.insert(channel.partial_message.end(), payload.begin(), payload.end());
+		channel.is_receiving = true;
+		channel.expected_fragment_index = next_fragment_index(index);
+		return;
+	}
+
+	std::shared_ptr<const message_handler> handler;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		channel.stats.received_messages++;
+		handler = channel.handler;
+	}
+	channel.is_receiving = false;
+
+	// message in single fragment is passed without copying
+	if (channel.partial_message.empty())
+	{
+		if (handler)
+			(*handler)(*this, id, payload);
+		return;
+	}
+
+	channel.partial_message.insert(channel.partial_message.end(), payload.begin(), payload.end());
+	if (handler)
+		(*handler)(*this, id, buffer_view{channel.partial_message});
+	channel.partial_message.clear();
+}
+
+}
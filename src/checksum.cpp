@@ -0,0 +1,409 @@
+/*
+ * checksum.cpp
+ *
+ *  Created on: May 12, 2016
+ *      Author: rafal
+ */
+
+#include "checksum.h"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define MROBOT_CHECKSUM_X86
+#endif
+
+namespace mrobot
+{
+
+namespace
+{
+
+/**
+ * @brief Parameters of CRC (reflected CRCs keep register in low bits)
+ */
+struct crc_parameters
+{
+	std::uint32_t polynomial; /// reversed for reflected CRCs
+	std::uint32_t initial;
+	std::uint32_t final_xor;
+	std::size_t size; /// number of bytes
+	bool is_reflected;
+};
+
+const crc_parameters parameters[] = {
+	{0xA001, 0xFFFF, 0, 2, true},
+	{0x1021, 0xFFFF, 0, 2, false},
+	{0xEDB88320, 0xFFFFFFFF, 0xFFFFFFFF, 4, true},
+	{0x82F63B78, 0xFFFFFFFF, 0xFFFFFFFF, 4, true},
+};
+
+using crc_tables = std::array<std::array<std::uint32_t, 256>, 8>;
+
+const crc_parameters& parameters_of(checksum_type type)
+{
+	return parameters[static_cast<int>(type)];
+}
+
+std::uint32_t update_bitwise(const crc_parameters& crc, std::uint32_t value, const unsigned char* data, std::size_t size)
+{
+	for (std::size_t i = 0; i < size; i++)
+	{
+		if (crc.is_reflected)
+		{
+			value ^= data[i];
+			for (int bit = 0; bit < 8; bit++)
+				value = (value >> 1) ^ ((value & 1) ? crc.polynomial : 0);
+		}
+		else
+		{
+			value ^= static_cast<std::uint32_t>(data[i]) << 8;
+			for (int bit = 0; bit < 8; bit++)
+				value = ((value << 1) ^ ((value & 0x8000) ? crc.polynomial : 0)) & 0xFFFF;
+		}
+	}
+	return value;
+}
+
+/**
+ * @brief Creates tables of slicing-by-8 (table k holds CRC of byte followed by k zero bytes)
+ */
+crc_tables create_tables(const crc_parameters& crc)
+{
+	crc_tables tables;
+	for (std::uint32_t byte = 0; byte < 256; byte++)
+	{
+		unsigned char value = static_cast<unsigned char>(byte);
+		tables[0][byte] = update_bitwise(crc, 0, &value, 1);
+	}
+
+	for (int k = 1; k < 8; k++)
+	{
+		for (std::uint32_t byte = 0; byte < 256; byte++)
+		{
+			std::uint32_t previous = tables[k - 1][byte];
+			if (crc.is_reflected)
+				tables[k][byte] = (previous >> 8) ^ tables[0][previous & 0xFF];
+			else
+				tables[k][byte] = ((previous << 8) & 0xFFFF) ^ tables[0][previous >> 8];
+		}
+	}
+	return tables;
+}
+
+const crc_tables tables[] = {
+	create_tables(parameters[0]),
+	create_tables(parameters[1]),
+	create_tables(parameters[2]),
+	create_tables(parameters[3]),
+};
+
+std::uint32_t update_slicing_by_8(checksum_type type, std::uint32_t value, const unsigned char* data, std::size_t size)
+{
+	const crc_tables& t = tables[static_cast<int>(type)];
+
+	if (parameters_of(type).is_reflected)
+	{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		for (; size >= 8; data += 8, size -= 8)
+		{
+			std::uint32_t low;
+			std::uint32_t high;
+			std::memcpy(&low, data, 4);
+			std::memcpy(&high, data + 4, 4);
+			low ^= value;
+			value = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+					^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+		}
+#endif
+		for (; size > 0; data++, size--)
+			value = (value >> 8) ^ t[0][(value ^ *data) & 0xFF];
+		return value;
+	}
+
+	for (; size >= 8; data += 8, size -= 8)
+	{
+		value = t[7][data[0] ^ (value >> 8)] ^ t[6][data[1] ^ (value & 0xFF)] ^ t[5][data[2]] ^ t[4][data[3]]
+				^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+	}
+	for (; size > 0; data++, size--)
+		value = ((value << 8) & 0xFFFF) ^ t[0][(value >> 8) ^ *data];
+	return value;
+}
+
+#ifdef MROBOT_CHECKSUM_X86
+
+__attribute__((target("sse4.2")))
+std::uint32_t update_sse42(std::uint32_t value, const unsigned char* data, std::size_t size)
+{
+	std::uint64_t value64 = value;
+	for (; size >= 8; data += 8, size -= 8)
+	{
+		std::uint64_t block;
+		std::memcpy(&block, data, 8);
+		value64 = _mm_crc32_u64(value64, block);
+	}
+	value = static_cast<std::uint32_t>(value64);
+	for (; size > 0; data++, size--)
+		value = _mm_crc32_u8(value, *data);
+	return value;
+}
+
+/**
+ * @brief Folds 128 bit accumulator into following block
+ */
+__attribute__((target("pclmul,sse4.1")))
+inline __m128i fold_pclmul(__m128i accumulator, __m128i next, __m128i constants)
+{
+	__m128i low = _mm_clmulepi64_si128(accumulator, constants, 0x00);
+	__m128i high = _mm_clmulepi64_si128(accumulator, constants, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(high, next), low);
+}
+
+/**
+ * @brief Computes CRC-32 by folding 64 byte blocks with carry-less multiplication
+ *
+ * Folding constants and Barrett reduction follow Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ * Data shorter than 64 bytes (and tail shorter than 16 bytes) is handled
+ * by slicing-by-8.
+ */
+__attribute__((target("pclmul,sse4.1")))
+std::uint32_t update_pclmul(std::uint32_t value, const unsigned char* data, std::size_t size)
+{
+	if (size < 64)
+		return update_slicing_by_8(checksum_type::crc32, value, data, size);
+
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i polynomial = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	auto load = [](const unsigned char* address)
+	{	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(address));};
+
+	__m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(static_cast<int>(value)));
+	__m128i x2 = load(data + 16);
+	__m128i x3 = load(data + 32);
+	__m128i x4 = load(data + 48);
+	data += 64;
+	size -= 64;
+
+	for (; size >= 64; data += 64, size -= 64)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), x5), load(data));
+		x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), x6), load(data + 16));
+		x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), x7), load(data + 32));
+		x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), x8), load(data + 48));
+	}
+
+	// fold four blocks into one, then remaining 16 byte blocks
+	x1 = fold_pclmul(x1, x2, k3k4);
+	x1 = fold_pclmul(x1, x3, k3k4);
+	x1 = fold_pclmul(x1, x4, k3k4);
+	for (; size >= 16; data += 16, size -= 16)
+		x1 = fold_pclmul(x1, load(data), k3k4);
+
+	// fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, polynomial, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, polynomial, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	value = static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+
+	return update_slicing_by_8(checksum_type::crc32, value, data, size);
+}
+
+#endif
+
+/**
+ * @brief Checks if CPU has instructions needed by implementation (called once for each one)
+ */
+bool detect_cpu_support(checksum_implementation implementation)
+{
+#ifdef MROBOT_CHECKSUM_X86
+	__builtin_cpu_init();
+	switch (implementation)
+	{
+	case checksum_implementation::sse42:
+		return __builtin_cpu_supports("sse4.2");
+	case checksum_implementation::pclmul:
+		return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+	default:
+		break;
+	}
+#endif
+	return implementation == checksum_implementation::bitwise || implementation == checksum_implementation::slicing_by_8;
+}
+
+const bool supported_implementations[] = {
+	detect_cpu_support(checksum_implementation::bitwise),
+	detect_cpu_support(checksum_implementation::slicing_by_8),
+	detect_cpu_support(checksum_implementation::sse42),
+	detect_cpu_support(checksum_implementation::pclmul),
+};
+
+bool is_cpu_supporting(checksum_implementation implementation)
+{
+	return supported_implementations[static_cast<int>(implementation)];
+}
+
+/**
+ * @brief Chooses the best implementation of CRC supported by CPU (checked once)
+ */
+checksum_implementation detect_checksum_implementation(checksum_type type)
+{
+	if (type == checksum_type::crc32c && is_cpu_supporting(checksum_implementation::sse42))
+		return checksum_implementation::sse42;
+	if (type == checksum_type::crc32 && is_cpu_supporting(checksum_implementation::pclmul))
+		return checksum_implementation::pclmul;
+	return checksum_implementation::slicing_by_8;
+}
+
+const checksum_implementation selected_implementations[] = {
+	detect_checksum_implementation(checksum_type::crc16_modbus),
+	detect_checksum_implementation(checksum_type::crc16_ccitt),
+	detect_checksum_implementation(checksum_type::crc32),
+	detect_checksum_implementation(checksum_type::crc32c),
+};
+
+}
+
+/**
+ * @brief Gets number of bytes of checksum appended to frame
+ */
+std::size_t get_checksum_size(checksum_type type)
+{
+	return parameters_of(type).size;
+}
+
+/**
+ * @brief Gets checksum of empty data (start value of update_checksum())
+ */
+std::uint32_t get_initial_checksum(checksum_type type)
+{
+	const crc_parameters& crc = parameters_of(type);
+	return crc.initial ^ crc.final_xor;
+}
+
+/**
+ * @brief Extends checksum with following part of data
+ *
+ * Uses SSE4.2 (CRC-32C) or PCLMUL (CRC-32) when CPU supports it (detected
+ * at runtime), otherwise slicing-by-8.
+ * @param checksum checksum of previous parts (or initial checksum)
+ * @return checksum of all parts
+ */
+std::uint32_t update_checksum(checksum_type type, std::uint32_t checksum, buffer_view data)
+{
+	return update_checksum(type, checksum, data, selected_implementations[static_cast<int>(type)]);
+}
+
+/**
+ * @brief Extends checksum using given implementation
+ *
+ * Slicing-by-8 is used when implementation doesn't support CRC type or
+ * isn't supported by CPU.
+ */
+std::uint32_t update_checksum(checksum_type type, std::uint32_t checksum, buffer_view data,
+		checksum_implementation implementation)
+{
+	const crc_parameters& crc = parameters_of(type);
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data);
+	std::uint32_t value = checksum ^ crc.final_xor;
+
+	if (!is_checksum_implementation_supported(type, implementation))
+		implementation = checksum_implementation::slicing_by_8;
+
+	switch (implementation)
+	{
+	case checksum_implementation::bitwise:
+		value = update_bitwise(crc, value, bytes, data.size);
+		break;
+#ifdef MROBOT_CHECKSUM_X86
+	case checksum_implementation::sse42:
+		value = update_sse42(value, bytes, data.size);
+		break;
+	case checksum_implementation::pclmul:
+		value = update_pclmul(value, bytes, data.size);
+		break;
+#endif
+	default:
+		value = update_slicing_by_8(type, value, bytes, data.size);
+		break;
+	}
+	return value ^ crc.final_xor;
+}
+
+/**
+ * @brief Computes checksum of data
+ */
+std::uint32_t compute_checksum(checksum_type type, buffer_view data)
+{
+	return update_checksum(type, get_initial_checksum(type), data);
+}
+
+/**
+ * @brief Stores checksum in byte order used by protocols
+ * @param destination memory for get_checksum_size() bytes
+ */
+void write_checksum(checksum_type type, std::uint32_t checksum, char* destination)
+{
+	const crc_parameters& crc = parameters_of(type);
+	for (std::size_t i = 0; i < crc.size; i++)
+	{
+		unsigned shift = crc.is_reflected ? 8 * i : 8 * (crc.size - 1 - i);
+		destination[i] = static_cast<char>(checksum >> shift);
+	}
+}
+
+/**
+ * @brief Loads checksum stored by write_checksum()
+ */
+std::uint32_t read_checksum(checksum_type type, const char* source)
+{
+	const crc_parameters& crc = parameters_of(type);
+	std::uint32_t checksum = 0;
+	for (std::size_t i = 0; i < crc.size; i++)
+	{
+		unsigned shift = crc.is_reflected ? 8 * i : 8 * (crc.size - 1 - i);
+		checksum |= static_cast<std::uint32_t>(static_cast<unsigned char>(source[i])) << shift;
+	}
+	return checksum;
+}
+
+/**
+ * @brief Gets implementation selected for this CPU and CRC type
+ */
+checksum_implementation get_checksum_implementation(checksum_type type)
+{
+	return selected_implementations[static_cast<int>(type)];
+}
+
+/**
+ * @brief Checks if implementation can compute given CRC on this CPU
+ */
+bool is_checksum_implementation_supported(checksum_type type, checksum_implementation implementation)
+{
+	if (implementation == checksum_implementation::sse42 && type != checksum_type::crc32c)
+		return false;
+	if (implementation == checksum_implementation::pclmul && type != checksum_type::crc32)
+		return false;
+	return is_cpu_supporting(implementation);
+}
+
+}
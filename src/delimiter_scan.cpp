@@ -0,0 +1,182 @@
+/*
+ * delimiter_scan.cpp
+ *
+ *  Created on: May 3, 2016
+ *      Author: rafal
+ */
+
+#include "delimiter_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MROBOT_SCAN_X86
+#endif
+
+namespace mrobot
+{
+
+namespace
+{
+
+const char* find_byte_scalar(const char* begin, const char* end, char value)
+{
+	for (; begin != end; ++begin)
+	{
+		if (*begin == value)
+			return begin;
+	}
+	return end;
+}
+
+const char* find_any_of_two_scalar(const char* begin, const char* end,
+		char first, char second)
+{
+	for (; begin != end; ++begin)
+	{
+		if (*begin == first || *begin == second)
+			return begin;
+	}
+	return end;
+}
+
+#ifdef MROBOT_SCAN_X86
+
+__attribute__((target("sse2")))
+const char* find_byte_sse2(const char* begin, const char* end, char value)
+{
+	const __m128i pattern = _mm_set1_epi8(value);
+	for (; end - begin >= 16; begin += 16)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+		if (mask != 0)
+			return begin + __builtin_ctz(mask);
+	}
+	return find_byte_scalar(begin, end, value);
+}
+
+__attribute__((target("sse2")))
+const char* find_any_of_two_sse2(const char* begin, const char* end,
+		char first, char second)
+{
+	const __m128i first_pattern = _mm_set1_epi8(first);
+	const __m128i second_pattern = _mm_set1_epi8(second);
+	for (; end - begin >= 16; begin += 16)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		__m128i matches = _mm_or_si128(_mm_cmpeq_epi8(block, first_pattern),
+				_mm_cmpeq_epi8(block, second_pattern));
+		int mask = _mm_movemask_epi8(matches);
+		if (mask != 0)
+			return begin + __builtin_ctz(mask);
+	}
+	return find_any_of_two_scalar(begin, end, first, second);
+}
+
+__attribute__((target("avx2")))
+const char* find_byte_avx2(const char* begin, const char* end, char value)
+{
+	const __m256i pattern = _mm256_set1_epi8(value);
+	for (; end - begin >= 32; begin += 32)
+	{
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern));
+		if (mask != 0)
+			return begin + __builtin_ctz(mask);
+	}
+	return find_byte_sse2(begin, end, value);
+}
+
+__attribute__((target("avx2")))
+const char* find_any_of_two_avx2(const char* begin, const char* end,
+		char first, char second)
+{
+	const __m256i first_pattern = _mm256_set1_epi8(first);
+	const __m256i second_pattern = _mm256_set1_epi8(second);
+	for (; end - begin >= 32; begin += 32)
+	{
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		__m256i matches = _mm256_or_si256(_mm256_cmpeq_epi8(block, first_pattern),
+				_mm256_cmpeq_epi8(block, second_pattern));
+		unsigned mask = _mm256_movemask_epi8(matches);
+		if (mask != 0)
+			return begin + __builtin_ctz(mask);
+	}
+	return find_any_of_two_sse2(begin, end, first, second);
+}
+
+#endif
+
+/**
+ * @brief Chooses the best implementation supported by CPU (checked once)
+ */
+scan_implementation detect_scan_implementation()
+{
+#ifdef MROBOT_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return scan_implementation::avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return scan_implementation::sse2;
+#endif
+	return scan_implementation::scalar;
+}
+
+const scan_implementation selected_implementation = detect_scan_implementation();
+
+}
+
+/**
+ * @brief Finds first occurrence of byte in memory range
+ *
+ * Uses AVX2 or SSE2 when CPU supports it (detected at runtime).
+ * @return pointer to found byte or end when byte wasn't found
+ */
+const char* find_byte(const char* begin, const char* end, char value)
+{
+#ifdef MROBOT_SCAN_X86
+	switch (selected_implementation)
+	{
+	case scan_implementation::avx2:
+		return find_byte_avx2(begin, end, value);
+	case scan_implementation::sse2:
+		return find_byte_sse2(begin, end, value);
+	default:
+		break;
+	}
+#endif
+	return find_byte_scalar(begin, end, value);
+}
+
+/**
+ * @brief Finds first occurrence of any of two bytes in memory range
+ *
+ * Uses AVX2 or SSE2 when CPU supports it (detected at runtime).
+ * @return pointer to found byte or end when none of bytes was found
+ */
+const char* find_any_of_two(const char* begin, const char* end, char first,
+		char second)
+{
+#ifdef MROBOT_SCAN_X86
+	switch (selected_implementation)
+	{
+	case scan_implementation::avx2:
+		return find_any_of_two_avx2(begin, end, first, second);
+	case scan_implementation::sse2:
+		return find_any_of_two_sse2(begin, end, first, second);
+	default:
+		break;
+	}
+#endif
+	return find_any_of_two_scalar(begin, end, first, second);
+}
+
+/**
+ * @brief Gets implementation selected for this CPU
+ */
+scan_implementation get_scan_implementation()
+{
+	return selected_implementation;
+}
+
+}
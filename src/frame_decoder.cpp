@@ -0,0 +1,336 @@
+/*
+ * frame_decoder.cpp
+ *
+ *  Created on: May 3, 2016
+ *      Author: rafal
+ */
+
+#include "frame_decoder.h"
+#include "delimiter_scan.h"
+#include <cstring>
+
+namespace mrobot
+{
+
+frame_decoder::frame_decoder(std::size_t max_frame_size) :
+		_max_frame_size(max_frame_size)
+{
+	_frame.reserve(max_frame_size);
+}
+
+/**
+ * @brief Appends data to partial frame
+ *
+ * When frame exceeds maximal size, it is dropped and error is counted.
+ * @return false if frame is dropped
+ */
+bool frame_decoder::append(const char* begin, const char* end)
+{
+	if (_is_frame_dropped)
+		return false;
+
+	if (_frame.size() + (end - begin) > _max_frame_size)
+	{
+		_frame.clear();
+		_is_frame_dropped = true;
+		_errors_count++;
+		return false;
+	}
+	_frame.insert(_frame.end(), begin, end);
+	return true;
+}
+
+delimiter_decoder::delimiter_decoder(char delimiter, bool include_delimiter,
+		std::size_t max_frame_size) :
+		frame_decoder(max_frame_size), _delimiter(delimiter), _include_delimiter(
+				include_delimiter)
+{
+}
+
+/**
+ * @brief Finds delimiters (vectorized scan) and passes frames to handler
+ *
+ * Frames which are contained in single chunk are passed without copying.
+ */
+void delimiter_decoder::decode(buffer_view data, const frame_handler& handler)
+{
+	const char* position = data.begin();
+	while (position != data.end())
+	{
+		const char* delimiter = find_byte(position, data.end(), _delimiter);
+		if (delimiter == data.end())
+		{
+			append(position, data.end());
+			return;
+		}
+
+		const char* frame_end = _include_delimiter ? delimiter + 1 : delimiter;
+		if (_frame.empty() && !_is_frame_dropped)
+		{
+			if (static_cast<std::size_t>(frame_end - position) <= _max_frame_size)
+				handler(buffer_view{position, static_cast<std::size_t>(frame_end - position)});
+			else
+				_errors_count++;
+		}
+		else if (append(position, frame_end))
+		{
+			handler(buffer_view{_frame});
+		}
+
+		_frame.clear();
+		_is_frame_dropped = false;
+		position = delimiter + 1;
+	}
+}
+
+length_prefix_decoder::length_prefix_decoder(std::size_t prefix_size,
+		bool is_big_endian, std::size_t max_frame_size) :
+		frame_decoder(max_frame_size), _prefix_size(
+				prefix_size == 1 || prefix_size == 2 ? prefix_size : 4), _is_big_endian(
+				is_big_endian)
+{
+}
+
+/**
+ * @brief Collects length prefix and payload, passes complete payloads to handler
+ *
+ * Payloads which are contained in single chunk are passed without copying.
+ * Frames with length above maximal frame size are skipped.
+ */
+void length_prefix_decoder::decode(buffer_view data,
+		const frame_handler& handler)
+{
+	const char* position = data.begin();
+	while (position != data.end())
+	{
+		if (_prefix_length < _prefix_size)
+		{
+			std::size_t count = std::min<std::size_t>(_prefix_size - _prefix_length,
+					data.end() - position);
+			std::memcpy(_prefix + _prefix_length, position, count);
+			_prefix_length += count;
+			position += count;
+			if (_prefix_length < _prefix_size)
+				return;
+
+			_payload_size = read_length(_prefix);
+			_frame.clear();
+			_is_frame_dropped = _payload_size > _max_frame_size;
+			if (_is_frame_dropped)
+				_errors_count++;
+		}
+
+		std::size_t collected = _is_frame_dropped ? 0 : _frame.size();
+		std::size_t available = data.end() - position;
+
+		if (_is_frame_dropped)
+		{
+			// skipped payload size is tracked by decrementing it
+			std::size_t count = std::min(_payload_size, available);
+			_payload_size -= count;
+			position += count;
+		}
+		else if (collected == 0 && available >= _payload_size)
+		{
+			handler(buffer_view{position, _payload_size});
+			position += _payload_size;
+			_payload_size = 0;
+		}
+		else
+		{
+			std::size_t count = std::min(_payload_size - collected, available);
+			_frame.insert(_frame.end(), position, position + count);
+			position += count;
+			if (_frame.size() < _payload_size)
+				return;
+			handler(buffer_view{_frame});
+			_payload_size = 0;
+		}
+
+		if (_payload_size == 0)
+		{
+			_prefix_length = 0;
+			_is_frame_dropped = false;
+			_frame.clear();
+		}
+	}
+}
+
+void length_prefix_decoder::reset()
+{
+	frame_decoder::reset();
+	_prefix_length = 0;
+	_payload_size = 0;
+	_is_frame_dropped = false;
+}
+
+std::size_t length_prefix_decoder::read_length(const char* prefix)
+{
+	std::size_t length = 0;
+	for (std::size_t i = 0; i < _prefix_size; i++)
+	{
+		std::size_t byte_index = _is_big_endian ? i : _prefix_size - 1 - i;
+		length = (length << 8) | static_cast<unsigned char>(prefix[byte_index]);
+	}
+	return length;
+}
+
+slip_decoder::slip_decoder(std::size_t max_frame_size) :
+		frame_decoder(max_frame_size)
+{
+}
+
+/**
+ * @brief Removes SLIP escaping and passes frames to handler
+ *
+ * Runs of ordinary bytes between special bytes (found by vectorized scan)
+ * are copied in bulk. Empty frames (e.g. leading END bytes) are ignored.
+ */
+void slip_decoder::decode(buffer_view data, const frame_handler& handler)
+{
+	const char* position = data.begin();
+	while (position != data.end())
+	{
+		if (_is_escaped)
+		{
+			_is_escaped = false;
+			const char special_bytes[] = { end, escape };
+			if (*position == escaped_end)
+				append(special_bytes, special_bytes + 1);
+			else if (*position == escaped_escape)
+				append(special_bytes + 1, special_bytes + 2);
+			else
+			{
+				_errors_count++;
+				_is_frame_dropped = true;
+			}
+			position++;
+			continue;
+		}
+
+		const char* special = find_any_of_two(position, data.end(), end, escape);
+		append(position, special);
+		if (special == data.end())
+			return;
+
+		if (*special == escape)
+		{
+			_is_escaped = true;
+		}
+		else
+		{
+			if (!_is_frame_dropped && !_frame.empty())
+				handler(buffer_view{_frame});
+			_frame.clear();
+			_is_frame_dropped = false;
+		}
+		position = special + 1;
+	}
+}
+
+void slip_decoder::reset()
+{
+	frame_decoder::reset();
+	_is_escaped = false;
+	_is_frame_dropped = false;
+}
+
+cobs_decoder::cobs_decoder(std::size_t max_frame_size) :
+		frame_decoder(max_frame_size + max_frame_size / 254 + 1)
+{
+	_decoded.reserve(max_frame_size);
+}
+
+/**
+ * @brief Finds zero delimiters (vectorized scan), decodes frames and passes them to handler
+ *
+ * Encoded frames contained in single chunk are decoded without copying
+ * them to partial frame buffer.
+ */
+void cobs_decoder::decode(buffer_view data, const frame_handler& handler)
+{
+	const char* position = data.begin();
+	while (position != data.end())
+	{
+		const char* delimiter = find_byte(position, data.end(), 0);
+		if (delimiter == data.end())
+		{
+			append(position, data.end());
+			return;
+		}
+
+		bool is_decoded = false;
+		if (_frame.empty() && !_is_frame_dropped)
+			is_decoded = decode_frame(buffer_view{position, static_cast<std::size_t>(delimiter - position)});
+		else if (append(position, delimiter))
+			is_decoded = decode_frame(buffer_view{_frame});
+
+		if (is_decoded)
+			handler(buffer_view{_decoded});
+
+		_frame.clear();
+		_is_frame_dropped = false;
+		position = delimiter + 1;
+	}
+}
+
+/**
+ * @brief Decodes single COBS frame (without zero delimiter) to decoded buffer
+ * @return false if frame is empty or malformed
+ */
+bool cobs_decoder::decode_frame(buffer_view encoded)
+{
+	_decoded.clear();
+	if (encoded.empty())
+		return false;
+
+	const char* position = encoded.begin();
+	while (position != encoded.end())
+	{
+		std::size_t code = static_cast<unsigned char>(*position++);
+		if (code == 0 || static_cast<std::size_t>(encoded.end() - position) < code - 1)
+		{
+			_errors_count++;
+			return false;
+		}
+
+		_decoded.insert(_decoded.end(), position, position + code - 1);
+		position += code - 1;
+
+		// code below 0xFF means zero byte, except after the last block
+		if (code < 0xFF && position != encoded.end())
+			_decoded.push_back(0);
+	}
+	return true;
+}
+
+checksum_decoder::checksum_decoder(std::unique_ptr<frame_decoder> decoder, checksum_type type) :
+		frame_decoder(0), _decoder(std::move(decoder)), _type(type)
+{
+}
+
+/**
+ * @brief Passes data to inner decoder and forwards frames with valid checksum (without it)
+ */
+void checksum_decoder::decode(buffer_view data, const frame_handler& handler)
+{
+	_decoder->decode(data, [this, &handler](buffer_view frame)
+	{
+		std::size_t checksum_size = get_checksum_size(_type);
+		if (frame.size < checksum_size)
+		{
+			_errors_count++;
+			return;
+		}
+
+		buffer_view payload{frame.data, frame.size - checksum_size};
+		if (compute_checksum(_type, payload) != read_checksum(_type, payload.end()))
+		{
+			_errors_count++;
+			return;
+		}
+		handler(payload);
+	});
+}
+
+}
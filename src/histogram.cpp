@@ -0,0 +1,100 @@
+/*
+ * histogram.cpp
+ *
+ *  Created on: Apr 4, 2016
+ *      Author: rafal
+ */
+
+#include "histogram.h"
+#include <cmath>
+#include <algorithm>
+
+namespace mrobot
+{
+
+/**
+ * @brief Adds single value
+ */
+void histogram::record(std::uint64_t value)
+{
+	_buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(value, std::memory_order_relaxed);
+
+	std::uint64_t max = _max.load(std::memory_order_relaxed);
+	while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+/**
+ * @brief Removes all values (shouldn't be called concurrently with record())
+ */
+void histogram::reset()
+{
+	for (auto& bucket : _buckets)
+		bucket.store(0, std::memory_order_relaxed);
+	_count.store(0, std::memory_order_relaxed);
+	_sum.store(0, std::memory_order_relaxed);
+	_max.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets value below which given fraction of recorded values lies
+ * @param fraction e.g. 0.5 for median, 0.99 for 99th percentile
+ * @return upper bound of bucket which holds the percentile (zero when empty)
+ */
+std::uint64_t histogram::percentile(double fraction) const
+{
+	unsigned long long count = this->count();
+	if (count == 0)
+		return 0;
+
+	unsigned long long rank = static_cast<unsigned long long>(std::ceil(fraction * count));
+	rank = std::min(std::max(rank, 1ULL), count);
+
+	unsigned long long seen = 0;
+	for (std::size_t bucket = 0; bucket < _buckets_count; bucket++)
+	{
+		seen += _buckets[bucket].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return std::min(upper_bound_of(bucket), max());
+	}
+	return max();
+}
+
+std::uint64_t histogram::mean() const
+{
+	unsigned long long count = this->count();
+	if (count == 0)
+		return 0;
+	return _sum.load(std::memory_order_relaxed) / count;
+}
+
+/**
+ * @brief Gets bucket of value (values smaller than number of sub buckets have own buckets)
+ */
+std::size_t histogram::bucket_of(std::uint64_t value)
+{
+	if (value < _sub_buckets_count)
+		return value;
+
+	int msb = 63 - __builtin_clzll(value);
+	std::size_t sub_bucket = (value >> (msb - _sub_bucket_bits)) & (_sub_buckets_count - 1);
+	return (msb - _sub_bucket_bits + 1) * _sub_buckets_count + sub_bucket;
+}
+
+/**
+ * @brief Gets the biggest value stored in bucket
+ */
+std::uint64_t histogram::upper_bound_of(std::size_t bucket)
+{
+	if (bucket < _sub_buckets_count)
+		return bucket;
+
+	int shift = bucket / _sub_buckets_count - 1;
+	std::uint64_t lower = (_sub_buckets_count + bucket % _sub_buckets_count) << shift;
+	return lower + ((std::uint64_t{1} << shift) - 1);
+}
+
+}
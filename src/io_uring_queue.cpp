@@ -0,0 +1,159 @@
+/*
+ * io_uring_queue.cpp
+ *
+ *  Created on: Apr 10, 2016
+ *      Author: rafal
+ */
+
+#include "io_uring_queue.h"
+#include <csignal>
+#include <ctime>
+#include <algorithm>
+
+namespace mrobot
+{
+
+/**
+ * @brief Creates io_uring instance and maps its rings
+ * @param entries number of submission entries
+ * @throws poll_exception when kernel doesn't support io_uring (or it is disabled)
+ */
+io_uring_queue::io_uring_queue(unsigned entries)
+{
+	_ring_fd = syscall(__NR_io_uring_setup, entries, &_params);
+	if (_ring_fd < 0)
+		throw poll_exception
+		{ "Cannot create io_uring instance.", strerror(errno) };
+
+	_sq_ring_size = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+	_cq_ring_size = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+	if (_params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		_sq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+		_cq_ring_size = 0;
+	}
+	_sqes_size = _params.sq_entries * sizeof(io_uring_sqe);
+
+	void* sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+	void* cq_ring = sq_ring;
+	if (sq_ring != MAP_FAILED && _cq_ring_size != 0)
+		cq_ring = mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+	void* sqes = MAP_FAILED;
+	if (sq_ring != MAP_FAILED && cq_ring != MAP_FAILED)
+		sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+
+	if (sqes == MAP_FAILED)
+	{
+		std::string error = strerror(errno);
+		if (cq_ring != MAP_FAILED && _cq_ring_size != 0)
+			munmap(cq_ring, _cq_ring_size);
+		if (sq_ring != MAP_FAILED)
+			munmap(sq_ring, _sq_ring_size);
+		close(_ring_fd);
+		throw poll_exception
+		{ "Cannot map io_uring rings.", error };
+	}
+
+	_sq_ring = static_cast<char*>(sq_ring);
+	_cq_ring = static_cast<char*>(cq_ring);
+	_sqes = static_cast<io_uring_sqe*>(sqes);
+
+	_sq_head = reinterpret_cast<unsigned*>(_sq_ring + _params.sq_off.head);
+	_sq_tail = reinterpret_cast<unsigned*>(_sq_ring + _params.sq_off.tail);
+	_sq_array = reinterpret_cast<unsigned*>(_sq_ring + _params.sq_off.array);
+	_sq_mask = *reinterpret_cast<unsigned*>(_sq_ring + _params.sq_off.ring_mask);
+
+	_cq_head = reinterpret_cast<unsigned*>(_cq_ring + _params.cq_off.head);
+	_cq_tail = reinterpret_cast<unsigned*>(_cq_ring + _params.cq_off.tail);
+	_cq_mask = *reinterpret_cast<unsigned*>(_cq_ring + _params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(_cq_ring + _params.cq_off.cqes);
+}
+
+io_uring_queue::~io_uring_queue()
+{
+	munmap(_sqes, _sqes_size);
+	if (_cq_ring_size != 0)
+		munmap(_cq_ring, _cq_ring_size);
+	munmap(_sq_ring, _sq_ring_size);
+	close(_ring_fd);
+}
+
+/**
+ * @brief Gets cleared submission entry
+ *
+ * When submission ring is full, filled entries are submitted first.
+ * @return entry which will be submitted by next submit call
+ * @throws poll_exception
+ */
+io_uring_sqe* io_uring_queue::get_sqe()
+{
+	unsigned tail = *_sq_tail;
+	if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _params.sq_entries)
+	{
+		if (submit() < 0)
+			throw poll_exception
+			{ "Cannot submit io_uring entries.", strerror(errno) };
+		if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _params.sq_entries)
+			throw poll_exception
+			{ "io_uring submission ring is full." };
+	}
+
+	unsigned index = tail & _sq_mask;
+	io_uring_sqe* sqe = &_sqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+
+	_sq_array[index] = index;
+	__atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	_pending_submissions++;
+	return sqe;
+}
+
+/**
+ * @brief Submits filled entries without waiting for completions
+ * @return number of submitted entries or -1 on error (errno is set)
+ */
+int io_uring_queue::submit()
+{
+	int result = syscall(__NR_io_uring_enter, _ring_fd, _pending_submissions, 0, 0, nullptr, 0);
+	if (result >= 0)
+		_pending_submissions -= std::min<unsigned>(result, _pending_submissions);
+	return result;
+}
+
+/**
+ * @brief Submits filled entries and waits for at least one completion
+ *
+ * Submission and waiting is done by single io_uring_enter() call.
+ * @param timeout maximal waiting time in milliseconds (negative means no limit)
+ * @return number of submitted entries or -1 on error (errno is set, ETIME means timeout)
+ */
+int io_uring_queue::submit_and_wait(int timeout)
+{
+	unsigned flags = IORING_ENTER_GETEVENTS;
+	__kernel_timespec time_limit{};
+	io_uring_getevents_arg argument{};
+	void* argument_pointer = nullptr;
+	std::size_t argument_size = 0;
+
+	if (timeout >= 0)
+	{
+		time_limit.tv_sec = timeout / 1000;
+		time_limit.tv_nsec = (timeout % 1000) * 1000000LL;
+		argument.sigmask_sz = _NSIG / 8;
+		argument.ts = reinterpret_cast<std::uintptr_t>(&time_limit);
+		argument_pointer = &argument;
+		argument_size = sizeof(argument);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	int result = syscall(__NR_io_uring_enter, _ring_fd, _pending_submissions, 1,
+			flags, argument_pointer, argument_size);
+	if (result >= 0)
+		_pending_submissions -= std::min<unsigned>(result, _pending_submissions);
+	return result;
+}
+
+}
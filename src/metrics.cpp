@@ -0,0 +1,134 @@
+/*
+ * metrics.cpp
+ *
+ *  Created on: Apr 6, 2016
+ *      Author: rafal
+ */
+
+#include "metrics.h"
+
+namespace mrobot
+{
+
+histogram_summary histogram_summary::of(const histogram& values)
+{
+	histogram_summary summary;
+	summary.count = values.count();
+	summary.mean = values.mean();
+	summary.p50 = values.percentile(0.5);
+	summary.p90 = values.percentile(0.9);
+	summary.p99 = values.percentile(0.99);
+	summary.max = values.max();
+	return summary;
+}
+
+/**
+ * @brief Remembers number of stored bytes if it is the biggest seen
+ */
+void port_metrics::update_peak_receive_buffer(std::size_t bytes)
+{
+	std::size_t peak = peak_receive_buffer_bytes.load(std::memory_order_relaxed);
+	while (bytes > peak && !peak_receive_buffer_bytes.compare_exchange_weak(peak, bytes, std::memory_order_relaxed))
+	{
+	}
+}
+
+/**
+ * @brief Copies counters to snapshot (fields not stored in metrics are left unchanged)
+ */
+void port_metrics::fill(port_metrics_snapshot& snapshot) const
+{
+	snapshot.bytes_in = bytes_in.load(std::memory_order_relaxed);
+	snapshot.bytes_out = bytes_out.load(std::memory_order_relaxed);
+	snapshot.frames_in = frames_in.load(std::memory_order_relaxed);
+	snapshot.frames_out = frames_out.load(std::memory_order_relaxed);
+	snapshot.read_calls = read_calls.load(std::memory_order_relaxed);
+	snapshot.write_calls = write_calls.load(std::memory_order_relaxed);
+	snapshot.read_errors = read_errors.load(std::memory_order_relaxed);
+	snapshot.write_errors = write_errors.load(std::memory_order_relaxed);
+	snapshot.coalesced_messages = coalesced_messages.load(std::memory_order_relaxed);
+	snapshot.coalesced_writes = coalesced_writes.load(std::memory_order_relaxed);
+	snapshot.peak_receive_buffer_bytes = peak_receive_buffer_bytes.load(std::memory_order_relaxed);
+	snapshot.dispatched_buffers = dispatched_buffers.load(std::memory_order_relaxed);
+	snapshot.dispatch_overflows = dispatch_overflows.load(std::memory_order_relaxed);
+	snapshot.read_size = histogram_summary::of(read_size);
+	snapshot.handler_time = histogram_summary::of(handler_time);
+}
+
+/**
+ * @brief Copies counters to snapshot (fields not stored in metrics are left unchanged)
+ */
+void reactor_metrics::fill(reactor_metrics_snapshot& snapshot) const
+{
+	snapshot.wakeups = wakeups.load(std::memory_order_relaxed);
+	snapshot.empty_wakeups = empty_wakeups.load(std::memory_order_relaxed);
+	snapshot.dispatched_events = dispatched_events.load(std::memory_order_relaxed);
+	snapshot.expired_timers = expired_timers.load(std::memory_order_relaxed);
+	snapshot.errors = errors.load(std::memory_order_relaxed);
+}
+
+static void export_histogram(std::ostream& stream, const std::string& name,
+		const std::string& labels, const histogram_summary& summary)
+{
+	stream << name << "_count{" << labels << "} " << summary.count << "\n";
+	stream << name << "_mean{" << labels << "} " << summary.mean << "\n";
+	stream << name << "{" << labels << ",quantile=\"0.5\"} " << summary.p50 << "\n";
+	stream << name << "{" << labels << ",quantile=\"0.9\"} " << summary.p90 << "\n";
+	stream << name << "{" << labels << ",quantile=\"0.99\"} " << summary.p99 << "\n";
+	stream << name << "_max{" << labels << "} " << summary.max << "\n";
+}
+
+/**
+ * @brief Writes port metrics in text format (one "name{labels} value" line per value)
+ * @param stream output stream
+ * @param port_name value of port label (e.g. device path)
+ * @param snapshot metrics of the port
+ */
+void export_metrics(std::ostream& stream, const std::string& port_name, const port_metrics_snapshot& snapshot)
+{
+	std::string labels = "port=\"" + port_name + "\"";
+
+	stream << "mrobot_port_bytes_in{" << labels << "} " << snapshot.bytes_in << "\n";
+	stream << "mrobot_port_bytes_out{" << labels << "} " << snapshot.bytes_out << "\n";
+	stream << "mrobot_port_frames_in{" << labels << "} " << snapshot.frames_in << "\n";
+	stream << "mrobot_port_frames_out{" << labels << "} " << snapshot.frames_out << "\n";
+	stream << "mrobot_port_read_calls{" << labels << "} " << snapshot.read_calls << "\n";
+	stream << "mrobot_port_write_calls{" << labels << "} " << snapshot.write_calls << "\n";
+	stream << "mrobot_port_read_errors{" << labels << "} " << snapshot.read_errors << "\n";
+	stream << "mrobot_port_write_errors{" << labels << "} " << snapshot.write_errors << "\n";
+	stream << "mrobot_port_frame_errors{" << labels << "} " << snapshot.frame_errors << "\n";
+	stream << "mrobot_port_dropped_messages{" << labels << "} " << snapshot.dropped_messages << "\n";
+	stream << "mrobot_port_coalesced_messages{" << labels << "} " << snapshot.coalesced_messages << "\n";
+	stream << "mrobot_port_coalesced_writes{" << labels << "} " << snapshot.coalesced_writes << "\n";
+	stream << "mrobot_port_write_calls_per_message{" << labels << "} " << snapshot.get_write_calls_per_message() << "\n";
+	stream << "mrobot_port_transmit_queue_bytes{" << labels << "} " << snapshot.transmit_queue_bytes << "\n";
+	stream << "mrobot_port_transmit_queue_messages{" << labels << "} " << snapshot.transmit_queue_messages << "\n";
+	stream << "mrobot_port_peak_receive_buffer_bytes{" << labels << "} " << snapshot.peak_receive_buffer_bytes << "\n";
+	stream << "mrobot_port_dispatched_buffers{" << labels << "} " << snapshot.dispatched_buffers << "\n";
+	stream << "mrobot_port_dispatch_overflows{" << labels << "} " << snapshot.dispatch_overflows << "\n";
+	stream << "mrobot_port_dispatch_queue_depth{" << labels << "} " << snapshot.dispatch_queue_depth << "\n";
+	export_histogram(stream, "mrobot_port_read_size_bytes", labels, snapshot.read_size);
+	export_histogram(stream, "mrobot_port_handler_time_ns", labels, snapshot.handler_time);
+}
+
+/**
+ * @brief Writes reactor metrics in text format
+ * @param stream output stream
+ * @param shard value of shard label (index of poll controler shard)
+ * @param snapshot metrics of the reactor
+ */
+void export_metrics(std::ostream& stream, std::size_t shard, const reactor_metrics_snapshot& snapshot)
+{
+	std::string labels = "shard=\"" + std::to_string(shard) + "\"";
+
+	stream << "mrobot_reactor_wakeups{" << labels << "} " << snapshot.wakeups << "\n";
+	stream << "mrobot_reactor_empty_wakeups{" << labels << "} " << snapshot.empty_wakeups << "\n";
+	stream << "mrobot_reactor_dispatched_events{" << labels << "} " << snapshot.dispatched_events << "\n";
+	stream << "mrobot_reactor_expired_timers{" << labels << "} " << snapshot.expired_timers << "\n";
+	stream << "mrobot_reactor_errors{" << labels << "} " << snapshot.errors << "\n";
+	stream << "mrobot_reactor_observers{" << labels << "} " << snapshot.observers << "\n";
+	stream << "mrobot_reactor_pending_changes{" << labels << "} " << snapshot.pending_changes << "\n";
+	stream << "mrobot_reactor_pending_timers{" << labels << "} " << snapshot.pending_timers << "\n";
+}
+
+}
@@ -6,121 +6,342 @@
  */
 
 #include <poll_controler.h>
+#include <sys/mman.h>
 
 namespace mrobot
 {
 
 poll_controler::poll_controler() :
-		poll_controler(-1, milliseconds(500))
+		poll_controler(-1, trigger_mode::level)
 {
 
 }
 
-poll_controler::poll_controler(int poll_timeout,
-		milliseconds poll_interval) :
-		_timeout(poll_timeout), _poll_interval(poll_interval)
+/**
+ * @param poll_timeout time in milliseconds after which epoll_wait() terminates (negative means never)
+ * @param mode readiness notification mode
+ * @param shards_count number of polling threads (at least one)
+ * @throws poll_exception
+ */
+poll_controler::poll_controler(int poll_timeout, trigger_mode mode,
+		std::size_t shards_count) :
+		_shared_shards_count(std::max<std::size_t>(shards_count, 1)), _shard_loads(_shared_shards_count, 0),
+		_trigger_mode(mode), _poll_timeout(poll_timeout)
 {
-
+	for (std::size_t i = 0; i < _shard_loads.size(); i++)
+	{
+		_shards.emplace_back(new reactor{poll_timeout, mode});
+		_shards.back()->set_buffer_pool(_buffer_pool);
+		_shards.back()->set_trace_ring(_trace_ring);
+	}
 }
 
 poll_controler::~poll_controler()
 {
-	delete[] _ufds;
-	_is_poll_thread_running = false;
-	_poll_thread.join();
+	stop_polling();
 }
 
+/**
+ * @brief Starts observing file descriptor of given owner
+ *
+ * Shard is chosen according to shard assignment option. Can be called
+ * while polling threads are running.
+ * @param observer owner of observed file descriptor
+ */
 void poll_controler::add(ifile_descriptor_owner* observer)
 {
-	_observers[observer->get_file_descriptor()] = observer;
+	std::size_t shard;
+	{
+		std::unique_lock<std::mutex> lock{_assignments_mutex};
+		shard = choose_shard(observer);
+	}
+	add(observer, shard, false);
+}
+
+/**
+ * @brief Starts observing file descriptor in given shard
+ *
+ * Explicitly assigned descriptors aren't moved by rebalancing.
+ * @param observer owner of observed file descriptor
+ * @param shard index of shard
+ * @throws poll_exception when shard doesn't exist
+ */
+void poll_controler::add(ifile_descriptor_owner* observer, std::size_t shard)
+{
+	add(observer, shard, true);
+}
+
+void poll_controler::add(ifile_descriptor_owner* observer, std::size_t shard,
+		bool is_pinned)
+{
+	{
+		std::unique_lock<std::mutex> lock{_assignments_mutex};
+		if (shard >= _shards.size())
+			throw poll_exception
+			{ "Shard index out of range." };
+		if (_assignments.count(observer))
+			return;
+		_assignments[observer] = assignment_entry{shard, is_pinned, false};
+		_shard_loads[shard]++;
+	}
+
+	_shards[shard]->add(observer);
+
+	if (_is_automatic_rebalancing_enabled && !is_poll_thread())
+		rebalance();
 }
 
+/**
+ * @brief Stops observing file descriptor of given owner
+ *
+ * After return owner isn't used by any shard and can be destroyed.
+ * @param observer owner of observed file descriptor
+ */
 void poll_controler::remove(ifile_descriptor_owner* observer)
 {
-	_observers.erase(observer->get_file_descriptor());
+	std::size_t shard;
+	{
+		std::unique_lock<std::mutex> lock{_assignments_mutex};
+		_move_finished_condition.wait(lock, [this, observer]
+		{
+			auto entry = _assignments.find(observer);
+			return entry == _assignments.end() || !entry->second.is_moving;
+		});
+
+		auto entry = _assignments.find(observer);
+		if (entry == _assignments.end())
+			return;
+		shard = entry->second.shard;
+		_shard_loads[shard]--;
+		_assignments.erase(entry);
+	}
+
+	_shards[shard]->remove(observer);
+
+	if (_is_automatic_rebalancing_enabled && !is_poll_thread())
+		rebalance();
 }
 
 void poll_controler::start_polling()
 {
-	construct_ufds_array();
-	_is_poll_thread_running = true;
-	_poll_thread = std::thread
-	{ &poll_controler::poll_loop, this };
+	_is_polling = true;
+	for (auto& shard : _shards)
+		shard->start_polling();
 }
+
 void poll_controler::stop_polling()
 {
-	construct_ufds_array();
-	_is_poll_thread_running = false;
-	_poll_thread.join();
+	_is_polling = false;
+	for (auto& shard : _shards)
+		shard->stop_polling();
 }
 
-void poll_controler::poll_loop()
+/**
+ * @brief Creates shard dedicated to latency sensitive descriptors
+ *
+ * Descriptors are never assigned to dedicated shard automatically (nor
+ * by rebalancing), they have to be added with add(observer, shard).
+ * Real-time priority, pinning and memory locking require privileges
+ * (CAP_SYS_NICE, CAP_IPC_LOCK), without them shard works with normal
+ * scheduling - achieved settings can be checked with reactor::is_realtime()
+ * and is_memory_locked(). Shouldn't be called concurrently with other functions.
+ * @param options settings of polling thread
+ * @return index of created shard
+ */
+std::size_t poll_controler::add_low_latency_shard(const low_latency_options& options)
 {
-	std::cerr << "poll_loop\n";
-	while (_is_poll_thread_running)
+	if (options.lock_memory && !_is_memory_locked)
 	{
-		std::cerr << "insight loop...\n";
-		std::this_thread::sleep_for(_poll_interval);
-		try
-		{
-			poll_file_descriptors();
-		} catch (poll_exception& ex)
-		{
-			std::cerr << ex.what();
-		}
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+			_is_memory_locked = true;
+		else
+			MROBOT_LOG_WARNING(poll_exception( "Cannot lock process memory.", strerror(errno) ).what());
 	}
+
+	std::unique_ptr<reactor> shard{new reactor{_poll_timeout, _trigger_mode}};
+	shard->set_busy_polling(options.busy_polling);
+	shard->set_realtime_priority(options.realtime_priority);
+	shard->set_cpu_affinity(options.cpus);
+	shard->set_io_backend(_io_backend);
+	shard->set_buffer_pool(_buffer_pool);
+	shard->set_trace_ring(_trace_ring);
+
+	{
+		std::unique_lock<std::mutex> lock{_assignments_mutex};
+		_shards.push_back(std::move(shard));
+		_shard_loads.push_back(0);
+	}
+
+	if (_is_polling)
+		_shards.back()->start_polling();
+	return _shards.size() - 1;
 }
 
-void mrobot::poll_controler::poll_file_descriptors()
+/**
+ * @brief Restricts polling thread of given shard to given CPUs
+ *
+ * Affinity is applied when polling is started.
+ * @param shard index of shard
+ * @param cpus CPU numbers (empty means no restriction)
+ */
+void poll_controler::set_cpu_affinity(std::size_t shard,
+		const std::vector<int>& cpus)
 {
-	std::cerr << "poll_file_descriptors\n";
-	if (_observed_fd_count > 0)
-	{
-		// events_count equal to zero means timeout
-		int events_count = poll(_ufds, _observed_fd_count, _timeout);
-		std::cerr << "after poll\n";
+	_shards.at(shard)->set_cpu_affinity(cpus);
+}
 
-		if (events_count < 0)
-			throw poll_exception
-			{ "Error when polling file descriptors.", strerror(errno) };
-		else
-		{
-			for (int i = 0; (i < _observed_fd_count) && (events_count > 0);
-					i++)
-			{
-				if (_ufds[i].events & POLLIN)
-				{
-					std::cerr << "data ready to read\n";
-					_observers[_ufds[i].fd]->process_data();
-					events_count--;
-				}
-			}
-		}
+/**
+ * @brief Selects kernel interface used by all shards
+ *
+ * Backend is applied when polling is started. When io_uring is requested
+ * but isn't supported by kernel, shards fall back to epoll at runtime
+ * (active backend can be checked with get_io_backend()).
+ * @param backend requested backend
+ */
+void poll_controler::set_io_backend(io_backend backend)
+{
+	_io_backend = backend;
+	for (auto& shard : _shards)
+		shard->set_io_backend(backend);
+}
+
+/**
+ * @brief Enables rebalancing of shards after each add() and remove()
+ *
+ * Moving descriptor waits for polling threads of both shards, so add()
+ * and remove() called from polling thread (e.g. by handler) don't
+ * rebalance - shards are balanced by next add() or remove() called by
+ * other thread, or by explicit rebalance().
+ * @param is_enabled rebalancing is enabled
+ */
+void poll_controler::set_automatic_rebalancing(bool is_enabled)
+{
+	_is_automatic_rebalancing_enabled = is_enabled;
+}
+
+/**
+ * @brief Moves descriptors from the most to the least loaded shards
+ *
+ * Descriptors are moved one by one until loads of shards differ at most
+ * by one (or only pinned descriptors are left). Shouldn't be called from
+ * polling threads.
+ */
+void poll_controler::rebalance()
+{
+	while (move_observer())
+	{
 	}
 }
 
-void mrobot::poll_controler::construct_ufds_array()
+std::size_t poll_controler::get_shard_load(std::size_t shard)
 {
-	//TODO trivial version of construction. Can be done better.
+	std::unique_lock<std::mutex> lock{_assignments_mutex};
+	return _shard_loads.at(shard);
+}
 
-	_observed_fd_count = _observers.size();
+/**
+ * @brief Gets index of shard which observes descriptor of given owner
+ * @throws poll_exception if owner isn't observed
+ */
+std::size_t poll_controler::get_shard_of(ifile_descriptor_owner* observer)
+{
+	std::unique_lock<std::mutex> lock{_assignments_mutex};
+	auto entry = _assignments.find(observer);
+	if (entry == _assignments.end())
+		throw poll_exception
+		{ "File descriptor owner isn't observed." };
+	return entry->second.shard;
+}
 
-	std::cerr << "Observers.size(): " << _observed_fd_count << "\n";
+/**
+ * @brief Writes metrics of all shards in text format
+ *
+ * Port metrics are exported separately (see serial_port::get_metrics()).
+ */
+void poll_controler::export_metrics(std::ostream& stream)
+{
+	for (std::size_t shard = 0; shard < _shards.size(); shard++)
+		mrobot::export_metrics(stream, shard, _shards[shard]->get_metrics());
+}
 
-	if (_ufds != nullptr)
-		delete[] _ufds;
+/**
+ * @brief Checks if function is called from polling thread of any shard
+ */
+bool poll_controler::is_poll_thread()
+{
+	for (auto& shard : _shards)
+	{
+		if (shard->is_poll_thread())
+			return true;
+	}
+	return false;
+}
 
-	_ufds = new pollfd[_observed_fd_count];
+/**
+ * @brief Chooses shard for new descriptor (assignments mutex has to be locked)
+ */
+std::size_t poll_controler::choose_shard(ifile_descriptor_owner* observer)
+{
+	switch (_shard_assignment)
+	{
+	case shard_assignment::least_loaded:
+		return std::min_element(_shard_loads.begin(), _shard_loads.begin() + _shared_shards_count)
+				- _shard_loads.begin();
+	case shard_assignment::hash:
+	default:
+		return static_cast<std::size_t>(observer->get_file_descriptor())
+				% _shared_shards_count;
+	}
+}
 
-	int i = 0;
-	for (auto observer : _observers)
+/**
+ * @brief Moves single not pinned descriptor from the most to the least loaded shard
+ * @return false if shards are balanced or no descriptor can be moved
+ */
+bool poll_controler::move_observer()
+{
+	ifile_descriptor_owner* observer = nullptr;
+	std::size_t source, destination;
 	{
-		_ufds[i].fd = observer.first;
-		std::cerr << "fd: " << observer.first << "\n";
-		_ufds[i++].events = POLLIN;
+		std::unique_lock<std::mutex> lock{_assignments_mutex};
+
+		// dedicated shards don't take part in rebalancing
+		auto shared_end = _shard_loads.begin() + _shared_shards_count;
+		source = std::max_element(_shard_loads.begin(), shared_end)
+				- _shard_loads.begin();
+		destination = std::min_element(_shard_loads.begin(), shared_end)
+				- _shard_loads.begin();
+		if (_shard_loads[source] <= _shard_loads[destination] + 1)
+			return false;
+
+		for (auto& assignment : _assignments)
+		{
+			if (assignment.second.shard == source && !assignment.second.is_pinned
+					&& !assignment.second.is_moving)
+			{
+				observer = assignment.first;
+				assignment.second.is_moving = true;
+				break;
+			}
+		}
+		if (observer == nullptr)
+			return false;
+
+		_shard_loads[source]--;
+		_shard_loads[destination]++;
 	}
 
-	_are_poll_objects_initialized = true;
+	// owner isn't detached, so its queued data is kept, its timers are moved with it
+	_shards[source]->move(observer, *_shards[destination]);
+
+	{
+		std::unique_lock<std::mutex> lock{_assignments_mutex};
+		auto& entry = _assignments[observer];
+		entry.shard = destination;
+		entry.is_moving = false;
+	}
+	_move_finished_condition.notify_all();
+	return true;
 }
 
 }
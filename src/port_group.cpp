@@ -0,0 +1,238 @@
+/*
+ * port_group.cpp
+ *
+ *  Created on: Apr 24, 2016
+ *      Author: rafal
+ */
+
+#include "port_group.h"
+#include "log.h"
+#include <algorithm>
+
+namespace mrobot
+{
+
+/**
+ * @param controler poll controler which observes members
+ * @param merge_delay time for which received chunk waits for older chunks of other members
+ */
+port_group::port_group(poll_controler& controler, timer_clock::duration merge_delay) :
+		_controler(controler), _merge_delay(merge_delay)
+{
+}
+
+/**
+ * @brief Removes all members from group and poll controler
+ */
+port_group::~port_group()
+{
+	std::vector<serial_port*> members;
+	{
+		std::unique_lock<std::mutex> lock{_members_mutex};
+		members = _members;
+	}
+
+	for (serial_port* port : members)
+		remove(port);
+}
+
+/**
+ * @brief Adds port to group and to poll controler
+ *
+ * Buffer event of port is subscribed by the group.
+ * @throws serial_port_exception when buffer event of port is already subscribed
+ */
+void port_group::add(serial_port* port)
+{
+	{
+		std::unique_lock<std::mutex> lock{_members_mutex};
+		if (std::find(_members.begin(), _members.end(), port) != _members.end())
+			return;
+		if (port->is_buffer_event_subscribed())
+			throw serial_port_exception("Buffer event of port is already subscribed.");
+		_members.push_back(port);
+	}
+
+	port->subscribe_buffer_event([this](serial_port& member, pooled_buffer buffer)
+	{
+		receive(member, std::move(buffer));
+	});
+	_controler.add(port);
+}
+
+/**
+ * @brief Removes port from group and from poll controler
+ *
+ * Pending chunks are delivered, so data received by port isn't lost.
+ */
+void port_group::remove(serial_port* port)
+{
+	{
+		std::unique_lock<std::mutex> lock{_members_mutex};
+		auto position = std::find(_members.begin(), _members.end(), port);
+		if (position == _members.end())
+			return;
+		_members.erase(position);
+	}
+
+	// timers of port are cancelled by its reactor
+	_controler.remove(port);
+	port->unsubscribe_buffer_event();
+
+	std::unique_lock<std::mutex> lock{_merge_mutex};
+	if (_delivery_timer_owner == port)
+	{
+		_is_delivery_scheduled = false;
+		_delivery_timer_owner = nullptr;
+	}
+	deliver_chunks(timer_clock::time_point::max());
+}
+
+/**
+ * @brief Sends data to all members
+ *
+ * Data is copied once, members share the payload.
+ * @return number of members which queued data (others dropped it or failed)
+ */
+std::size_t port_group::broadcast(buffer_view data, const send_completion_handler& completion_handler)
+{
+	return broadcast(std::make_shared<const std::vector<char>>(data.begin(), data.end()), completion_handler);
+}
+
+/**
+ * @brief Sends shared payload to all members without copying it
+ *
+ * Each member writes immediately as much as its device accepts and
+ * queues the rest. Failure of one member doesn't stop the others.
+ * @param payload data to send (mustn't be modified until it is sent)
+ * @param completion_handler called once for each member
+ * @return number of members which queued data (others dropped it or failed)
+ */
+std::size_t port_group::broadcast(const std::shared_ptr<const std::vector<char>>& payload,
+		const send_completion_handler& completion_handler)
+{
+	std::unique_lock<std::mutex> lock{_members_mutex};
+	std::size_t accepted_count = 0;
+
+	for (serial_port* port : _members)
+	{
+		try
+		{
+			if (port->send_async(payload, completion_handler))
+				accepted_count++;
+		} catch (serial_port_exception& ex)
+		{
+			_failed_broadcasts_count++;
+			MROBOT_LOG_WARNING(ex.what());
+		}
+	}
+	return accepted_count;
+}
+
+/**
+ * @brief Subscribe merged data event
+ *
+ * Handler gets chunks received by all members ordered by receive time.
+ * It is called by polling threads (one at a time), it can't call
+ * remove() or flush().
+ * @param event_handler function which will handle received chunks
+ */
+void port_group::subscribe_merged_data_event(const merged_data_event_handler& event_handler)
+{
+	std::unique_lock<std::mutex> lock{_merge_mutex};
+	if (!_is_merged_data_event_subscribed)
+	{
+		_merged_data_event_handler = event_handler;
+		_is_merged_data_event_subscribed = true;
+	}
+}
+
+void port_group::unsubscribe_merged_data_event()
+{
+	std::unique_lock<std::mutex> lock{_merge_mutex};
+	if (_is_merged_data_event_subscribed)
+	{
+		_is_merged_data_event_subscribed = false;
+		_pending_chunks.clear();
+	}
+}
+
+/**
+ * @brief Delivers all pending chunks without waiting for merge delay
+ */
+void port_group::flush()
+{
+	std::unique_lock<std::mutex> lock{_merge_mutex};
+	deliver_chunks(timer_clock::time_point::max());
+}
+
+std::size_t port_group::get_members_count()
+{
+	std::unique_lock<std::mutex> lock{_members_mutex};
+	return _members.size();
+}
+
+/**
+ * @brief Queues chunk received by member (called by polling thread of member)
+ */
+void port_group::receive(serial_port& port, pooled_buffer buffer)
+{
+	timer_clock::time_point now = timer_clock::now();
+	std::unique_lock<std::mutex> lock{_merge_mutex};
+	if (!_is_merged_data_event_subscribed)
+		return;
+
+	_pending_chunks.push_back(received_chunk{now, _next_sequence++, &port, std::move(buffer)});
+	std::push_heap(_pending_chunks.begin(), _pending_chunks.end(), std::greater<received_chunk>{});
+
+	deliver_chunks(now - _merge_delay);
+	// timer is cancelled when its owner leaves poll controler (it is moved with owner between shards)
+	if (_is_delivery_scheduled && _delivery_timer_owner->get_reactor() == nullptr)
+		_is_delivery_scheduled = false;
+	if (!_pending_chunks.empty() && !_is_delivery_scheduled)
+		schedule_delivery(port);
+}
+
+/**
+ * @brief Passes chunks received before deadline to handler (merge mutex has to be locked)
+ */
+void port_group::deliver_chunks(timer_clock::time_point deadline)
+{
+	while (!_pending_chunks.empty() && _pending_chunks.front().time <= deadline)
+	{
+		std::pop_heap(_pending_chunks.begin(), _pending_chunks.end(), std::greater<received_chunk>{});
+		received_chunk chunk = std::move(_pending_chunks.back());
+		_pending_chunks.pop_back();
+
+		if (_is_merged_data_event_subscribed)
+			_merged_data_event_handler(*chunk.port, chunk.time, std::move(chunk.buffer));
+	}
+}
+
+/**
+ * @brief Schedules timer which delivers the oldest pending chunk (merge mutex has to be locked)
+ *
+ * Timer is owned by given member, so it runs in reactor of the member
+ * (also after the member is moved to other shard).
+ */
+void port_group::schedule_delivery(serial_port& port)
+{
+	reactor* owner_reactor = port.get_reactor();
+	if (owner_reactor == nullptr)
+		return;
+
+	timer_clock::duration delay = _pending_chunks.front().time + _merge_delay - timer_clock::now();
+	_is_delivery_scheduled = true;
+	_delivery_timer_owner = &port;
+	owner_reactor->schedule_timer(&port, std::max(delay, timer_clock::duration::zero()), [this, &port]()
+	{
+		std::unique_lock<std::mutex> lock{_merge_mutex};
+		_is_delivery_scheduled = false;
+		_delivery_timer_owner = nullptr;
+		deliver_chunks(timer_clock::now() - _merge_delay);
+		if (!_pending_chunks.empty())
+			schedule_delivery(port);
+	});
+}
+
+}
@@ -0,0 +1,1116 @@
+/*
+ * reactor.cpp
+ *
+ *  Created on: Mar 20, 2016
+ *      Author: rafal
+ */
+
+#include <reactor.h>
+
+namespace mrobot
+{
+
+reactor::reactor(int poll_timeout, trigger_mode mode) :
+		_timeout(poll_timeout), _trigger_mode(mode)
+{
+	_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epoll_fd < 0)
+		throw poll_exception
+		{ "Cannot create epoll instance.", strerror(errno) };
+
+	_wake_up_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_wake_up_fd < 0)
+	{
+		close(_epoll_fd);
+		throw poll_exception
+		{ "Cannot create wake up event.", strerror(errno) };
+	}
+
+	// wake up event is always observed, it is marked by reserved key
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.u64 = _wake_up_key;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_up_fd, &event) < 0)
+	{
+		close(_wake_up_fd);
+		close(_epoll_fd);
+		throw poll_exception
+		{ "Cannot observe wake up event.", strerror(errno) };
+	}
+
+	_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	event.data.u64 = _timer_key;
+	if (_timer_fd < 0 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _timer_fd, &event) < 0)
+	{
+		int error = errno;
+		if (_timer_fd >= 0)
+			close(_timer_fd);
+		close(_wake_up_fd);
+		close(_epoll_fd);
+		throw poll_exception
+		{ "Cannot create timer descriptor.", strerror(error) };
+	}
+}
+
+reactor::~reactor()
+{
+	stop_polling();
+	close(_timer_fd);
+	close(_wake_up_fd);
+	close(_epoll_fd);
+}
+
+/**
+ * @brief Starts observing file descriptor of given owner
+ *
+ * Can be called while polling thread is running (from any thread).
+ * Descriptor is then registered by polling thread, which is woken
+ * up, so other observed descriptors aren't affected.
+ * @param observer owner of observed file descriptor
+ */
+void reactor::add(ifile_descriptor_owner* observer)
+{
+	registration_change change{observer, observer->get_file_descriptor(), true, nullptr};
+	observer->attach(this);
+
+	if (!_is_poll_thread_running || is_poll_thread())
+	{
+		apply_change(change);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock{_changes_mutex};
+		_pending_changes.push_back(change);
+	}
+	wake_up();
+}
+
+/**
+ * @brief Stops observing file descriptor of given owner
+ *
+ * Can be called while polling thread is running (from any thread).
+ * When called from other thread than polling thread, function blocks
+ * until descriptor is unregistered (and, with io_uring backend, until
+ * its operations in flight are cancelled), so after return owner won't
+ * be used by reactor and can be safely destroyed. Pending timers of the
+ * owner are cancelled.
+ * @param observer owner of observed file descriptor
+ */
+void reactor::remove(ifile_descriptor_owner* observer)
+{
+	remove_observer(observer, nullptr);
+	observer->attach(nullptr);
+}
+
+/**
+ * @brief Moves observed descriptor and pending timers of its owner to other reactor
+ *
+ * Owner isn't detached, so its queued data is kept. Timers are taken by
+ * polling thread together with removal of descriptor (none of them can be
+ * running then) and keep their identifiers, so owner can cancel them in
+ * destination reactor. Blocks like remove().
+ * @param observer owner of observed file descriptor
+ * @param destination reactor which observes descriptor after the call
+ */
+void reactor::move(ifile_descriptor_owner* observer, reactor& destination)
+{
+	std::vector<timer_wheel::timer_entry> timers;
+	remove_observer(observer, &timers);
+	destination.add(observer);
+	destination.adopt_timers(timers);
+}
+
+/**
+ * @brief Unregisters descriptor (see remove())
+ * @param moved_timers receives timers of owner (nullptr means timers are cancelled)
+ */
+void reactor::remove_observer(ifile_descriptor_owner* observer, std::vector<timer_wheel::timer_entry>* moved_timers)
+{
+	registration_change change{observer, observer->get_file_descriptor(), false, moved_timers};
+
+	if (!_is_poll_thread_running || is_poll_thread())
+	{
+		apply_change(change);
+	}
+	else
+	{
+		std::unique_lock<std::mutex> lock{_changes_mutex};
+		_pending_changes.push_back(change);
+		_pending_removals.insert(observer);
+		wake_up();
+
+		_removal_finished_condition.wait(lock, [this, observer]
+		{	return _pending_removals.count(observer) == 0;});
+	}
+}
+
+/**
+ * @brief Enables or disables observing of descriptor writability (EPOLLOUT)
+ *
+ * When interest is set, process_write() of the owner is called each time
+ * descriptor becomes writable (with io_uring backend prepared data is
+ * written). Interest should be set only when owner has pending data,
+ * otherwise polling thread would be woken up continuously.
+ * Can be called from any thread.
+ * @param observer owner of observed file descriptor
+ * @param is_interested true to observe writability
+ * @throws poll_exception
+ */
+void reactor::set_write_interest(ifile_descriptor_owner* observer,
+		bool is_interested)
+{
+	std::unique_lock<std::mutex> lock{_observers_mutex};
+
+	int file_descriptor = observer->get_file_descriptor();
+	if (is_interested)
+		_write_interests.insert(file_descriptor);
+	else
+		_write_interests.erase(file_descriptor);
+
+	auto entry = _observers.find(file_descriptor);
+	if (entry == _observers.end() || !entry->second.is_registered)
+		return;
+
+	if (_io_uring)
+	{
+		if (is_interested)
+		{
+			schedule_submission(entry->second);
+			if (!is_poll_thread())
+				wake_up();
+		}
+		return;
+	}
+
+	epoll_event event{};
+	event.events = events_for(file_descriptor);
+	event.data.u64 = entry->second.dispatch_key;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, file_descriptor, &event) < 0)
+		throw poll_exception
+		{ "Cannot change observed events.", strerror(errno) };
+}
+
+/**
+ * @brief Calls handler from polling thread after given delay
+ *
+ * Timers are kept in timer wheel with millisecond ticks (deadline is
+ * rounded up), so scheduling and cancelling don't depend on number of
+ * pending timers. Epoll backend is woken up by timer descriptor, which
+ * is armed again only when the nearest expiration changes. Timer is
+ * cancelled when its owner is removed from reactor and moved with it,
+ * when owner is moved to other reactor. Can be called from any thread
+ * (also from timer handler).
+ * @param owner observed descriptor owner which uses timer
+ * @param delay time after which handler is called
+ * @param handler function called once by polling thread
+ * @return identifier of the timer (used to cancel it)
+ */
+std::uint64_t reactor::schedule_timer(ifile_descriptor_owner* owner,
+		timer_clock::duration delay, const timer_handler& handler)
+{
+	// timer without delay isn't rounded up to the next tick
+	timer_clock::time_point deadline = delay > timer_clock::duration::zero() ?
+			timer_clock::now() + delay : timer_clock::time_point::min();
+	std::uint64_t timer_id;
+	bool is_nearest;
+	{
+		std::unique_lock<std::mutex> lock{_timers_mutex};
+		timer_id = _timers.schedule(deadline, owner, handler);
+		is_nearest = arm_next_expiration();
+	}
+
+	// io_uring backend doesn't observe timer descriptor, its wait timeout could be longer
+	if (is_nearest && _requested_io_backend == io_backend::io_uring
+			&& _is_poll_thread_running && !is_poll_thread())
+		wake_up();
+	return timer_id;
+}
+
+/**
+ * @brief Cancels pending timer
+ *
+ * Nothing is done when timer has already expired. Can be called from any
+ * thread, but handler which is being called can't be stopped.
+ * @param timer_id identifier returned by schedule_timer()
+ */
+void reactor::cancel_timer(std::uint64_t timer_id)
+{
+	// timer descriptor isn't armed again, it can only wake up polling thread too early
+	std::unique_lock<std::mutex> lock{_timers_mutex};
+	_timers.cancel(timer_id);
+}
+
+/**
+ * @brief Starts polling thread
+ *
+ * When io_uring backend is requested but kernel doesn't provide it,
+ * epoll backend is used.
+ * @throws poll_exception
+ */
+void reactor::start_polling()
+{
+	if (_is_poll_thread_running)
+		return;
+
+	if (_requested_io_backend == io_backend::io_uring)
+		start_io_uring();
+
+	register_observers();
+	_is_poll_thread_running = true;
+	_poll_thread = std::thread
+	{ &reactor::poll_loop, this };
+}
+
+void reactor::stop_polling()
+{
+	_is_poll_thread_running = false;
+	wake_up();
+	if (_poll_thread.joinable())
+		_poll_thread.join();
+	_poll_thread_id = std::thread::id{};
+	_is_realtime = false;
+	apply_pending_changes();
+	unregister_observers();
+	_io_uring.reset();
+}
+
+void reactor::poll_loop()
+{
+	_poll_thread_id = std::this_thread::get_id();
+	apply_cpu_affinity();
+	apply_realtime_priority();
+
+	while (_is_poll_thread_running)
+	{
+		try
+		{
+			if (_io_uring)
+				complete_io_uring_operations();
+			else
+				poll_file_descriptors();
+		} catch (std::exception& ex)
+		{
+			_metrics.errors.fetch_add(1, std::memory_order_relaxed);
+			MROBOT_LOG_ERROR(ex.what());
+		}
+	}
+
+	if (_io_uring)
+	{
+		// operations in flight use memory of owners, so they are cancelled before thread ends
+		for (auto& observer : _observers)
+			cancel_operations(observer.second);
+		while (_submitted_operations_count > 0 || _is_wake_up_read_submitted)
+		{
+			try
+			{
+				complete_io_uring_operations();
+			} catch (std::exception& ex)
+			{
+				MROBOT_LOG_ERROR(ex.what());
+			}
+		}
+	}
+}
+
+/**
+ * @brief Waits for events on observed file descriptors and dispatches them
+ *
+ * Thread is blocked only in epoll_wait(), so data is processed as soon
+ * as descriptor becomes readable. Only descriptors which are ready are
+ * returned by kernel, so cost of wake up doesn't depend on number of
+ * observed descriptors. Events hold keys of dispatch table, so owners
+ * are found by index and their handlers are called without virtual calls.
+ */
+void reactor::poll_file_descriptors()
+{
+	// events_count equal to zero means timeout
+	int events_count = epoll_wait(_epoll_fd, _events, _max_events, wait_timeout());
+
+	if (events_count < 0)
+	{
+		if (errno == EINTR)
+			return;
+		throw poll_exception
+		{ "Error when polling file descriptors.", strerror(errno) };
+	}
+
+	if (_trace_ring && _trace_ring->is_enabled())
+		_wakeup_time = trace_time();
+
+	reactor_metrics::add(_metrics.wakeups);
+	unsigned long long dispatched_events = 0;
+
+	for (int i = 0; i < events_count; i++)
+	{
+		std::uint64_t key = _events[i].data.u64;
+		if (key == _wake_up_key)
+		{
+			// consume wake up event, loop condition is checked by caller
+			eventfd_t value;
+			eventfd_read(_wake_up_fd, &value);
+			apply_pending_changes();
+			continue;
+		}
+
+		if (key == _timer_key)
+		{
+			// consume expiration, timers are run after dispatching events
+			std::uint64_t expirations;
+			if (read(_timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+				MROBOT_LOG_WARNING(poll_exception( "Cannot read timer descriptor.", strerror(errno) ).what());
+			continue;
+		}
+
+		// slot is checked again after each handler, owner could be removed by it
+		std::uint32_t index = static_cast<std::uint32_t>(key);
+		std::uint32_t generation = static_cast<std::uint32_t>(key >> 32);
+		if (_dispatch_slots[index].generation != generation)
+			continue;
+
+		dispatched_events++;
+		if (_events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			_dispatch_slots[index].functions.process_data(_dispatch_slots[index].observer);
+
+		if ((_events[i].events & EPOLLOUT) && _dispatch_slots[index].generation == generation)
+			_dispatch_slots[index].functions.process_write(_dispatch_slots[index].observer);
+	}
+
+	if (dispatched_events == 0)
+		reactor_metrics::add(_metrics.empty_wakeups);
+	else
+		reactor_metrics::add(_metrics.dispatched_events, dispatched_events);
+
+	run_expired_timers();
+}
+
+/**
+ * @brief Adds all observers to epoll instance
+ * @throws poll_exception
+ */
+void reactor::register_observers()
+{
+	std::unique_lock<std::mutex> lock{_observers_mutex};
+	for (auto& observer : _observers)
+		register_observer(observer.second);
+}
+
+/**
+ * @brief Adds single file descriptor to epoll instance (or schedules its io_uring operations)
+ *
+ * Observers mutex has to be locked by caller.
+ * @throws poll_exception
+ */
+void reactor::register_observer(observer_entry& entry)
+{
+	MROBOT_LOG_DEBUG("fd: " << entry.file_descriptor << "\n");
+
+	if (_io_uring)
+	{
+		entry.is_registered = true;
+		schedule_submission(entry);
+		return;
+	}
+
+	entry.dispatch_key = acquire_dispatch_slot(entry.observer);
+	epoll_event event{};
+	event.events = events_for(entry.file_descriptor);
+	event.data.u64 = entry.dispatch_key;
+
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, entry.file_descriptor, &event) < 0)
+	{
+		int error = errno;
+		release_dispatch_slot(entry.dispatch_key);
+		throw poll_exception
+		{ "Cannot observe file descriptor.", strerror(error) };
+	}
+	entry.is_registered = true;
+}
+
+/**
+ * @brief Removes all observers from epoll instance
+ */
+void reactor::unregister_observers()
+{
+	std::unique_lock<std::mutex> lock{_observers_mutex};
+	for (auto& observer : _observers)
+	{
+		if (observer.second.is_registered && !_io_uring)
+		{
+			epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, observer.first, nullptr);
+			release_dispatch_slot(observer.second.dispatch_key);
+		}
+		observer.second.is_registered = false;
+		observer.second.is_scheduled = false;
+	}
+	_scheduled_entries.clear();
+}
+
+/**
+ * @brief Applies single registration change
+ *
+ * Descriptors are added to epoll instance only when polling thread
+ * is running (otherwise they are registered in start_polling()).
+ * With io_uring backend, removed entry is kept until its operations
+ * in flight are cancelled.
+ * @throws poll_exception
+ */
+void reactor::apply_change(const registration_change& change)
+{
+	std::unique_lock<std::mutex> lock{_observers_mutex};
+
+	if (change.is_add)
+	{
+		if (_observers.count(change.file_descriptor))
+			return;
+		observer_entry& entry = _observers[change.file_descriptor];
+		entry = observer_entry{};
+		entry.observer = change.observer;
+		entry.file_descriptor = change.file_descriptor;
+		if (_is_poll_thread_running)
+			register_observer(entry);
+		return;
+	}
+
+	auto entry = _observers.find(change.file_descriptor);
+	if (entry == _observers.end() || entry->second.observer != change.observer)
+	{
+		lock.unlock();
+		finish_removal(change.observer);
+		return;
+	}
+
+	_write_interests.erase(change.file_descriptor);
+	if (change.moved_timers != nullptr)
+	{
+		std::unique_lock<std::mutex> timers_lock{_timers_mutex};
+		*change.moved_timers = _timers.take_owner(change.observer);
+	}
+	else
+		cancel_timers_of(change.observer);
+	if (entry->second.is_registered)
+	{
+		if (_io_uring)
+		{
+			_removed_observers.push_back(change.observer);
+			entry->second.is_registered = false;
+			if (entry->second.is_read_submitted || entry->second.is_write_submitted)
+			{
+				// entry is erased when last operation completes
+				cancel_operations(entry->second);
+				return;
+			}
+		}
+		else
+		{
+			epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, change.file_descriptor, nullptr);
+			release_dispatch_slot(entry->second.dispatch_key);
+		}
+	}
+
+	if (entry->second.is_scheduled)
+		_scheduled_entries.erase(std::find(_scheduled_entries.begin(),
+				_scheduled_entries.end(), &entry->second));
+	_observers.erase(entry);
+
+	lock.unlock();
+	finish_removal(change.observer);
+}
+
+/**
+ * @brief Stores owner in free slot of dispatch table (observers mutex has to be locked)
+ * @return key passed in epoll events (index of slot and its generation)
+ */
+std::uint64_t reactor::acquire_dispatch_slot(ifile_descriptor_owner* observer)
+{
+	std::uint32_t index = _free_dispatch_slot;
+	if (index == UINT32_MAX)
+	{
+		index = static_cast<std::uint32_t>(_dispatch_slots.size());
+		_dispatch_slots.push_back(dispatch_slot{nullptr, {}, 1, UINT32_MAX});
+	}
+	else
+		_free_dispatch_slot = _dispatch_slots[index].next_free;
+
+	dispatch_slot& slot = _dispatch_slots[index];
+	slot.observer = observer;
+	slot.functions = observer->get_dispatch_functions();
+	return (static_cast<std::uint64_t>(slot.generation) << 32) | index;
+}
+
+/**
+ * @brief Frees slot of dispatch table (observers mutex has to be locked)
+ *
+ * Generation of slot is changed, so events returned before removal
+ * aren't dispatched.
+ */
+void reactor::release_dispatch_slot(std::uint64_t dispatch_key)
+{
+	std::uint32_t index = static_cast<std::uint32_t>(dispatch_key);
+	dispatch_slot& slot = _dispatch_slots[index];
+	slot.observer = nullptr;
+	// generations equal to zero and to all ones are skipped, so keys never match reserved ones
+	if (++slot.generation == UINT32_MAX)
+		slot.generation = 1;
+	slot.next_free = _free_dispatch_slot;
+	_free_dispatch_slot = index;
+}
+
+/**
+ * @brief Applies changes queued by other threads
+ */
+void reactor::apply_pending_changes()
+{
+	std::vector<registration_change> changes;
+	{
+		std::unique_lock<std::mutex> lock{_changes_mutex};
+		changes.swap(_pending_changes);
+	}
+
+	for (auto& change : changes)
+	{
+		try
+		{
+			apply_change(change);
+		} catch (poll_exception& ex)
+		{
+			_metrics.errors.fetch_add(1, std::memory_order_relaxed);
+			MROBOT_LOG_ERROR(ex.what());
+		}
+	}
+}
+
+/**
+ * @brief Wakes up thread waiting in remove() for given observer
+ */
+void reactor::finish_removal(ifile_descriptor_owner* observer)
+{
+	{
+		std::unique_lock<std::mutex> lock{_changes_mutex};
+		auto removal = _pending_removals.find(observer);
+		if (removal == _pending_removals.end())
+			return;
+		_pending_removals.erase(removal);
+	}
+	_removal_finished_condition.notify_all();
+}
+
+/**
+ * @brief Computes epoll events observed for given descriptor
+ *
+ * Observers mutex has to be locked by caller.
+ */
+uint32_t reactor::events_for(int file_descriptor)
+{
+	uint32_t events = EPOLLIN;
+	if (_trigger_mode == trigger_mode::edge)
+		events |= EPOLLET;
+	if (_write_interests.count(file_descriptor))
+		events |= EPOLLOUT;
+	return events;
+}
+
+/**
+ * @brief Computes time of single wait for events
+ *
+ * Epoll backend is woken up by timer descriptor. For io_uring backend
+ * poll timeout is shortened to the nearest expiration of timer wheel
+ * (rounded up, so timer has always expired when wait ends). With busy
+ * polling kernel is only checked for events, without waiting.
+ * @return time in milliseconds (negative means no limit)
+ */
+int reactor::wait_timeout()
+{
+	if (_is_busy_polling_enabled)
+		return 0;
+	if (!_io_uring)
+		return _timeout;
+
+	std::unique_lock<std::mutex> lock{_timers_mutex};
+	if (!_timers.has_next_expiration())
+		return _timeout;
+
+	timer_clock::duration remaining = _timers.get_next_expiration() - timer_clock::now();
+	if (remaining <= timer_clock::duration::zero())
+		return 0;
+
+	auto timeout = std::chrono::ceil<milliseconds>(remaining).count();
+	if (_timeout >= 0 && _timeout < timeout)
+		return _timeout;
+	return static_cast<int>(std::min<decltype(timeout)>(timeout, INT_MAX));
+}
+
+/**
+ * @brief Calls handlers of expired timers (called from polling thread)
+ *
+ * Only timers which expired before the call are run, so timers scheduled
+ * by handlers are called in next iteration of the loop, even if they have
+ * already expired. Handlers are called without lock, so they can cancel
+ * other timers.
+ */
+void reactor::run_expired_timers()
+{
+	std::size_t expired_count;
+	{
+		std::unique_lock<std::mutex> lock{_timers_mutex};
+		expired_count = _timers.advance(timer_clock::now());
+	}
+
+	for (; expired_count > 0; expired_count--)
+	{
+		timer_handler handler;
+		{
+			std::unique_lock<std::mutex> lock{_timers_mutex};
+			if (!_timers.pop_expired(handler))
+				break;
+		}
+		reactor_metrics::add(_metrics.expired_timers);
+		handler();
+	}
+
+	// expired timer descriptor is disarmed, so it's armed for the rest of timers
+	std::unique_lock<std::mutex> lock{_timers_mutex};
+	if (_timers.has_next_expiration())
+		arm_timer(_timers.get_next_expiration());
+	else if (_armed_expiration != timer_clock::time_point::max())
+		arm_timer(timer_clock::time_point::max());
+}
+
+/**
+ * @brief Cancels all timers of removed owner
+ */
+void reactor::cancel_timers_of(ifile_descriptor_owner* owner)
+{
+	std::unique_lock<std::mutex> lock{_timers_mutex};
+	_timers.cancel_owner(owner);
+}
+
+/**
+ * @brief Schedules timers taken from other reactor (see move())
+ * @param timers timers of moved owner (handlers are moved out)
+ */
+void reactor::adopt_timers(std::vector<timer_wheel::timer_entry>& timers)
+{
+	if (timers.empty())
+		return;
+
+	bool is_nearest;
+	{
+		std::unique_lock<std::mutex> lock{_timers_mutex};
+		for (auto& timer : timers)
+			_timers.adopt(std::move(timer));
+		is_nearest = arm_next_expiration();
+	}
+
+	if (is_nearest && _requested_io_backend == io_backend::io_uring
+			&& _is_poll_thread_running && !is_poll_thread())
+		wake_up();
+}
+
+/**
+ * @brief Arms timer descriptor when the nearest expiration was moved earlier (timers mutex has to be locked)
+ * @return true if descriptor was armed
+ */
+bool reactor::arm_next_expiration()
+{
+	timer_clock::time_point expiration = _timers.get_next_expiration();
+	if (expiration >= _armed_expiration)
+		return false;
+	arm_timer(expiration);
+	return true;
+}
+
+/**
+ * @brief Sets absolute expiration of timer descriptor (timers mutex has to be locked)
+ *
+ * Steady clock uses CLOCK_MONOTONIC, the same as timer descriptor.
+ * @param expiration time of expiration (maximal time point disarms descriptor)
+ */
+void reactor::arm_timer(timer_clock::time_point expiration)
+{
+	itimerspec value{};
+	if (expiration != timer_clock::time_point::max())
+	{
+		auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(expiration.time_since_epoch()).count();
+		// zero value would disarm descriptor
+		nanoseconds = std::max<decltype(nanoseconds)>(nanoseconds, 1);
+		value.it_value.tv_sec = nanoseconds / 1000000000;
+		value.it_value.tv_nsec = nanoseconds % 1000000000;
+	}
+
+	if (timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &value, nullptr) < 0)
+		MROBOT_LOG_WARNING(poll_exception( "Cannot arm timer descriptor.", strerror(errno) ).what());
+	_armed_expiration = expiration;
+}
+
+/**
+ * @brief Checks if function is called from polling thread
+ */
+bool reactor::is_poll_thread()
+{
+	return std::this_thread::get_id() == _poll_thread_id.load();
+}
+
+/**
+ * @brief Restricts polling thread to given CPUs
+ *
+ * Affinity is applied when polling is started.
+ * @param cpus CPU numbers (empty means no restriction)
+ */
+void reactor::set_cpu_affinity(const std::vector<int>& cpus)
+{
+	_cpu_affinity = cpus;
+}
+
+/**
+ * @brief Gets number of observed descriptors
+ */
+std::size_t reactor::get_observers_count()
+{
+	std::unique_lock<std::mutex> lock{_observers_mutex};
+	return _observers.size();
+}
+
+/**
+ * @brief Gets copy of reactor counters and queue depths
+ */
+reactor_metrics_snapshot reactor::get_metrics()
+{
+	reactor_metrics_snapshot snapshot;
+	_metrics.fill(snapshot);
+	snapshot.observers = get_observers_count();
+	{
+		std::unique_lock<std::mutex> lock{_changes_mutex};
+		snapshot.pending_changes = _pending_changes.size();
+	}
+	{
+		std::unique_lock<std::mutex> lock{_timers_mutex};
+		snapshot.pending_timers = _timers.size();
+	}
+	return snapshot;
+}
+
+/**
+ * @brief Sets CPU affinity of polling thread (called from polling thread)
+ */
+void reactor::apply_cpu_affinity()
+{
+	if (_cpu_affinity.empty())
+		return;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int cpu : _cpu_affinity)
+		CPU_SET(cpu, &cpus);
+
+	int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (error != 0)
+		MROBOT_LOG_WARNING(poll_exception( "Cannot set CPU affinity of polling thread.", strerror(error) ).what());
+}
+
+/**
+ * @brief Switches polling thread to SCHED_FIFO policy (called from polling thread)
+ *
+ * Without CAP_SYS_NICE (or RLIMIT_RTPRIO) the thread keeps normal
+ * scheduling, which can be checked with is_realtime().
+ */
+void reactor::apply_realtime_priority()
+{
+	if (_realtime_priority <= 0)
+		return;
+
+	sched_param parameters{};
+	parameters.sched_priority = std::min(_realtime_priority, sched_get_priority_max(SCHED_FIFO));
+
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters);
+	if (error != 0)
+	{
+		MROBOT_LOG_WARNING(poll_exception( "Cannot set real-time priority of polling thread.", strerror(error) ).what());
+		return;
+	}
+	_is_realtime = true;
+}
+
+/**
+ * @brief Interrupts epoll_wait() (or io_uring_enter()) in polling thread
+ */
+void reactor::wake_up()
+{
+	eventfd_write(_wake_up_fd, 1);
+}
+
+/**
+ * @brief Creates io_uring instance, falls back to epoll when it isn't available
+ */
+void reactor::start_io_uring()
+{
+	try
+	{
+		_io_uring.reset(new io_uring_queue{_io_uring_entries});
+		// wait timeout is needed by poll timeout and by timers
+		if (!_io_uring->has_timeout_support())
+			throw poll_exception
+			{ "Kernel doesn't support io_uring wait timeout." };
+	} catch (poll_exception& ex)
+	{
+		MROBOT_LOG_WARNING(ex.what() << "Falling back to epoll backend.\n");
+		_io_uring.reset();
+	}
+	_is_wake_up_read_submitted = false;
+	_submitted_operations_count = 0;
+}
+
+/**
+ * @brief Submits scheduled operations, waits for completions and dispatches them
+ *
+ * Reads and writes of all descriptors which need new operations, together
+ * with waiting for completions, are done by single io_uring_enter() call.
+ */
+void reactor::complete_io_uring_operations()
+{
+	submit_scheduled_operations();
+
+	if (_io_uring->submit_and_wait(wait_timeout()) < 0 && errno != EINTR
+			&& errno != ETIME && errno != EBUSY)
+		throw poll_exception
+		{ "Error when waiting for io_uring completions.", strerror(errno) };
+
+	if (_trace_ring && _trace_ring->is_enabled())
+		_wakeup_time = trace_time();
+
+	_removed_observers.clear();
+	reactor_metrics::add(_metrics.wakeups);
+	unsigned long long dispatched_events = _metrics.dispatched_events.load(std::memory_order_relaxed);
+
+	_io_uring->process_completions([this](std::uint64_t user_data, int result)
+	{	process_completion(user_data, result);});
+
+	if (_metrics.dispatched_events.load(std::memory_order_relaxed) == dispatched_events)
+		reactor_metrics::add(_metrics.empty_wakeups);
+
+	if (_is_poll_thread_running)
+		run_expired_timers();
+}
+
+/**
+ * @brief Marks entry as needing new submissions (observers mutex has to be locked)
+ */
+void reactor::schedule_submission(observer_entry& entry)
+{
+	if (entry.is_scheduled)
+		return;
+	entry.is_scheduled = true;
+	_scheduled_entries.push_back(&entry);
+}
+
+/**
+ * @brief Submits reads and writes for scheduled entries
+ *
+ * Owners are called without observers mutex locked, because they can
+ * call set_write_interest() (e.g. when transmit queue becomes empty).
+ */
+void reactor::submit_scheduled_operations()
+{
+	// wake up read isn't renewed when operations are drained after polling was stopped
+	if (!_is_wake_up_read_submitted && _is_poll_thread_running)
+		submit_wake_up_read();
+
+	{
+		std::unique_lock<std::mutex> lock{_observers_mutex};
+		_submitting_entries.swap(_scheduled_entries);
+		for (observer_entry* entry : _submitting_entries)
+			entry->is_scheduled = false;
+	}
+
+	for (observer_entry* entry : _submitting_entries)
+	{
+		if (!entry->is_registered)
+			continue;
+		if (!entry->is_read_submitted)
+			submit_read(*entry);
+
+		bool is_write_interested;
+		{
+			std::unique_lock<std::mutex> lock{_observers_mutex};
+			is_write_interested = _write_interests.count(entry->file_descriptor) != 0;
+		}
+		if (is_write_interested && !entry->is_write_submitted)
+			submit_write(*entry);
+	}
+	_submitting_entries.clear();
+}
+
+/**
+ * @brief Submits read into owner memory (or poll for input when owner doesn't support completion I/O)
+ */
+void reactor::submit_read(observer_entry& entry)
+{
+	int regions_count = 0;
+	if (entry.observer->is_completion_io_supported())
+		regions_count = entry.observer->prepare_read(entry.read_regions);
+
+	io_uring_sqe* sqe = _io_uring->get_sqe();
+	sqe->fd = entry.file_descriptor;
+	sqe->user_data = reinterpret_cast<std::uintptr_t>(&entry) | read_operation;
+
+	entry.is_read_completion_io = regions_count > 0;
+	if (entry.is_read_completion_io)
+	{
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = reinterpret_cast<std::uintptr_t>(entry.read_regions);
+		sqe->len = regions_count;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+	}
+
+	entry.is_read_submitted = true;
+	_submitted_operations_count++;
+}
+
+/**
+ * @brief Submits write of owner data (or poll for output when owner doesn't support completion I/O)
+ */
+void reactor::submit_write(observer_entry& entry)
+{
+	int buffers_count = 0;
+	entry.is_write_completion_io = entry.observer->is_completion_io_supported();
+	if (entry.is_write_completion_io)
+	{
+		buffers_count = entry.observer->prepare_write(entry.write_buffers, _max_write_buffers);
+		if (buffers_count == 0)
+			return;
+	}
+
+	io_uring_sqe* sqe = _io_uring->get_sqe();
+	sqe->fd = entry.file_descriptor;
+	sqe->user_data = reinterpret_cast<std::uintptr_t>(&entry) | write_operation;
+
+	if (entry.is_write_completion_io)
+	{
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = reinterpret_cast<std::uintptr_t>(entry.write_buffers);
+		sqe->len = buffers_count;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLOUT;
+	}
+
+	entry.is_write_submitted = true;
+	_submitted_operations_count++;
+}
+
+/**
+ * @brief Submits read of wake up event, so other threads can interrupt io_uring_enter()
+ */
+void reactor::submit_wake_up_read()
+{
+	io_uring_sqe* sqe = _io_uring->get_sqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = _wake_up_fd;
+	sqe->addr = reinterpret_cast<std::uintptr_t>(&_wake_up_value);
+	sqe->len = sizeof(_wake_up_value);
+	sqe->user_data = wake_up_operation;
+	_is_wake_up_read_submitted = true;
+}
+
+/**
+ * @brief Requests cancellation of entry operations in flight
+ */
+void reactor::cancel_operations(observer_entry& entry)
+{
+	entry.is_removing = true;
+	for (std::uintptr_t operation :
+	{ read_operation, write_operation })
+	{
+		if ((operation == read_operation && !entry.is_read_submitted)
+				|| (operation == write_operation && !entry.is_write_submitted))
+			continue;
+
+		io_uring_sqe* sqe = _io_uring->get_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = reinterpret_cast<std::uintptr_t>(&entry) | operation;
+		sqe->user_data = cancel_operation;
+	}
+}
+
+/**
+ * @brief Dispatches single io_uring completion
+ * @param user_data entry address and operation tag
+ * @param result result of operation (negative errno on error)
+ */
+void reactor::process_completion(std::uint64_t user_data, int result)
+{
+	auto tag = static_cast<operation_tag>(user_data & tag_mask);
+
+	if (tag == cancel_operation)
+		return;
+
+	if (tag == wake_up_operation)
+	{
+		_is_wake_up_read_submitted = false;
+		if (_is_poll_thread_running)
+			apply_pending_changes();
+		return;
+	}
+
+	auto& entry = *reinterpret_cast<observer_entry*>(user_data & ~static_cast<std::uint64_t>(tag_mask));
+	_submitted_operations_count--;
+	if (tag == read_operation)
+		entry.is_read_submitted = false;
+	else
+		entry.is_write_submitted = false;
+
+	if (entry.is_removing)
+	{
+		if (!entry.is_read_submitted && !entry.is_write_submitted)
+		{
+			ifile_descriptor_owner* observer = entry.observer;
+			{
+				std::unique_lock<std::mutex> lock{_observers_mutex};
+				if (entry.is_scheduled)
+					_scheduled_entries.erase(std::find(_scheduled_entries.begin(),
+							_scheduled_entries.end(), &entry));
+				auto found = _observers.find(entry.file_descriptor);
+				if (found != _observers.end() && &found->second == &entry)
+					_observers.erase(found);
+			}
+			finish_removal(observer);
+		}
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock{_observers_mutex};
+		schedule_submission(entry);
+	}
+
+	// completion could be returned before observer was removed by other handler
+	if (std::find(_removed_observers.begin(), _removed_observers.end(),
+			entry.observer) != _removed_observers.end())
+		return;
+
+	reactor_metrics::add(_metrics.dispatched_events);
+	if (tag == read_operation)
+	{
+		if (entry.is_read_completion_io)
+			entry.observer->complete_read(result);
+		else if (result >= 0)
+			entry.observer->process_data();
+	}
+	else
+	{
+		if (entry.is_write_completion_io)
+			entry.observer->complete_write(result);
+		else if (result >= 0)
+			entry.observer->process_write();
+	}
+}
+
+}
@@ -0,0 +1,109 @@
+/*
+ * replay_engine.cpp
+ *
+ *  Created on: May 1, 2016
+ *      Author: rafal
+ */
+
+#include "replay_engine.h"
+#include "serial_port_exception.h"
+#include "trace.h"
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace mrobot
+{
+
+/**
+ * @throws serial_port_exception
+ */
+replay_pty::replay_pty()
+{
+	_master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (_master < 0)
+		throw serial_port_exception("Cannot open pseudo-terminal.", strerror(errno));
+
+	char device[64];
+	if (grantpt(_master) < 0 || unlockpt(_master) < 0 || ptsname_r(_master, device, sizeof(device)) != 0)
+	{
+		int error = errno;
+		close(_master);
+		throw serial_port_exception("Cannot prepare pseudo-terminal.", strerror(error));
+	}
+	_device = device;
+}
+
+replay_pty::~replay_pty()
+{
+	close(_master);
+}
+
+replay_engine::replay_engine(capture_reader& reader) :
+		_reader(reader)
+{
+}
+
+/**
+ * @brief Replays capture from its beginning (blocks until all records are replayed or stop() is called)
+ * @throws serial_port_exception
+ */
+replay_statistics replay_engine::run()
+{
+	replay_statistics statistics;
+	_is_stopped = false;
+	_reader.rewind();
+
+	std::uint64_t start_time = trace_time();
+	std::uint64_t first_record_time = 0;
+	capture_record record;
+
+	while (!_is_stopped && _reader.next(record))
+	{
+		if (first_record_time == 0)
+			first_record_time = record.time;
+
+		auto target = _targets.find(record.port_id);
+		if (record.direction != capture_direction::received || target == _targets.end())
+			continue;
+
+		if (_speed > 0)
+		{
+			std::uint64_t deadline = start_time + static_cast<std::uint64_t>((record.time - first_record_time) / _speed);
+			timespec wake_up_time{static_cast<time_t>(deadline / 1000000000u), static_cast<long>(deadline % 1000000000u)};
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_up_time, nullptr) == EINTR)
+				;
+		}
+
+		write_all(target->second, record.data);
+		statistics.records++;
+		statistics.bytes += record.data.size;
+	}
+
+	statistics.duration = std::chrono::nanoseconds{trace_time() - start_time};
+	return statistics;
+}
+
+/**
+ * @throws serial_port_exception
+ */
+void replay_engine::write_all(int file_descriptor, buffer_view data)
+{
+	std::size_t written = 0;
+	while (written < data.size)
+	{
+		ssize_t result = write(file_descriptor, data.data + written, data.size - written);
+		if (result < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw serial_port_exception("Error when replaying data.", strerror(errno));
+		}
+		written += result;
+	}
+}
+
+}
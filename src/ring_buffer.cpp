@@ -0,0 +1,130 @@
+/*
+ * ring_buffer.cpp
+ *
+ *  Created on: Mar 2, 2016
+ *      Author: rafal
+ */
+
+#include "ring_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace mrobot
+{
+
+/**
+ * @param capacity requested capacity in bytes (rounded up to power of two)
+ */
+ring_buffer::ring_buffer(std::size_t capacity)
+{
+	resize(capacity);
+}
+
+/**
+ * @brief Changes buffer capacity, stored data is preserved
+ *
+ * @param capacity requested capacity in bytes (rounded up to power of two,
+ * never smaller than amount of stored data)
+ */
+void ring_buffer::resize(std::size_t capacity)
+{
+	std::size_t stored = size();
+	capacity = round_up_to_power_of_two(std::max(capacity, stored));
+
+	std::unique_ptr<char[]> data{new char[capacity]};
+	read(data.get(), stored);
+
+	_data = std::move(data);
+	_mask = capacity - 1;
+	_read_index = 0;
+	_write_index = stored;
+}
+
+/**
+ * @brief Describes free space of the buffer
+ * @param regions filled with free memory regions
+ * @return number of filled regions (0 when buffer is full)
+ */
+int ring_buffer::writable_regions(iovec regions[2])
+{
+	std::size_t free = free_space();
+	if (free == 0)
+		return 0;
+
+	std::size_t start = _write_index & _mask;
+	std::size_t first = std::min(free, capacity() - start);
+
+	regions[0].iov_base = _data.get() + start;
+	regions[0].iov_len = first;
+	if (first == free)
+		return 1;
+
+	regions[1].iov_base = _data.get();
+	regions[1].iov_len = free - first;
+	return 2;
+}
+
+/**
+ * @brief Marks bytes written to writable regions as stored
+ * @param count number of written bytes
+ */
+void ring_buffer::commit(std::size_t count)
+{
+	_write_index += count;
+}
+
+/**
+ * @brief Gets contiguous view of the oldest stored data
+ *
+ * If stored data wraps around end of memory, only first part is returned.
+ * Next part is returned after first is consumed.
+ */
+buffer_view ring_buffer::readable_front() const
+{
+	std::size_t start = _read_index & _mask;
+	return {_data.get() + start, std::min(size(), capacity() - start)};
+}
+
+/**
+ * @brief Copies and consumes stored data
+ * @param destination memory to which data is copied
+ * @param count maximal number of bytes to copy
+ * @return number of copied bytes
+ */
+std::size_t ring_buffer::read(char* destination, std::size_t count)
+{
+	std::size_t copied = 0;
+	count = std::min(count, size());
+	while (copied < count)
+	{
+		buffer_view front = readable_front();
+		std::size_t chunk = std::min(front.size, count - copied);
+		std::memcpy(destination + copied, front.data, chunk);
+		consume(chunk);
+		copied += chunk;
+	}
+	return copied;
+}
+
+/**
+ * @brief Removes oldest stored data
+ * @param count number of bytes to remove
+ */
+void ring_buffer::consume(std::size_t count)
+{
+	_read_index += std::min(count, size());
+
+	// rewind empty buffer, so next data is stored contiguously
+	if (empty())
+		clear();
+}
+
+std::size_t ring_buffer::round_up_to_power_of_two(std::size_t value)
+{
+	std::size_t result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+}
@@ -6,11 +6,13 @@
  */
 
 #include "serial_port.h"
+#include "reactor.h"
+#include "baudrate.h"
+#include <linux/serial.h>
 
 namespace mrobot
 {
 
-
 serial_port::serial_port(std::string device, baudrate_option baudrate, data_bits_option data_bits,
 		parity_option parity, stop_bits_option stop_bits): _device(device)
 {
@@ -18,14 +20,28 @@ serial_port::serial_port(std::string device, baudrate_option baudrate, data_bits
 	configure(baudrate, data_bits, parity, stop_bits);
 }
 
+/**
+ * @param baudrate any baud rate in bits per second (see configure())
+ */
+serial_port::serial_port(std::string device, unsigned int baudrate, data_bits_option data_bits,
+		parity_option parity, stop_bits_option stop_bits): _device(device)
+{
+	open_device(device);
+	configure(baudrate, data_bits, parity, stop_bits);
+}
+
 serial_port::~serial_port()
 {
+	if(_worker_pool)
+		_worker_pool->detach(this);
 	close(_file_descriptor);
 }
 
 /**
  * @brief Opens tty (serial) device given in input argument
- * By default blocking behavior is enabled.
+ * Device is opened in non blocking mode, so it can be drained
+ * by edge triggered poll controler. Blocking behavior of
+ * send_data() and receive_data() is emulated with poll().
  *
  * @param device serial device name
  * @throws serial_port_exception
@@ -42,7 +58,6 @@ void serial_port::open_device(std::string device)
 	{
 		throw serial_port_exception{"System function open() can't open file.", strerror(errno)};
 	}
-	fcntl(_file_descriptor, F_SETFL, 0); // enable blocking behavior
 	_is_opend = true;
 }
 /**
@@ -57,6 +72,27 @@ void serial_port::open_device(std::string device)
  * @throws serial_port_exception
  */
 void serial_port::configure(baudrate_option baudrate, data_bits_option data_bits, parity_option parity, stop_bits_option stop_bits)
+{
+	configure(from_speed_constant(static_cast<unsigned int>(baudrate)), data_bits, parity, stop_bits);
+}
+
+/**
+ * @brief Configures tty ( serial ) device with any baud rate
+ *
+ * Standard speed constant (Bxxx) is used when it exists, other rates
+ * (e.g. 250000 or 2000000 on adapters without such constant) are set
+ * with termios2 BOTHER interface. Rate applied by driver is read back
+ * (see get_baudrate()), because driver can round it to nearest rate
+ * supported by hardware.
+ *
+ * @param baudrate baud rate in bits per second
+ * @param data_bits number of data bits
+ * @param parity parity check
+ * @param stop_bits number of stop bits
+ *
+ * @throws serial_port_exception
+ */
+void serial_port::configure(unsigned int baudrate, data_bits_option data_bits, parity_option parity, stop_bits_option stop_bits)
 {
 	// structure used to tty device configuration
 	termios config;
@@ -123,6 +159,8 @@ void serial_port::configure(baudrate_option baudrate, data_bits_option data_bits
 	 // configure data bits
 	 config.c_cflag &= ~CSIZE;
 	 config.c_cflag |= static_cast<unsigned int>(data_bits);
+	 int character_bits = 1 + (data_bits == data_bits_option::six ? 6 : data_bits == data_bits_option::seven ? 7 : 8)
+			 + (parity == parity_option::none ? 0 : 1) + (stop_bits == stop_bits_option::two ? 2 : 1);
 	 // TODO change configuration to consent with this at this site   http://www.cmrr.umn.edu/~strupp/serial.html#3_1
 
      // driver will read input bytes
@@ -130,11 +168,13 @@ void serial_port::configure(baudrate_option baudrate, data_bits_option data_bits
  	 config.c_cflag |= (CLOCAL|CREAD);
 
  	 // set up control characters
-	 config.c_cc[VMIN]  = 1; // one input byte is enough to return from read()
-	 config.c_cc[VTIME] = 0; // inter character timer off
+	 config.c_cc[VMIN]  = get_batch_size(); // number of input bytes which make device readable
+	 config.c_cc[VTIME] = 0; // inter character timer off (gaps are measured by reactor timers)
 
-	 // communication speed
-	 if(cfsetispeed(&config,static_cast<unsigned int>(baudrate)) < 0 || cfsetospeed(&config, static_cast<unsigned int>(baudrate)) < 0)
+	 // communication speed (rate without speed constant is set after other settings)
+	 unsigned int speed = B38400;
+	 bool is_standard_baudrate = to_speed_constant(baudrate, speed);
+	 if(cfsetispeed(&config, speed) < 0 || cfsetospeed(&config, speed) < 0)
 	 {
 		 throw serial_port_exception("Error when setting baud rate.", strerror(errno));
 	 }
@@ -144,132 +184,1788 @@ void serial_port::configure(baudrate_option baudrate, data_bits_option data_bits
 	 {
 		 throw serial_port_exception("Cannot apply new configuration.", strerror(errno));
 	 }
+
+	 if(!is_standard_baudrate)
+		 set_custom_baudrate(_file_descriptor, baudrate);
+	 _baudrate = get_actual_baudrate(_file_descriptor);
+
+	 _character_time = std::chrono::microseconds{_baudrate == 0 ? 0 : character_bits * 1000000LL / _baudrate};
 	 _is_configured = true;
 }
 
+/**
+ * @brief Selects when received data is passed to event handlers
+ *
+ * - low_latency - each read is delivered immediately, polling thread
+ *   is woken up by every received byte,
+ * - batched - device becomes readable when batch size (see
+ *   set_min_data_to_read()) is received (VMIN), smaller batch is
+ *   delivered when no byte arrives for inter-byte timeout (checked by
+ *   reactor timer armed by received data, idle port has no timer and
+ *   its device is readable with first byte of next batch),
+ * - packet_gap - data is collected until line is silent for inter-byte
+ *   timeout (3.5 characters by default, like Modbus RTU) and delivered
+ *   as one packet.
+ *
+ * Mode should be changed before port is added to poll controler.
+ * @param mode read mode
+ * @throws serial_port_exception
+ */
+void serial_port::set_read_mode(read_mode mode)
+{
+	_read_mode = mode;
+	apply_read_mode();
+}
+
+/**
+ * @brief Enables mode for latency sensitive (control loop) ports
+ *
+ * Sets ASYNC_LOW_LATENCY flag of tty driver, so received data is pushed
+ * to line discipline immediately instead of being deferred, selects
+ * low_latency read mode and starts measuring round-trip latency (time
+ * from send to next received data, see get_round_trip_latency()).
+ * Drivers which don't support TIOCSSERIAL (e.g. pseudo-terminals, some
+ * USB adapters) are left unchanged, but read mode and measurement are
+ * still enabled. Port can be additionally added to low latency shard of
+ * poll controler (see poll_controler::add_low_latency_shard()).
+ * @param is_enabled true to enable low latency mode
+ * @return true if driver flag was changed
+ * @throws serial_port_exception
+ */
+bool serial_port::set_low_latency(bool is_enabled)
+{
+	_is_round_trip_measured = is_enabled;
+	_request_send_time = 0;
+	if(is_enabled)
+		set_read_mode(read_mode::low_latency);
+
+	serial_struct serial_info{};
+	if(ioctl(_file_descriptor, TIOCGSERIAL, &serial_info) < 0)
+		return false;
+
+	if(is_enabled)
+		serial_info.flags |= ASYNC_LOW_LATENCY;
+	else
+		serial_info.flags &= ~ASYNC_LOW_LATENCY;
+
+	if(ioctl(_file_descriptor, TIOCSSERIAL, &serial_info) < 0)
+		return false;
+
+	_is_driver_low_latency = is_enabled;
+	return true;
+}
+
+/**
+ * @brief Remembers time of request, if round-trip latency is measured
+ *
+ * Only first send after received data is remembered, so round trip of
+ * request sent in several parts is measured from its beginning.
+ */
+void serial_port::mark_send_time()
+{
+	if(!_is_round_trip_measured)
+		return;
+
+	std::int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+	std::int64_t expected = 0;
+	_request_send_time.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Records message accepted by send_async() (send time, capture and enqueue trace stamp)
+ * @param data whole message
+ * @param trace_id id of traced message (zero if message isn't sampled)
+ * @param enqueue_time time of enqueue stamp of traced message
+ */
+void serial_port::record_accepted_send(buffer_view data, std::uint64_t trace_id, std::uint64_t enqueue_time)
+{
+	mark_send_time();
+	if(_capture)
+		_capture->record(capture_direction::sent, _capture_port_id, trace_time(), data);
+	trace_ring* ring = _trace_ring.load(std::memory_order_relaxed);
+	if(trace_id != 0 && ring != nullptr)
+		ring->record(trace_point::transmit_enqueue, _file_descriptor, trace_id, data.size, enqueue_time);
+}
+
+/**
+ * @brief Sets number of bytes delivered at once in batched read mode
+ *
+ * Values bigger than 255 (maximal VMIN) are collected in receive buffer.
+ * @param min_data_to_read_count batch size in bytes
+ * @throws serial_port_exception
+ */
+void serial_port::set_min_data_to_read(int min_data_to_read_count)
+{
+	_min_data_to_read_count = min_data_to_read_count;
+	apply_read_mode();
+}
+
+/**
+ * @brief Sets silence on the line which ends batch or packet
+ * @param timeout inter-byte timeout (zero means 3.5 characters at configured
+ * baud rate, but at least 1750 us as required by Modbus RTU above 19200 baud)
+ */
+void serial_port::set_inter_byte_timeout(std::chrono::microseconds timeout)
+{
+	_inter_byte_timeout = timeout;
+}
+
+/**
+ * @brief Gets inter-byte timeout used by batched and packet gap read modes
+ */
+std::chrono::microseconds serial_port::get_inter_byte_timeout()
+{
+	constexpr std::chrono::microseconds min_packet_gap{1750};
+
+	if(_inter_byte_timeout > std::chrono::microseconds::zero())
+		return _inter_byte_timeout;
+	return std::max(_character_time * 7 / 2, min_packet_gap);
+}
+
+/**
+ * @brief Gets number of bytes which make device readable (VMIN)
+ */
+std::size_t serial_port::get_batch_size()
+{
+	if(_read_mode != read_mode::batched || _min_data_to_read_count <= 0 || _is_idle_wakeup_set)
+		return 1;
+	return std::min(_min_data_to_read_count, 255);
+}
+
+/**
+ * @brief Updates VMIN and VTIME of device according to read mode
+ * @throws serial_port_exception
+ */
+void serial_port::apply_read_mode()
+{
+	termios config;
+	if(tcgetattr(_file_descriptor, &config) < 0)
+		throw serial_port_exception("Cannot get serial interface configuration", strerror(errno));
+
+	config.c_cc[VMIN] = get_batch_size();
+	config.c_cc[VTIME] = 0;
+
+	if(tcsetattr(_file_descriptor, TCSANOW, &config) < 0)
+		throw serial_port_exception("Cannot apply new configuration.", strerror(errno));
+}
+
 
 /**
  * @brief Sends data through serial port
  *
- * This function counts data in buffer, then
- * creates temporary char array with will hold all input data.
- * After input data is copied to array it will be written to
- * serial device file by system function write(). If write
- * is successful buffer will be flushed.
+ * Data is written directly from the buffer (without intermediate copy).
+ * Function returns when whole buffer is written, or when it is copied to
+ * coalescing buffer (see set_write_coalescing()).
  * @param buffer holds data to send
  * @throws serial_port_exception
  */
 void serial_port::send_data(const std::vector<char>& buffer)
 {
-	//std::unique_lock<std::mutex> lock{_fd_mutex};
+	send(buffer_view{buffer});
+}
+
+/**
+ * @brief Sends contiguous block of data through serial port
+ * @param data data to send
+ * @throws serial_port_exception
+ */
+void serial_port::send(buffer_view data)
+{
+	iovec buffers[2] = {iovec{const_cast<char*>(data.data), data.size}};
+	write_message(buffers, 1, false);
+}
+
+/**
+ * @brief Sends list of buffers through serial port (scatter/gather write)
+ *
+ * All buffers are passed to single writev() call, so e.g. header, payload
+ * and CRC of the frame are sent without copying them to one buffer.
+ * @param buffers data to send, in order of transmission
+ * @throws serial_port_exception
+ */
+void serial_port::send(std::initializer_list<buffer_view> buffers)
+{
+	// one more buffer for checksum
+	iovec local_buffers[_max_local_buffers + 1];
+	std::vector<iovec> dynamic_buffers;
+	iovec* iov = local_buffers;
+
+	if(buffers.size() > _max_local_buffers)
+	{
+		dynamic_buffers.resize(buffers.size() + 1);
+		iov = dynamic_buffers.data();
+	}
 
-	int length = buffer.size();
-	char out_buffer[length];
+	int count = 0;
+	for(const buffer_view& buffer : buffers)
+		iov[count++] = iovec{const_cast<char*>(buffer.data), buffer.size};
 
-	int i = 0;
-	for (const char&c : buffer)
+	write_message(iov, count, false);
+}
+
+/**
+ * @brief Sends array of iovec structures through serial port
+ * @param buffers data to send (not modified)
+ * @param count number of elements in buffers
+ * @throws serial_port_exception
+ */
+void serial_port::send(const iovec* buffers, int count)
+{
+	// copy is modified by write (and gets one more buffer for checksum)
+	iovec local_buffers[_max_local_buffers + 1];
+	std::vector<iovec> dynamic_buffers;
+	iovec* iov = local_buffers;
+
+	if(static_cast<std::size_t>(count) > _max_local_buffers)
 	{
-		out_buffer[i++] = c;
+		dynamic_buffers.resize(count + 1);
+		iov = dynamic_buffers.data();
 	}
 
-	// write data to file
-	int written_bytes = write(_file_descriptor, out_buffer, length);
+	std::copy(buffers, buffers + count, iov);
+	write_message(iov, count, false);
+}
 
-	if (written_bytes < 0)
-		throw serial_port_exception("Error when sending data.",
-				strerror(errno));
-	else if (written_bytes < length)
-		throw serial_port_exception("Less elements written than expected.",
-				strerror(errno));
+/**
+ * @brief Sends data immediately, even if write coalescing is enabled
+ *
+ * Data waiting in coalescing buffer is written before the message by the
+ * same writev() call, so order of messages is kept.
+ * @param data data to send
+ * @throws serial_port_exception
+ */
+void serial_port::send_urgent(buffer_view data)
+{
+	iovec buffers[2] = {iovec{const_cast<char*>(data.data), data.size}};
+	write_message(buffers, 1, true);
 }
 
+/**
+ * @brief Writes data waiting in coalescing buffer
+ * @throws serial_port_exception
+ */
+void serial_port::flush()
+{
+	std::unique_lock<std::mutex> lock{_coalescing_mutex};
+	write_coalescing_buffer();
+}
 
 /**
- * @brief Subscribe data ready event
- * @param event_handler function which will handle data ready event
+ * @brief Enables gathering of small blocking sends in one outgoing buffer
+ *
+ * Messages sent by send_data() and send() are copied to coalescing buffer
+ * and written by single system call when buffer reaches threshold or when
+ * the oldest message waited for deadline, whichever comes first. Deadline
+ * is checked by every send and by reactor timer (rounded up to timer tick),
+ * so port has to be added to poll controler - otherwise messages are
+ * written immediately. Messages not smaller than threshold and messages
+ * sent by send_urgent() are written at once, together with buffered data.
+ *
+ * Timer doesn't block polling thread - it passes buffered data to
+ * transmit queue (regardless of its capacity), which is written when
+ * device accepts it. Later blocking sends wait until queued data is
+ * written (in polling thread they are queued too), so order of messages
+ * is kept. Buffered data isn't written when port is destroyed, call
+ * flush() before.
+ * @param threshold number of buffered bytes which causes write
+ * @param deadline maximal time which message waits in buffer
  */
-void serial_port::subscribe_data_ready_event(data_ready_event_handler& event_handler)
+void serial_port::set_write_coalescing(std::size_t threshold, std::chrono::microseconds deadline)
 {
-	if(!_is_data_ready_event_subscribed)
+	std::unique_lock<std::mutex> lock{_coalescing_mutex};
+	_coalescing_threshold = threshold;
+	_coalescing_deadline = deadline;
+	_coalescing_buffer.reserve(threshold);
+	_is_write_coalescing_enabled = true;
+}
+
+/**
+ * @brief Writes buffered data and disables write coalescing
+ * @throws serial_port_exception
+ */
+void serial_port::disable_write_coalescing()
+{
+	std::unique_lock<std::mutex> lock{_coalescing_mutex};
+	_is_write_coalescing_enabled = false;
+	write_coalescing_buffer();
+}
+
+/**
+ * @brief Writes message or puts it in coalescing buffer
+ * @param buffers data of message, with space for one more buffer (for checksum)
+ * @param count number of buffers with data
+ * @param is_urgent message (and buffered data) is written immediately
+ * @throws serial_port_exception
+ */
+void serial_port::write_message(iovec* buffers, int count, bool is_urgent)
+{
+	char checksum[4];
+	count = append_checksum(buffers, count, checksum);
+
+	if(!_is_write_coalescing_enabled)
 	{
-		_data_ready_event_handler = event_handler;
-		_is_data_ready_event_subscribed = true;
+		write_all(buffers, count);
+		return;
 	}
+
+	std::unique_lock<std::mutex> lock{_coalescing_mutex};
+	write_coalesced(buffers, count, is_urgent);
 }
 
-void serial_port::unsubscribe_data_ready_event()
+/**
+ * @brief Appends message to coalescing buffer or writes it with buffered data (coalescing mutex has to be locked)
+ * @param buffers data of message (including checksum)
+ * @param count number of buffers
+ * @param is_urgent message (and buffered data) is written immediately
+ * @throws serial_port_exception
+ */
+void serial_port::write_coalesced(iovec* buffers, int count, bool is_urgent)
 {
-	if(_is_data_ready_event_subscribed)
+	std::size_t size = 0;
+	for(int i = 0; i < count; i++)
+		size += buffers[i].iov_len;
+
+	if(_is_write_coalescing_enabled && !is_urgent && size < _coalescing_threshold && _reactor != nullptr)
 	{
-		_is_data_ready_event_subscribed = false;
+		auto now = std::chrono::steady_clock::now();
+		if(_coalesced_messages_count == 0)
+		{
+			_coalescing_buffer.clear();
+			_coalescing_start = now;
+		}
+		for(int i = 0; i < count; i++)
+		{
+			const char* data = static_cast<const char*>(buffers[i].iov_base);
+			_coalescing_buffer.insert(_coalescing_buffer.end(), data, data + buffers[i].iov_len);
+		}
+		_coalesced_messages_count++;
+		port_metrics::add(_metrics.coalesced_messages);
+
+		if(_coalescing_buffer.size() >= _coalescing_threshold || now - _coalescing_start >= _coalescing_deadline)
+			write_coalescing_buffer();
+		else if(_coalesced_messages_count == 1)
+			schedule_coalescing_timer();
+		return;
+	}
+
+	if(_coalesced_messages_count == 0)
+	{
+		write_coalesced_batch(buffers, count, 1);
+		return;
+	}
+
+	// buffered data goes first, message is written by the same system call
+	iovec local_buffers[_max_local_buffers + 2];
+	std::vector<iovec> dynamic_buffers;
+	iovec* iov = local_buffers;
+
+	if(static_cast<std::size_t>(count) + 1 > _max_local_buffers + 2)
+	{
+		dynamic_buffers.resize(count + 1);
+		iov = dynamic_buffers.data();
+	}
+
+	iov[0] = iovec{_coalescing_buffer.data(), _coalescing_buffer.size()};
+	std::copy(buffers, buffers + count, iov + 1);
+	write_coalesced_batch(iov, count + 1, end_coalescing_batch() + 1);
+}
+
+/**
+ * @brief Writes messages stored in coalescing buffer (coalescing mutex has to be locked)
+ * @throws serial_port_exception
+ */
+void serial_port::write_coalescing_buffer()
+{
+	if(_coalesced_messages_count == 0)
+		return;
+
+	iovec buffer{_coalescing_buffer.data(), _coalescing_buffer.size()};
+	write_coalesced_batch(&buffer, 1, end_coalescing_batch());
+}
+
+/**
+ * @brief Writes batch after data queued at earlier deadline (coalescing mutex has to be locked)
+ *
+ * Sending thread waits until transmit queue is written by polling thread,
+ * polling thread (which can't wait for itself) queues the batch.
+ * @throws serial_port_exception
+ */
+void serial_port::write_coalesced_batch(iovec* buffers, int count, std::size_t messages_count)
+{
+	{
+		std::unique_lock<std::mutex> lock{_transmit_mutex};
+		reactor* owner_reactor = _reactor;
+		if(!_transmit_queue.empty() && owner_reactor != nullptr)
+		{
+			if(owner_reactor->is_poll_thread())
+			{
+				auto batch = std::make_shared<std::vector<char>>();
+				for(int i = 0; i < count; i++)
+				{
+					const char* data = static_cast<const char*>(buffers[i].iov_base);
+					batch->insert(batch->end(), data, data + buffers[i].iov_len);
+				}
+				lock.unlock();
+				queue_coalesced_batch(std::move(batch), messages_count);
+				return;
+			}
+			_transmit_space_condition.wait(lock, [this]
+			{	return _transmit_queue.empty() || _reactor == nullptr;});
+		}
 	}
+	write_all(buffers, count, messages_count);
 }
 
 /**
- * @brief Read data from serial port
+ * @brief Writes batch without blocking, the rest is put in transmit queue
+ *
+ * Batch is queued even if transmit queue is full, because its messages
+ * were already accepted by blocking sends.
+ * @param batch messages (with checksums) written by single write
+ * @param messages_count number of messages in batch
+ * @throws serial_port_exception
  */
-void serial_port::read_data()
+void serial_port::queue_coalesced_batch(std::shared_ptr<std::vector<char>> batch, std::size_t messages_count)
 {
-	//std::unique_lock<std::mutex> lock{_fd_mutex};
+	buffer_view data{*batch};
+	mark_send_time();
+	if(_capture)
+		_capture->record(capture_direction::sent, _capture_port_id, trace_time(), data);
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
 
-	char read_buffer[_data_buffer_size];
-	std::memset(read_buffer, 0, _data_buffer_size);
+	std::size_t written_bytes = 0;
+	if(_transmit_queue.empty())
+	{
+		written_bytes = write_some(data);
+		_transmit_stats.sent_bytes += written_bytes;
+		if(written_bytes == data.size)
+		{
+			port_metrics::add(_metrics.frames_out, messages_count);
+			_transmit_stats.sent_messages++;
+			return;
+		}
+	}
 
-	int read_bytes = read(_file_descriptor, read_buffer, _data_buffer_size);
+	reactor* owner_reactor = _reactor;
+	if(owner_reactor == nullptr)
+	{
+		lock.unlock();
+		iovec unsent{const_cast<char*>(data.data) + written_bytes, data.size - written_bytes};
+		write_all(&unsent, 1, messages_count);
+		return;
+	}
 
-	if(read_bytes < 0)
-		throw serial_port_exception{"Error when reading data from serial port", strerror(errno)};
+	// queue entry counts one message when it is written
+	port_metrics::add(_metrics.frames_out, messages_count - 1);
+	buffer_view unsent{data.data + written_bytes, data.size - written_bytes};
+	_transmit_queue.push_back(transmit_entry{std::move(batch), unsent, 0, 0, nullptr});
+	_transmit_stats.queued_bytes += unsent.size;
+	_transmit_stats.queued_messages++;
+	_transmit_stats.peak_queued_bytes = std::max(_transmit_stats.peak_queued_bytes, _transmit_stats.queued_bytes);
 
-	_received_data_buffer.clear();
-	for(int i = 0; i<read_bytes; i++)
+	if(!_is_write_interest_set)
 	{
-		_received_data_buffer.push_back(read_buffer[i]);
+		owner_reactor->set_write_interest(this, true);
+		_is_write_interest_set = true;
 	}
 }
 
 /**
- * @brief Checks if there is data ready to read.
- * @return size of data to read in bytes
+ * @brief Marks buffered messages as written and cancels deadline timer (coalescing mutex has to be locked)
+ *
+ * Buffer content stays valid until next message is appended, so it can be
+ * written after the call. When write fails, buffered messages are lost.
+ * @return number of messages in finished batch
  */
-int serial_port::is_data_ready()
+std::size_t serial_port::end_coalescing_batch()
 {
-	// data ready to read
-	int bytes = 0;
+	std::size_t messages_count = _coalesced_messages_count;
+	_coalesced_messages_count = 0;
+	_coalescing_batch++;
+	port_metrics::add(_metrics.coalesced_writes);
 
-	ioctl(_file_descriptor, FIONREAD, &bytes); // check number of bytes ready to read
+	reactor* owner_reactor = _reactor;
+	std::uint64_t timer_id = _coalescing_timer.exchange(0);
+	if(timer_id != 0 && owner_reactor != nullptr)
+		owner_reactor->cancel_timer(timer_id);
+	return messages_count;
+}
 
-	return bytes;
+/**
+ * @brief Schedules write of current batch at its deadline (coalescing mutex has to be locked)
+ */
+void serial_port::schedule_coalescing_timer()
+{
+	reactor* owner_reactor = _reactor;
+	if(owner_reactor == nullptr)
+		return;
+
+	std::uint64_t batch = _coalescing_batch;
+	std::chrono::microseconds delay = _coalescing_deadline - std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - _coalescing_start);
+	_coalescing_timer = owner_reactor->schedule_timer(this, delay, [this, batch]
+	{
+		process_coalescing_deadline(batch);
+	});
 }
 
 /**
- * @brief Reads data from serial port
- * @param buffer received data buffer
+ * @brief Passes batch which reached its deadline to transmit queue (called by reactor timer)
+ *
+ * When sending thread holds coalescing buffer (e.g. waits for device),
+ * polling thread doesn't wait for it - check is repeated after deadline.
+ * @param batch number of batch for which timer was scheduled
  */
-void serial_port::receive_data(std::vector<char>& buffer)
+void serial_port::process_coalescing_deadline(std::uint64_t batch)
 {
-	//std::unique_lock<std::mutex> lock{_fd_mutex};
+	std::unique_lock<std::mutex> lock{_coalescing_mutex, std::try_to_lock};
+	if(!lock.owns_lock())
+	{
+		// sending thread cancels stored timer when it writes the batch
+		reactor* owner_reactor = _reactor;
+		if(owner_reactor != nullptr)
+			_coalescing_timer = owner_reactor->schedule_timer(this, _coalescing_deadline, [this, batch]
+			{
+				process_coalescing_deadline(batch);
+			});
+		return;
+	}
 
-	int buffer_size = buffer.size();
-	char read_buffer[buffer_size];
-	std::memset(read_buffer, 0, buffer_size);
+	// batch was already written by send or flush
+	if(batch != _coalescing_batch || _coalesced_messages_count == 0)
+		return;
+	_coalescing_timer = 0;
 
-	int read_bytes = read(_file_descriptor, read_buffer, buffer_size);
+	// buffer is handed over to transmit queue (new batch gets new buffer)
+	auto data = std::make_shared<std::vector<char>>(std::move(_coalescing_buffer));
+	_coalescing_buffer = std::vector<char>{};
+	_coalescing_buffer.reserve(_coalescing_threshold);
+	std::size_t messages_count = end_coalescing_batch();
+	queue_coalesced_batch(std::move(data), messages_count);
+}
 
-	if(read_bytes < 0)
-		throw serial_port_exception{"Error when reading data from serial port", strerror(errno)};
+/**
+ * @brief Adds buffer with checksum of all buffers (when send checksum is enabled)
+ * @param buffers data of message, with space for one more buffer
+ * @param count number of buffers with data
+ * @param checksum memory for checksum (at least 4 bytes), has to be valid until message is written
+ * @return number of buffers to write
+ */
+int serial_port::append_checksum(iovec* buffers, int count, char* checksum)
+{
+	if(!_is_send_checksum_enabled)
+		return count;
+
+	std::uint32_t value = get_initial_checksum(_send_checksum_type);
+	for(int i = 0; i < count; i++)
+		value = update_checksum(_send_checksum_type, value, buffer_view{static_cast<const char*>(buffers[i].iov_base), buffers[i].iov_len});
+	write_checksum(_send_checksum_type, value, checksum);
+	buffers[count] = iovec{checksum, get_checksum_size(_send_checksum_type)};
+	return count + 1;
+}
+
+/**
+ * @brief Writes all buffers to device
+ *
+ * Partial writes are continued and interrupted writes are repeated.
+ * When device can't accept more data function waits until it is writable.
+ * @param buffers data to send, modified to track progress of the transfer
+ * @param count number of elements in buffers
+ * @param messages_count number of messages carried by buffers
+ * @throws serial_port_exception
+ */
+void serial_port::write_all(iovec* buffers, int count, std::size_t messages_count)
+{
+	//std::unique_lock<std::mutex> lock{_fd_mutex};
+	mark_send_time();
+	if(_capture)
+		_capture->record(capture_direction::sent, _capture_port_id, trace_time(), buffers, count);
 
-	buffer.clear();
-	for(int i = 0; i<read_bytes; i++)
+	while(count > 0)
 	{
-		buffer.push_back(read_buffer[i]);
+		// skip empty (or already written) buffers
+		if(buffers->iov_len == 0)
+		{
+			buffers++;
+			count--;
+			continue;
+		}
+
+		ssize_t written_bytes = writev(_file_descriptor, buffers, std::min(count, IOV_MAX));
+		port_metrics::add(_metrics.write_calls);
+		if(written_bytes < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN)
+			{
+				wait_for(POLLOUT);
+				continue;
+			}
+			port_metrics::add(_metrics.write_errors);
+			throw serial_port_exception("Error when sending data.", strerror(errno));
+		}
+		port_metrics::add(_metrics.bytes_out, written_bytes);
+
+		// advance through written buffers
+		std::size_t remaining = written_bytes;
+		while(count > 0 && remaining >= buffers->iov_len)
+		{
+			remaining -= buffers->iov_len;
+			buffers++;
+			count--;
+		}
+		if(count > 0)
+		{
+			buffers->iov_base = static_cast<char*>(buffers->iov_base) + remaining;
+			buffers->iov_len -= remaining;
+		}
 	}
+	port_metrics::add(_metrics.frames_out, messages_count);
 }
 
-void serial_port::process_data()
+
+/**
+ * @brief Queues data for sending without blocking on device
+ *
+ * When transmit queue is empty, data is written immediately as far as
+ * device accepts it. Remaining data is copied to transmit queue, which is
+ * drained by poll controler when device becomes writable (port has to be
+ * added to poll controler, otherwise nothing is written and exception is
+ * thrown). When queue is full, behavior depends on
+ * backpressure option. Completion handler is called from polling thread,
+ * or from calling thread when data was written immediately or dropped.
+ *
+ * @param data data to send
+ * @param completion_handler function called when data is sent, dropped or fails (can be empty)
+ * @return false if data was dropped because transmit queue was full
+ * @throws serial_port_exception
+ */
+bool serial_port::send_async(buffer_view data, const send_completion_handler& completion_handler)
 {
-	read_data();
-	if(_is_data_ready_event_subscribed)
-		_data_ready_event_handler(*this,_received_data_buffer);
+	return send_async(data, nullptr, completion_handler);
+}
+
+/**
+ * @brief Queues shared payload for sending without copying it
+ *
+ * Works like send_async() with buffer view, but unsent part of payload
+ * isn't copied - transmit queue keeps reference to it, so one payload can
+ * be queued on many ports (see port_group).
+ * @param payload data to send (mustn't be modified until it is sent)
+ * @param completion_handler function called when data is sent, dropped or fails (can be empty)
+ * @return false if data was dropped because transmit queue was full
+ * @throws serial_port_exception
+ */
+bool serial_port::send_async(const std::shared_ptr<const std::vector<char>>& payload, const send_completion_handler& completion_handler)
+{
+	return send_async(buffer_view{*payload}, payload, completion_handler);
+}
+
+/**
+ * @param payload owner of data kept by transmit queue (nullptr means data is copied)
+ */
+bool serial_port::send_async(buffer_view data, std::shared_ptr<const void> payload, const send_completion_handler& completion_handler)
+{
+	// data gathered by blocking sends is written first, so order of messages is kept
+	if(_is_write_coalescing_enabled)
+		flush();
+
+	if(_is_send_checksum_enabled)
+	{
+		// message with checksum is created once and kept by transmit queue, so it isn't copied again
+		std::size_t checksum_size = get_checksum_size(_send_checksum_type);
+		auto message = std::make_shared<std::vector<char>>(data.size + checksum_size);
+		std::memcpy(message->data(), data.data, data.size);
+		write_checksum(_send_checksum_type, compute_checksum(_send_checksum_type, data), message->data() + data.size);
+		data = buffer_view{*message};
+		payload = std::move(message);
+	}
+
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+	// checked before anything is written, so failed send leaves device untouched
+	reactor* owner_reactor = _reactor;
+	if(owner_reactor == nullptr)
+		throw serial_port_exception("Asynchronous send requires port added to poll controler.");
+
+	// message is recorded only when it is accepted (written or queued), but time of enqueue stamp is taken before write
+	std::uint64_t trace_id = 0;
+	std::uint64_t enqueue_time = 0;
+	trace_ring* ring = _trace_ring.load(std::memory_order_relaxed);
+	if(ring != nullptr && ring->sample(_transmit_trace_countdown))
+	{
+		trace_id = ++_traced_messages_count;
+		enqueue_time = trace_time();
+	}
+
+	std::size_t written_bytes = 0;
+	if(_transmit_queue.empty())
+	{
+		written_bytes = write_some(data);
+		_transmit_stats.sent_bytes += written_bytes;
+
+		if(written_bytes == data.size)
+		{
+			record_accepted_send(data, trace_id, enqueue_time);
+			if(trace_id != 0)
+				record_trace(trace_point::write_complete, trace_id, data.size);
+			port_metrics::add(_metrics.frames_out);
+			_transmit_stats.sent_messages++;
+			lock.unlock();
+			if(completion_handler)
+				completion_handler(*this, send_status::sent);
+			return true;
+		}
+	}
+
+	std::size_t remaining = data.size - written_bytes;
+	if(!has_transmit_space(remaining))
+	{
+		switch(_backpressure)
+		{
+		case backpressure_option::drop:
+			_transmit_stats.dropped_messages++;
+			lock.unlock();
+			if(completion_handler)
+				completion_handler(*this, send_status::dropped);
+			return false;
+		case backpressure_option::error:
+			throw serial_port_exception("Transmit queue is full.");
+		case backpressure_option::block:
+			if(owner_reactor->is_poll_thread())
+				throw serial_port_exception("Transmit queue is full (polling thread can't block).");
+			_transmit_space_condition.wait(lock, [this, remaining]
+			{	return has_transmit_space(remaining) || _reactor == nullptr;});
+			if(_reactor == nullptr)
+				throw serial_port_exception("Port removed from poll controler while waiting for transmit queue.");
+			break;
+		}
+	}
+
+	buffer_view unsent{data.data + written_bytes, remaining};
+	if(!payload)
+	{
+		auto copy = std::make_shared<std::vector<char>>(unsent.begin(), unsent.end());
+		unsent = buffer_view{*copy};
+		payload = std::move(copy);
+	}
+	_transmit_queue.push_back(transmit_entry{std::move(payload), unsent, 0, trace_id, completion_handler});
+	record_accepted_send(data, trace_id, enqueue_time);
+	_transmit_stats.queued_bytes += remaining;
+	_transmit_stats.queued_messages++;
+	_transmit_stats.peak_queued_bytes = std::max(_transmit_stats.peak_queued_bytes, _transmit_stats.queued_bytes);
+
+	if(!_is_write_interest_set)
+	{
+		owner_reactor->set_write_interest(this, true);
+		_is_write_interest_set = true;
+	}
+	return true;
+}
+
+/**
+ * @brief Sets maximal number of bytes stored in transmit queue
+ *
+ * Message is always accepted by empty queue, even if it is bigger than capacity.
+ * @param capacity queue capacity in bytes
+ */
+void serial_port::set_transmit_queue_capacity(std::size_t capacity)
+{
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+	_transmit_queue_capacity = capacity;
+	_transmit_space_condition.notify_all();
+}
+
+/**
+ * @brief Sets behavior of send_async() when transmit queue is full
+ */
+void serial_port::set_backpressure(backpressure_option backpressure)
+{
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+	_backpressure = backpressure;
+}
+
+/**
+ * @brief Gets snapshot of transmit queue depth and counters
+ */
+transmit_queue_stats serial_port::get_transmit_queue_stats()
+{
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+	return _transmit_stats;
+}
+
+/**
+ * @brief Writes as much data as device accepts without blocking
+ * @return number of written bytes
+ * @throws serial_port_exception
+ */
+std::size_t serial_port::write_some(buffer_view data)
+{
+	std::size_t written = 0;
+	while(written < data.size)
+	{
+		ssize_t written_bytes = write(_file_descriptor, data.data + written, data.size - written);
+		port_metrics::add(_metrics.write_calls);
+		if(written_bytes < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN)
+				break;
+			port_metrics::add(_metrics.write_errors);
+			throw serial_port_exception("Error when sending data.", strerror(errno));
+		}
+		port_metrics::add(_metrics.bytes_out, written_bytes);
+		written += written_bytes;
+	}
+	return written;
+}
+
+/**
+ * @brief Checks if message fits in transmit queue (transmit mutex has to be locked)
+ */
+bool serial_port::has_transmit_space(std::size_t size)
+{
+	return _transmit_queue.empty() || _transmit_stats.queued_bytes + size <= _transmit_queue_capacity;
+}
+
+/**
+ * @brief Writes queued messages when device becomes writable
+ *
+ * Up to _max_write_batch messages are written by single writev() call.
+ * When queue becomes empty, write interest is removed from reactor.
+ */
+void serial_port::process_write()
+{
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+
+	iovec buffers[_max_write_batch];
+	int count = collect_transmit_buffers(buffers, _max_write_batch);
+
+	ssize_t written_bytes = 0;
+	if(count > 0)
+	{
+		do
+		{
+			written_bytes = writev(_file_descriptor, buffers, count);
+			port_metrics::add(_metrics.write_calls);
+		}
+		while(written_bytes < 0 && errno == EINTR);
+	}
+
+	advance_transmit_queue(written_bytes < 0 ? -errno : written_bytes);
+
+	lock.unlock();
+	complete_transmissions(_write_completions);
+}
+
+/**
+ * @brief Describes queued messages for io_uring write
+ *
+ * Queued messages aren't removed until write completes, so described
+ * memory stays valid.
+ */
+int serial_port::prepare_write(iovec* buffers, int max_count)
+{
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+	return collect_transmit_buffers(buffers, max_count);
+}
+
+/**
+ * @brief Processes result of io_uring write of queued messages
+ * @param result number of written bytes or negative errno
+ */
+void serial_port::complete_write(int result)
+{
+	port_metrics::add(_metrics.write_calls);
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+	advance_transmit_queue(result);
+	lock.unlock();
+	complete_transmissions(_write_completions);
+}
+
+/**
+ * @brief Describes free space of receive buffer for io_uring read
+ *
+ * In batched and packet gap modes data is read by gap timer too, so
+ * reactor only polls for input (which respects VMIN) and process_data()
+ * reads in polling thread.
+ */
+int serial_port::prepare_read(iovec regions[2])
+{
+	if(_read_mode != read_mode::low_latency)
+		return 0;
+	return _receive_buffer.writable_regions(regions);
+}
+
+/**
+ * @brief Processes result of io_uring read into receive buffer
+ * @param result number of read bytes or negative errno
+ * @throws serial_port_exception
+ */
+void serial_port::complete_read(int result)
+{
+	port_metrics::add(_metrics.read_calls);
+	if(result < 0)
+	{
+		if(result == -EAGAIN || result == -EINTR || result == -ECANCELED)
+			return;
+		port_metrics::add(_metrics.read_errors);
+		throw serial_port_exception{"Error when reading data from serial port", strerror(-result)};
+	}
+
+	if(_capture && result > 0)
+	{
+		iovec regions[2];
+		int regions_count = _receive_buffer.writable_regions(regions);
+		capture_received(regions, regions_count, result);
+	}
+
+	_receive_buffer.commit(result);
+	port_metrics::add(_metrics.bytes_in, result);
+	_metrics.read_size.record(result);
+	_metrics.update_peak_receive_buffer(_receive_buffer.size());
+	if(result > 0)
+		trace_read(result);
+	deliver_data();
+}
+
+/**
+ * @brief Fills iovec array with queued data (transmit mutex has to be locked)
+ * @return number of filled buffers
+ */
+int serial_port::collect_transmit_buffers(iovec* buffers, int max_count)
+{
+	int count = 0;
+	for(auto entry = _transmit_queue.begin(); entry != _transmit_queue.end() && count < max_count; ++entry)
+		buffers[count++] = iovec{const_cast<char*>(entry->data.data) + entry->offset, entry->data.size - entry->offset};
+	return count;
+}
+
+/**
+ * @brief Removes written data from transmit queue (transmit mutex has to be locked)
+ *
+ * Completions of finished messages are collected in _write_completions.
+ * On device error all queued messages fail. When queue becomes empty,
+ * write interest is removed from reactor.
+ * @param result number of written bytes or negative errno
+ */
+void serial_port::advance_transmit_queue(ssize_t result)
+{
+	if(result < 0 && result != -EAGAIN && result != -EINTR && result != -ECANCELED)
+	{
+		// device error - nothing from the queue can be sent
+		port_metrics::add(_metrics.write_errors);
+		for(auto& entry : _transmit_queue)
+			_write_completions.emplace_back(std::move(entry.completion_handler), send_status::failed);
+		_transmit_stats.failed_messages += _transmit_queue.size();
+		_transmit_queue.clear();
+		_transmit_stats.queued_bytes = 0;
+		_transmit_stats.queued_messages = 0;
+	}
+	else if(result > 0)
+	{
+		std::size_t remaining = result;
+		port_metrics::add(_metrics.bytes_out, remaining);
+		_transmit_stats.sent_bytes += remaining;
+		_transmit_stats.queued_bytes -= remaining;
+
+		while(remaining > 0)
+		{
+			transmit_entry& entry = _transmit_queue.front();
+			std::size_t chunk = std::min(remaining, entry.data.size - entry.offset);
+			entry.offset += chunk;
+			remaining -= chunk;
+
+			if(entry.offset == entry.data.size)
+			{
+				if(entry.trace_id != 0)
+					record_trace(trace_point::write_complete, entry.trace_id, entry.data.size);
+				_write_completions.emplace_back(std::move(entry.completion_handler), send_status::sent);
+				port_metrics::add(_metrics.frames_out);
+				_transmit_stats.sent_messages++;
+				_transmit_stats.queued_messages--;
+				_transmit_queue.pop_front();
+			}
+		}
+	}
+
+	reactor* owner_reactor = _reactor;
+	if(_transmit_queue.empty() && _is_write_interest_set && owner_reactor != nullptr)
+	{
+		owner_reactor->set_write_interest(this, false);
+		_is_write_interest_set = false;
+	}
+	_transmit_space_condition.notify_all();
+}
+
+/**
+ * @brief Calls completion handlers (transmit mutex can't be locked)
+ */
+void serial_port::complete_transmissions(std::vector<transmit_completion>& completions)
+{
+	for(auto& completion : completions)
+	{
+		if(completion.first)
+			completion.first(*this, completion.second);
+	}
+	completions.clear();
+}
+
+/**
+ * @brief Remembers reactor which observes device
+ *
+ * When port is added to reactor with data already queued (e.g. when it
+ * is moved between poll controler shards), write interest is restored.
+ * @param owner_reactor reactor (nullptr when port is removed)
+ */
+void serial_port::attach(reactor* owner_reactor)
+{
+	std::unique_lock<std::mutex> lock{_transmit_mutex};
+	_reactor = owner_reactor;
+	_trace_ring = owner_reactor != nullptr ? owner_reactor->get_trace_ring() : nullptr;
+	_is_write_interest_set = false;
+
+	if(owner_reactor != nullptr && !_transmit_queue.empty())
+	{
+		owner_reactor->set_write_interest(this, true);
+		_is_write_interest_set = true;
+	}
+	_transmit_space_condition.notify_all();
+	lock.unlock();
+
+	if(owner_reactor == nullptr)
+	{
+		// timers are cancelled when port is removed (when it is moved to other shard, they are moved with it)
+		std::unique_lock<std::mutex> coalescing_lock{_coalescing_mutex};
+		_coalescing_timer = 0;
+		_is_gap_timer_scheduled = false;
+		coalescing_lock.unlock();
+		set_idle_wakeup(false);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> coalescing_lock{_coalescing_mutex};
+		if(_coalesced_messages_count > 0 && _coalescing_timer == 0)
+			schedule_coalescing_timer();
+	}
+
+	if(!_is_buffer_pool_set && owner_reactor->get_buffer_pool())
+		_buffer_pool = owner_reactor->get_buffer_pool();
+
+	if(_read_mode != read_mode::low_latency && !_receive_buffer.empty())
+		schedule_gap_timer(get_inter_byte_timeout());
+	else
+		set_idle_wakeup(true);
+}
+
+/**
+ * @brief Subscribe data ready event
+ * @param event_handler function which will handle data ready event
+ */
+void serial_port::subscribe_data_ready_event(data_ready_event_handler& event_handler)
+{
+	if(!_is_data_ready_event_subscribed)
+	{
+		_data_ready_event_handler = event_handler;
+		_is_data_ready_event_subscribed = true;
+	}
+}
+
+void serial_port::unsubscribe_data_ready_event()
+{
+	if(_is_data_ready_event_subscribed)
+	{
+		_is_data_ready_event_subscribed = false;
+	}
+}
+
+/**
+ * @brief Subscribe data view event
+ *
+ * Handler gets views pointing directly to receive buffer, which are
+ * valid only until handler returns.
+ * @param event_handler function which will handle received data
+ */
+void serial_port::subscribe_data_view_event(const data_view_event_handler& event_handler)
+{
+	if(!_is_data_view_event_subscribed)
+	{
+		_data_view_event_handler = event_handler;
+		_is_data_view_event_subscribed = true;
+	}
+}
+
+void serial_port::unsubscribe_data_view_event()
+{
+	if(_is_data_view_event_subscribed)
+	{
+		_is_data_view_event_subscribed = false;
+	}
+}
+
+/**
+ * @brief Subscribe buffer event
+ *
+ * Handler gets received data in reference counted pool buffers, which
+ * can be kept or passed to other threads without copying. Buffer returns
+ * to pool when its last copy is destroyed. Pool of poll controler is used
+ * when port is added to it, otherwise port creates its own pool.
+ * @param event_handler function which will handle received buffers
+ */
+void serial_port::subscribe_buffer_event(const buffer_event_handler& event_handler)
+{
+	if(!_is_buffer_event_subscribed)
+	{
+		if(!_buffer_pool)
+			_buffer_pool = buffer_pool::create();
+		_buffer_event_handler = event_handler;
+		_is_buffer_event_subscribed = true;
+	}
+}
+
+void serial_port::unsubscribe_buffer_event()
+{
+	if(_is_buffer_event_subscribed)
+	{
+		_is_buffer_event_subscribed = false;
+	}
+}
+
+/**
+ * @brief Sets pool of buffers passed to buffer event handler
+ *
+ * Explicitly set pool isn't replaced by pool of poll controler. When pool
+ * has limited number of blocks and all are used, received data isn't
+ * passed to buffer event handler (other handlers still get it).
+ * Has to be called before port is added to poll controler.
+ * @param pool buffer pool (nullptr restores pool of poll controler)
+ */
+void serial_port::set_buffer_pool(std::shared_ptr<buffer_pool> pool)
+{
+	_is_buffer_pool_set = pool != nullptr;
+	_buffer_pool = std::move(pool);
+
+	reactor* owner_reactor = _reactor;
+	if(!_buffer_pool && owner_reactor != nullptr)
+		_buffer_pool = owner_reactor->get_buffer_pool();
+	if(!_buffer_pool && _is_buffer_event_subscribed)
+		_buffer_pool = buffer_pool::create();
+}
+
+/**
+ * @brief Moves handlers of received data to worker pool
+ *
+ * Polling thread only reads data, copies it into pool buffers and pushes
+ * them to lock-free queue of the port, so cost of handlers doesn't delay
+ * I/O. All handlers (including frame decoding) are called by single
+ * worker, so data of the port is handled in order. When queue (or bounded
+ * buffer pool) is full, data is dropped and counted in dispatch_overflows
+ * metric. Has to be called before port is added to poll controler.
+ * @param pool worker pool (nullptr restores calling handlers by polling thread)
+ * @param queue_capacity number of buffers which can wait for worker
+ */
+void serial_port::set_worker_pool(std::shared_ptr<worker_pool> pool, std::size_t queue_capacity)
+{
+	if(_worker_pool)
+		_worker_pool->detach(this);
+	_dispatch_queue.reset();
+	_worker_pool = std::move(pool);
+
+	if(_worker_pool)
+	{
+		if(!_buffer_pool)
+			_buffer_pool = buffer_pool::create();
+		_dispatch_queue.reset(new spsc_queue<pooled_buffer>{queue_capacity});
+		_worker = _worker_pool->attach(this);
+	}
+}
+
+/**
+ * @brief Records traffic of port to capture file
+ *
+ * Every read chunk and every sent message is recorded with its time.
+ * Many ports can share one writer. Has to be called before port is added
+ * to poll controler.
+ * @param writer capture file (nullptr disables capture)
+ * @param port_id identifier of port in capture file
+ */
+void serial_port::set_capture(std::shared_ptr<capture_writer> writer, std::uint32_t port_id)
+{
+	_capture = std::move(writer);
+	_capture_port_id = port_id;
+}
+
+/**
+ * @brief Appends checksum to every sent message
+ *
+ * Checksum of whole message (all buffers of scatter/gather send) is sent
+ * after it, without copying blocking sends. Asynchronous sends copy message
+ * with checksum once. Received frames can be validated by checksum_decoder.
+ * Has to be called before sending.
+ * @param type CRC appended to messages
+ */
+void serial_port::set_send_checksum(checksum_type type)
+{
+	_send_checksum_type = type;
+	_is_send_checksum_enabled = true;
+}
+
+/**
+ * @brief Sets decoder which splits received data into frames
+ *
+ * Decoder is used only when frame event is subscribed. Decoders for
+ * delimiter terminated, length prefixed, SLIP and COBS frames are
+ * available (see frame_decoder.h).
+ * @param decoder frame decoder (nullptr disables framing)
+ */
+void serial_port::set_frame_decoder(std::unique_ptr<frame_decoder> decoder)
+{
+	_frame_decoder = std::move(decoder);
+}
+
+/**
+ * @brief Subscribe frame event
+ *
+ * Handler is called only with complete frames found by frame decoder.
+ * Frame views are valid only until handler returns.
+ * @param event_handler function which will handle received frames
+ */
+void serial_port::subscribe_frame_event(const frame_event_handler& event_handler)
+{
+	if(!_is_frame_event_subscribed)
+	{
+		_frame_event_handler = event_handler;
+		_decoded_frame_handler = [this](buffer_view frame)
+		{
+			port_metrics::add(_metrics.frames_in);
+			_frame_event_handler(*this, frame);
+		};
+		_is_frame_event_subscribed = true;
+	}
+}
+
+void serial_port::unsubscribe_frame_event()
+{
+	if(_is_frame_event_subscribed)
+	{
+		_is_frame_event_subscribed = false;
+		if(_frame_decoder)
+			_frame_decoder->reset();
+	}
+}
+
+/**
+ * @brief Gets copy of port counters
+ *
+ * Counters are updated without locks, only transmit queue depth is read
+ * under transmit mutex. Can be called from any thread.
+ */
+port_metrics_snapshot serial_port::get_metrics()
+{
+	port_metrics_snapshot snapshot;
+	_metrics.fill(snapshot);
+
+	{
+		std::unique_lock<std::mutex> lock{_transmit_mutex};
+		snapshot.transmit_queue_bytes = _transmit_stats.queued_bytes;
+		snapshot.transmit_queue_messages = _transmit_stats.queued_messages;
+		snapshot.dropped_messages = _transmit_stats.dropped_messages;
+	}
+
+	if(_frame_decoder)
+		snapshot.frame_errors = _frame_decoder->get_errors_count();
+	if(_dispatch_queue)
+		snapshot.dispatch_queue_depth = _dispatch_queue->size();
+	return snapshot;
+}
+
+/**
+ * @brief Changes size of receive buffer
+ *
+ * Whole free space of the buffer is filled by single read, so bigger
+ * buffer means less system calls when data rate is high. Buffer is used
+ * by polling thread, so it can be resized only when port isn't added to
+ * poll controler.
+ * @param size buffer size in bytes (rounded up to power of two)
+ */
+void serial_port::set_receive_buffer_size(std::size_t size)
+{
+	if(_reactor != nullptr)
+		throw serial_port_exception("Receive buffer can't be resized while port is added to poll controler.");
+	_receive_buffer.resize(size);
+}
+
+/**
+ * @brief Read available data from serial port to receive buffer
+ *
+ * Free space of the receive buffer is filled by single readv() call.
+ * Reading is repeated only when it was interrupted by signal.
+ * @return true if receive buffer was filled completely (device can have more data)
+ */
+bool serial_port::read_data()
+{
+	//std::unique_lock<std::mutex> lock{_fd_mutex};
+
+	iovec regions[2];
+	int regions_count = _receive_buffer.writable_regions(regions);
+	if(regions_count == 0)
+		return true;
+
+	ssize_t read_bytes = 0;
+	do
+	{
+		read_bytes = readv(_file_descriptor, regions, regions_count);
+		port_metrics::add(_metrics.read_calls);
+	}
+	while(read_bytes < 0 && errno == EINTR);
+
+	if(read_bytes < 0)
+	{
+		if(errno == EAGAIN)
+			return false;
+		port_metrics::add(_metrics.read_errors);
+		throw serial_port_exception{"Error when reading data from serial port", strerror(errno)};
+	}
+
+	_receive_buffer.commit(read_bytes);
+	port_metrics::add(_metrics.bytes_in, read_bytes);
+	_metrics.read_size.record(read_bytes);
+	_metrics.update_peak_receive_buffer(_receive_buffer.size());
+	if(read_bytes > 0)
+	{
+		_is_data_received = true;
+		trace_read(read_bytes);
+		if(_capture)
+			capture_received(regions, regions_count, read_bytes);
+	}
+	return _receive_buffer.full();
+}
+
+/**
+ * @brief Passes received data to subscribed handlers and consumes it
+ *
+ * Handlers are called once per contiguous region of the receive buffer
+ * (twice when data wraps around end of the buffer). When worker pool is
+ * set, data is only queued for worker.
+ */
+void serial_port::deliver_data()
+{
+	if(_is_round_trip_measured && !_receive_buffer.empty())
+	{
+		std::int64_t send_time = _request_send_time.exchange(0, std::memory_order_relaxed);
+		if(send_time != 0)
+			_round_trip_latency.record(std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration{send_time});
+	}
+
+	if(_receive_buffer.empty())
+		return;
+
+	std::uint64_t traced_chunk = _traced_chunk;
+	std::size_t size = _receive_buffer.size();
+	_traced_chunk = 0;
+	if(traced_chunk != 0)
+		record_trace(trace_point::handler_enter, traced_chunk, size);
+
+	if(_worker_pool)
+	{
+		while(!_receive_buffer.empty())
+		{
+			buffer_view data = _receive_buffer.readable_front();
+			dispatch_data(data);
+			_receive_buffer.consume(data.size);
+		}
+		_worker_pool->notify(_worker);
+	}
+	else
+	{
+		auto start_time = std::chrono::steady_clock::now();
+		while(!_receive_buffer.empty())
+		{
+			buffer_view data = _receive_buffer.readable_front();
+			call_handlers(data, nullptr);
+			_receive_buffer.consume(data.size);
+		}
+		_metrics.handler_time.record((std::chrono::steady_clock::now() - start_time).count());
+	}
+
+	if(traced_chunk != 0)
+		record_trace(trace_point::handler_exit, traced_chunk, size);
+}
+
+/**
+ * @brief Records wakeup and read time of received chunk when it is sampled
+ *
+ * Handler stamps of chunk are recorded by deliver_data() (in worker pool
+ * mode they mark queueing of data for worker).
+ * @param size number of read bytes
+ */
+void serial_port::trace_read(std::size_t size)
+{
+	trace_ring* ring = _trace_ring.load(std::memory_order_relaxed);
+	if(ring == nullptr || !ring->sample(_receive_trace_countdown))
+		return;
+
+	std::uint64_t read_time = trace_time();
+	_traced_chunk = ++_traced_chunks_count;
+
+	reactor* owner_reactor = _reactor;
+	if(owner_reactor != nullptr && owner_reactor->get_wakeup_time() != 0)
+		ring->record(trace_point::wakeup, _file_descriptor, _traced_chunk, size, owner_reactor->get_wakeup_time());
+	ring->record(trace_point::read, _file_descriptor, _traced_chunk, size, read_time);
+}
+
+/**
+ * @brief Records data which was just read into receive buffer
+ * @param regions free space of receive buffer passed to read
+ * @param size number of read bytes
+ */
+void serial_port::capture_received(const iovec regions[2], int regions_count, std::size_t size)
+{
+	iovec read_regions[2];
+	int count = 0;
+	for(int i = 0; i < regions_count && size > 0; i++)
+	{
+		std::size_t region_size = std::min(size, regions[i].iov_len);
+		read_regions[count++] = iovec{regions[i].iov_base, region_size};
+		size -= region_size;
+	}
+	_capture->record(capture_direction::received, _capture_port_id, trace_time(), read_regions, count);
+}
+
+/**
+ * @brief Records current time of traced chunk or message
+ */
+void serial_port::record_trace(trace_point point, std::uint64_t id, std::size_t size)
+{
+	trace_ring* ring = _trace_ring.load(std::memory_order_relaxed);
+	if(ring != nullptr)
+		ring->record(point, _file_descriptor, id, size, trace_time());
+}
+
+/**
+ * @brief Calls subscribed handlers with received data
+ * @param data received data
+ * @param buffer pool buffer which holds data (nullptr when data is in receive buffer)
+ */
+void serial_port::call_handlers(buffer_view data, const pooled_buffer* buffer)
+{
+	if(_is_data_view_event_subscribed)
+		_data_view_event_handler(*this, data);
+
+	if(_is_buffer_event_subscribed)
+	{
+		if(buffer != nullptr)
+			_buffer_event_handler(*this, *buffer);
+		else
+			deliver_buffers(data);
+	}
+
+	if(_is_data_ready_event_subscribed)
+	{
+		_received_data_buffer.assign(data.begin(), data.end());
+		_data_ready_event_handler(*this, _received_data_buffer);
+	}
+
+	if(_is_frame_event_subscribed && _frame_decoder)
+		_frame_decoder->decode(data, _decoded_frame_handler);
+}
+
+/**
+ * @brief Copies received data into pool buffers and queues them for worker (called by polling thread)
+ */
+void serial_port::dispatch_data(buffer_view data)
+{
+	std::size_t offset = 0;
+	while(offset < data.size)
+	{
+		pooled_buffer buffer = _buffer_pool->acquire();
+		if(!buffer)
+		{
+			port_metrics::add(_metrics.dispatch_overflows);
+			return;
+		}
+
+		std::size_t size = std::min(data.size - offset, buffer.capacity());
+		std::memcpy(buffer.data(), data.data + offset, size);
+		buffer.set_size(size);
+		offset += size;
+
+		if(_dispatch_queue->try_push(std::move(buffer)))
+			port_metrics::add(_metrics.dispatched_buffers);
+		else
+			port_metrics::add(_metrics.dispatch_overflows);
+	}
+}
+
+/**
+ * @brief Calls handlers with queued buffers (called by worker)
+ *
+ * At most _max_dispatch_batch buffers are handled at once, so busy port
+ * doesn't starve other ports of the worker.
+ * @return false when queue was empty
+ */
+bool serial_port::process_dispatched()
+{
+	std::size_t count = 0;
+	auto start_time = std::chrono::steady_clock::now();
+
+	while(count < _max_dispatch_batch && _dispatch_queue->try_pop(_dispatched_buffer))
+	{
+		count++;
+		call_handlers(_dispatched_buffer.view(), &_dispatched_buffer);
+		_dispatched_buffer.reset();
+	}
+
+	if(count != 0)
+		_metrics.handler_time.record((std::chrono::steady_clock::now() - start_time).count());
+	return count != 0;
+}
+
+/**
+ * @brief Copies received data into pool buffers and passes them to buffer event handler
+ *
+ * This is the only copy of received data, steady state doesn't allocate
+ * memory (blocks released by handlers are reused). Data larger than
+ * block is split into several buffers.
+ */
+void serial_port::deliver_buffers(buffer_view data)
+{
+	std::size_t offset = 0;
+	while(offset < data.size)
+	{
+		pooled_buffer buffer = _buffer_pool->acquire();
+		if(!buffer)
+			return;
+
+		std::size_t size = std::min(data.size - offset, buffer.capacity());
+		std::memcpy(buffer.data(), data.data + offset, size);
+		buffer.set_size(size);
+		offset += size;
+		_buffer_event_handler(*this, std::move(buffer));
+	}
+}
+
+/**
+ * @brief Blocks until device is ready for requested operation
+ * @param events poll() events to wait for (POLLIN or POLLOUT)
+ * @throws serial_port_exception
+ */
+void serial_port::wait_for(short events)
+{
+	pollfd device{_file_descriptor, events, 0};
+
+	while(poll(&device, 1, -1) < 0)
+	{
+		if(errno != EINTR)
+			throw serial_port_exception{"Error when waiting for serial port", strerror(errno)};
+	}
+}
+
+/**
+ * @brief Checks if there is data ready to read.
+ * @return size of data to read in bytes
+ */
+int serial_port::is_data_ready()
+{
+	// data ready to read
+	int bytes = 0;
+
+	ioctl(_file_descriptor, FIONREAD, &bytes); // check number of bytes ready to read
+
+	return bytes;
+}
+
+/**
+ * @brief Reads data from serial port
+ *
+ * Data which is already stored in receive buffer is returned first.
+ * Otherwise function blocks until device has data to read.
+ * @param buffer received data buffer, its size determines maximal number of read bytes
+ */
+void serial_port::receive_data(std::vector<char>& buffer)
+{
+	//std::unique_lock<std::mutex> lock{_fd_mutex};
+
+	if(!_receive_buffer.empty())
+	{
+		buffer.resize(_receive_buffer.read(buffer.data(), buffer.size()));
+		return;
+	}
+
+	int read_bytes = read(_file_descriptor, buffer.data(), buffer.size());
+	port_metrics::add(_metrics.read_calls);
+	while(read_bytes < 0 && (errno == EAGAIN || errno == EINTR))
+	{
+		wait_for(POLLIN);
+		read_bytes = read(_file_descriptor, buffer.data(), buffer.size());
+		port_metrics::add(_metrics.read_calls);
+	}
+
+	if(read_bytes < 0)
+	{
+		port_metrics::add(_metrics.read_errors);
+		throw serial_port_exception{"Error when reading data from serial port", strerror(errno)};
+	}
+	port_metrics::add(_metrics.bytes_in, read_bytes);
+	_metrics.read_size.record(read_bytes);
+
+	buffer.resize(read_bytes);
+}
+
+/**
+ * @brief Reads data from device and passes it to subscribed handlers
+ *
+ * When receive buffer was filled completely, reading is repeated after
+ * data is delivered, so device is drained (required in edge triggered mode).
+ * Depending on read mode, data can be kept in receive buffer until batch
+ * is complete or line becomes silent.
+ */
+void serial_port::process_data()
+{
+	_is_data_received = false;
+	bool has_more_data = false;
+	do
+	{
+		has_more_data = read_data();
+		if(has_more_data || is_delivery_due())
+			deliver_data();
+	}
+	while(has_more_data);
+
+	if(_is_data_received && _read_mode != read_mode::low_latency)
+		restart_gap_timer();
+}
+
+/**
+ * @brief Reads all data available in device and delivers it with data stored in receive buffer
+ */
+void serial_port::flush_received_data()
+{
+	bool has_more_data = false;
+	do
+	{
+		has_more_data = read_data();
+		deliver_data();
+	}
+	while(has_more_data);
+}
+
+/**
+ * @brief Checks if data stored in receive buffer should be delivered without waiting for gap
+ */
+bool serial_port::is_delivery_due()
+{
+	switch(_read_mode)
+	{
+	case read_mode::batched:
+		return _receive_buffer.size() >= static_cast<std::size_t>(std::max(_min_data_to_read_count, 1));
+	case read_mode::packet_gap:
+		return false;
+	case read_mode::low_latency:
+	default:
+		return true;
+	}
+}
+
+/**
+ * @brief Schedules check of inter-byte gap, unless check is already pending
+ */
+void serial_port::schedule_gap_timer(std::chrono::microseconds delay)
+{
+	reactor* owner_reactor = _reactor;
+	if(owner_reactor == nullptr || _is_gap_timer_scheduled.exchange(true))
+		return;
+
+	owner_reactor->schedule_timer(this, delay, [this]
+	{
+		_is_gap_timer_scheduled = false;
+		process_gap_timeout();
+	});
+}
+
+/**
+ * @brief Notes time of received data and schedules check of inter-byte gap
+ *
+ * In batched mode, device of port which was idle is made readable by full
+ * batch again.
+ */
+void serial_port::restart_gap_timer()
+{
+	_last_receive_time = std::chrono::steady_clock::now();
+	if(_is_idle_wakeup_set)
+		set_idle_wakeup(false);
+	schedule_gap_timer(get_inter_byte_timeout());
+}
+
+/**
+ * @brief Makes device of idle port in batched mode readable with first byte
+ *
+ * Device holding less than VMIN bytes doesn't become readable, so without
+ * it first bytes of next batch would wait for the rest of the batch.
+ * Device is switched only when port becomes idle or receives again, not
+ * by every read.
+ * @param is_enabled true when port becomes idle
+ * @throws serial_port_exception
+ */
+void serial_port::set_idle_wakeup(bool is_enabled)
+{
+	bool is_batch_waited = _read_mode == read_mode::batched && _min_data_to_read_count > 1;
+	if(_is_idle_wakeup_set == is_enabled || (is_enabled && !is_batch_waited))
+		return;
+	_is_idle_wakeup_set = is_enabled;
+	apply_read_mode();
+}
+
+/**
+ * @brief Delivers data when line was silent for inter-byte timeout (called by reactor timer)
+ *
+ * Timer is armed by received data and gap is measured from last read
+ * which returned data. In batched mode, device can hold less than VMIN
+ * bytes without becoming readable, so they are read when timer expires.
+ * When nothing was read, batch is delivered and port waits for first byte
+ * of next batch without timer. In packet gap mode, packet is delivered when
+ * inter-byte timeout passed since last received data.
+ */
+void serial_port::process_gap_timeout()
+{
+	std::chrono::microseconds timeout = get_inter_byte_timeout();
+	auto silence = std::chrono::steady_clock::now() - _last_receive_time;
+	if(_read_mode != read_mode::low_latency && silence < timeout)
+	{
+		schedule_gap_timer(std::chrono::duration_cast<std::chrono::microseconds>(timeout - silence) + std::chrono::microseconds{1});
+		return;
+	}
+
+	switch(_read_mode)
+	{
+	case read_mode::batched:
+		// reading rearms timer when device held part of batch
+		process_data();
+		if(!_is_data_received)
+		{
+			deliver_data();
+			set_idle_wakeup(true);
+		}
+		break;
+	case read_mode::packet_gap:
+	{
+		// data received after last dispatch extends the packet
+		if(is_data_ready() > 0)
+		{
+			process_data();
+			break;
+		}
+
+		deliver_data();
+		break;
+	}
+	case read_mode::low_latency:
+	default:
+		flush_received_data();
+		break;
+	}
 }
 
 int serial_port::get_file_descriptor()
@@ -0,0 +1,412 @@
+/*
+ * timer_wheel.cpp
+ *
+ *  Created on: May 8, 2016
+ *      Author: rafal
+ */
+
+#include <timer_wheel.h>
+#include <stdexcept>
+
+namespace mrobot
+{
+
+std::atomic<std::uint16_t> timer_wheel::_tags_count{0};
+
+/**
+ * @brief Creates empty wheel
+ * @param tick resolution of deadlines (they are rounded up to ticks)
+ * @param origin time of tick zero (deadlines before it expire immediately)
+ */
+timer_wheel::timer_wheel(timer_clock::duration tick, timer_clock::time_point origin) :
+		_tag(_tags_count.fetch_add(1, std::memory_order_relaxed)), _tick(tick), _origin(origin)
+{
+}
+
+/**
+ * @brief Adds timer to the wheel
+ *
+ * Timer which deadline has already passed is put to due list.
+ * @param deadline time after which timer expires
+ * @param owner pointer used by cancel_owner() (can be nullptr)
+ * @param handler function returned by pop_expired()
+ * @return identifier of the timer (never equal to zero)
+ * @throws std::length_error when wheel holds maximal number of timers
+ */
+std::uint64_t timer_wheel::schedule(timer_clock::time_point deadline, const void* owner, timer_handler handler)
+{
+	std::uint32_t index = allocate(deadline, owner, std::move(handler));
+	_nodes[index].id = make_id(index);
+	return _nodes[index].id;
+}
+
+/**
+ * @brief Removes timer from the wheel (also expired timer which wasn't popped)
+ * @param timer_id identifier returned by schedule() (or identifier of adopted timer)
+ * @return false when timer was already popped or cancelled
+ */
+bool timer_wheel::cancel(std::uint64_t timer_id)
+{
+	std::uint32_t index = static_cast<std::uint32_t>(timer_id & (_max_nodes - 1));
+	if (index >= _nodes.size() || _nodes[index].list == _none || _nodes[index].id != timer_id)
+	{
+		auto adopted = _adopted_timers.find(timer_id);
+		if (adopted == _adopted_timers.end())
+			return false;
+		index = adopted->second;
+	}
+
+	unlink(index);
+	release(index);
+	return true;
+}
+
+/**
+ * @brief Removes all timers of given owner
+ *
+ * Unlike other operations it checks all nodes of the wheel.
+ */
+void timer_wheel::cancel_owner(const void* owner)
+{
+	for (std::uint32_t index = 0; index < _nodes.size(); index++)
+	{
+		if (_nodes[index].list != _none && _nodes[index].owner == owner)
+		{
+			unlink(index);
+			release(index);
+		}
+	}
+}
+
+/**
+ * @brief Removes all timers of given owner and returns them
+ *
+ * Expired timers which weren't popped get deadline which has already
+ * passed, so they expire immediately in wheel which adopts them.
+ * @return timers in order of nodes (not deadlines)
+ */
+std::vector<timer_wheel::timer_entry> timer_wheel::take_owner(const void* owner)
+{
+	std::vector<timer_entry> timers;
+	for (std::uint32_t index = 0; index < _nodes.size(); index++)
+	{
+		node& timer = _nodes[index];
+		if (timer.list == _none || timer.owner != owner)
+			continue;
+
+		timer_clock::time_point deadline = timer_clock::time_point::max();
+		if (timer.list == _due_list)
+			deadline = timer_clock::time_point::min();
+		else if (timer.expiration_tick < (UINT64_MAX >> 1))
+			deadline = _origin + _tick * timer.expiration_tick;
+		timers.push_back(timer_entry{timer.id, deadline, timer.owner, std::move(timer.handler)});
+		unlink(index);
+		release(index);
+	}
+	return timers;
+}
+
+/**
+ * @brief Adds timer taken from other wheel (or from this one)
+ *
+ * Timer keeps its identifier, so it can be cancelled by it.
+ * @param timer timer returned by take_owner()
+ * @throws std::length_error when wheel holds maximal number of timers
+ */
+void timer_wheel::adopt(timer_entry timer)
+{
+	std::uint32_t index = allocate(timer.deadline, timer.owner, std::move(timer.handler));
+	_nodes[index].id = timer.id;
+	_adopted_timers[timer.id] = index;
+}
+
+/**
+ * @brief Moves timers which expired before given time to due list
+ *
+ * Empty slots are skipped with bitmaps of occupied slots, so time of
+ * advance depends on number of non-empty slots, not on elapsed ticks.
+ * @param now current time
+ * @return number of timers in due list
+ */
+std::size_t timer_wheel::advance(timer_clock::time_point now)
+{
+	std::uint64_t target_tick = now > _origin ? static_cast<std::uint64_t>((now - _origin) / _tick) : 0;
+
+	while (_current_tick < target_tick)
+	{
+		std::uint64_t tick = next_event_tick();
+		if (tick > target_tick)
+		{
+			_current_tick = target_tick;
+			break;
+		}
+		_current_tick = tick;
+
+		// timers beyond range of the wheel are inserted again
+		if ((tick & UINT32_MAX) == 0)
+			cascade(_overflow_list);
+
+		for (unsigned level = _levels - 1; level > 0; level--)
+		{
+			if ((tick & ((std::uint64_t{1} << (level * _slot_bits)) - 1)) == 0)
+				cascade(level * _slots + ((tick >> (level * _slot_bits)) & (_slots - 1)));
+		}
+		expire_slot(tick & (_slots - 1));
+	}
+	return _due_count;
+}
+
+/**
+ * @brief Takes first timer from due list
+ * @param handler filled with handler of expired timer
+ * @return false when due list is empty
+ */
+bool timer_wheel::pop_expired(timer_handler& handler)
+{
+	std::uint32_t index = _lists[_due_list].first;
+	if (index == _none)
+		return false;
+
+	handler = std::move(_nodes[index].handler);
+	unlink(index);
+	release(index);
+	return true;
+}
+
+/**
+ * @brief Returns time when wheel should be advanced
+ *
+ * For timers in higher levels it is time of cascade, which can be
+ * earlier than their deadlines. When due list isn't empty, time of
+ * current tick (which has already passed) is returned.
+ */
+timer_clock::time_point timer_wheel::get_next_expiration() const
+{
+	if (_due_count != 0)
+		return _origin + _tick * _current_tick;
+
+	std::uint64_t tick = next_event_tick();
+	if (tick == UINT64_MAX)
+		return timer_clock::time_point::max();
+	return _origin + _tick * tick;
+}
+
+/**
+ * @brief Creates identifier of node from tag of wheel, generation and index
+ */
+std::uint64_t timer_wheel::make_id(std::uint32_t index) const
+{
+	return (static_cast<std::uint64_t>(_tag) << (_index_bits + _generation_bits))
+			| (static_cast<std::uint64_t>(_nodes[index].generation) << _index_bits) | index;
+}
+
+/**
+ * @brief Takes free node and inserts it as timer (identifier is set by caller)
+ * @return index of node
+ * @throws std::length_error when wheel holds maximal number of timers
+ */
+std::uint32_t timer_wheel::allocate(timer_clock::time_point deadline, const void* owner, timer_handler handler)
+{
+	std::uint32_t index = _free_nodes;
+	if (index == _none)
+	{
+		if (_nodes.size() >= _max_nodes)
+			throw std::length_error("Too many timers in timer wheel.");
+		index = static_cast<std::uint32_t>(_nodes.size());
+		_nodes.emplace_back();
+	}
+	else
+		_free_nodes = _nodes[index].next;
+
+	node& timer = _nodes[index];
+	timer.expiration_tick = to_tick(deadline);
+	timer.owner = owner;
+	timer.handler = std::move(handler);
+	insert(index);
+	_count++;
+	return index;
+}
+
+/**
+ * @brief Converts deadline to tick (rounded up)
+ */
+std::uint64_t timer_wheel::to_tick(timer_clock::time_point time) const
+{
+	if (time <= _origin)
+		return 0;
+	if (time - _origin >= _tick * (UINT64_MAX >> 1))
+		return UINT64_MAX >> 1;
+
+	timer_clock::duration elapsed = time - _origin;
+	return static_cast<std::uint64_t>((elapsed + _tick - timer_clock::duration{1}) / _tick);
+}
+
+/**
+ * @brief Puts node to the list matching its expiration tick
+ *
+ * Timer is stored in the lowest level which window contains both current
+ * and expiration tick, so its slot is always ahead of current position.
+ */
+void timer_wheel::insert(std::uint32_t index)
+{
+	std::uint64_t tick = _nodes[index].expiration_tick;
+	if (tick <= _current_tick)
+	{
+		link(_due_list, index);
+		return;
+	}
+
+	for (unsigned level = 0; level < _levels; level++)
+	{
+		unsigned shift = (level + 1) * _slot_bits;
+		if ((tick >> shift) == (_current_tick >> shift))
+		{
+			link(level * _slots + ((tick >> (level * _slot_bits)) & (_slots - 1)), index);
+			return;
+		}
+	}
+	link(_overflow_list, index);
+}
+
+/**
+ * @brief Adds node at the end of given list
+ */
+void timer_wheel::link(std::uint32_t list, std::uint32_t index)
+{
+	node& timer = _nodes[index];
+	list_head& head = _lists[list];
+	timer.list = list;
+	timer.next = _none;
+	timer.previous = head.last;
+	if (head.last == _none)
+		head.first = index;
+	else
+		_nodes[head.last].next = index;
+	head.last = index;
+
+	if (list < _levels * _slots)
+		_occupied_slots[list / 64] |= std::uint64_t{1} << (list % 64);
+	else if (list == _due_list)
+		_due_count++;
+}
+
+/**
+ * @brief Removes node from its list
+ */
+void timer_wheel::unlink(std::uint32_t index)
+{
+	node& timer = _nodes[index];
+	list_head& head = _lists[timer.list];
+	if (timer.previous == _none)
+		head.first = timer.next;
+	else
+		_nodes[timer.previous].next = timer.next;
+	if (timer.next == _none)
+		head.last = timer.previous;
+	else
+		_nodes[timer.next].previous = timer.previous;
+
+	if (timer.list < _levels * _slots)
+	{
+		if (head.first == _none)
+			_occupied_slots[timer.list / 64] &= ~(std::uint64_t{1} << (timer.list % 64));
+	}
+	else if (timer.list == _due_list)
+		_due_count--;
+	timer.list = _none;
+}
+
+/**
+ * @brief Returns unlinked node to free list
+ */
+void timer_wheel::release(std::uint32_t index)
+{
+	node& timer = _nodes[index];
+	if (timer.id != make_id(index))
+		_adopted_timers.erase(timer.id);
+	timer.handler = nullptr;
+	timer.owner = nullptr;
+	timer.id = 0;
+	// zero generation is skipped, so identifiers are never equal to zero
+	if (++timer.generation == (std::uint32_t{1} << _generation_bits))
+		timer.generation = 1;
+	timer.next = _free_nodes;
+	_free_nodes = index;
+	_count--;
+}
+
+/**
+ * @brief Inserts again all timers of higher level slot (or overflow list)
+ *
+ * List is detached first, because its timers can be inserted to it again.
+ */
+void timer_wheel::cascade(std::uint32_t list)
+{
+	std::uint32_t index = _lists[list].first;
+	_lists[list] = list_head{};
+	if (list < _levels * _slots)
+		_occupied_slots[list / 64] &= ~(std::uint64_t{1} << (list % 64));
+
+	while (index != _none)
+	{
+		std::uint32_t next = _nodes[index].next;
+		insert(index);
+		index = next;
+	}
+}
+
+/**
+ * @brief Moves timers of level 0 slot to due list
+ */
+void timer_wheel::expire_slot(unsigned slot)
+{
+	std::uint32_t index = _lists[slot].first;
+	while (index != _none)
+	{
+		std::uint32_t next = _nodes[index].next;
+		unlink(index);
+		link(_due_list, index);
+		index = next;
+	}
+}
+
+/**
+ * @brief Finds first occupied slot of level starting from given slot
+ * @return index of slot or number of slots when there is none
+ */
+unsigned timer_wheel::find_slot(unsigned level, unsigned first_slot) const
+{
+	for (unsigned slot = first_slot; slot < _slots;)
+	{
+		std::uint64_t bits = _occupied_slots[(level * _slots + slot) / 64] >> (slot % 64);
+		if (bits != 0)
+			return slot + __builtin_ctzll(bits);
+		slot = (slot / 64 + 1) * 64;
+	}
+	return _slots;
+}
+
+/**
+ * @brief Finds tick in which first timer expires or is cascaded
+ *
+ * All occupied slots are ahead of current position, so the first one in
+ * the lowest level gives the nearest tick.
+ * @return tick number (UINT64_MAX when wheel is empty)
+ */
+std::uint64_t timer_wheel::next_event_tick() const
+{
+	for (unsigned level = 0; level < _levels; level++)
+	{
+		unsigned shift = level * _slot_bits;
+		unsigned slot = find_slot(level, ((_current_tick >> shift) & (_slots - 1)) + 1);
+		if (slot < _slots)
+			return ((_current_tick >> (shift + _slot_bits)) << (shift + _slot_bits))
+					| (static_cast<std::uint64_t>(slot) << shift);
+	}
+
+	if (_lists[_overflow_list].first != _none)
+		return ((_current_tick >> (_levels * _slot_bits)) + 1) << (_levels * _slot_bits);
+	return UINT64_MAX;
+}
+
+}
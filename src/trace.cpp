@@ -0,0 +1,151 @@
+/*
+ * trace.cpp
+ *
+ *  Created on: Apr 27, 2016
+ *      Author: rafal
+ */
+
+#include "trace.h"
+#include <algorithm>
+#include <fstream>
+
+namespace mrobot
+{
+
+const char* to_string(trace_point point)
+{
+	switch (point)
+	{
+	case trace_point::wakeup:
+		return "wakeup";
+	case trace_point::read:
+		return "read";
+	case trace_point::handler_enter:
+		return "handler_enter";
+	case trace_point::handler_exit:
+		return "handler_exit";
+	case trace_point::transmit_enqueue:
+		return "transmit_enqueue";
+	case trace_point::write_complete:
+		return "write_complete";
+	}
+	return "unknown";
+}
+
+/**
+ * @param capacity number of kept records (rounded up to power of two)
+ */
+trace_ring::trace_ring(std::size_t capacity)
+{
+	std::size_t rounded = 1;
+	while (rounded < capacity)
+		rounded <<= 1;
+	_mask = rounded - 1;
+	_slots.reset(new slot[rounded]);
+}
+
+/**
+ * @brief Decides whether next chunk of source is traced
+ * @param countdown sampling state kept by source
+ */
+bool trace_ring::sample(unsigned& countdown) const
+{
+	unsigned period = get_sampling();
+	if (period == 0)
+		return false;
+
+	if (countdown == 0 || countdown >= period)
+	{
+		countdown = period - 1;
+		return true;
+	}
+	countdown--;
+	return false;
+}
+
+/**
+ * @brief Stores record (can be called by many threads at once)
+ */
+void trace_ring::record(trace_point point, std::uint32_t source, std::uint64_t id, std::size_t size, std::uint64_t time)
+{
+	std::uint64_t index = _next_index.fetch_add(1, std::memory_order_relaxed);
+	slot& current = _slots[index & _mask];
+
+	std::uint64_t details = (static_cast<std::uint64_t>(source) << 32)
+			| (std::min<std::uint64_t>(size, 0xffffff) << 8) | static_cast<std::uint8_t>(point);
+
+	current.stamp.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	current.time.store(time, std::memory_order_relaxed);
+	current.id.store(id, std::memory_order_relaxed);
+	current.details.store(details, std::memory_order_relaxed);
+	current.stamp.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Gets copy of stored records ordered from the oldest
+ *
+ * Records overwritten while they are copied are skipped.
+ */
+std::vector<trace_record> trace_ring::get_records() const
+{
+	std::uint64_t end = _next_index.load(std::memory_order_acquire);
+	std::uint64_t begin = end > _mask ? end - _mask - 1 : 0;
+
+	std::vector<trace_record> records;
+	records.reserve(end - begin);
+	for (std::uint64_t index = begin; index < end; index++)
+	{
+		const slot& current = _slots[index & _mask];
+		if (current.stamp.load(std::memory_order_acquire) != index + 1)
+			continue;
+
+		trace_record record;
+		record.time = current.time.load(std::memory_order_relaxed);
+		record.id = current.id.load(std::memory_order_relaxed);
+		std::uint64_t details = current.details.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (current.stamp.load(std::memory_order_relaxed) != index + 1)
+			continue;
+
+		record.source = details >> 32;
+		record.size = (details >> 8) & 0xffffff;
+		record.point = static_cast<trace_point>(details & 0xff);
+		records.push_back(record);
+	}
+	return records;
+}
+
+/**
+ * @brief Writes records in text format (one "time_ns source point id size" line per record)
+ */
+void trace_ring::dump(std::ostream& stream) const
+{
+	for (const trace_record& record : get_records())
+		stream << record.time << " " << record.source << " " << to_string(record.point)
+				<< " " << record.id << " " << record.size << "\n";
+}
+
+/**
+ * @brief Writes records to file
+ * @throws std::ios_base::failure
+ */
+void trace_ring::dump(const std::string& path) const
+{
+	std::ofstream file;
+	file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+	file.open(path);
+	dump(file);
+}
+
+/**
+ * @brief Drops stored records (shouldn't be called while records are written)
+ */
+void trace_ring::clear()
+{
+	for (std::size_t i = 0; i <= _mask; i++)
+		_slots[i].stamp.store(0, std::memory_order_relaxed);
+	_next_index.store(0, std::memory_order_release);
+}
+
+}
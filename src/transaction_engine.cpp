@@ -0,0 +1,290 @@
+/*
+ * transaction_engine.cpp
+ *
+ *  Created on: May 5, 2016
+ *      Author: rafal
+ */
+
+#include "transaction_engine.h"
+#include "log.h"
+#include <algorithm>
+
+namespace mrobot
+{
+
+/**
+ * @brief Subscribes frame event of port (port needs frame decoder)
+ * @param port port which sends requests and receives responses
+ * @param response_correlator returns key of transaction of response (empty when frame isn't response)
+ * @param window maximal number of requests in flight (at least one)
+ */
+transaction_engine::transaction_engine(serial_port& port, const correlator& response_correlator, std::size_t window) :
+		_port(port), _correlator(response_correlator), _window(std::max<std::size_t>(window, 1))
+{
+	_port.subscribe_frame_event([this](serial_port&, buffer_view frame) { receive(frame); });
+}
+
+/**
+ * @brief Cancels all pending transactions
+ *
+ * Engine has to be destroyed when polling thread can't handle its
+ * responses and timeouts (port removed from poll controler or polling
+ * stopped).
+ */
+transaction_engine::~transaction_engine()
+{
+	_port.unsubscribe_frame_event();
+
+	std::vector<transaction_pointer> pending;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		for (auto& entry : _in_flight)
+			pending.push_back(entry.second);
+		pending.insert(pending.end(), _queued.begin(), _queued.end());
+		_in_flight.clear();
+		_queued.clear();
+		_window = 0;
+	}
+
+	for (auto& current : pending)
+		finish(current, transaction_status::cancelled);
+}
+
+/**
+ * @brief Sends request now or when window has free slot
+ * @param key identifier returned by correlator for response to this request
+ * @param request data to send
+ * @param options timeout and retry policy
+ * @param handler function called once when transaction finishes
+ * @throws serial_port_exception when transaction with the same key is pending
+ */
+void transaction_engine::submit(std::uint64_t key, std::vector<char> request,
+		const transaction_options& options, const completion_handler& handler)
+{
+	auto current = std::make_shared<transaction>();
+	current->key = key;
+	current->request = std::move(request);
+	current->options = options;
+	current->handler = handler;
+
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		bool is_queued = std::any_of(_queued.begin(), _queued.end(),
+				[key](const transaction_pointer& queued) { return queued->key == key; });
+		if (is_queued || _in_flight.count(key) != 0)
+			throw serial_port_exception("Transaction with the same key is pending.");
+
+		if (_in_flight.size() >= _window)
+		{
+			_queued.push_back(current);
+			return;
+		}
+		_in_flight.emplace(key, current);
+	}
+	send(current);
+}
+
+/**
+ * @brief Sends request and returns future of its result
+ * @throws serial_port_exception when transaction with the same key is pending
+ */
+std::future<transaction_result> transaction_engine::submit(std::uint64_t key, std::vector<char> request,
+		const transaction_options& options)
+{
+	auto promise = std::make_shared<std::promise<transaction_result>>();
+	submit(key, std::move(request), options, [promise](transaction_result& result)
+	{
+		promise->set_value(std::move(result));
+	});
+	return promise->get_future();
+}
+
+/**
+ * @brief Sets maximal number of requests in flight (queued requests are sent when window grows)
+ */
+void transaction_engine::set_window(std::size_t window)
+{
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		_window = std::max<std::size_t>(window, 1);
+	}
+	start_queued();
+}
+
+/**
+ * @brief Sets function called (by polling thread) with frames which don't match any transaction
+ */
+void transaction_engine::set_unsolicited_frame_handler(const unsolicited_frame_handler& handler)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	_unsolicited_frame_handler = handler;
+}
+
+std::size_t transaction_engine::get_in_flight_count()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return _in_flight.size();
+}
+
+std::size_t transaction_engine::get_queued_count()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return _queued.size();
+}
+
+/**
+ * @brief Starts next attempt of transaction (mutex can't be locked)
+ *
+ * Timeout is scheduled before request is sent, so it is armed even when
+ * response arrives immediately.
+ */
+void transaction_engine::send(const transaction_pointer& current)
+{
+	reactor* owner_reactor = _port.get_reactor();
+	if (owner_reactor == nullptr)
+	{
+		MROBOT_LOG_WARNING("Transaction can't be sent - port isn't added to poll controler.\n");
+		finish(current, transaction_status::failed);
+		return;
+	}
+
+	unsigned attempt;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		if (current->is_finished)
+			return;
+		attempt = ++current->result.attempts;
+	}
+
+	std::uint64_t timer_id = owner_reactor->schedule_timer(&_port, current->options.timeout,
+			[this, current, attempt]() { time_out(current, attempt); });
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		current->timer_id = timer_id;
+		current->timer_reactor = owner_reactor;
+	}
+
+	try
+	{
+		_port.send_async(buffer_view{current->request}, [this, current](serial_port&, send_status status)
+		{
+			if (status != send_status::sent)
+				finish(current, transaction_status::failed);
+		});
+	} catch (serial_port_exception& ex)
+	{
+		MROBOT_LOG_WARNING(ex.what());
+		finish(current, transaction_status::failed);
+	}
+}
+
+/**
+ * @brief Matches received frame with transaction in flight (called by polling thread)
+ */
+void transaction_engine::receive(buffer_view frame)
+{
+	std::optional<std::uint64_t> key = _correlator(frame);
+
+	transaction_pointer current;
+	unsolicited_frame_handler unsolicited_handler;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		auto entry = key ? _in_flight.find(*key) : _in_flight.end();
+		if (entry == _in_flight.end())
+		{
+			unsolicited_handler = _unsolicited_frame_handler;
+		}
+		else
+		{
+			current = entry->second;
+			current->result.response.assign(frame.begin(), frame.end());
+		}
+	}
+
+	if (current)
+	{
+		finish(current, transaction_status::completed);
+		return;
+	}
+
+	_unmatched_responses_count++;
+	if (unsolicited_handler)
+		unsolicited_handler(frame);
+}
+
+/**
+ * @brief Retries transaction or finishes it when its attempt timed out (called by polling thread)
+ */
+void transaction_engine::time_out(const transaction_pointer& current, unsigned attempt)
+{
+	bool is_retried;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		if (current->is_finished || current->result.attempts != attempt)
+			return;
+		current->timer_id = 0;
+		is_retried = attempt <= current->options.retries;
+	}
+
+	if (is_retried)
+		send(current);
+	else
+		finish(current, transaction_status::timed_out);
+}
+
+/**
+ * @brief Completes transaction, calls its handler and sends queued requests (mutex can't be locked)
+ */
+void transaction_engine::finish(const transaction_pointer& current, transaction_status status)
+{
+	std::uint64_t timer_id;
+	reactor* timer_reactor;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		if (current->is_finished)
+			return;
+		current->is_finished = true;
+		current->result.status = status;
+		timer_id = current->timer_id;
+		timer_reactor = current->timer_reactor;
+
+		auto entry = _in_flight.find(current->key);
+		if (entry != _in_flight.end() && entry->second == current)
+			_in_flight.erase(entry);
+	}
+
+	// timer is moved with port when port is moved to other shard (identifiers don't match timers of other reactors)
+	reactor* owner_reactor = _port.get_reactor();
+	if (timer_id != 0)
+	{
+		timer_reactor->cancel_timer(timer_id);
+		if (owner_reactor != nullptr && owner_reactor != timer_reactor)
+			owner_reactor->cancel_timer(timer_id);
+	}
+
+	if (current->handler)
+		current->handler(current->result);
+	start_queued();
+}
+
+/**
+ * @brief Sends queued requests while window has free slots (mutex can't be locked)
+ */
+void transaction_engine::start_queued()
+{
+	std::vector<transaction_pointer> started;
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		while (_in_flight.size() < _window && !_queued.empty())
+		{
+			started.push_back(_queued.front());
+			_in_flight.emplace(_queued.front()->key, _queued.front());
+			_queued.pop_front();
+		}
+	}
+
+	for (auto& current : started)
+		send(current);
+}
+
+}
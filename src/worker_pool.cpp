@@ -0,0 +1,145 @@
+/*
+ * worker_pool.cpp
+ *
+ *  Created on: Apr 18, 2016
+ *      Author: rafal
+ */
+
+#include "worker_pool.h"
+#include "log.h"
+#include <algorithm>
+#include <exception>
+
+namespace mrobot
+{
+
+/**
+ * @param workers_count number of worker threads (at least one)
+ */
+worker_pool::worker_pool(std::size_t workers_count)
+{
+	workers_count = std::max<std::size_t>(workers_count, 1);
+	for (std::size_t i = 0; i < workers_count; i++)
+		_workers.emplace_back(new worker);
+
+	for (auto& current : _workers)
+	{
+		worker* thread_worker = current.get();
+		current->thread = std::thread{[this, thread_worker]() { work(*thread_worker); }};
+	}
+}
+
+/**
+ * @brief Stops workers (work which is still queued isn't handled)
+ */
+worker_pool::~worker_pool()
+{
+	_is_running = false;
+	for (auto& current : _workers)
+	{
+		{
+			std::unique_lock<std::mutex> lock{current->wake_up_mutex};
+			current->is_notified = true;
+		}
+		current->wake_up_condition.notify_one();
+	}
+
+	for (auto& current : _workers)
+		current->thread.join();
+}
+
+/**
+ * @brief Assigns consumer to the least loaded worker
+ * @return index of worker which has to be notified about queued work
+ */
+std::size_t worker_pool::attach(idispatch_consumer* consumer)
+{
+	auto least_loaded = std::min_element(_workers.begin(), _workers.end(),
+			[](const std::unique_ptr<worker>& first, const std::unique_ptr<worker>& second)
+			{
+				return first->consumers_count < second->consumers_count;
+			});
+
+	std::unique_lock<std::mutex> lock{(*least_loaded)->consumers_mutex};
+	(*least_loaded)->consumers.push_back(consumer);
+	(*least_loaded)->consumers_count++;
+	return least_loaded - _workers.begin();
+}
+
+/**
+ * @brief Removes consumer from its worker
+ *
+ * Waits until worker finishes handling of consumers, so consumer isn't
+ * used after return. Can't be called from handler run by worker.
+ */
+void worker_pool::detach(idispatch_consumer* consumer)
+{
+	for (auto& current : _workers)
+	{
+		std::unique_lock<std::mutex> lock{current->consumers_mutex};
+		auto position = std::find(current->consumers.begin(), current->consumers.end(), consumer);
+		if (position != current->consumers.end())
+		{
+			current->consumers.erase(position);
+			current->consumers_count--;
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Wakes worker after work was queued (can be called from any thread)
+ */
+void worker_pool::notify(std::size_t worker_index)
+{
+	worker& current = *_workers.at(worker_index);
+	if (current.is_notified.exchange(true))
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock{current.wake_up_mutex};
+	}
+	current.wake_up_condition.notify_one();
+}
+
+bool worker_pool::is_worker_thread()
+{
+	return std::any_of(_workers.begin(), _workers.end(), [](const std::unique_ptr<worker>& current)
+	{
+		return current->thread.get_id() == std::this_thread::get_id();
+	});
+}
+
+/**
+ * @brief Handles queued work of consumers until pool is destroyed
+ */
+void worker_pool::work(worker& current)
+{
+	while (_is_running)
+	{
+		// exchange synchronizes with notify(), so work queued before it is seen below
+		current.is_notified.exchange(false);
+
+		bool is_work_done = true;
+		while (is_work_done && _is_running)
+		{
+			is_work_done = false;
+			std::unique_lock<std::mutex> lock{current.consumers_mutex};
+			for (idispatch_consumer* consumer : current.consumers)
+			{
+				try
+				{
+					is_work_done |= consumer->process_dispatched();
+				} catch (std::exception& ex)
+				{
+					MROBOT_LOG_ERROR(ex.what());
+				}
+			}
+		}
+
+		std::unique_lock<std::mutex> lock{current.wake_up_mutex};
+		current.wake_up_condition.wait(lock, [&current]() { return current.is_notified.load(); });
+	}
+}
+
+}
@@ -0,0 +1,219 @@
+/*
+ * async_port_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of coroutine interface of serial port: reads, timeouts, teardown
+ * of wrapper with suspended coroutines and rebalancing of port with
+ * pending timeout.
+ *
+ * Usage: async_port_test [filter]
+ */
+
+#include "test_util.h"
+#include "poll_controler.h"
+#include "async_port.h"
+#include <atomic>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Stores handle of awaiting coroutine (test destroys frames which are never resumed)
+ */
+struct handle_of
+{
+	std::coroutine_handle<>* handle;
+
+	bool await_ready() { return false; }
+	bool await_suspend(std::coroutine_handle<> awaiting)
+	{
+		*handle = awaiting;
+		return false;
+	}
+	void await_resume() {}
+};
+
+/**
+ * @brief State of coroutine observed by test thread
+ */
+struct outcome
+{
+	std::coroutine_handle<> handle;
+	std::atomic<bool> is_finished{false};
+	std::atomic<bool> is_timed_out{false};
+	std::atomic<bool> is_new_shard{false};
+	std::string line;
+};
+
+/**
+ * @brief Wrapper of port observed by poll controler with given number of shards
+ *
+ * With two shards port is added to shard 0 together with two pinned
+ * descriptors, so rebalancing moves it to shard 1.
+ */
+struct async_fixture
+{
+	pty_pair pty;
+	poll_controler controler;
+	idle_owner pinned[2];
+	std::unique_ptr<async_port> port;
+
+	explicit async_fixture(std::size_t shards_count = 1) :
+			controler(-1, trigger_mode::level, shards_count)
+	{
+		port.reset(new async_port{*pty.port});
+		controler.set_shard_assignment(shard_assignment::least_loaded);
+		controler.add(pty.port.get());
+		if (shards_count > 1)
+		{
+			for (idle_owner& owner : pinned)
+				controler.add(&owner, 0);
+		}
+		controler.start_polling();
+	}
+
+	~async_fixture()
+	{
+		controler.stop_polling();
+		port.reset();
+		if (pty.port->get_reactor() != nullptr)
+			controler.remove(pty.port.get());
+		if (controler.get_shards_count() > 1)
+		{
+			for (idle_owner& owner : pinned)
+				controler.remove(&owner);
+		}
+	}
+
+	std::size_t pending_timers(std::size_t shard)
+	{
+		return controler.get_metrics(shard).pending_timers;
+	}
+};
+
+task<void> read_line(async_port& port, outcome& result, timer_clock::duration timeout, poll_controler* controler = nullptr)
+{
+	co_await handle_of{&result.handle};
+	try
+	{
+		result.line = co_await port.read_until('\n', timeout);
+		co_await port.write_all(buffer_view{result.line.data(), result.line.size()});
+	} catch (serial_port_exception&)
+	{
+		result.is_timed_out = true;
+	}
+	if (controler != nullptr)
+		result.is_new_shard = controler->get_shard(1).is_poll_thread();
+	result.is_finished = true;
+}
+
+task<void> sleep_then_finish(async_port& port, outcome& result, timer_clock::duration delay)
+{
+	co_await handle_of{&result.handle};
+	co_await port.sleep_for(delay);
+	result.is_finished = true;
+}
+
+void read_until_returns_line()
+{
+	async_fixture fixture;
+	outcome result;
+	spawn(*fixture.port, read_line(*fixture.port, result, std::chrono::seconds{1}));
+	fixture.pty.write_master("ab");
+	fixture.pty.write_master("c\nde");
+
+	MROBOT_CHECK(wait_until([&] { return result.is_finished.load(); }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(!result.is_timed_out);
+	MROBOT_CHECK(result.line == "abc\n");
+	MROBOT_CHECK(fixture.pty.read_master(4, std::chrono::milliseconds{1000}) == "abc\n");
+	MROBOT_CHECK(wait_until([&] { return fixture.pending_timers(0) == 0; }, std::chrono::milliseconds{100}));
+}
+
+void read_timeout_throws()
+{
+	async_fixture fixture;
+	outcome result;
+	spawn(*fixture.port, read_line(*fixture.port, result, std::chrono::milliseconds{20}));
+
+	MROBOT_CHECK(wait_until([&] { return result.is_finished.load(); }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(result.is_timed_out);
+}
+
+void destruction_cancels_sleep()
+{
+	async_fixture fixture;
+	outcome result;
+	spawn(*fixture.port, sleep_then_finish(*fixture.port, result, std::chrono::milliseconds{50}));
+	MROBOT_CHECK(wait_until([&] { return result.handle && fixture.pending_timers(0) == 1; }, std::chrono::milliseconds{1000}));
+
+	fixture.port.reset();
+	std::this_thread::sleep_for(std::chrono::milliseconds{100});
+	MROBOT_CHECK(!result.is_finished);
+	MROBOT_CHECK(fixture.pending_timers(0) == 0);
+	fixture.controler.stop_polling();
+	result.handle.destroy();
+}
+
+void destruction_after_remove()
+{
+	async_fixture fixture;
+	outcome result;
+	spawn(*fixture.port, read_line(*fixture.port, result, std::chrono::milliseconds{50}));
+	MROBOT_CHECK(wait_until([&] { return result.handle && fixture.pending_timers(0) == 1; }, std::chrono::milliseconds{1000}));
+
+	// timeout is owned by port, so removing port cancels it and wrapper can be destroyed without reactor
+	fixture.controler.remove(fixture.pty.port.get());
+	MROBOT_CHECK(fixture.pending_timers(0) == 0);
+	fixture.port.reset();
+	std::this_thread::sleep_for(std::chrono::milliseconds{100});
+	MROBOT_CHECK(!result.is_finished);
+	fixture.controler.stop_polling();
+	result.handle.destroy();
+}
+
+void timeout_after_rebalance()
+{
+	async_fixture fixture{2};
+	outcome result;
+	spawn(*fixture.port, read_line(*fixture.port, result, std::chrono::milliseconds{200}, &fixture.controler));
+	MROBOT_CHECK(wait_until([&] { return result.handle && fixture.pending_timers(0) == 1; }, std::chrono::milliseconds{1000}));
+
+	fixture.controler.rebalance();
+	MROBOT_CHECK(fixture.controler.get_shard_of(fixture.pty.port.get()) == 1);
+	MROBOT_CHECK(wait_until([&] { return result.is_finished.load(); }, std::chrono::milliseconds{2000}));
+	MROBOT_CHECK(result.is_timed_out);
+	MROBOT_CHECK(result.is_new_shard);
+}
+
+void read_after_rebalance_cancels_timeout()
+{
+	async_fixture fixture{2};
+	outcome result;
+	spawn(*fixture.port, read_line(*fixture.port, result, std::chrono::seconds{1}, &fixture.controler));
+	MROBOT_CHECK(wait_until([&] { return result.handle && fixture.pending_timers(0) == 1; }, std::chrono::milliseconds{1000}));
+
+	fixture.controler.rebalance();
+	MROBOT_CHECK(fixture.pending_timers(1) == 1);
+	fixture.pty.write_master("moved\n");
+	MROBOT_CHECK(wait_until([&] { return result.is_finished.load(); }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(!result.is_timed_out);
+	MROBOT_CHECK(result.line == "moved\n");
+	MROBOT_CHECK(wait_until([&] { return fixture.pending_timers(1) == 0; }, std::chrono::milliseconds{100}));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "read_until_returns_line", read_until_returns_line },
+		{ "read_timeout_throws", read_timeout_throws },
+		{ "destruction_cancels_sleep", destruction_cancels_sleep },
+		{ "destruction_after_remove", destruction_after_remove },
+		{ "timeout_after_rebalance", timeout_after_rebalance },
+		{ "read_after_rebalance_cancels_timeout", read_after_rebalance_cancels_timeout },
+	}, argc, argv);
+}
@@ -0,0 +1,100 @@
+/*
+ * baudrate_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of mapping between baud rates and speed constants and of
+ * arbitrary baud rates set through termios2 BOTHER on pseudo-terminal.
+ *
+ * Usage: baudrate_test [filter]
+ */
+
+#include "test_util.h"
+#include "baudrate.h"
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Baud rate option and its rate in bits per second
+ */
+struct standard_rate
+{
+	baudrate_option option;
+	unsigned int baudrate;
+};
+
+const standard_rate standard_rates[] = {
+	{ baudrate_option::b50, 50 }, { baudrate_option::b300, 300 }, { baudrate_option::b1200, 1200 },
+	{ baudrate_option::b9600, 9600 }, { baudrate_option::b19200, 19200 }, { baudrate_option::b38400, 38400 },
+	{ baudrate_option::b57600, 57600 }, { baudrate_option::b115200, 115200 }, { baudrate_option::b230400, 230400 },
+	{ baudrate_option::b460800, 460800 }, { baudrate_option::b921600, 921600 }, { baudrate_option::b1000000, 1000000 },
+	{ baudrate_option::b4000000, 4000000 },
+};
+
+void standard_rates_map_to_constants()
+{
+	for (const standard_rate& rate : standard_rates)
+	{
+		unsigned int speed = 0;
+		MROBOT_CHECK(to_speed_constant(rate.baudrate, speed));
+		MROBOT_CHECK(speed == static_cast<unsigned int>(rate.option));
+		MROBOT_CHECK(from_speed_constant(speed) == rate.baudrate);
+	}
+}
+
+void other_rates_have_no_constant()
+{
+	const unsigned int rates[] = { 1, 12345, 31250, 250000, 1843200, 5000000 };
+	for (unsigned int rate : rates)
+	{
+		unsigned int speed = 12;
+		MROBOT_CHECK(!to_speed_constant(rate, speed));
+		MROBOT_CHECK(speed == 12);
+	}
+	MROBOT_CHECK(from_speed_constant(0x7FFFFFFF) == 0);
+}
+
+void port_applies_standard_and_custom_rates()
+{
+	pty_pair pty;
+	const unsigned int rates[] = { 9600, 115200, 250000, 31250 };
+	for (unsigned int rate : rates)
+	{
+		// pseudo-terminal keeps requested rate, real drivers can round custom one
+		serial_port port{pty.device(), rate};
+		MROBOT_CHECK(port.get_baudrate() == rate);
+		MROBOT_CHECK(get_actual_baudrate(port.get_file_descriptor()) == rate);
+	}
+
+	serial_port port{pty.device(), baudrate_option::b57600};
+	MROBOT_CHECK(port.get_baudrate() == 57600);
+}
+
+void character_time_follows_rate()
+{
+	pty_pair pty;
+	// 10 bits per character (8N1, whole microseconds), 3.5 characters, but at least 1750 us
+	const std::pair<unsigned int, long> timeouts[] = {
+		{ 9600, 3643 }, { 1200, 29165 }, { 115200, 1750 }, { 250000, 1750 },
+	};
+	for (const auto& timeout : timeouts)
+	{
+		serial_port port{pty.device(), timeout.first};
+		MROBOT_CHECK(port.get_inter_byte_timeout().count() == timeout.second);
+	}
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "standard_rates_map_to_constants", standard_rates_map_to_constants },
+		{ "other_rates_have_no_constant", other_rates_have_no_constant },
+		{ "port_applies_standard_and_custom_rates", port_applies_standard_and_custom_rates },
+		{ "character_time_follows_rate", character_time_follows_rate },
+	}, argc, argv);
+}
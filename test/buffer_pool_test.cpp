@@ -0,0 +1,160 @@
+/*
+ * buffer_pool_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of refcounted buffer pool: slab allocation, exhaustion and reuse
+ * of released blocks, handle reference counting and buffers outliving
+ * the pool.
+ *
+ * Usage: buffer_pool_test [filter]
+ */
+
+#include "test_util.h"
+#include "buffer_pool.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <set>
+
+namespace
+{
+using namespace mrobot_test;
+
+void slabs_are_allocated_on_demand()
+{
+	// requested blocks, blocks per slab, expected allocated blocks
+	const std::size_t cases[][3] = {
+		{ 1, 4, 4 }, { 4, 4, 4 }, { 5, 4, 8 }, { 9, 1, 9 }, { 3, 0, 3 },
+	};
+	for (const auto& test : cases)
+	{
+		std::shared_ptr<buffer_pool> pool = buffer_pool::create(100, test[1]);
+		std::vector<pooled_buffer> buffers;
+		for (std::size_t i = 0; i < test[0]; i++)
+			buffers.push_back(pool->acquire());
+		MROBOT_CHECK(pool->get_blocks_count() == test[2]);
+		MROBOT_CHECK(pool->get_free_blocks_count() == test[2] - test[0]);
+	}
+}
+
+void blocks_are_aligned_and_distinct()
+{
+	std::shared_ptr<buffer_pool> pool = buffer_pool::create(100, 8);
+	std::vector<pooled_buffer> buffers;
+	std::set<char*> data;
+	for (int i = 0; i < 16; i++)
+	{
+		buffers.push_back(pool->acquire());
+		pooled_buffer& buffer = buffers.back();
+		MROBOT_CHECK(buffer && buffer.size() == 0 && buffer.capacity() == 100);
+		MROBOT_CHECK(reinterpret_cast<std::uintptr_t>(buffer.data()) % 8 == 0);
+		std::memset(buffer.data(), i, buffer.capacity());
+		data.insert(buffer.data());
+	}
+	MROBOT_CHECK(data.size() == 16);
+	for (int i = 0; i < 16; i++)
+		MROBOT_CHECK(buffers[i].data()[0] == i && buffers[i].data()[99] == i);
+}
+
+void exhausted_pool_returns_empty_buffer()
+{
+	std::shared_ptr<buffer_pool> pool = buffer_pool::create(16, 2, 3);
+	pooled_buffer first = pool->acquire();
+	pooled_buffer second = pool->acquire();
+	pooled_buffer third = pool->acquire();
+	MROBOT_CHECK(first && second && third);
+	MROBOT_CHECK(pool->get_blocks_count() == 3);
+
+	pooled_buffer exhausted = pool->acquire();
+	MROBOT_CHECK(!exhausted);
+	MROBOT_CHECK(exhausted.size() == 0 && exhausted.capacity() == 0 && exhausted.view().empty());
+
+	// released block is reused without allocation
+	char* released = second.data();
+	second.reset();
+	pooled_buffer reused = pool->acquire();
+	MROBOT_CHECK(reused && reused.data() == released);
+	MROBOT_CHECK(pool->get_blocks_count() == 3);
+	MROBOT_CHECK(!pool->acquire());
+}
+
+void copies_share_block_until_last_is_released()
+{
+	std::shared_ptr<buffer_pool> pool = buffer_pool::create(16, 1, 1);
+	pooled_buffer buffer = pool->acquire();
+	std::memcpy(buffer.data(), "data", 4);
+	buffer.set_size(4);
+
+	pooled_buffer copy = buffer;
+	pooled_buffer assigned;
+	assigned = copy;
+	MROBOT_CHECK(buffer.use_count() == 3);
+	MROBOT_CHECK(std::string(assigned.view().begin(), assigned.view().end()) == "data");
+
+	pooled_buffer moved = std::move(copy);
+	MROBOT_CHECK(!copy && moved.use_count() == 3);
+
+	buffer.reset();
+	assigned.reset();
+	MROBOT_CHECK(pool->get_free_blocks_count() == 0);
+	moved.reset();
+	MROBOT_CHECK(pool->get_free_blocks_count() == 1);
+}
+
+void buffer_outlives_pool()
+{
+	pooled_buffer buffer;
+	{
+		std::shared_ptr<buffer_pool> pool = buffer_pool::create(16);
+		buffer = pool->acquire();
+	}
+	// block keeps pool alive, releasing it destroys pool (checked by sanitizers)
+	std::memcpy(buffer.data(), "kept", 4);
+	buffer.set_size(4);
+	MROBOT_CHECK(buffer.capacity() == 16);
+	buffer.reset();
+}
+
+void concurrent_acquire_and_release()
+{
+	std::shared_ptr<buffer_pool> pool = buffer_pool::create(64, 4, 16);
+	std::vector<std::thread> threads;
+	std::atomic<int> failures{0};
+	for (int t = 0; t < 4; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			for (int i = 0; i < 10000; i++)
+			{
+				pooled_buffer buffer = pool->acquire();
+				if (!buffer)
+					continue;
+				buffer.data()[0] = static_cast<char>(t);
+				pooled_buffer copy = buffer;
+				if (copy.data()[0] != static_cast<char>(t))
+					failures++;
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	MROBOT_CHECK(failures == 0);
+	MROBOT_CHECK(pool->get_free_blocks_count() == pool->get_blocks_count());
+	MROBOT_CHECK(pool->get_blocks_count() <= 16);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "slabs_are_allocated_on_demand", slabs_are_allocated_on_demand },
+		{ "blocks_are_aligned_and_distinct", blocks_are_aligned_and_distinct },
+		{ "exhausted_pool_returns_empty_buffer", exhausted_pool_returns_empty_buffer },
+		{ "copies_share_block_until_last_is_released", copies_share_block_until_last_is_released },
+		{ "buffer_outlives_pool", buffer_outlives_pool },
+		{ "concurrent_acquire_and_release", concurrent_acquire_and_release },
+	}, argc, argv);
+}
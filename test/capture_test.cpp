@@ -0,0 +1,348 @@
+/*
+ * capture_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Round-trip tests of capture files: records written by capture_writer
+ * (single and gathered buffers, growing segments, unclosed file) are read
+ * back by capture_reader, traffic of port is captured and received data
+ * is replayed to other port with original timing.
+ *
+ * Usage: capture_test [filter]
+ */
+
+#include "test_util.h"
+#include "capture.h"
+#include "poll_controler.h"
+#include "replay_engine.h"
+#include <sys/stat.h>
+#include <mutex>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Path of capture file which is removed with the object
+ */
+class temporary_file
+{
+public:
+	explicit temporary_file(const std::string& name) :
+			path("/tmp/mrobot_" + name + "_" + std::to_string(getpid()) + ".cap")
+	{
+	}
+
+	~temporary_file()
+	{
+		unlink(path.c_str());
+	}
+
+	std::size_t size()
+	{
+		struct stat status;
+		return stat(path.c_str(), &status) == 0 ? status.st_size : 0;
+	}
+
+	const std::string path;
+};
+
+/**
+ * @brief Expected content of record
+ */
+struct expected_record
+{
+	capture_direction direction;
+	std::uint32_t port_id;
+	std::uint64_t time;
+	std::string data;
+};
+
+void check_records(capture_reader& reader, const std::vector<expected_record>& records)
+{
+	capture_record record;
+	for (const expected_record& expected : records)
+	{
+		MROBOT_CHECK(reader.next(record));
+		MROBOT_CHECK(record.direction == expected.direction);
+		MROBOT_CHECK(record.port_id == expected.port_id);
+		MROBOT_CHECK(record.time == expected.time);
+		MROBOT_CHECK(std::string(record.data.begin(), record.data.end()) == expected.data);
+	}
+	MROBOT_CHECK(!reader.next(record));
+}
+
+void records_round_trip()
+{
+	// payload sizes around 8 byte padding, zero bytes and both directions
+	const std::vector<expected_record> records = {
+		{ capture_direction::received, 1, 1000, "a" },
+		{ capture_direction::sent, 1, 1001, "" },
+		{ capture_direction::received, 2, 2000, std::string("\0\x01\x02", 3) },
+		{ capture_direction::sent, 0xFFFFFFFF, 3000, "1234567" },
+		{ capture_direction::received, 3, 4000, "12345678" },
+		{ capture_direction::sent, 3, 0xFFFFFFFFFFFFull, "123456789" },
+		{ capture_direction::received, 4, 5000, std::string(1000, '\xFF') },
+	};
+
+	temporary_file file{"round_trip"};
+	capture_writer writer{file.path};
+	std::size_t size = 16;
+	for (const expected_record& record : records)
+	{
+		writer.record(record.direction, record.port_id, record.time, buffer_view{record.data});
+		size += 16 + (record.data.size() + 7) / 8 * 8;
+	}
+	MROBOT_CHECK(writer.get_records_count() == records.size());
+	MROBOT_CHECK(writer.get_size() == size);
+	writer.close();
+	MROBOT_CHECK(file.size() == size);
+
+	// closed writer ignores records
+	writer.record(capture_direction::received, 1, 6000, buffer_view{"late", 4});
+	MROBOT_CHECK(writer.get_records_count() == records.size());
+
+	capture_reader reader{file.path};
+	check_records(reader, records);
+	reader.rewind();
+	check_records(reader, records);
+}
+
+void gathered_buffers_make_one_record()
+{
+	temporary_file file{"gathered"};
+	{
+		capture_writer writer{file.path};
+		static const char parts[] = "abcdefghij";
+		const std::vector<std::vector<std::size_t>> cases = { { 1 }, { 3, 0, 2 }, { 0 }, { 4, 6 }, { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 } };
+		std::uint64_t time = 1;
+		for (const std::vector<std::size_t>& sizes : cases)
+		{
+			std::vector<iovec> buffers;
+			std::size_t offset = 0;
+			for (std::size_t size : sizes)
+			{
+				buffers.push_back(iovec{const_cast<char*>(parts + offset), size});
+				offset += size;
+			}
+			writer.record(capture_direction::received, 5, time++, buffers.data(), buffers.size());
+		}
+		MROBOT_CHECK(writer.get_records_count() == cases.size());
+	}
+
+	capture_reader reader{file.path};
+	check_records(reader, {
+		{ capture_direction::received, 5, 1, "a" },
+		{ capture_direction::received, 5, 2, "abcde" },
+		{ capture_direction::received, 5, 3, "" },
+		{ capture_direction::received, 5, 4, "abcdefghij" },
+		{ capture_direction::received, 5, 5, "abcdefghij" },
+	});
+}
+
+void file_grows_by_segments()
+{
+	temporary_file file{"segments"};
+	std::vector<expected_record> records;
+	{
+		// segment is at least 4096 bytes, records cross many segment borders
+		capture_writer writer{file.path, 1};
+		for (std::uint64_t i = 1; i <= 500; i++)
+		{
+			records.push_back({ i % 3 ? capture_direction::received : capture_direction::sent, static_cast<std::uint32_t>(i % 4), i,
+					std::string(i % 61, static_cast<char>('a' + i % 26)) });
+			writer.record(records.back().direction, records.back().port_id, records.back().time, buffer_view{records.back().data});
+		}
+		MROBOT_CHECK(writer.get_size() > 4 * 4096);
+		MROBOT_CHECK(file.size() % 4096 == 0 && file.size() >= writer.get_size());
+	}
+
+	capture_reader reader{file.path};
+	check_records(reader, records);
+}
+
+void unclosed_file_ends_at_zero_tail()
+{
+	temporary_file file{"unclosed"};
+	capture_writer writer{file.path};
+	writer.record(capture_direction::received, 1, 10, buffer_view{"first", 5});
+	writer.record(capture_direction::sent, 1, 20, buffer_view{"second", 6});
+
+	// file still has size of whole segment, zero filled rest isn't a record
+	MROBOT_CHECK(file.size() > writer.get_size());
+	capture_reader reader{file.path};
+	check_records(reader, {
+		{ capture_direction::received, 1, 10, "first" },
+		{ capture_direction::sent, 1, 20, "second" },
+	});
+	writer.close();
+}
+
+void invalid_file_is_rejected()
+{
+	const std::string contents[] = { "", "MRCAP", std::string("NOTCAP\0\0\x01\0\0\0\0\0\0\0", 16) };
+	for (const std::string& content : contents)
+	{
+		temporary_file file{"invalid"};
+		FILE* stream = std::fopen(file.path.c_str(), "wb");
+		std::fwrite(content.data(), 1, content.size(), stream);
+		std::fclose(stream);
+
+		bool is_thrown = false;
+		try
+		{
+			capture_reader reader{file.path};
+		} catch (serial_port_exception&)
+		{
+			is_thrown = true;
+		}
+		MROBOT_CHECK(is_thrown);
+	}
+
+	bool is_thrown = false;
+	try
+	{
+		capture_reader reader{"/nonexistent/capture.cap"};
+	} catch (serial_port_exception&)
+	{
+		is_thrown = true;
+	}
+	MROBOT_CHECK(is_thrown);
+}
+
+/**
+ * @brief Data received by handler of port (called by polling thread)
+ */
+struct received_data
+{
+	std::mutex mutex;
+	std::string data;
+
+	void append(buffer_view view)
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		data.append(view.begin(), view.end());
+	}
+
+	std::string get_data()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		return data;
+	}
+};
+
+void port_traffic_is_captured_and_replayed()
+{
+	temporary_file file{"port"};
+	std::shared_ptr<capture_writer> writer = std::make_shared<capture_writer>(file.path);
+	{
+		pty_pair pty;
+		received_data received;
+		pty.port->set_capture(writer, 7);
+		pty.port->subscribe_data_view_event([&](serial_port&, buffer_view data) { received.append(data); });
+		poll_controler controler{-1};
+		controler.add(pty.port.get());
+		controler.start_polling();
+
+		pty.write_master("request");
+		MROBOT_CHECK(wait_until([&] { return received.get_data() == "request"; }, std::chrono::milliseconds{1000}));
+		pty.port->send(buffer_view{"reply", 5});
+		MROBOT_CHECK(pty.read_master(5, std::chrono::milliseconds{1000}) == "reply");
+		controler.stop_polling();
+		controler.remove(pty.port.get());
+	}
+	writer->close();
+
+	// received data can be read in many chunks, sent data is one record
+	capture_reader reader{file.path};
+	capture_record record;
+	std::string received;
+	std::string sent;
+	std::uint64_t previous_time = 0;
+	while (reader.next(record))
+	{
+		MROBOT_CHECK(record.port_id == 7);
+		MROBOT_CHECK(record.time >= previous_time);
+		previous_time = record.time;
+		(record.direction == capture_direction::received ? received : sent).append(record.data.begin(), record.data.end());
+	}
+	MROBOT_CHECK(received == "request");
+	MROBOT_CHECK(sent == "reply");
+
+	// only received data of port with target is replayed
+	replay_pty pty;
+	serial_port port{pty.get_device(), baudrate_option::b115200};
+	received_data replayed;
+	port.subscribe_data_view_event([&](serial_port&, buffer_view data) { replayed.append(data); });
+	poll_controler controler{-1};
+	controler.add(&port);
+	controler.start_polling();
+
+	replay_engine engine{reader};
+	engine.set_speed(0);
+	engine.add_target(7, pty.get_master());
+	replay_statistics statistics = engine.run();
+	MROBOT_CHECK(statistics.bytes == 7 && statistics.records >= 1);
+	MROBOT_CHECK(wait_until([&] { return replayed.get_data() == "request"; }, std::chrono::milliseconds{1000}));
+
+	replay_engine other_engine{reader};
+	other_engine.add_target(8, pty.get_master());
+	MROBOT_CHECK(other_engine.run().records == 0);
+	controler.stop_polling();
+	controler.remove(&port);
+}
+
+void replay_keeps_timing()
+{
+	temporary_file file{"timing"};
+	{
+		capture_writer writer{file.path};
+		writer.record(capture_direction::received, 1, 1000000000, buffer_view{"a", 1});
+		writer.record(capture_direction::sent, 1, 1010000000, buffer_view{"skipped", 7});
+		writer.record(capture_direction::received, 2, 1020000000, buffer_view{"other", 5});
+		writer.record(capture_direction::received, 1, 1040000000, buffer_view{"b", 1});
+	}
+
+	replay_pty pty;
+	serial_port port{pty.get_device(), baudrate_option::b115200};
+	capture_reader reader{file.path};
+	replay_engine engine{reader};
+	engine.add_target(1, pty.get_master());
+
+	// speed, minimal and maximal duration in milliseconds
+	const double cases[][3] = { { 1, 40, 1000 }, { 2, 20, 1000 }, { 0, 0, 20 } };
+	for (const auto& test : cases)
+	{
+		engine.set_speed(test[0]);
+		replay_statistics statistics = engine.run();
+		MROBOT_CHECK(statistics.records == 2 && statistics.bytes == 2);
+		MROBOT_CHECK(statistics.duration >= std::chrono::milliseconds{static_cast<long>(test[1])});
+		MROBOT_CHECK(statistics.duration < std::chrono::milliseconds{static_cast<long>(test[2])});
+
+		std::string data;
+		MROBOT_CHECK(wait_until([&]
+		{
+			char buffer[16];
+			ssize_t count = read(port.get_file_descriptor(), buffer, sizeof(buffer));
+			if (count > 0)
+				data.append(buffer, count);
+			return data == "ab";
+		}, std::chrono::milliseconds{1000}));
+	}
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "records_round_trip", records_round_trip },
+		{ "gathered_buffers_make_one_record", gathered_buffers_make_one_record },
+		{ "file_grows_by_segments", file_grows_by_segments },
+		{ "unclosed_file_ends_at_zero_tail", unclosed_file_ends_at_zero_tail },
+		{ "invalid_file_is_rejected", invalid_file_is_rejected },
+		{ "port_traffic_is_captured_and_replayed", port_traffic_is_captured_and_replayed },
+		{ "replay_keeps_timing", replay_keeps_timing },
+	}, argc, argv);
+}
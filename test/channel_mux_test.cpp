@@ -0,0 +1,147 @@
+/*
+ * channel_mux_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of channel multiplexer: fragment format, reassembly of messages
+ * looped back by master side and discarding of incomplete messages.
+ *
+ * Usage: channel_mux_test [filter]
+ */
+
+#include "test_util.h"
+#include "channel_mux.h"
+#include "poll_controler.h"
+#include <mutex>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Mux on polled port, messages received on channel 1 are stored
+ */
+struct mux_fixture
+{
+	pty_pair pty;
+	poll_controler controler{-1};
+	channel_mux mux;
+	std::mutex mutex;
+	std::vector<std::string> messages;
+
+	explicit mux_fixture(std::size_t max_fragment_size = 256) :
+			mux(*pty.port, max_fragment_size)
+	{
+		mux.add_channel(1);
+		mux.subscribe_message_event(1, [this](channel_mux&, std::uint8_t, buffer_view message)
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			messages.emplace_back(message.begin(), message.end());
+		});
+		controler.add(pty.port.get());
+		controler.start_polling();
+	}
+
+	~mux_fixture()
+	{
+		controler.stop_polling();
+		controler.remove(pty.port.get());
+	}
+
+	std::vector<std::string> get_messages()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		return messages;
+	}
+};
+
+/**
+ * @brief Creates frame of fragment (length, channel with more fragments flag, index, payload)
+ */
+std::string fragment_frame(std::uint8_t channel, bool is_more, std::uint8_t index, const std::string& payload)
+{
+	std::size_t length = payload.size() + 2;
+	std::string frame;
+	frame += static_cast<char>(length >> 8);
+	frame += static_cast<char>(length);
+	frame += static_cast<char>(channel | (is_more ? 0x80 : 0));
+	frame += static_cast<char>(index);
+	return frame + payload;
+}
+
+void fragments_carry_index()
+{
+	mux_fixture fixture{4};
+	MROBOT_CHECK(fixture.mux.send(1, buffer_view{std::string{"abcdefghij"}}));
+
+	std::string expected = fragment_frame(1, true, 0, "abcd") + fragment_frame(1, true, 1, "efgh")
+			+ fragment_frame(1, false, 2, "ij");
+	MROBOT_CHECK(fixture.pty.read_master(expected.size(), std::chrono::milliseconds{1000}) == expected);
+	MROBOT_CHECK(fixture.mux.get_stats(1).sent_messages == 1);
+}
+
+void looped_back_message_is_reassembled()
+{
+	mux_fixture fixture{100};
+	std::string message(1000, 'm');
+	for (std::size_t i = 0; i < message.size(); i++)
+		message[i] = static_cast<char>('a' + i % 26);
+	MROBOT_CHECK(fixture.mux.send(1, buffer_view{message}));
+
+	std::string wire = fixture.pty.read_master(message.size() + 10 * 4, std::chrono::milliseconds{1000});
+	MROBOT_CHECK(wire.size() == message.size() + 10 * 4);
+	fixture.pty.write_master(wire);
+	MROBOT_CHECK(wait_until([&] { return fixture.get_messages().size() == 1; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(fixture.get_messages()[0] == message);
+	MROBOT_CHECK(fixture.mux.get_errors_count() == 0);
+}
+
+void missing_fragment_discards_message()
+{
+	mux_fixture fixture;
+	// fragment 1 is missing, so fragment 2 and the rest of message are dropped
+	fixture.pty.write_master(fragment_frame(1, true, 0, "AB") + fragment_frame(1, false, 2, "EF")
+			+ fragment_frame(1, false, 0, "next"));
+
+	MROBOT_CHECK(wait_until([&] { return fixture.get_messages().size() == 1; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(fixture.get_messages()[0] == "next");
+	MROBOT_CHECK(fixture.mux.get_errors_count() == 1);
+	MROBOT_CHECK(fixture.mux.get_stats(1).received_messages == 1);
+}
+
+void first_fragment_discards_incomplete_message()
+{
+	mux_fixture fixture;
+	// last fragment of first message is missing
+	fixture.pty.write_master(fragment_frame(1, true, 0, "AB") + fragment_frame(1, true, 1, "CD")
+			+ fragment_frame(1, true, 0, "EF") + fragment_frame(1, false, 1, "GH"));
+
+	MROBOT_CHECK(wait_until([&] { return fixture.get_messages().size() == 1; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(fixture.get_messages()[0] == "EFGH");
+	MROBOT_CHECK(fixture.mux.get_errors_count() == 1);
+}
+
+void fragment_without_first_is_dropped()
+{
+	mux_fixture fixture;
+	fixture.pty.write_master(fragment_frame(1, true, 1, "CD") + fragment_frame(1, false, 2, "EF")
+			+ fragment_frame(1, false, 0, "whole"));
+
+	MROBOT_CHECK(wait_until([&] { return fixture.get_messages().size() == 1; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(fixture.get_messages()[0] == "whole");
+	MROBOT_CHECK(fixture.mux.get_errors_count() == 2);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "fragments_carry_index", fragments_carry_index },
+		{ "looped_back_message_is_reassembled", looped_back_message_is_reassembled },
+		{ "missing_fragment_discards_message", missing_fragment_discards_message },
+		{ "first_fragment_discards_incomplete_message", first_fragment_discards_incomplete_message },
+		{ "fragment_without_first_is_dropped", fragment_without_first_is_dropped },
+	}, argc, argv);
+}
@@ -0,0 +1,155 @@
+/*
+ * checksum_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Known-answer tests of CRC types in every implementation supported by
+ * CPU, byte order of stored checksums and validation of frames by
+ * checksum_decoder.
+ *
+ * Usage: checksum_test [filter]
+ */
+
+#include "test_util.h"
+#include "checksum.h"
+#include "frame_decoder.h"
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Check value of CRC type (checksum of "123456789") and its stored bytes
+ */
+struct known_answer
+{
+	checksum_type type;
+	std::uint32_t check;
+	std::string stored;
+};
+
+const std::vector<known_answer> known_answers = {
+	{ checksum_type::crc16_modbus, 0x4B37, "\x37\x4B" },
+	{ checksum_type::crc16_ccitt, 0x29B1, "\x29\xB1" },
+	{ checksum_type::crc32, 0xCBF43926, "\x26\x39\xF4\xCB" },
+	{ checksum_type::crc32c, 0xE3069283, "\x83\x92\x06\xE3" },
+};
+
+const checksum_implementation implementations[] = {
+	checksum_implementation::bitwise,
+	checksum_implementation::slicing_by_8,
+	checksum_implementation::sse42,
+	checksum_implementation::pclmul,
+};
+
+std::uint32_t checksum_of(checksum_type type, const std::string& data, checksum_implementation implementation)
+{
+	return update_checksum(type, get_initial_checksum(type), buffer_view{data}, implementation);
+}
+
+void check_values_of_all_implementations()
+{
+	std::string data = "123456789";
+	for (const known_answer& answer : known_answers)
+	{
+		MROBOT_CHECK(compute_checksum(answer.type, buffer_view{data}) == answer.check);
+		for (checksum_implementation implementation : implementations)
+			MROBOT_CHECK(checksum_of(answer.type, data, implementation) == answer.check);
+	}
+}
+
+void implementations_match_reference()
+{
+	std::string data;
+	std::uint32_t seed = 12345;
+	for (int i = 0; i < 1000; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data += static_cast<char>(seed >> 16);
+	}
+
+	// lengths around block sizes of slicing and folding implementations
+	for (const known_answer& answer : known_answers)
+	{
+		for (std::size_t length = 0; length <= data.size(); length += length < 200 ? 1 : 97)
+		{
+			std::string part = data.substr(0, length);
+			std::uint32_t reference = checksum_of(answer.type, part, checksum_implementation::bitwise);
+			for (checksum_implementation implementation : implementations)
+			{
+				if (is_checksum_implementation_supported(answer.type, implementation))
+					MROBOT_CHECK(checksum_of(answer.type, part, implementation) == reference);
+			}
+		}
+	}
+}
+
+void update_continues_checksum()
+{
+	std::string data = "123456789";
+	for (const known_answer& answer : known_answers)
+	{
+		for (std::size_t split = 0; split <= data.size(); split++)
+		{
+			std::uint32_t checksum = update_checksum(answer.type, get_initial_checksum(answer.type), buffer_view{data.data(), split});
+			checksum = update_checksum(answer.type, checksum, buffer_view{data.data() + split, data.size() - split});
+			MROBOT_CHECK(checksum == answer.check);
+		}
+	}
+}
+
+void stored_byte_order()
+{
+	for (const known_answer& answer : known_answers)
+	{
+		char stored[4] = {};
+		MROBOT_CHECK(get_checksum_size(answer.type) == answer.stored.size());
+		write_checksum(answer.type, answer.check, stored);
+		MROBOT_CHECK(std::string(stored, answer.stored.size()) == answer.stored);
+		MROBOT_CHECK(read_checksum(answer.type, answer.stored.data()) == answer.check);
+	}
+}
+
+/**
+ * @brief Creates frame with one byte length prefix, payload and checksum
+ */
+std::string frame_of(checksum_type type, const std::string& payload)
+{
+	std::string checksum(get_checksum_size(type), '\0');
+	write_checksum(type, compute_checksum(type, buffer_view{payload}), &checksum[0]);
+	return static_cast<char>(payload.size() + checksum.size()) + payload + checksum;
+}
+
+void decoder_strips_and_rejects()
+{
+	for (const known_answer& answer : known_answers)
+	{
+		std::string corrupted = frame_of(answer.type, "bad");
+		corrupted[1] ^= 0x01;
+		std::string too_short{static_cast<char>(1), 'x'};
+
+		// valid, corrupted, shorter than checksum, valid with empty payload
+		std::string stream = frame_of(answer.type, "first") + corrupted + too_short + frame_of(answer.type, "");
+		checksum_decoder decoder{std::unique_ptr<frame_decoder>{new length_prefix_decoder{1}}, answer.type};
+		std::vector<std::string> frames;
+		decoder.decode(buffer_view{stream}, [&](buffer_view frame) { frames.emplace_back(frame.begin(), frame.end()); });
+
+		MROBOT_CHECK(frames.size() == 2 && frames[0] == "first" && frames[1].empty());
+		MROBOT_CHECK(decoder.get_errors_count() == 2);
+		MROBOT_CHECK(decoder.get_decoder().get_errors_count() == 0);
+	}
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "check_values_of_all_implementations", check_values_of_all_implementations },
+		{ "implementations_match_reference", implementations_match_reference },
+		{ "update_continues_checksum", update_continues_checksum },
+		{ "stored_byte_order", stored_byte_order },
+		{ "decoder_strips_and_rejects", decoder_strips_and_rejects },
+	}, argc, argv);
+}
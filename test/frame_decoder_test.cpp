@@ -0,0 +1,183 @@
+/*
+ * frame_decoder_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Known-answer tests of frame decoders (delimiter, length prefix, SLIP,
+ * COBS) and of vectorized delimiter scanning. Every input is decoded as
+ * one chunk, split in two at each position and fed byte by byte.
+ *
+ * Usage: frame_decoder_test [filter]
+ */
+
+#include "test_util.h"
+#include "frame_decoder.h"
+#include "delimiter_scan.h"
+#include <algorithm>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Makes string of literal which can contain zero bytes
+ */
+template<std::size_t size>
+std::string bytes(const char (&data)[size])
+{
+	return std::string(data, size - 1);
+}
+
+/**
+ * @brief Input of decoder and expected frames
+ */
+struct decoder_case
+{
+	const char* name;
+	std::function<std::unique_ptr<frame_decoder>()> create;
+	std::string input;
+	std::vector<std::string> frames;
+	unsigned long long errors;
+};
+
+/**
+ * @brief Decodes input split into given chunks with new decoder
+ */
+void decode_chunks(const decoder_case& test, const std::vector<std::size_t>& chunk_sizes)
+{
+	std::unique_ptr<frame_decoder> decoder = test.create();
+	std::vector<std::string> frames;
+	std::size_t offset = 0;
+	for (std::size_t size : chunk_sizes)
+	{
+		decoder->decode(buffer_view{test.input.data() + offset, size}, [&](buffer_view frame)
+		{
+			frames.emplace_back(frame.begin(), frame.end());
+		});
+		offset += size;
+	}
+	MROBOT_CHECK(frames == test.frames);
+	MROBOT_CHECK(decoder->get_errors_count() == test.errors);
+}
+
+void run_decoder_cases(const std::vector<decoder_case>& cases)
+{
+	for (const decoder_case& test : cases)
+	{
+		try
+		{
+			decode_chunks(test, {test.input.size()});
+			for (std::size_t split = 1; split < test.input.size(); split++)
+				decode_chunks(test, {split, test.input.size() - split});
+			decode_chunks(test, std::vector<std::size_t>(test.input.size(), 1));
+		} catch (check_failure& failure)
+		{
+			throw std::runtime_error(std::string{test.name} + ": " + failure.what());
+		}
+	}
+}
+
+template<typename decoder_type, typename... argument_types>
+std::function<std::unique_ptr<frame_decoder>()> decoder_of(argument_types... arguments)
+{
+	return [=] { return std::unique_ptr<frame_decoder>{new decoder_type(arguments...)}; };
+}
+
+void delimiter_decoder_cases()
+{
+	run_decoder_cases({
+		{ "lines", decoder_of<delimiter_decoder>('\n'), "a\nbc\n\n", { "a", "bc", "" }, 0 },
+		{ "partial_frame_is_kept", decoder_of<delimiter_decoder>('\n'), "ab\ncd", { "ab" }, 0 },
+		{ "include_delimiter", decoder_of<delimiter_decoder>(';', true), "ab;c;", { "ab;", "c;" }, 0 },
+		{ "too_long_frame_is_dropped", decoder_of<delimiter_decoder>('\n', false, 4), "12345\nok\n1234\n", { "ok", "1234" }, 1 },
+		{ "long_stream", decoder_of<delimiter_decoder>('|'), std::string(100, 'x') + "|" + std::string(37, 'y') + "|",
+				{ std::string(100, 'x'), std::string(37, 'y') }, 0 },
+	});
+}
+
+void length_prefix_decoder_cases()
+{
+	run_decoder_cases({
+		{ "big_endian", decoder_of<length_prefix_decoder>(2, true, 8), bytes("\x00\x03" "abc" "\x00\x01" "z"), { "abc", "z" }, 0 },
+		{ "little_endian", decoder_of<length_prefix_decoder>(2, false, 8), bytes("\x02\x00" "ab"), { "ab" }, 0 },
+		{ "one_byte_prefix", decoder_of<length_prefix_decoder>(1, true, 8), bytes("\x01" "a" "\x02" "bc"), { "a", "bc" }, 0 },
+		{ "four_byte_prefix", decoder_of<length_prefix_decoder>(4, true, 8), bytes("\x00\x00\x00\x04" "abcd"), { "abcd" }, 0 },
+		{ "empty_payload", decoder_of<length_prefix_decoder>(2, true, 8), bytes("\x00\x00\x00\x01" "a"), { "", "a" }, 0 },
+		{ "too_long_payload_is_skipped", decoder_of<length_prefix_decoder>(2, true, 4), bytes("\x00\x05" "hello" "\x00\x02" "ok"),
+				{ "ok" }, 1 },
+		{ "partial_payload_is_kept", decoder_of<length_prefix_decoder>(2, true, 8), bytes("\x00\x04" "ab"), {}, 0 },
+	});
+}
+
+void slip_decoder_cases()
+{
+	run_decoder_cases({
+		{ "plain_frames", decoder_of<slip_decoder>(), bytes("ab" "\xC0" "cd" "\xC0"), { "ab", "cd" }, 0 },
+		{ "escaped_bytes", decoder_of<slip_decoder>(), bytes("\xC0" "a" "\xDB\xDC" "b" "\xDB\xDD" "\xC0"), { bytes("a" "\xC0" "b" "\xDB") }, 0 },
+		{ "empty_frames_are_ignored", decoder_of<slip_decoder>(), bytes("\xC0\xC0" "x" "\xC0\xC0"), { "x" }, 0 },
+		{ "invalid_escape_drops_frame", decoder_of<slip_decoder>(), bytes("a" "\xDB" "zb" "\xC0" "ok" "\xC0"), { "ok" }, 1 },
+		{ "too_long_frame_is_dropped", decoder_of<slip_decoder>(4), bytes("12345" "\xC0" "1234" "\xC0"), { "1234" }, 1 },
+	});
+}
+
+void cobs_decoder_cases()
+{
+	std::string block;
+	for (int i = 1; i < 0xFF; i++)
+		block += static_cast<char>(i);
+
+	// common COBS encoding examples (zero runs and full 254 byte block)
+	run_decoder_cases({
+		{ "zero", decoder_of<cobs_decoder>(), bytes("\x01\x01\x00"), { bytes("\x00") }, 0 },
+		{ "two_zeros", decoder_of<cobs_decoder>(), bytes("\x01\x01\x01\x00"), { bytes("\x00\x00") }, 0 },
+		{ "zero_inside", decoder_of<cobs_decoder>(), bytes("\x03\x11\x22\x02\x33\x00"), { bytes("\x11\x22\x00\x33") }, 0 },
+		{ "no_zero", decoder_of<cobs_decoder>(), bytes("\x05\x11\x22\x33\x44\x00"), { bytes("\x11\x22\x33\x44") }, 0 },
+		{ "trailing_zeros", decoder_of<cobs_decoder>(), bytes("\x02\x11\x01\x01\x01\x00"), { bytes("\x11\x00\x00\x00") }, 0 },
+		{ "full_block", decoder_of<cobs_decoder>(), "\xFF" + block + std::string(1, '\0'), { block }, 0 },
+		{ "full_block_and_zero", decoder_of<cobs_decoder>(), "\xFF" + block + bytes("\x01\x01\x00"), { block + std::string(1, '\0') }, 0 },
+		{ "empty_frame_is_ignored", decoder_of<cobs_decoder>(), bytes("\x00\x02" "a" "\x00"), { "a" }, 0 },
+		{ "truncated_block_is_dropped", decoder_of<cobs_decoder>(), bytes("\x05" "ab" "\x00\x02" "c" "\x00"), { "c" }, 1 },
+	});
+}
+
+void scan_matches_scalar_search()
+{
+	std::string data(300, 'a');
+	for (std::size_t offset = 0; offset < 33; offset++)
+	{
+		for (std::size_t length = 0; offset + length <= data.size(); length += length < 70 ? 1 : 37)
+		{
+			const char* begin = data.data() + offset;
+			const char* end = begin + length;
+			MROBOT_CHECK(find_byte(begin, end, '|') == end);
+			MROBOT_CHECK(find_any_of_two(begin, end, '|', '#') == end);
+
+			for (std::size_t position = 0; position < length; position += 1 + position / 8)
+			{
+				std::string text = data;
+				text[offset + position] = '#';
+				if (position + 1 < length)
+					text[offset + position + 1] = '|';
+				const char* text_begin = text.data() + offset;
+				const char* text_end = text_begin + length;
+
+				MROBOT_CHECK(find_byte(text_begin, text_end, '#') == std::find(text_begin, text_end, '#'));
+				MROBOT_CHECK(find_any_of_two(text_begin, text_end, '|', '#') == text_begin + position);
+			}
+		}
+	}
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "delimiter_decoder_cases", delimiter_decoder_cases },
+		{ "length_prefix_decoder_cases", length_prefix_decoder_cases },
+		{ "slip_decoder_cases", slip_decoder_cases },
+		{ "cobs_decoder_cases", cobs_decoder_cases },
+		{ "scan_matches_scalar_search", scan_matches_scalar_search },
+	}, argc, argv);
+}
@@ -0,0 +1,169 @@
+/*
+ * port_group_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of port group: merging of received data, delivery timer of
+ * member moved to other shard, removing members and broadcasting.
+ *
+ * Usage: port_group_test [filter]
+ */
+
+#include "test_util.h"
+#include "port_group.h"
+#include <mutex>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Merged data received by test (merged data event is called by polling threads)
+ */
+struct merged_stream
+{
+	std::mutex mutex;
+	std::string data;
+	std::vector<serial_port*> ports;
+
+	void subscribe(port_group& group)
+	{
+		group.subscribe_merged_data_event([this](serial_port& port, timer_clock::time_point, pooled_buffer buffer)
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			data.append(buffer.data(), buffer.size());
+			ports.push_back(&port);
+		});
+	}
+
+	std::string get_data()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		return data;
+	}
+};
+
+void merges_members_in_receive_order()
+{
+	pty_pair first;
+	pty_pair second;
+	poll_controler controler{-1, trigger_mode::level, 2};
+	merged_stream stream;
+	{
+		port_group group{controler, std::chrono::milliseconds{20}};
+		stream.subscribe(group);
+		group.add(first.port.get());
+		group.add(second.port.get());
+		controler.start_polling();
+
+		first.write_master("a");
+		MROBOT_CHECK(wait_until([&] { return first.port->get_metrics().bytes_in == 1; }, std::chrono::milliseconds{1000}));
+		second.write_master("b");
+		MROBOT_CHECK(wait_until([&] { return stream.get_data() == "ab"; }, std::chrono::milliseconds{1000}));
+		MROBOT_CHECK(stream.ports.size() == 2 && stream.ports[0] == first.port.get() && stream.ports[1] == second.port.get());
+		controler.stop_polling();
+	}
+	MROBOT_CHECK(controler.get_shard_load(0) + controler.get_shard_load(1) == 0);
+}
+
+void delivery_timer_moves_with_member()
+{
+	pty_pair pty;
+	poll_controler controler{-1, trigger_mode::level, 2};
+	idle_owner pinned[2];
+	merged_stream stream;
+	controler.set_shard_assignment(shard_assignment::least_loaded);
+	{
+		port_group group{controler, std::chrono::milliseconds{100}};
+		stream.subscribe(group);
+		group.add(pty.port.get());
+		for (idle_owner& owner : pinned)
+			controler.add(&owner, 0);
+		controler.start_polling();
+		MROBOT_CHECK(controler.get_shard_of(pty.port.get()) == 0);
+
+		pty.write_master("first");
+		MROBOT_CHECK(wait_until([&] { return controler.get_metrics(0).pending_timers == 1; }, std::chrono::milliseconds{1000}));
+		controler.rebalance();
+		MROBOT_CHECK(controler.get_shard_of(pty.port.get()) == 1);
+		MROBOT_CHECK(wait_until([&] { return stream.get_data() == "first"; }, std::chrono::milliseconds{1000}));
+
+		// delivery isn't considered scheduled after moved timer fired
+		pty.write_master("second");
+		MROBOT_CHECK(wait_until([&] { return stream.get_data() == "firstsecond"; }, std::chrono::milliseconds{1000}));
+		controler.stop_polling();
+	}
+	for (idle_owner& owner : pinned)
+		controler.remove(&owner);
+}
+
+void remove_delivers_pending_chunks()
+{
+	pty_pair pty;
+	poll_controler controler{-1};
+	merged_stream stream;
+	port_group group{controler, std::chrono::seconds{10}};
+	stream.subscribe(group);
+	group.add(pty.port.get());
+	controler.start_polling();
+
+	pty.write_master("pending");
+	MROBOT_CHECK(wait_until([&] { return pty.port->get_metrics().bytes_in == 7; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(stream.get_data().empty());
+	group.remove(pty.port.get());
+	MROBOT_CHECK(stream.get_data() == "pending");
+	MROBOT_CHECK(group.get_members_count() == 0);
+	MROBOT_CHECK(pty.port->get_reactor() == nullptr);
+	MROBOT_CHECK(!pty.port->is_buffer_event_subscribed());
+	controler.stop_polling();
+}
+
+void add_rejects_subscribed_port()
+{
+	pty_pair pty;
+	poll_controler controler{-1};
+	port_group group{controler};
+	pty.port->subscribe_buffer_event([](serial_port&, pooled_buffer) {});
+
+	bool is_thrown = false;
+	try
+	{
+		group.add(pty.port.get());
+	} catch (serial_port_exception&)
+	{
+		is_thrown = true;
+	}
+	MROBOT_CHECK(is_thrown);
+	MROBOT_CHECK(group.get_members_count() == 0);
+	MROBOT_CHECK(pty.port->get_reactor() == nullptr);
+}
+
+void broadcast_sends_to_all_members()
+{
+	pty_pair first;
+	pty_pair second;
+	poll_controler controler{-1};
+	port_group group{controler};
+	group.add(first.port.get());
+	group.add(second.port.get());
+	controler.start_polling();
+
+	MROBOT_CHECK(group.broadcast(buffer_view{"ping", 4}) == 2);
+	MROBOT_CHECK(first.read_master(4, std::chrono::milliseconds{1000}) == "ping");
+	MROBOT_CHECK(second.read_master(4, std::chrono::milliseconds{1000}) == "ping");
+	controler.stop_polling();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "merges_members_in_receive_order", merges_members_in_receive_order },
+		{ "delivery_timer_moves_with_member", delivery_timer_moves_with_member },
+		{ "remove_delivers_pending_chunks", remove_delivers_pending_chunks },
+		{ "add_rejects_subscribed_port", add_rejects_subscribed_port },
+		{ "broadcast_sends_to_all_members", broadcast_sends_to_all_members },
+	}, argc, argv);
+}
@@ -0,0 +1,196 @@
+/*
+ * reactor_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of reactor timers and moving descriptors between poll controler
+ * shards (also automatic rebalancing requested by polling thread).
+ *
+ * Usage: reactor_test [filter]
+ */
+
+#include "test_util.h"
+#include "poll_controler.h"
+#include <atomic>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Controler with two shards, owner in shard 0 which rebalancing moves to shard 1
+ */
+struct two_shards
+{
+	poll_controler controler{-1, trigger_mode::level, 2};
+	idle_owner moved;
+	idle_owner pinned[2];
+
+	two_shards()
+	{
+		controler.set_shard_assignment(shard_assignment::least_loaded);
+		controler.add(&moved);
+		for (idle_owner& owner : pinned)
+			controler.add(&owner, 0);
+		controler.start_polling();
+		MROBOT_CHECK(controler.get_shard_of(&moved) == 0);
+	}
+
+	~two_shards()
+	{
+		controler.stop_polling();
+		controler.remove(&moved);
+		for (idle_owner& owner : pinned)
+			controler.remove(&owner);
+	}
+};
+
+void timer_moves_with_owner()
+{
+	two_shards shards;
+	std::atomic<int> calls{0};
+	std::atomic<bool> is_new_shard{false};
+	shards.controler.get_shard(0).schedule_timer(&shards.moved, std::chrono::milliseconds{100}, [&]
+	{
+		is_new_shard = shards.controler.get_shard(1).is_poll_thread();
+		calls++;
+	});
+
+	shards.controler.rebalance();
+	MROBOT_CHECK(shards.controler.get_shard_of(&shards.moved) == 1);
+	MROBOT_CHECK(wait_until([&] { return calls == 1; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(is_new_shard);
+	std::this_thread::sleep_for(std::chrono::milliseconds{50});
+	MROBOT_CHECK(calls == 1);
+}
+
+void moved_timer_is_cancelled_in_new_shard()
+{
+	two_shards shards;
+	std::atomic<int> cancelled_calls{0};
+	std::atomic<int> kept_calls{0};
+	reactor& source = shards.controler.get_shard(0);
+	std::uint64_t cancelled = source.schedule_timer(&shards.moved, std::chrono::milliseconds{50}, [&] { cancelled_calls++; });
+	source.schedule_timer(&shards.moved, std::chrono::milliseconds{50}, [&] { kept_calls++; });
+
+	shards.controler.rebalance();
+	shards.controler.get_shard(1).cancel_timer(cancelled);
+
+	MROBOT_CHECK(wait_until([&] { return kept_calls == 1; }, std::chrono::milliseconds{1000}));
+	std::this_thread::sleep_for(std::chrono::milliseconds{50});
+	MROBOT_CHECK(cancelled_calls == 0);
+}
+
+void identifier_of_other_reactor_does_not_cancel_timer()
+{
+	reactor first{-1};
+	reactor second{-1};
+	idle_owner owner;
+	std::atomic<int> calls{0};
+	std::uint64_t foreign = first.schedule_timer(&owner, std::chrono::milliseconds{10}, [] {});
+	std::uint64_t own = second.schedule_timer(&owner, std::chrono::milliseconds{10}, [&] { calls++; });
+	MROBOT_CHECK(foreign != own);
+
+	second.cancel_timer(foreign);
+	second.add(&owner);
+	second.start_polling();
+	MROBOT_CHECK(wait_until([&] { return calls == 1; }, std::chrono::milliseconds{1000}));
+	second.stop_polling();
+	second.remove(&owner);
+}
+
+void remove_cancels_timers()
+{
+	poll_controler controler{-1};
+	idle_owner owner;
+	controler.add(&owner);
+	controler.start_polling();
+	std::atomic<int> calls{0};
+	controler.get_shard(0).schedule_timer(&owner, std::chrono::milliseconds{20}, [&] { calls++; });
+	controler.remove(&owner);
+	std::this_thread::sleep_for(std::chrono::milliseconds{60});
+	controler.stop_polling();
+	MROBOT_CHECK(calls == 0);
+}
+
+void batched_port_delivers_after_move()
+{
+	pty_pair pty;
+	poll_controler controler{-1, trigger_mode::level, 2};
+	idle_owner pinned[2];
+	controler.set_shard_assignment(shard_assignment::least_loaded);
+
+	std::atomic<std::size_t> received{0};
+	pty.port->set_read_mode(read_mode::batched);
+	pty.port->set_min_data_to_read(100);
+	pty.port->set_inter_byte_timeout(std::chrono::milliseconds{5});
+	pty.port->subscribe_data_view_event([&](serial_port&, buffer_view data) { received += data.size; });
+
+	controler.add(pty.port.get());
+	for (idle_owner& owner : pinned)
+		controler.add(&owner, 0);
+	controler.start_polling();
+
+	// gap timer of batched mode is moved with port, so batch smaller than VMIN is still delivered
+	controler.rebalance();
+	MROBOT_CHECK(controler.get_shard_of(pty.port.get()) == 1);
+	pty.write_master("0123456789");
+	MROBOT_CHECK(wait_until([&] { return received == 10; }, std::chrono::milliseconds{1000}));
+
+	controler.stop_polling();
+	controler.remove(pty.port.get());
+	for (idle_owner& owner : pinned)
+		controler.remove(&owner);
+}
+
+void add_from_polling_thread_skips_rebalance()
+{
+	two_shards shards;
+	idle_owner added;
+	std::atomic<bool> is_added{false};
+	shards.controler.set_automatic_rebalancing(true);
+	shards.controler.get_shard(0).schedule_timer(nullptr, std::chrono::milliseconds{1}, [&]
+	{
+		shards.controler.add(&added);
+		is_added = true;
+	});
+
+	// moving descriptor waits for polling thread of shard 0, so add() called by it can't rebalance
+	MROBOT_CHECK(wait_until([&] { return is_added.load(); }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(shards.controler.get_shard_of(&shards.moved) == 0);
+	shards.controler.remove(&added);
+	MROBOT_CHECK(shards.controler.get_shard_of(&shards.moved) == 1);
+	shards.controler.set_automatic_rebalancing(false);
+}
+
+void shard_out_of_range_throws()
+{
+	poll_controler controler{-1, trigger_mode::level, 2};
+	idle_owner owner;
+	bool is_thrown = false;
+	try
+	{
+		controler.add(&owner, 2);
+	} catch (poll_exception&)
+	{
+		is_thrown = true;
+	}
+	MROBOT_CHECK(is_thrown);
+	MROBOT_CHECK(controler.get_shard_load(0) == 0 && controler.get_shard_load(1) == 0);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "timer_moves_with_owner", timer_moves_with_owner },
+		{ "moved_timer_is_cancelled_in_new_shard", moved_timer_is_cancelled_in_new_shard },
+		{ "identifier_of_other_reactor_does_not_cancel_timer", identifier_of_other_reactor_does_not_cancel_timer },
+		{ "remove_cancels_timers", remove_cancels_timers },
+		{ "batched_port_delivers_after_move", batched_port_delivers_after_move },
+		{ "add_from_polling_thread_skips_rebalance", add_from_polling_thread_skips_rebalance },
+		{ "shard_out_of_range_throws", shard_out_of_range_throws },
+	}, argc, argv);
+}
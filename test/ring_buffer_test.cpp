@@ -0,0 +1,167 @@
+/*
+ * ring_buffer_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of receive ring buffer: capacity rounding, data wrapping around
+ * end of memory at every offset and resizing of wrapped data.
+ *
+ * Usage: ring_buffer_test [filter]
+ */
+
+#include "test_util.h"
+#include "ring_buffer.h"
+#include <cstring>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Stores data through writable regions (as readv() does)
+ * @return number of stored bytes
+ */
+std::size_t write(ring_buffer& buffer, const std::string& data)
+{
+	iovec regions[2];
+	int count = buffer.writable_regions(regions);
+	std::size_t written = 0;
+	for (int i = 0; i < count && written < data.size(); i++)
+	{
+		std::size_t size = std::min(regions[i].iov_len, data.size() - written);
+		std::memcpy(regions[i].iov_base, data.data() + written, size);
+		written += size;
+	}
+	buffer.commit(written);
+	return written;
+}
+
+/**
+ * @brief Consumes stored data through contiguous views (as deliver_data() does)
+ */
+std::string read_views(ring_buffer& buffer)
+{
+	std::string data;
+	while (!buffer.empty())
+	{
+		buffer_view front = buffer.readable_front();
+		data.append(front.begin(), front.end());
+		buffer.consume(front.size);
+	}
+	return data;
+}
+
+std::string pattern(std::size_t size, char first)
+{
+	std::string data;
+	for (std::size_t i = 0; i < size; i++)
+		data += static_cast<char>(first + i % 26);
+	return data;
+}
+
+void capacity_is_rounded_to_power_of_two()
+{
+	const std::pair<std::size_t, std::size_t> capacities[] = {
+		{ 0, 1 }, { 1, 1 }, { 3, 4 }, { 8, 8 }, { 9, 16 }, { 4096, 4096 }, { 5000, 8192 },
+	};
+	for (const auto& capacity : capacities)
+	{
+		ring_buffer buffer{capacity.first};
+		MROBOT_CHECK(buffer.capacity() == capacity.second);
+		MROBOT_CHECK(buffer.empty() && buffer.free_space() == capacity.second);
+	}
+}
+
+void data_wraps_at_every_offset()
+{
+	const std::size_t capacity = 8;
+	for (std::size_t offset = 0; offset < capacity; offset++)
+	{
+		for (std::size_t size = 1; size <= capacity; size++)
+		{
+			ring_buffer buffer{capacity};
+			// keeps one byte, so consuming doesn't rewind buffer
+			MROBOT_CHECK(write(buffer, pattern(offset + 1, 'A')) == offset + 1);
+			buffer.consume(offset);
+
+			std::string data = pattern(size - 1, 'a');
+			iovec regions[2];
+			int regions_count = buffer.writable_regions(regions);
+			MROBOT_CHECK(regions_count == (offset == 0 || offset == capacity - 1 ? 1 : 2));
+			MROBOT_CHECK(write(buffer, data) == data.size());
+			MROBOT_CHECK(buffer.size() == size);
+			MROBOT_CHECK(buffer.full() == (size == capacity));
+
+			std::string expected = std::string(1, static_cast<char>('A' + offset % 26)) + data;
+			if (size % 2 == 0)
+			{
+				MROBOT_CHECK(read_views(buffer) == expected);
+			}
+			else
+			{
+				std::string copy(capacity, '\0');
+				copy.resize(buffer.read(&copy[0], copy.size()));
+				MROBOT_CHECK(copy == expected);
+			}
+			MROBOT_CHECK(buffer.empty());
+		}
+	}
+}
+
+void full_buffer_has_no_regions()
+{
+	ring_buffer buffer{4};
+	MROBOT_CHECK(write(buffer, "abcdef") == 4);
+	iovec regions[2];
+	MROBOT_CHECK(buffer.writable_regions(regions) == 0);
+	MROBOT_CHECK(buffer.full());
+	MROBOT_CHECK(read_views(buffer) == "abcd");
+}
+
+void consuming_all_data_rewinds_buffer()
+{
+	ring_buffer buffer{8};
+	write(buffer, "abcdef");
+	buffer.consume(6);
+	iovec regions[2];
+	MROBOT_CHECK(buffer.writable_regions(regions) == 1);
+	MROBOT_CHECK(regions[0].iov_len == 8);
+
+	// consuming more than stored is limited to stored data
+	write(buffer, "xy");
+	buffer.consume(100);
+	MROBOT_CHECK(buffer.empty());
+}
+
+void resize_keeps_wrapped_data()
+{
+	ring_buffer buffer{8};
+	write(buffer, "0123456");
+	buffer.consume(5);
+	write(buffer, "abcde");
+	MROBOT_CHECK(buffer.readable_front().size == 3);
+
+	buffer.resize(32);
+	MROBOT_CHECK(buffer.capacity() == 32);
+	MROBOT_CHECK(buffer.readable_front().size == 7);
+	MROBOT_CHECK(write(buffer, "fg") == 2);
+
+	// capacity isn't reduced below stored data
+	buffer.resize(2);
+	MROBOT_CHECK(buffer.capacity() == 16);
+	MROBOT_CHECK(read_views(buffer) == "56abcdefg");
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "capacity_is_rounded_to_power_of_two", capacity_is_rounded_to_power_of_two },
+		{ "data_wraps_at_every_offset", data_wraps_at_every_offset },
+		{ "full_buffer_has_no_regions", full_buffer_has_no_regions },
+		{ "consuming_all_data_rewinds_buffer", consuming_all_data_rewinds_buffer },
+		{ "resize_keeps_wrapped_data", resize_keeps_wrapped_data },
+	}, argc, argv);
+}
@@ -0,0 +1,368 @@
+/*
+ * serial_port_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of serial port sends, asynchronous send and write coalescing:
+ * deadline flush, flush while device doesn't accept data and order of
+ * coalesced and queued data. Dispatch of received data to overrides of
+ * derived ports and to handler of inline port.
+ *
+ * Usage: serial_port_test [filter]
+ */
+
+#include "test_util.h"
+#include "poll_controler.h"
+#include "inline_serial_port.h"
+#include <atomic>
+#include <mutex>
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Port observed by single shard poll controler
+ */
+struct polled_port
+{
+	pty_pair pty;
+	poll_controler controler{-1};
+
+	polled_port()
+	{
+		controler.add(pty.port.get());
+		controler.start_polling();
+	}
+
+	~polled_port()
+	{
+		controler.stop_polling();
+		controler.remove(pty.port.get());
+	}
+};
+
+/**
+ * @brief Data received by test handlers (handlers are called by polling thread)
+ */
+struct received_data
+{
+	std::mutex mutex;
+	std::string data;
+	std::vector<std::string> frames;
+
+	void append(buffer_view view)
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		data.append(view.begin(), view.end());
+	}
+
+	void add_frame(buffer_view frame)
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		frames.emplace_back(frame.begin(), frame.end());
+	}
+
+	std::string get_data()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		return data;
+	}
+
+	std::vector<std::string> get_frames()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		return frames;
+	}
+};
+
+void send_async_without_controler_writes_nothing()
+{
+	pty_pair pty;
+	bool is_thrown = false;
+	try
+	{
+		pty.port->send_async(buffer_view{"data", 4});
+	} catch (serial_port_exception&)
+	{
+		is_thrown = true;
+	}
+	MROBOT_CHECK(is_thrown);
+	MROBOT_CHECK(pty.read_master(4, std::chrono::milliseconds{20}).empty());
+	MROBOT_CHECK(pty.port->get_metrics().bytes_out == 0);
+}
+
+void send_iovec_list()
+{
+	pty_pair pty;
+	std::string expected;
+	std::vector<iovec> buffers;
+	static const char digits[] = "0123456789";
+	for (int i = 0; i < 100; i++)
+	{
+		buffers.push_back(iovec{const_cast<char*>(digits + i % 10), 1});
+		expected += digits[i % 10];
+	}
+
+	// short list is described on stack, long list is allocated
+	pty.port->send(buffers.data(), 3);
+	pty.port->send(buffers.data(), buffers.size());
+	MROBOT_CHECK(pty.read_master(103, std::chrono::milliseconds{1000}) == "012" + expected);
+	MROBOT_CHECK(buffers[0].iov_base == digits && buffers[0].iov_len == 1);
+}
+
+void deadline_writes_batch()
+{
+	polled_port polled;
+	serial_port& port = *polled.pty.port;
+	port.set_write_coalescing(1024, std::chrono::milliseconds{2});
+
+	port.send(buffer_view{"ab", 2});
+	port.send(buffer_view{"cd", 2});
+	port.send(buffer_view{"ef", 2});
+	MROBOT_CHECK(polled.pty.read_master(6, std::chrono::milliseconds{1000}) == "abcdef");
+
+	port_metrics_snapshot metrics = port.get_metrics();
+	MROBOT_CHECK(metrics.coalesced_messages == 3);
+	MROBOT_CHECK(metrics.coalesced_writes == 1);
+	MROBOT_CHECK(metrics.frames_out == 3);
+}
+
+void threshold_writes_batch_with_message()
+{
+	polled_port polled;
+	serial_port& port = *polled.pty.port;
+	port.set_write_coalescing(8, std::chrono::seconds{10});
+
+	port.send(buffer_view{"abc", 3});
+	port.send(buffer_view{"0123456789", 10});
+	MROBOT_CHECK(polled.pty.read_master(13, std::chrono::milliseconds{1000}) == "abc0123456789");
+	MROBOT_CHECK(port.get_metrics().frames_out == 2);
+}
+
+void deadline_does_not_block_polling_thread()
+{
+	polled_port polled;
+	serial_port& port = *polled.pty.port;
+	port.set_transmit_queue_capacity(1 << 20);
+	port.set_write_coalescing(64, std::chrono::milliseconds{2});
+
+	// master doesn't read, so queued payload keeps device full
+	std::string payload(256 * 1024, 'x');
+	MROBOT_CHECK(port.send_async(buffer_view{payload}));
+	MROBOT_CHECK(port.get_transmit_queue_stats().queued_bytes > 0);
+
+	port.send(buffer_view{"tail", 4});
+	std::this_thread::sleep_for(std::chrono::milliseconds{10});
+	std::atomic<bool> is_probe_called{false};
+	polled.controler.get_shard(0).schedule_timer(nullptr, std::chrono::milliseconds{1}, [&] { is_probe_called = true; });
+	MROBOT_CHECK(wait_until([&] { return is_probe_called.load(); }, std::chrono::milliseconds{200}));
+	MROBOT_CHECK(port.get_metrics().coalesced_writes == 1);
+
+	// blocking send waits until batch queued at deadline is written
+	std::thread sender([&] { port.send(buffer_view{"0123456789012345678901234567890123456789012345678901234567890123456789", 70}); });
+	std::string received = polled.pty.read_master(payload.size() + 74, std::chrono::milliseconds{5000});
+	sender.join();
+	MROBOT_CHECK(received.size() == payload.size() + 74);
+	MROBOT_CHECK(received.compare(payload.size(), 4, "tail") == 0);
+	MROBOT_CHECK(received.compare(payload.size() + 4, 10, "0123456789") == 0);
+	MROBOT_CHECK(port.get_metrics().frames_out == 3);
+}
+
+void batch_survives_move_between_shards()
+{
+	pty_pair pty;
+	poll_controler controler{-1, trigger_mode::level, 2};
+	idle_owner pinned[2];
+	controler.set_shard_assignment(shard_assignment::least_loaded);
+	controler.add(pty.port.get());
+	for (idle_owner& owner : pinned)
+		controler.add(&owner, 0);
+	controler.start_polling();
+
+	pty.port->set_write_coalescing(1024, std::chrono::milliseconds{50});
+	pty.port->send(buffer_view{"moved", 5});
+	controler.rebalance();
+	MROBOT_CHECK(controler.get_shard_of(pty.port.get()) == 1);
+	MROBOT_CHECK(pty.read_master(5, std::chrono::milliseconds{1000}) == "moved");
+
+	controler.stop_polling();
+	controler.remove(pty.port.get());
+	for (idle_owner& owner : pinned)
+		controler.remove(&owner);
+}
+
+void dropped_send_is_not_captured()
+{
+	polled_port polled;
+	serial_port& port = *polled.pty.port;
+	std::string path = "/tmp/serial_port_test_" + std::to_string(getpid()) + ".cap";
+	auto capture = std::make_shared<capture_writer>(path);
+	port.set_capture(capture, 1);
+	port.set_transmit_queue_capacity(16);
+	port.set_backpressure(backpressure_option::drop);
+
+	// master doesn't read, so rest of payload stays in transmit queue
+	std::string payload(256 * 1024, 'x');
+	MROBOT_CHECK(port.send_async(buffer_view{payload}));
+	MROBOT_CHECK(port.get_transmit_queue_stats().queued_bytes > 0);
+	MROBOT_CHECK(!port.send_async(buffer_view{"dropped", 7}));
+	MROBOT_CHECK(port.get_transmit_queue_stats().dropped_messages == 1);
+	MROBOT_CHECK(capture->get_records_count() == 1);
+
+	port.set_capture(nullptr, 0);
+	capture->close();
+	unlink(path.c_str());
+}
+
+void batched_gap_timer_is_armed_by_received_data()
+{
+	pty_pair pty;
+	received_data received;
+	pty.port->set_read_mode(read_mode::batched);
+	pty.port->set_min_data_to_read(100);
+	pty.port->set_inter_byte_timeout(std::chrono::milliseconds{5});
+	pty.port->subscribe_data_view_event([&](serial_port&, buffer_view data) { received.append(data); });
+	poll_controler controler{-1};
+	controler.add(pty.port.get());
+	controler.start_polling();
+
+	// idle port doesn't poll device
+	std::this_thread::sleep_for(std::chrono::milliseconds{20});
+	MROBOT_CHECK(controler.get_metrics(0).pending_timers == 0);
+
+	for (const std::string& batch : {std::string{"first"}, std::string{"second"}})
+	{
+		std::string expected = received.get_data() + batch;
+		pty.write_master(batch);
+		MROBOT_CHECK(wait_until([&] { return received.get_data() == expected; }, std::chrono::milliseconds{1000}));
+		MROBOT_CHECK(wait_until([&] { return controler.get_metrics(0).pending_timers == 0; }, std::chrono::milliseconds{100}));
+	}
+	controler.stop_polling();
+	controler.remove(pty.port.get());
+}
+
+void receive_buffer_is_not_resized_while_polled()
+{
+	polled_port polled;
+	serial_port& port = *polled.pty.port;
+	std::size_t size = port.get_receive_buffer_size();
+	bool is_thrown = false;
+	try
+	{
+		port.set_receive_buffer_size(size * 4);
+	} catch (serial_port_exception&)
+	{
+		is_thrown = true;
+	}
+	MROBOT_CHECK(is_thrown);
+	MROBOT_CHECK(port.get_receive_buffer_size() == size);
+
+	polled.controler.stop_polling();
+	polled.controler.remove(&port);
+	port.set_receive_buffer_size(size * 4);
+	MROBOT_CHECK(port.get_receive_buffer_size() == size * 4);
+	polled.controler.add(&port);
+	polled.controler.start_polling();
+}
+
+/**
+ * @brief Port which counts calls of its override of process_data()
+ */
+class counting_port: public serial_port
+{
+public:
+	using serial_port::serial_port;
+
+	virtual void process_data() override
+	{
+		calls++;
+		serial_port::process_data();
+	}
+
+	std::atomic<int> calls{0};
+};
+
+/**
+ * @brief Handler of inline port used by tests
+ */
+struct appending_handler
+{
+	received_data* received;
+
+	void operator()(serial_port&, buffer_view data) { received->append(data); }
+};
+
+void derived_port_override_is_dispatched()
+{
+	pty_pair pty;
+	counting_port* port = new counting_port{pty.device(), baudrate_option::b115200};
+	pty.port.reset(port);
+	received_data received;
+	port->subscribe_data_view_event([&](serial_port&, buffer_view data) { received.append(data); });
+
+	poll_controler controler{-1};
+	controler.add(port);
+	controler.start_polling();
+	pty.write_master("data");
+	MROBOT_CHECK(wait_until([&] { return received.get_data() == "data"; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(port->calls > 0);
+	controler.stop_polling();
+	controler.remove(port);
+}
+
+void inline_port_calls_handler()
+{
+	pty_pair pty;
+	received_data received;
+	pty.port.reset(new inline_serial_port<appending_handler>{pty.device(), appending_handler{&received}, baudrate_option::b115200});
+	poll_controler controler{-1};
+	controler.add(pty.port.get());
+	controler.start_polling();
+
+	pty.write_master("inline");
+	MROBOT_CHECK(wait_until([&] { return received.get_data() == "inline"; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(pty.port->get_metrics().handler_time.count > 0);
+	controler.stop_polling();
+	controler.remove(pty.port.get());
+}
+
+void inline_port_with_decoder_delivers_frames()
+{
+	pty_pair pty;
+	received_data received;
+	pty.port.reset(new inline_serial_port<appending_handler>{pty.device(), appending_handler{&received}, baudrate_option::b115200});
+	pty.port->set_frame_decoder(std::unique_ptr<frame_decoder>{new delimiter_decoder{'\n'}});
+	pty.port->subscribe_frame_event([&](serial_port&, buffer_view frame) { received.add_frame(frame); });
+	poll_controler controler{-1};
+	controler.add(pty.port.get());
+	controler.start_polling();
+
+	pty.write_master("one\ntwo\n");
+	MROBOT_CHECK(wait_until([&] { return received.get_frames().size() == 2; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(received.get_frames()[0] == "one" && received.get_frames()[1] == "two");
+	MROBOT_CHECK(received.get_data() == "one\ntwo\n");
+	controler.stop_polling();
+	controler.remove(pty.port.get());
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "send_async_without_controler_writes_nothing", send_async_without_controler_writes_nothing },
+		{ "send_iovec_list", send_iovec_list },
+		{ "deadline_writes_batch", deadline_writes_batch },
+		{ "threshold_writes_batch_with_message", threshold_writes_batch_with_message },
+		{ "deadline_does_not_block_polling_thread", deadline_does_not_block_polling_thread },
+		{ "batch_survives_move_between_shards", batch_survives_move_between_shards },
+		{ "dropped_send_is_not_captured", dropped_send_is_not_captured },
+		{ "batched_gap_timer_is_armed_by_received_data", batched_gap_timer_is_armed_by_received_data },
+		{ "receive_buffer_is_not_resized_while_polled", receive_buffer_is_not_resized_while_polled },
+		{ "derived_port_override_is_dispatched", derived_port_override_is_dispatched },
+		{ "inline_port_calls_handler", inline_port_calls_handler },
+		{ "inline_port_with_decoder_delivers_frames", inline_port_with_decoder_delivers_frames },
+	}, argc, argv);
+}
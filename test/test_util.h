@@ -0,0 +1,197 @@
+/*
+ * test_util.h
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Helpers shared by tests. Behavioural tests run their cases on
+ * pseudo-terminal pairs (no hardware needed). Each test program prints one
+ * line per case and returns number of failed cases. Test programs are built by
+ * CMakeLists.txt of repository and run by ctest.
+ */
+
+#ifndef TEST_TEST_UTIL_H_
+#define TEST_TEST_UTIL_H_
+
+#include "serial_port.h"
+#include <pty.h>
+#include <sys/eventfd.h>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fails current test case when condition is false
+ */
+#define MROBOT_CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+			throw mrobot_test::check_failure{__FILE__, __LINE__, #condition}; \
+	} while (false)
+
+namespace mrobot_test
+{
+using namespace mrobot;
+using test_clock = std::chrono::steady_clock;
+
+/**
+ * @brief Thrown by MROBOT_CHECK
+ */
+struct check_failure: public std::runtime_error
+{
+	check_failure(const char* file, int line, const char* condition) :
+			std::runtime_error(std::string{file} + ":" + std::to_string(line) + ": " + condition)
+	{
+	}
+};
+
+/**
+ * @brief Pseudo-terminal with raw master side and serial_port opened on slave side
+ */
+class pty_pair
+{
+public:
+	pty_pair()
+	{
+		char name[64];
+		if (openpty(&_master, &_slave, name, nullptr, nullptr) < 0)
+			throw serial_port_exception("Cannot open pseudo-terminal.", strerror(errno));
+
+		termios config;
+		tcgetattr(_master, &config);
+		cfmakeraw(&config);
+		tcsetattr(_master, TCSANOW, &config);
+
+		_device = name;
+		port.reset(new serial_port{name, baudrate_option::b115200});
+	}
+
+	~pty_pair()
+	{
+		port.reset();
+		close(_slave);
+		close(_master);
+	}
+
+	int master() { return _master; }
+	const std::string& device() { return _device; }
+
+	/**
+	 * @brief Writes data to master side (received by port)
+	 */
+	void write_master(const std::string& data)
+	{
+		std::size_t written = 0;
+		while (written < data.size())
+		{
+			ssize_t count = write(_master, data.data() + written, data.size() - written);
+			if (count < 0 && errno != EINTR && errno != EAGAIN)
+				throw serial_port_exception("Cannot write to pseudo-terminal.", strerror(errno));
+			if (count > 0)
+				written += count;
+		}
+	}
+
+	/**
+	 * @brief Reads data sent by port until given number of bytes arrives or timeout expires
+	 */
+	std::string read_master(std::size_t size, std::chrono::milliseconds timeout)
+	{
+		std::string data;
+		auto deadline = test_clock::now() + timeout;
+		while (data.size() < size && test_clock::now() < deadline)
+		{
+			pollfd descriptor{_master, POLLIN, 0};
+			if (poll(&descriptor, 1, 1) <= 0)
+				continue;
+			char buffer[4096];
+			ssize_t count = read(_master, buffer, std::min(sizeof(buffer), size - data.size()));
+			if (count > 0)
+				data.append(buffer, count);
+		}
+		return data;
+	}
+
+	std::unique_ptr<serial_port> port;
+
+private:
+	int _master = -1;
+	int _slave = -1;
+	std::string _device;
+};
+
+/**
+ * @brief Observed descriptor which is never readable (keeps shard loaded)
+ */
+class idle_owner: public ifile_descriptor_owner
+{
+public:
+	idle_owner() : _file_descriptor(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+	~idle_owner() { close(_file_descriptor); }
+
+	virtual void process_data() override {}
+	virtual int get_file_descriptor() override { return _file_descriptor; }
+
+private:
+	int _file_descriptor;
+};
+
+/**
+ * @brief Waits until condition is true or timeout expires
+ * @return final value of condition
+ */
+inline bool wait_until(const std::function<bool()>& condition, std::chrono::milliseconds timeout)
+{
+	auto deadline = test_clock::now() + timeout;
+	while (!condition())
+	{
+		if (test_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds{1});
+	}
+	return true;
+}
+
+/**
+ * @brief Named test case
+ */
+struct test_case
+{
+	const char* name;
+	std::function<void()> run;
+};
+
+/**
+ * @brief Runs test cases (or only these which name contains filter)
+ * @return number of failed cases
+ */
+inline int run_tests(const std::vector<test_case>& cases, int argc, char* argv[])
+{
+	std::string filter = argc > 1 ? argv[1] : "";
+	int failures = 0;
+	for (const test_case& test : cases)
+	{
+		if (!filter.empty() && std::string{test.name}.find(filter) == std::string::npos)
+			continue;
+		try
+		{
+			test.run();
+			std::printf("PASS %s\n", test.name);
+		} catch (std::exception& ex)
+		{
+			std::printf("FAIL %s: %s\n", test.name, ex.what());
+			failures++;
+		}
+	}
+	return failures;
+}
+
+}
+
+#endif /* TEST_TEST_UTIL_H_ */
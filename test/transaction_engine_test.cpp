@@ -0,0 +1,187 @@
+/*
+ * transaction_engine_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of transaction_engine: responses, timeouts with retries, window,
+ * teardown and rebalancing of port with pending timeout.
+ *
+ * Usage: transaction_engine_test [filter]
+ */
+
+#include "test_util.h"
+#include "poll_controler.h"
+#include "transaction_engine.h"
+
+namespace
+{
+using namespace mrobot_test;
+
+/**
+ * @brief Requests and responses are lines, first character is key of transaction
+ */
+std::optional<std::uint64_t> first_character(buffer_view response)
+{
+	if (response.size == 0)
+		return std::nullopt;
+	return static_cast<std::uint64_t>(response.data[0]);
+}
+
+std::vector<char> line(const std::string& text)
+{
+	std::vector<char> data(text.begin(), text.end());
+	data.push_back('\n');
+	return data;
+}
+
+/**
+ * @brief Port with line decoder observed by poll controler with given number of shards
+ *
+ * With two shards port is added to shard 0 together with two pinned
+ * descriptors, so rebalancing moves it to shard 1.
+ */
+struct engine_fixture
+{
+	pty_pair pty;
+	poll_controler controler;
+	idle_owner pinned[2];
+	std::unique_ptr<transaction_engine> engine;
+
+	explicit engine_fixture(std::size_t shards_count = 1, std::size_t window = 4) :
+			controler(-1, trigger_mode::level, shards_count)
+	{
+		pty.port->set_frame_decoder(std::unique_ptr<frame_decoder>{new delimiter_decoder{'\n'}});
+		engine.reset(new transaction_engine{*pty.port, first_character, window});
+
+		controler.set_shard_assignment(shard_assignment::least_loaded);
+		controler.add(pty.port.get());
+		if (shards_count > 1)
+		{
+			for (idle_owner& owner : pinned)
+				controler.add(&owner, 0);
+		}
+		controler.start_polling();
+	}
+
+	~engine_fixture()
+	{
+		controler.stop_polling();
+		engine.reset();
+		controler.remove(pty.port.get());
+		if (controler.get_shards_count() > 1)
+		{
+			for (idle_owner& owner : pinned)
+				controler.remove(&owner);
+		}
+	}
+
+	std::size_t pending_timers(std::size_t shard)
+	{
+		return controler.get_metrics(shard).pending_timers;
+	}
+};
+
+transaction_options timeout_of(std::chrono::milliseconds timeout, unsigned retries = 0)
+{
+	transaction_options options;
+	options.timeout = timeout;
+	options.retries = retries;
+	return options;
+}
+
+void response_completes_transaction()
+{
+	engine_fixture fixture;
+	auto result = fixture.engine->submit('a', line("a?"), timeout_of(std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(fixture.pty.read_master(3, std::chrono::milliseconds{1000}) == "a?\n");
+	fixture.pty.write_master("a!\n");
+
+	MROBOT_CHECK(result.wait_for(std::chrono::seconds{1}) == std::future_status::ready);
+	transaction_result value = result.get();
+	MROBOT_CHECK(value.status == transaction_status::completed);
+	MROBOT_CHECK(std::string(value.response.begin(), value.response.end()) == "a!");
+	MROBOT_CHECK(value.attempts == 1);
+	MROBOT_CHECK(wait_until([&] { return fixture.pending_timers(0) == 0; }, std::chrono::milliseconds{100}));
+}
+
+void timeout_retries_request()
+{
+	engine_fixture fixture;
+	auto result = fixture.engine->submit('b', line("b?"), timeout_of(std::chrono::milliseconds{30}, 2));
+
+	MROBOT_CHECK(result.wait_for(std::chrono::seconds{1}) == std::future_status::ready);
+	transaction_result value = result.get();
+	MROBOT_CHECK(value.status == transaction_status::timed_out);
+	MROBOT_CHECK(value.attempts == 3);
+	MROBOT_CHECK(fixture.pty.read_master(9, std::chrono::milliseconds{100}) == "b?\nb?\nb?\n");
+}
+
+void window_queues_requests()
+{
+	engine_fixture fixture{1, 1};
+	auto first = fixture.engine->submit('c', line("c?"), timeout_of(std::chrono::milliseconds{1000}));
+	auto second = fixture.engine->submit('d', line("d?"), timeout_of(std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(fixture.engine->get_in_flight_count() == 1);
+	MROBOT_CHECK(fixture.engine->get_queued_count() == 1);
+	MROBOT_CHECK(fixture.pty.read_master(3, std::chrono::milliseconds{1000}) == "c?\n");
+
+	fixture.pty.write_master("c!\n");
+	MROBOT_CHECK(fixture.pty.read_master(3, std::chrono::milliseconds{1000}) == "d?\n");
+	fixture.pty.write_master("d!\n");
+	MROBOT_CHECK(first.get().status == transaction_status::completed);
+	MROBOT_CHECK(second.wait_for(std::chrono::seconds{1}) == std::future_status::ready);
+	MROBOT_CHECK(second.get().status == transaction_status::completed);
+}
+
+void destroying_engine_cancels_transactions()
+{
+	engine_fixture fixture{1, 1};
+	auto in_flight = fixture.engine->submit('e', line("e?"), timeout_of(std::chrono::milliseconds{1000}));
+	auto queued = fixture.engine->submit('f', line("f?"), timeout_of(std::chrono::milliseconds{1000}));
+
+	fixture.engine.reset();
+	MROBOT_CHECK(in_flight.get().status == transaction_status::cancelled);
+	MROBOT_CHECK(queued.get().status == transaction_status::cancelled);
+	MROBOT_CHECK(fixture.pending_timers(0) == 0);
+}
+
+void timeout_after_rebalance()
+{
+	engine_fixture fixture{2};
+	MROBOT_CHECK(fixture.controler.get_shard_of(fixture.pty.port.get()) == 0);
+	auto result = fixture.engine->submit('g', line("g?"), timeout_of(std::chrono::milliseconds{200}));
+
+	fixture.controler.rebalance();
+	MROBOT_CHECK(fixture.controler.get_shard_of(fixture.pty.port.get()) == 1);
+	MROBOT_CHECK(result.wait_for(std::chrono::seconds{2}) == std::future_status::ready);
+	MROBOT_CHECK(result.get().status == transaction_status::timed_out);
+}
+
+void response_after_rebalance_cancels_timeout()
+{
+	engine_fixture fixture{2};
+	auto result = fixture.engine->submit('h', line("h?"), timeout_of(std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(fixture.pty.read_master(3, std::chrono::milliseconds{1000}) == "h?\n");
+
+	fixture.controler.rebalance();
+	MROBOT_CHECK(fixture.pending_timers(1) == 1);
+	fixture.pty.write_master("h!\n");
+	MROBOT_CHECK(result.wait_for(std::chrono::seconds{1}) == std::future_status::ready);
+	MROBOT_CHECK(result.get().status == transaction_status::completed);
+	MROBOT_CHECK(wait_until([&] { return fixture.pending_timers(1) == 0; }, std::chrono::milliseconds{100}));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "response_completes_transaction", response_completes_transaction },
+		{ "timeout_retries_request", timeout_retries_request },
+		{ "window_queues_requests", window_queues_requests },
+		{ "destroying_engine_cancels_transactions", destroying_engine_cancels_transactions },
+		{ "timeout_after_rebalance", timeout_after_rebalance },
+		{ "response_after_rebalance_cancels_timeout", response_after_rebalance_cancels_timeout },
+	}, argc, argv);
+}
@@ -0,0 +1,360 @@
+/*
+ * worker_pool_test.cpp
+ *
+ *  Created on: May 16, 2016
+ *      Author: rafal
+ *
+ * Tests of single producer single consumer queue (capacity rounding, order,
+ * wrapping and two threads), of worker pool (assignment to the least
+ * loaded worker, notification and detaching) and of dispatching received
+ * data of port to workers with overflow of dispatch queue.
+ *
+ * Usage: worker_pool_test [filter]
+ */
+
+#include "test_util.h"
+#include "poll_controler.h"
+#include "spsc_queue.h"
+#include "worker_pool.h"
+#include <atomic>
+#include <mutex>
+
+namespace
+{
+using namespace mrobot_test;
+
+void queue_capacity_is_rounded_to_power_of_two()
+{
+	const std::pair<std::size_t, std::size_t> capacities[] = {
+		{ 0, 1 }, { 1, 1 }, { 2, 2 }, { 3, 4 }, { 5, 8 }, { 256, 256 }, { 257, 512 },
+	};
+	for (const auto& capacity : capacities)
+	{
+		spsc_queue<int> queue{capacity.first};
+		MROBOT_CHECK(queue.capacity() == capacity.second);
+		MROBOT_CHECK(queue.empty() && queue.size() == 0);
+	}
+}
+
+void queue_keeps_order_when_wrapping()
+{
+	spsc_queue<int> queue{4};
+	int next_pushed = 0;
+	int next_popped = 0;
+	// pushed and popped counts shift position of data at every round
+	const std::pair<int, int> rounds[] = { { 3, 2 }, { 3, 3 }, { 4, 1 }, { 1, 3 }, { 2, 2 }, { 4, 4 } };
+	for (const auto& round : rounds)
+	{
+		for (int i = 0; i < round.first; i++)
+		{
+			int value = next_pushed;
+			if (queue.try_push(std::move(value)))
+				next_pushed++;
+		}
+		MROBOT_CHECK(queue.size() == static_cast<std::size_t>(next_pushed - next_popped));
+		MROBOT_CHECK(queue.size() <= queue.capacity());
+
+		for (int i = 0; i < round.second; i++)
+		{
+			int value = -1;
+			MROBOT_CHECK(queue.try_pop(value));
+			MROBOT_CHECK(value == next_popped);
+			next_popped++;
+		}
+	}
+	MROBOT_CHECK(queue.empty());
+	int value = -1;
+	MROBOT_CHECK(!queue.try_pop(value) && value == -1);
+}
+
+void full_queue_doesnt_move_value()
+{
+	spsc_queue<std::unique_ptr<int>> queue{2};
+	MROBOT_CHECK(queue.try_push(std::unique_ptr<int>{new int{1}}));
+	MROBOT_CHECK(queue.try_push(std::unique_ptr<int>{new int{2}}));
+
+	std::unique_ptr<int> rejected{new int{3}};
+	MROBOT_CHECK(!queue.try_push(std::move(rejected)));
+	MROBOT_CHECK(rejected && *rejected == 3);
+
+	// popped slot is released, so value doesn't outlive its consumer
+	std::unique_ptr<int> value;
+	MROBOT_CHECK(queue.try_pop(value) && *value == 1);
+	MROBOT_CHECK(queue.try_push(std::move(rejected)));
+	MROBOT_CHECK(queue.try_pop(value) && *value == 2);
+	MROBOT_CHECK(queue.try_pop(value) && *value == 3);
+	MROBOT_CHECK(!queue.try_pop(value));
+}
+
+void producer_and_consumer_threads()
+{
+	const std::size_t count = 200000;
+	spsc_queue<std::size_t> queue{64};
+	std::thread producer{[&]
+	{
+		for (std::size_t i = 0; i < count; i++)
+		{
+			std::size_t value = i;
+			while (!queue.try_push(std::move(value)))
+				std::this_thread::yield();
+		}
+	}};
+
+	std::size_t expected = 0;
+	bool is_ordered = true;
+	while (expected < count)
+	{
+		std::size_t value = 0;
+		if (!queue.try_pop(value))
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		is_ordered &= value == expected;
+		expected++;
+	}
+	producer.join();
+	MROBOT_CHECK(is_ordered);
+	MROBOT_CHECK(queue.empty());
+}
+
+/**
+ * @brief Consumer which handles values queued by test
+ */
+class counting_consumer: public idispatch_consumer
+{
+public:
+	explicit counting_consumer(worker_pool& pool) :
+			_pool(pool)
+	{
+	}
+
+	void queue(std::size_t value)
+	{
+		while (!_queue.try_push(std::move(value)))
+			std::this_thread::yield();
+	}
+
+	virtual bool process_dispatched() override
+	{
+		if (!_pool.is_worker_thread())
+			is_called_outside_worker = true;
+
+		std::size_t value = 0;
+		bool is_work_done = false;
+		while (_queue.try_pop(value))
+		{
+			is_work_done = true;
+			sum += value;
+			count++;
+		}
+		return is_work_done;
+	}
+
+	std::atomic<std::size_t> sum{0};
+	std::atomic<std::size_t> count{0};
+	std::atomic<bool> is_called_outside_worker{false};
+
+private:
+	worker_pool& _pool;
+	spsc_queue<std::size_t> _queue{16};
+};
+
+void consumers_are_assigned_to_least_loaded_worker()
+{
+	// workers count, consumers count, expected worker of every consumer
+	const std::vector<std::pair<std::pair<std::size_t, std::size_t>, std::vector<std::size_t>>> cases = {
+		{ { 0, 3 }, { 0, 0, 0 } },
+		{ { 1, 2 }, { 0, 0 } },
+		{ { 3, 7 }, { 0, 1, 2, 0, 1, 2, 0 } },
+		{ { 4, 2 }, { 0, 1 } },
+	};
+	for (const auto& test : cases)
+	{
+		worker_pool pool{test.first.first};
+		MROBOT_CHECK(pool.get_workers_count() == std::max<std::size_t>(test.first.first, 1));
+		MROBOT_CHECK(!pool.is_worker_thread());
+
+		std::vector<std::unique_ptr<counting_consumer>> consumers;
+		for (std::size_t i = 0; i < test.first.second; i++)
+		{
+			consumers.emplace_back(new counting_consumer{pool});
+			MROBOT_CHECK(pool.attach(consumers.back().get()) == test.second[i]);
+		}
+		for (auto& consumer : consumers)
+			pool.detach(consumer.get());
+	}
+
+	// detached consumer frees its worker for next consumer
+	worker_pool pool{2};
+	counting_consumer first{pool};
+	counting_consumer second{pool};
+	counting_consumer third{pool};
+	MROBOT_CHECK(pool.attach(&first) == 0);
+	MROBOT_CHECK(pool.attach(&second) == 1);
+	pool.detach(&first);
+	MROBOT_CHECK(pool.attach(&third) == 0);
+	pool.detach(&second);
+	pool.detach(&third);
+}
+
+void notified_worker_processes_queued_work()
+{
+	worker_pool pool{2};
+	std::vector<std::unique_ptr<counting_consumer>> consumers;
+	std::vector<std::size_t> workers;
+	for (int i = 0; i < 4; i++)
+	{
+		consumers.emplace_back(new counting_consumer{pool});
+		workers.push_back(pool.attach(consumers.back().get()));
+	}
+
+	const std::size_t count = 1000;
+	for (std::size_t value = 1; value <= count; value++)
+	{
+		std::size_t index = value % consumers.size();
+		consumers[index]->queue(value);
+		pool.notify(workers[index]);
+	}
+
+	MROBOT_CHECK(wait_until([&]
+	{
+		std::size_t processed = 0;
+		for (auto& consumer : consumers)
+			processed += consumer->count;
+		return processed == count;
+	}, std::chrono::milliseconds{2000}));
+
+	std::size_t sum = 0;
+	for (auto& consumer : consumers)
+	{
+		MROBOT_CHECK(!consumer->is_called_outside_worker);
+		sum += consumer->sum;
+		pool.detach(consumer.get());
+	}
+	MROBOT_CHECK(sum == count * (count + 1) / 2);
+}
+
+void detached_consumer_isnt_called()
+{
+	worker_pool pool{1};
+	counting_consumer consumer{pool};
+	std::size_t worker = pool.attach(&consumer);
+	consumer.queue(1);
+	pool.notify(worker);
+	MROBOT_CHECK(wait_until([&] { return consumer.count == 1; }, std::chrono::milliseconds{1000}));
+
+	// detach waits for worker, so queued value isn't handled after return
+	pool.detach(&consumer);
+	consumer.queue(2);
+	pool.notify(worker);
+	std::this_thread::sleep_for(std::chrono::milliseconds{20});
+	MROBOT_CHECK(consumer.count == 1 && consumer.sum == 1);
+}
+
+/**
+ * @brief Data received by handler of port which blocks worker until released
+ */
+struct blocking_handler
+{
+	std::mutex mutex;
+	std::string data;
+	std::atomic<bool> is_entered{false};
+	std::atomic<bool> is_released{false};
+	std::atomic<bool> is_called_outside_worker{false};
+
+	void handle(worker_pool& pool, buffer_view view)
+	{
+		if (!pool.is_worker_thread())
+			is_called_outside_worker = true;
+		is_entered = true;
+		while (!is_released)
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+
+		std::unique_lock<std::mutex> lock{mutex};
+		data.append(view.begin(), view.end());
+	}
+
+	std::string get_data()
+	{
+		std::unique_lock<std::mutex> lock{mutex};
+		return data;
+	}
+};
+
+void port_data_is_dispatched_to_worker()
+{
+	pty_pair pty;
+	std::shared_ptr<worker_pool> pool = std::make_shared<worker_pool>(2);
+	blocking_handler handler;
+	handler.is_released = true;
+	pty.port->set_worker_pool(pool);
+	MROBOT_CHECK(pty.port->is_dispatched_to_workers());
+	pty.port->subscribe_data_view_event([&](serial_port&, buffer_view data) { handler.handle(*pool, data); });
+
+	poll_controler controler{-1};
+	controler.add(pty.port.get());
+	controler.start_polling();
+	pty.write_master("first");
+	MROBOT_CHECK(wait_until([&] { return handler.get_data() == "first"; }, std::chrono::milliseconds{1000}));
+	pty.write_master("second");
+	MROBOT_CHECK(wait_until([&] { return handler.get_data() == "firstsecond"; }, std::chrono::milliseconds{1000}));
+	controler.stop_polling();
+	controler.remove(pty.port.get());
+
+	MROBOT_CHECK(!handler.is_called_outside_worker);
+	port_metrics_snapshot metrics = pty.port->get_metrics();
+	MROBOT_CHECK(metrics.dispatched_buffers >= 2);
+	MROBOT_CHECK(metrics.dispatch_overflows == 0);
+	MROBOT_CHECK(metrics.dispatch_queue_depth == 0);
+}
+
+void full_dispatch_queue_drops_data()
+{
+	pty_pair pty;
+	std::shared_ptr<worker_pool> pool = std::make_shared<worker_pool>(1);
+	blocking_handler handler;
+	pty.port->set_worker_pool(pool, 1);
+	pty.port->subscribe_data_view_event([&](serial_port&, buffer_view data) { handler.handle(*pool, data); });
+
+	poll_controler controler{-1};
+	controler.add(pty.port.get());
+	controler.start_polling();
+
+	// first buffer blocks worker, second waits in queue, third doesn't fit
+	pty.write_master("a");
+	MROBOT_CHECK(wait_until([&] { return handler.is_entered.load(); }, std::chrono::milliseconds{1000}));
+	pty.write_master("b");
+	MROBOT_CHECK(wait_until([&] { return pty.port->get_metrics().dispatched_buffers == 2; }, std::chrono::milliseconds{1000}));
+	MROBOT_CHECK(pty.port->get_metrics().dispatch_queue_depth == 1);
+	pty.write_master("c");
+	MROBOT_CHECK(wait_until([&] { return pty.port->get_metrics().dispatch_overflows == 1; }, std::chrono::milliseconds{1000}));
+
+	handler.is_released = true;
+	MROBOT_CHECK(wait_until([&] { return handler.get_data() == "ab"; }, std::chrono::milliseconds{1000}));
+	pty.write_master("d");
+	MROBOT_CHECK(wait_until([&] { return handler.get_data() == "abd"; }, std::chrono::milliseconds{1000}));
+	controler.stop_polling();
+	controler.remove(pty.port.get());
+
+	port_metrics_snapshot metrics = pty.port->get_metrics();
+	MROBOT_CHECK(metrics.dispatched_buffers == 3);
+	MROBOT_CHECK(metrics.dispatch_overflows == 1);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	return run_tests({
+		{ "queue_capacity_is_rounded_to_power_of_two", queue_capacity_is_rounded_to_power_of_two },
+		{ "queue_keeps_order_when_wrapping", queue_keeps_order_when_wrapping },
+		{ "full_queue_doesnt_move_value", full_queue_doesnt_move_value },
+		{ "producer_and_consumer_threads", producer_and_consumer_threads },
+		{ "consumers_are_assigned_to_least_loaded_worker", consumers_are_assigned_to_least_loaded_worker },
+		{ "notified_worker_processes_queued_work", notified_worker_processes_queued_work },
+		{ "detached_consumer_isnt_called", detached_consumer_isnt_called },
+		{ "port_data_is_dispatched_to_worker", port_data_is_dispatched_to_worker },
+		{ "full_dispatch_queue_drops_data", full_dispatch_queue_drops_data },
+	}, argc, argv);
+}